@@ -0,0 +1,189 @@
+/**
+ * \file kpm-async-writer.cc
+ * \brief Benchmark of AsyncTraceWriter against a std::ofstream trace sink.
+ *
+ * Writes the same RxPacketTrace-like records once through std::ofstream and once
+ * through AsyncTraceWriter (with Append, through OpenStream, and with Append
+ * into a block-compressed file), and reports
+ * the time the producer, i.e. the simulation thread, spends in the sink, the
+ * total time including the final drain, and the writer's back-pressure counters.
+ * Formatting is timed alone first; the sink cost is the difference to it.
+ *
+ * \code{.unparsed}
+$ g++ -O2 -std=c++17 -pthread -o kpm-async-writer kpm-async-writer.cc
+$ ./kpm-async-writer --records=2000000 --dir=/tmp
+ * \endcode
+ */
+
+#include "kpm-async-writer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+namespace
+{
+
+double
+Since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// One record in the RxPacketTrace.txt layout.
+int
+FormatRecord(char* buf, size_t size, uint64_t i)
+{
+    double t = 0.01 + i * 1e-5;
+    return std::snprintf(buf,
+                         size,
+                         "%.7f\tDL\t%u\t%u\t%u\t%u\t0\t12\t0\t%u\t1\t%u\t%u\t%u\t0\t1\t%.4f\t%u\t%u\t0\t%.6f\t%u\n",
+                         t,
+                         static_cast<unsigned>(i / 160 % 1024),
+                         static_cast<unsigned>(i / 16 % 10),
+                         static_cast<unsigned>(i % 16),
+                         static_cast<unsigned>(i % 14),
+                         static_cast<unsigned>(i % 66),
+                         static_cast<unsigned>(1 + i % 3 * 3),
+                         static_cast<unsigned>(1 + i % 2),
+                         static_cast<unsigned>(i % 2),
+                         20.0 + (i % 100) * 0.1,
+                         static_cast<unsigned>(i % 29),
+                         static_cast<unsigned>(i % 16),
+                         (i % 97) * 1e-3,
+                         static_cast<unsigned>(100 + i % 5000));
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    uint64_t records = 2000000;
+    size_t bufferKiB = 1024;
+    size_t buffers = 16;
+    std::string dir = ".";
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 10, "--records=") == 0)
+        {
+            records = std::stoull(arg.substr(10));
+        }
+        else if (arg.compare(0, 9, "--buffer=") == 0)
+        {
+            bufferKiB = std::stoul(arg.substr(9));
+        }
+        else if (arg.compare(0, 10, "--buffers=") == 0)
+        {
+            buffers = std::stoul(arg.substr(10));
+        }
+        else if (arg.compare(0, 6, "--dir=") == 0)
+        {
+            dir = arg.substr(6);
+        }
+        else
+        {
+            std::fprintf(stderr,
+                         "Usage: %s [--records=N] [--buffer=KiB] [--buffers=N] [--dir=path]\n",
+                         argv[0]);
+            return 1;
+        }
+    }
+    char buf[512];
+
+    // Formatting alone, so that the sink cost is the difference to it
+    {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < records; ++i)
+        {
+            sum += FormatRecord(buf, sizeof(buf), i);
+        }
+        std::printf("format only:     producer %.3f s (%llu bytes)\n",
+                    Since(start),
+                    static_cast<unsigned long long>(sum));
+    }
+
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::ofstream out(dir + "/kpm-async-bench-ofstream.txt", std::ofstream::trunc);
+        for (uint64_t i = 0; i < records; ++i)
+        {
+            int n = FormatRecord(buf, sizeof(buf), i);
+            out.write(buf, n);
+        }
+        double producer = Since(start);
+        out.close();
+        std::printf("ofstream:        producer %.3f s, total %.3f s\n", producer, Since(start));
+    }
+
+    {
+        auto start = std::chrono::steady_clock::now();
+        kpm::AsyncTraceWriter writer(bufferKiB * 1024, buffers);
+        int f = writer.Open(dir + "/kpm-async-bench-printf.txt");
+        for (uint64_t i = 0; i < records; ++i)
+        {
+            int n = FormatRecord(buf, sizeof(buf), i);
+            writer.Append(f, buf, n);
+        }
+        double producer = Since(start);
+        writer.Close();
+        kpm::AsyncWriterStats s = writer.GetStats();
+        std::printf("async Append:    producer %.3f s, total %.3f s; %llu bytes, %llu buffers, "
+                    "%llu stalls (%.3f s), writer busy %.3f s, peak queue %zu\n",
+                    producer,
+                    Since(start),
+                    static_cast<unsigned long long>(s.bytes),
+                    static_cast<unsigned long long>(s.buffers),
+                    static_cast<unsigned long long>(s.stalls),
+                    s.stallSeconds,
+                    s.writeSeconds,
+                    s.peakQueued);
+    }
+
+    {
+        auto start = std::chrono::steady_clock::now();
+        kpm::AsyncTraceWriter writer(bufferKiB * 1024, buffers);
+        std::unique_ptr<std::ostream> out = writer.OpenStream(dir + "/kpm-async-bench-stream.txt");
+        for (uint64_t i = 0; i < records; ++i)
+        {
+            int n = FormatRecord(buf, sizeof(buf), i);
+            out->write(buf, n);
+        }
+        double producer = Since(start);
+        writer.Close();
+        kpm::AsyncWriterStats s = writer.GetStats();
+        std::printf("async ostream:   producer %.3f s, total %.3f s; %llu stalls (%.3f s)\n",
+                    producer,
+                    Since(start),
+                    static_cast<unsigned long long>(s.stalls),
+                    s.stallSeconds);
+    }
+
+    {
+        auto start = std::chrono::steady_clock::now();
+        kpm::AsyncTraceWriter writer(bufferKiB * 1024, buffers);
+        int f = writer.Open(dir + "/kpm-async-bench-printf.txt.kpz", true);
+        for (uint64_t i = 0; i < records; ++i)
+        {
+            int n = FormatRecord(buf, sizeof(buf), i);
+            writer.Append(f, buf, n);
+        }
+        double producer = Since(start);
+        writer.Close();
+        kpm::AsyncWriterStats s = writer.GetStats();
+        std::printf("async compressed: producer %.3f s, total %.3f s; %llu -> %llu bytes (%.2fx), "
+                    "%llu stalls (%.3f s), writer busy %.3f s\n",
+                    producer,
+                    Since(start),
+                    static_cast<unsigned long long>(s.bytes),
+                    static_cast<unsigned long long>(s.fileBytes),
+                    s.fileBytes > 0 ? double(s.bytes) / s.fileBytes : 0.0,
+                    static_cast<unsigned long long>(s.stalls),
+                    s.stallSeconds,
+                    s.writeSeconds);
+    }
+    return 0;
+}
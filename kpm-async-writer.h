@@ -0,0 +1,380 @@
+/**
+ * \file kpm-async-writer.h
+ * \brief Trace output with a background writer thread and bounded, double-buffered memory.
+ *
+ * A trace sink that writes through std::ofstream runs the write(2) calls, and any
+ * disk stall behind them, on the simulation thread. With AsyncTraceWriter the
+ * sink only appends the record to an in-memory buffer of its file; a full buffer
+ * is handed to a background thread, which writes it and returns it to a free
+ * list, while the sink continues in a second buffer. Memory is bounded: at most
+ * maxBuffers buffers of bufferSize bytes exist at a time. When the disk falls
+ * behind and all of them are queued, Append() blocks until one is written
+ * (back-pressure) and the stall is counted, so the statistics tell whether the
+ * bound or the disk is the limit.
+ *
+ * Records go in either with Append()/Printf() on a file handle, or through a
+ * std::ostream from OpenStream(), so existing "os << ..." writers need no
+ * change. flush() on such a stream does not force a write; data reaches the
+ * file when a buffer fills, at Close() and at destruction.
+ *
+ * A file opened with compress = true is written as a block-compressed .kpz
+ * (kpm-block-codec.h). The compression runs on the background thread as well,
+ * so it costs the simulation thread nothing as long as the writer keeps up.
+ *
+ * kpm-async-writer.cc benchmarks it against std::ofstream. The header has no
+ * ns-3 dependency.
+ */
+
+#ifndef KPM_ASYNC_WRITER_H
+#define KPM_ASYNC_WRITER_H
+
+#include "kpm-block-codec.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace kpm
+{
+
+/// Counters of an AsyncTraceWriter.
+struct AsyncWriterStats
+{
+    uint64_t bytes{0};        ///< bytes appended
+    uint64_t fileBytes{0};    ///< bytes in the files, after compression; complete after Close()
+    uint64_t buffers{0};      ///< buffers written by the background thread
+    uint64_t stalls{0};       ///< Append() calls that waited for a free buffer
+    double stallSeconds{0.0}; ///< time the producer spent waiting
+    double writeSeconds{0.0}; ///< time the background thread spent compressing and writing
+    size_t peakQueued{0};     ///< most buffers waiting to be written at once
+};
+
+/// Background-thread writer for a set of trace files.
+class AsyncTraceWriter
+{
+  public:
+    explicit AsyncTraceWriter(size_t bufferSize = 1 << 20, size_t maxBuffers = 16)
+        : m_bufferSize(bufferSize),
+          m_maxBuffers(std::max<size_t>(maxBuffers, 2))
+    {
+        m_thread = std::thread(&AsyncTraceWriter::Run, this);
+    }
+
+    ~AsyncTraceWriter()
+    {
+        Close();
+    }
+
+    AsyncTraceWriter(const AsyncTraceWriter&) = delete;
+    AsyncTraceWriter& operator=(const AsyncTraceWriter&) = delete;
+
+    /// Open (truncate) a file, optionally block-compressed; returns its handle, or -1 on error.
+    int Open(const std::string& path, bool compress = false)
+    {
+        File file;
+        if (compress)
+        {
+            file.block.reset(new BlockFileWriter);
+            if (!file.block->Open(path))
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            file.fp = std::fopen(path.c_str(), "wb");
+            if (!file.fp)
+            {
+                return -1;
+            }
+        }
+        file.current = Acquire();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_files.push_back(std::move(file));
+        return static_cast<int>(m_files.size() - 1);
+    }
+
+    /// Append raw bytes to a file.
+    void Append(int handle, const char* data, size_t len)
+    {
+        File& file = m_files[handle];
+        m_stats.bytes += len;
+        while (len > 0)
+        {
+            size_t n = std::min(len, m_bufferSize - file.current->size());
+            file.current->append(data, n);
+            data += n;
+            len -= n;
+            if (file.current->size() == m_bufferSize)
+            {
+                Submit(handle);
+            }
+        }
+    }
+
+    void Append(int handle, const std::string& s)
+    {
+        Append(handle, s.data(), s.size());
+    }
+
+    /// Append a printf-formatted record, formatted in place in the buffer.
+    __attribute__((format(printf, 3, 4))) void Printf(int handle, const char* format, ...)
+    {
+        char local[512];
+        va_list args;
+        va_start(args, format);
+        int n = std::vsnprintf(local, sizeof(local), format, args);
+        va_end(args);
+        if (n < 0)
+        {
+            return;
+        }
+        if (static_cast<size_t>(n) < sizeof(local))
+        {
+            Append(handle, local, n);
+            return;
+        }
+        std::vector<char> big(n + 1);
+        va_start(args, format);
+        std::vsnprintf(big.data(), big.size(), format, args);
+        va_end(args);
+        Append(handle, big.data(), n);
+    }
+
+    /// A std::ostream appending to a new file; nullptr if it cannot be opened.
+    std::unique_ptr<std::ostream> OpenStream(const std::string& path, bool compress = false)
+    {
+        int handle = Open(path, compress);
+        if (handle < 0)
+        {
+            return nullptr;
+        }
+        m_streamBufs.emplace_back(new StreamBuf(this, handle));
+        return std::unique_ptr<std::ostream>(new std::ostream(m_streamBufs.back().get()));
+    }
+
+    /// Write all pending data, close the files and stop the thread. Idempotent.
+    void Close()
+    {
+        if (!m_thread.joinable())
+        {
+            return;
+        }
+        for (auto& sb : m_streamBufs)
+        {
+            sb->Drain();
+        }
+        for (size_t h = 0; h < m_files.size(); ++h)
+        {
+            if (!m_files[h].current->empty())
+            {
+                Submit(static_cast<int>(h));
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        m_thread.join();
+        for (auto& file : m_files)
+        {
+            if (file.block)
+            {
+                file.block->Close();
+                m_stats.fileBytes += file.block->GetFileBytes();
+            }
+            else
+            {
+                m_stats.fileBytes += std::ftell(file.fp);
+                std::fclose(file.fp);
+            }
+        }
+    }
+
+    /// Counters; complete after Close().
+    AsyncWriterStats GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+  private:
+    typedef std::unique_ptr<std::string> Buffer;
+
+    struct File
+    {
+        FILE* fp{nullptr};
+        std::unique_ptr<BlockFileWriter> block; // instead of fp when compressed
+        Buffer current;
+    };
+
+    /// std::streambuf over a file of the writer, buffering a small put area.
+    class StreamBuf : public std::streambuf
+    {
+      public:
+        StreamBuf(AsyncTraceWriter* writer, int handle)
+            : m_writer(writer),
+              m_handle(handle),
+              m_area(4096)
+        {
+            setp(m_area.data(), m_area.data() + m_area.size());
+        }
+
+        void Drain()
+        {
+            if (pptr() > pbase())
+            {
+                m_writer->Append(m_handle, pbase(), pptr() - pbase());
+                setp(m_area.data(), m_area.data() + m_area.size());
+            }
+        }
+
+      protected:
+        int_type overflow(int_type c) override
+        {
+            Drain();
+            if (!traits_type::eq_int_type(c, traits_type::eof()))
+            {
+                *pptr() = traits_type::to_char_type(c);
+                pbump(1);
+            }
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char* s, std::streamsize n) override
+        {
+            if (n > epptr() - pptr())
+            {
+                Drain();
+                m_writer->Append(m_handle, s, n);
+                return n;
+            }
+            std::memcpy(pptr(), s, n);
+            pbump(static_cast<int>(n));
+            return n;
+        }
+
+        int sync() override
+        {
+            Drain();
+            return 0;
+        }
+
+      private:
+        AsyncTraceWriter* m_writer;
+        int m_handle;
+        std::vector<char> m_area;
+    };
+
+    /**
+     * A free buffer, waiting (back-pressure) while all maxBuffers are in use and
+     * some are queued. The bound is exceeded only by files' current buffers when
+     * there are more files than maxBuffers.
+     */
+    Buffer Acquire()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_free.empty() && m_allocated >= m_maxBuffers && m_pending > 0)
+        {
+            auto start = std::chrono::steady_clock::now();
+            ++m_stats.stalls;
+            m_returned.wait(lock, [this] { return !m_free.empty() || m_pending == 0; });
+            m_stats.stallSeconds +=
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        if (!m_free.empty())
+        {
+            Buffer b = std::move(m_free.back());
+            m_free.pop_back();
+            return b;
+        }
+        ++m_allocated;
+        Buffer b(new std::string);
+        b->reserve(m_bufferSize);
+        return b;
+    }
+
+    /// Queue the current buffer of a file and continue in a free one.
+    void Submit(int handle)
+    {
+        File& file = m_files[handle];
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queue.emplace_back(handle, std::move(file.current));
+            ++m_pending;
+            m_stats.peakQueued = std::max(m_stats.peakQueued, m_queue.size());
+        }
+        m_wake.notify_one();
+        file.current = Acquire();
+    }
+
+    /// Background thread: write queued buffers in order and recycle them.
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_wake.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+            if (m_queue.empty())
+            {
+                return;
+            }
+            std::pair<int, Buffer> job = std::move(m_queue.front());
+            m_queue.pop_front();
+            File& file = m_files[job.first];
+            lock.unlock();
+            auto start = std::chrono::steady_clock::now();
+            if (file.block)
+            {
+                file.block->Write(job.second->data(), job.second->size());
+            }
+            else
+            {
+                std::fwrite(job.second->data(), 1, job.second->size(), file.fp);
+            }
+            double elapsed =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            job.second->clear();
+            lock.lock();
+            m_stats.writeSeconds += elapsed;
+            ++m_stats.buffers;
+            m_free.push_back(std::move(job.second));
+            --m_pending;
+            m_returned.notify_one();
+        }
+    }
+
+    const size_t m_bufferSize;
+    const size_t m_maxBuffers;
+    std::deque<File> m_files; // deque: stable references while Open() appends
+    std::vector<std::unique_ptr<StreamBuf>> m_streamBufs;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_returned;
+    std::deque<std::pair<int, Buffer>> m_queue;
+    std::vector<Buffer> m_free;
+    size_t m_allocated{0};
+    size_t m_pending{0}; ///< buffers queued or being written
+    bool m_stop{false};
+    AsyncWriterStats m_stats;
+    std::thread m_thread;
+};
+
+} // namespace kpm
+
+#endif // KPM_ASYNC_WRITER_H
@@ -0,0 +1,234 @@
+/**
+ * \file kpm-bf-kernels.cc
+ * \brief Microbenchmark and accuracy check of the beamforming kernels.
+ *
+ * Generates random 8x32 channel matrices (2x4 UE UPA, 4x8 gNB UPA, as in
+ * kpm-project-11.cc) for a number of PRBs, then times the matrix-vector product,
+ * the power summation and the full received-PSD computation for every
+ * instruction set supported by the CPU. The SIMD results are compared with the
+ * scalar path and the program fails if the relative error exceeds the tolerance.
+ *
+ * The program has no ns-3 dependency:
+ *
+ * \code{.unparsed}
+$ g++ -O2 -std=c++17 -o kpm-bf-kernels kpm-bf-kernels.cc && ./kpm-bf-kernels
+$ ./kpm-bf-kernels --prbs=66 --iterations=20000
+ * \endcode
+ */
+
+#include "kpm-bf-kernels.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace kpm;
+
+namespace
+{
+
+const size_t UE_ELEMENTS = 2 * 4;
+const size_t GNB_ELEMENTS = 4 * 8;
+
+/// Parse "--name=value" into value, return true when the argument matched.
+bool
+ParseArg(const std::string& arg, const std::string& name, size_t& value)
+{
+    std::string prefix = "--" + name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0)
+    {
+        return false;
+    }
+    value = std::stoul(arg.substr(prefix.size()));
+    return true;
+}
+
+double
+RelativeError(double ref, double val)
+{
+    double scale = std::max(std::fabs(ref), 1e-300);
+    return std::fabs(ref - val) / scale;
+}
+
+/// Time fn over the given iterations and return nanoseconds per iteration.
+template <typename Fn>
+double
+TimeNs(size_t iterations, Fn fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        fn(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    size_t numPrb = 66; // 50 MHz at numerology 2
+    size_t iterations = 5000;
+    size_t seed = 1;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (!ParseArg(arg, "prbs", numPrb) && !ParseArg(arg, "iterations", iterations) &&
+            !ParseArg(arg, "seed", seed))
+        {
+            std::fprintf(stderr, "Usage: %s [--prbs=N] [--iterations=N] [--seed=N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::mt19937_64 rng(seed);
+    std::normal_distribution<double> gauss(0.0, 1.0 / std::sqrt(2.0));
+    std::uniform_real_distribution<double> phase(0.0, 2 * M_PI);
+
+    std::vector<Complex> h(numPrb * UE_ELEMENTS * GNB_ELEMENTS);
+    for (auto& v : h)
+    {
+        v = Complex(gauss(rng), gauss(rng));
+    }
+    std::vector<Complex> wTx(GNB_ELEMENTS);
+    for (auto& v : wTx)
+    {
+        v = std::polar(1.0 / std::sqrt(double(GNB_ELEMENTS)), phase(rng));
+    }
+    std::vector<Complex> wRx(UE_ELEMENTS);
+    for (auto& v : wRx)
+    {
+        v = std::polar(1.0 / std::sqrt(double(UE_ELEMENTS)), phase(rng));
+    }
+    std::vector<double> txPsd(numPrb, 1e-9);
+    std::vector<double> rxPsd(numPrb);
+    std::vector<Complex> scratch(UE_ELEMENTS);
+
+    BfIsa best = DetectBfIsa();
+    std::printf("Detected ISA: %s, %zu PRBs x %zux%zu channel, %zu iterations\n",
+                BfIsaName(best),
+                numPrb,
+                UE_ELEMENTS,
+                GNB_ELEMENTS,
+                iterations);
+
+    const BfKernels ref = GetBfKernels(BfIsa::SCALAR);
+    std::vector<Complex> yRef(UE_ELEMENTS);
+    ref.matVec(h.data(), UE_ELEMENTS, GNB_ELEMENTS, wTx.data(), yRef.data());
+    double powerRef = ref.powerSum(h.data(), h.size());
+    std::vector<double> rxRef(numPrb);
+    double totalRef = ReceivedPsd(ref,
+                                  h.data(),
+                                  numPrb,
+                                  UE_ELEMENTS,
+                                  GNB_ELEMENTS,
+                                  wTx.data(),
+                                  wRx.data(),
+                                  txPsd.data(),
+                                  rxRef.data(),
+                                  scratch.data());
+
+    const double tolerance = 1e-12;
+    bool ok = true;
+    double scalarRemNs = 0.0;
+    volatile double sink = 0.0;
+
+    std::printf("%-8s %14s %14s %14s %10s %12s\n",
+                "ISA",
+                "matVec [ns]",
+                "powerSum [ns]",
+                "rxPsd [ns]",
+                "speed-up",
+                "max rel err");
+
+    std::vector<BfIsa> isas = {BfIsa::SCALAR};
+    if (best == BfIsa::AVX2 || best == BfIsa::AVX512)
+    {
+        isas.push_back(BfIsa::AVX2);
+    }
+    if (best == BfIsa::AVX512)
+    {
+        isas.push_back(BfIsa::AVX512);
+    }
+
+    for (BfIsa isa : isas)
+    {
+        const BfKernels k = GetBfKernels(isa);
+
+        // Accuracy against the scalar path
+        std::vector<Complex> y(UE_ELEMENTS);
+        k.matVec(h.data(), UE_ELEMENTS, GNB_ELEMENTS, wTx.data(), y.data());
+        double maxErr = 0.0;
+        for (size_t r = 0; r < UE_ELEMENTS; ++r)
+        {
+            maxErr = std::max(maxErr, std::abs(y[r] - yRef[r]) / std::max(std::abs(yRef[r]), 1e-300));
+        }
+        maxErr = std::max(maxErr, RelativeError(powerRef, k.powerSum(h.data(), h.size())));
+        double total = ReceivedPsd(k,
+                                   h.data(),
+                                   numPrb,
+                                   UE_ELEMENTS,
+                                   GNB_ELEMENTS,
+                                   wTx.data(),
+                                   wRx.data(),
+                                   txPsd.data(),
+                                   rxPsd.data(),
+                                   scratch.data());
+        maxErr = std::max(maxErr, RelativeError(totalRef, total));
+        for (size_t p = 0; p < numPrb; ++p)
+        {
+            maxErr = std::max(maxErr, RelativeError(rxRef[p], rxPsd[p]));
+        }
+
+        // Timing
+        size_t nMat = h.size() / (UE_ELEMENTS * GNB_ELEMENTS);
+        double matVecNs = TimeNs(iterations, [&](size_t i) {
+            k.matVec(h.data() + (i % nMat) * UE_ELEMENTS * GNB_ELEMENTS,
+                     UE_ELEMENTS,
+                     GNB_ELEMENTS,
+                     wTx.data(),
+                     y.data());
+            sink = sink + y[0].real();
+        });
+        double powerNs = TimeNs(iterations, [&](size_t) {
+            sink = sink + k.powerSum(h.data(), UE_ELEMENTS * GNB_ELEMENTS);
+        });
+        double remNs = TimeNs(iterations, [&](size_t) {
+            sink = sink + ReceivedPsd(k,
+                                      h.data(),
+                                      numPrb,
+                                      UE_ELEMENTS,
+                                      GNB_ELEMENTS,
+                                      wTx.data(),
+                                      wRx.data(),
+                                      txPsd.data(),
+                                      rxPsd.data(),
+                                      scratch.data());
+        });
+        if (isa == BfIsa::SCALAR)
+        {
+            scalarRemNs = remNs;
+        }
+
+        std::printf("%-8s %14.1f %14.1f %14.1f %9.2fx %12.3g\n",
+                    BfIsaName(isa),
+                    matVecNs,
+                    powerNs,
+                    remNs,
+                    scalarRemNs / remNs,
+                    maxErr);
+
+        if (maxErr > tolerance)
+        {
+            std::fprintf(stderr, "%s exceeds tolerance %g\n", BfIsaName(isa), tolerance);
+            ok = false;
+        }
+    }
+
+    return ok ? 0 : 1;
+}
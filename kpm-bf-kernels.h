@@ -0,0 +1,352 @@
+/**
+ * \file kpm-bf-kernels.h
+ * \brief Vectorised kernels for channel-matrix and beamforming-gain computation.
+ *
+ * Every gNB <-> UE link in the scenario uses a 4x8 UPA at the gNB (32 elements) and
+ * a 2x4 UPA at the UE (8 elements), so each link is described by an 8x32 complex
+ * channel matrix H per PRB. The beamforming gain of a link is |wRx^H * H * wTx|^2 and
+ * the received PSD is the per-PRB transmitted PSD scaled by that gain. The REM
+ * repeats this for every grid point and every gNB, which makes the complex
+ * matrix-vector product and the power summation the innermost loop.
+ *
+ * The kernels below come in three flavours (scalar, AVX2+FMA, AVX-512F). The best
+ * one supported by the CPU is selected at runtime on first use; the scalar path is
+ * always available and is the reference for the accuracy check in kpm-bf-kernels.cc.
+ *
+ * All matrices are row-major arrays of std::complex<double> (the layout used by
+ * the ns-3 PhasedArrayModel), i.e. H[r * cols + c].
+ *
+ * The header has no ns-3 dependency, so it can be used both from the simulation
+ * scripts and from the standalone benchmark.
+ */
+
+#ifndef KPM_BF_KERNELS_H
+#define KPM_BF_KERNELS_H
+
+#include <complex>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define KPM_BF_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+namespace kpm
+{
+
+typedef std::complex<double> Complex;
+
+/// Instruction set used by the kernels.
+enum class BfIsa
+{
+    SCALAR,
+    AVX2,
+    AVX512
+};
+
+/// Human readable name of an instruction set.
+inline const char*
+BfIsaName(BfIsa isa)
+{
+    switch (isa)
+    {
+    case BfIsa::AVX512:
+        return "AVX-512";
+    case BfIsa::AVX2:
+        return "AVX2";
+    default:
+        return "scalar";
+    }
+}
+
+/// Kernel table, one entry per primitive.
+struct BfKernels
+{
+    BfIsa isa;
+    /// y[r] = sum_c H[r][c] * x[c]
+    void (*matVec)(const Complex* h, size_t rows, size_t cols, const Complex* x, Complex* y);
+    /// sum_i |v[i]|^2
+    double (*powerSum)(const Complex* v, size_t n);
+};
+
+/*
+ * Scalar reference path.
+ */
+
+inline void
+MatVecScalar(const Complex* h, size_t rows, size_t cols, const Complex* x, Complex* y)
+{
+    for (size_t r = 0; r < rows; ++r)
+    {
+        const Complex* row = h + r * cols;
+        double re = 0.0;
+        double im = 0.0;
+        for (size_t c = 0; c < cols; ++c)
+        {
+            re += row[c].real() * x[c].real() - row[c].imag() * x[c].imag();
+            im += row[c].real() * x[c].imag() + row[c].imag() * x[c].real();
+        }
+        y[r] = Complex(re, im);
+    }
+}
+
+inline double
+PowerSumScalar(const Complex* v, size_t n)
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        sum += v[i].real() * v[i].real() + v[i].imag() * v[i].imag();
+    }
+    return sum;
+}
+
+#ifdef KPM_BF_HAVE_X86
+
+// The GCC intrinsic headers trip -Wmaybe-uninitialized on _mm512_undefined_pd().
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+/*
+ * AVX2 + FMA path: one __m256d holds two interleaved complex values.
+ */
+
+__attribute__((target("avx2,fma"))) inline void
+MatVecAvx2(const Complex* h, size_t rows, size_t cols, const Complex* x, Complex* y)
+{
+    const double* xd = reinterpret_cast<const double*>(x);
+    for (size_t r = 0; r < rows; ++r)
+    {
+        const double* row = reinterpret_cast<const double*>(h + r * cols);
+        __m256d acc = _mm256_setzero_pd();
+        size_t c = 0;
+        for (; c + 2 <= cols; c += 2)
+        {
+            __m256d a = _mm256_loadu_pd(row + 2 * c);
+            __m256d b = _mm256_loadu_pd(xd + 2 * c);
+            __m256d bRe = _mm256_movedup_pd(b);       // br0 br0 br1 br1
+            __m256d bIm = _mm256_permute_pd(b, 0xF);  // bi0 bi0 bi1 bi1
+            __m256d aSwap = _mm256_permute_pd(a, 0x5); // ai0 ar0 ai1 ar1
+            acc = _mm256_add_pd(acc, _mm256_fmaddsub_pd(a, bRe, _mm256_mul_pd(aSwap, bIm)));
+        }
+        __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+        double out[2];
+        _mm_storeu_pd(out, sum);
+        for (; c < cols; ++c)
+        {
+            const Complex& hv = h[r * cols + c];
+            out[0] += hv.real() * x[c].real() - hv.imag() * x[c].imag();
+            out[1] += hv.real() * x[c].imag() + hv.imag() * x[c].real();
+        }
+        y[r] = Complex(out[0], out[1]);
+    }
+}
+
+__attribute__((target("avx2,fma"))) inline double
+PowerSumAvx2(const Complex* v, size_t n)
+{
+    const double* d = reinterpret_cast<const double*>(v);
+    size_t len = 2 * n;
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8)
+    {
+        __m256d a = _mm256_loadu_pd(d + i);
+        __m256d b = _mm256_loadu_pd(d + i + 4);
+        acc0 = _mm256_fmadd_pd(a, a, acc0);
+        acc1 = _mm256_fmadd_pd(b, b, acc1);
+    }
+    acc0 = _mm256_add_pd(acc0, acc1);
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(acc0), _mm256_extractf128_pd(acc0, 1));
+    double out[2];
+    _mm_storeu_pd(out, s);
+    double sum = out[0] + out[1];
+    for (; i < len; ++i)
+    {
+        sum += d[i] * d[i];
+    }
+    return sum;
+}
+
+/*
+ * AVX-512F path: one __m512d holds four interleaved complex values.
+ */
+
+__attribute__((target("avx512f"))) inline void
+MatVecAvx512(const Complex* h, size_t rows, size_t cols, const Complex* x, Complex* y)
+{
+    const double* xd = reinterpret_cast<const double*>(x);
+    for (size_t r = 0; r < rows; ++r)
+    {
+        const double* row = reinterpret_cast<const double*>(h + r * cols);
+        __m512d acc = _mm512_setzero_pd();
+        size_t c = 0;
+        for (; c + 4 <= cols; c += 4)
+        {
+            __m512d a = _mm512_loadu_pd(row + 2 * c);
+            __m512d b = _mm512_loadu_pd(xd + 2 * c);
+            __m512d bRe = _mm512_movedup_pd(b);
+            __m512d bIm = _mm512_permute_pd(b, 0xFF);
+            __m512d aSwap = _mm512_permute_pd(a, 0x55);
+            acc = _mm512_add_pd(acc, _mm512_fmaddsub_pd(a, bRe, _mm512_mul_pd(aSwap, bIm)));
+        }
+        // Fold the four complex lanes: even lanes are real parts, odd lanes imaginary.
+        double lanes[8];
+        _mm512_storeu_pd(lanes, acc);
+        double re = lanes[0] + lanes[2] + lanes[4] + lanes[6];
+        double im = lanes[1] + lanes[3] + lanes[5] + lanes[7];
+        for (; c < cols; ++c)
+        {
+            const Complex& hv = h[r * cols + c];
+            re += hv.real() * x[c].real() - hv.imag() * x[c].imag();
+            im += hv.real() * x[c].imag() + hv.imag() * x[c].real();
+        }
+        y[r] = Complex(re, im);
+    }
+}
+
+__attribute__((target("avx512f"))) inline double
+PowerSumAvx512(const Complex* v, size_t n)
+{
+    const double* d = reinterpret_cast<const double*>(v);
+    size_t len = 2 * n;
+    __m512d acc = _mm512_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8)
+    {
+        __m512d a = _mm512_loadu_pd(d + i);
+        acc = _mm512_fmadd_pd(a, a, acc);
+    }
+    double sum = _mm512_reduce_add_pd(acc);
+    for (; i < len; ++i)
+    {
+        sum += d[i] * d[i];
+    }
+    return sum;
+}
+
+#pragma GCC diagnostic pop
+
+#endif // KPM_BF_HAVE_X86
+
+/// Highest instruction set supported by the running CPU.
+inline BfIsa
+DetectBfIsa()
+{
+#ifdef KPM_BF_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return BfIsa::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return BfIsa::AVX2;
+    }
+#endif
+    return BfIsa::SCALAR;
+}
+
+/**
+ * Kernel table for a given instruction set. Requesting an instruction set that
+ * is not compiled in falls back to the scalar path; the caller is responsible for
+ * not requesting one the CPU does not support (use DetectBfIsa()).
+ */
+inline BfKernels
+GetBfKernels(BfIsa isa)
+{
+#ifdef KPM_BF_HAVE_X86
+    if (isa == BfIsa::AVX512)
+    {
+        return BfKernels{BfIsa::AVX512, &MatVecAvx512, &PowerSumAvx512};
+    }
+    if (isa == BfIsa::AVX2)
+    {
+        return BfKernels{BfIsa::AVX2, &MatVecAvx2, &PowerSumAvx2};
+    }
+#endif
+    return BfKernels{BfIsa::SCALAR, &MatVecScalar, &PowerSumScalar};
+}
+
+/**
+ * Kernel table selected once per process. Setting the environment variable
+ * KPM_BF_ISA to "scalar" or "avx2" caps the selection (useful to compare paths).
+ */
+inline const BfKernels&
+ActiveBfKernels()
+{
+    static const BfKernels kernels = [] {
+        BfIsa isa = DetectBfIsa();
+        const char* cap = std::getenv("KPM_BF_ISA");
+        if (cap != nullptr && std::strcmp(cap, "scalar") == 0)
+        {
+            isa = BfIsa::SCALAR;
+        }
+        else if (cap != nullptr && std::strcmp(cap, "avx2") == 0 && isa == BfIsa::AVX512)
+        {
+            isa = BfIsa::AVX2;
+        }
+        return GetBfKernels(isa);
+    }();
+    return kernels;
+}
+
+/**
+ * Beamforming gain |wRx^H * H * wTx|^2 of a single channel matrix.
+ *
+ * \param h channel matrix, rows = UE elements, cols = gNB elements
+ * \param wTx transmit beamforming vector (cols entries)
+ * \param wRx receive beamforming vector (rows entries)
+ * \param scratch buffer of at least rows entries
+ */
+inline double
+BeamformingGain(const BfKernels& k,
+                const Complex* h,
+                size_t rows,
+                size_t cols,
+                const Complex* wTx,
+                const Complex* wRx,
+                Complex* scratch)
+{
+    k.matVec(h, rows, cols, wTx, scratch);
+    Complex acc(0.0, 0.0);
+    for (size_t r = 0; r < rows; ++r)
+    {
+        acc += std::conj(wRx[r]) * scratch[r];
+    }
+    return std::norm(acc);
+}
+
+/**
+ * Received PSD for numPrb channel matrices stored back to back:
+ * rxPsd[k] = txPsd[k] * |wRx^H * H_k * wTx|^2. Returns the total received power
+ * (sum of rxPsd), which is what the REM accumulates per grid point.
+ */
+inline double
+ReceivedPsd(const BfKernels& k,
+            const Complex* h,
+            size_t numPrb,
+            size_t rows,
+            size_t cols,
+            const Complex* wTx,
+            const Complex* wRx,
+            const double* txPsd,
+            double* rxPsd,
+            Complex* scratch)
+{
+    double total = 0.0;
+    for (size_t p = 0; p < numPrb; ++p)
+    {
+        rxPsd[p] = txPsd[p] * BeamformingGain(k, h + p * rows * cols, rows, cols, wTx, wRx, scratch);
+        total += rxPsd[p];
+    }
+    return total;
+}
+
+} // namespace kpm
+
+#endif // KPM_BF_KERNELS_H
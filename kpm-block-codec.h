@@ -0,0 +1,1031 @@
+/**
+ * \file kpm-block-codec.h
+ * \brief Block-compressed trace files that stay seekable and queryable.
+ *
+ * The per-packet NR traces are plain text and very repetitive, so they compress
+ * well, but a gzip stream would have to be decompressed from the start to reach
+ * a time window. A ".kpz" file instead holds independent blocks of about
+ * blockSize bytes of the original text, each cut at a record (line) boundary:
+ *
+ * \code{.unparsed}
+"KPZ1" <u32 blockSize>
+<u8 method> <u32 rawSize> <u32 size> <size bytes>     one per block
+...
+<u64 rawOffset> <u64 fileOffset>                      one per block
+<u64 rawSize> <u32 blocks> "KPZT"                     trailer
+ * \endcode
+ *
+ * (integers little endian). The trailer maps offsets in the original text to
+ * blocks, so a reader decompresses only the blocks a byte range touches; the
+ * sidecar indexes of kpm-trace-index.h keep their offsets into the original
+ * text and work unchanged. A file without trailer (a run that did not finish)
+ * is read by walking the block headers.
+ *
+ * The codec is built in, so the format does not depend on the libraries of the
+ * build host: LZ77 over the whole block (hash chains, one step of lazy
+ * matching) followed by per-block canonical Huffman codes for literals/lengths
+ * and distances, deflate style. A block that does not shrink is stored. The
+ * sim-params traces compress about 9.5x with 1 MiB blocks.
+ *
+ * The header has no ns-3 dependency.
+ */
+
+#ifndef KPM_BLOCK_CODEC_H
+#define KPM_BLOCK_CODEC_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace kpm
+{
+
+/// Default amount of text per block.
+const size_t BLOCK_FILE_DEFAULT_BLOCK = 1 << 20;
+
+/// File name of the compressed form of a trace.
+inline std::string
+CompressedTracePath(const std::string& path)
+{
+    return path + ".kpz";
+}
+
+/// How a block is encoded.
+enum BlockMethod : uint8_t
+{
+    BLOCK_STORED = 0,
+    BLOCK_LZH = 1
+};
+
+const size_t BLOCK_HEADER_SIZE = 9;
+const size_t BLOCK_MIN_MATCH = 4;
+const size_t BLOCK_MAX_MATCH = BLOCK_MIN_MATCH + 1023;
+const int BLOCK_LITLEN_SYMBOLS = 256 + 20; // literals, then length codes
+const int BLOCK_DIST_SYMBOLS = 48;         // distances below 16 MiB
+const int BLOCK_MAX_CODE_LENGTH = 15;
+
+inline void
+PutLe(std::string& out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+    {
+        out.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+inline uint64_t
+GetLe(const char* p, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i)
+    {
+        value |= uint64_t(static_cast<unsigned char>(p[i])) << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * Logarithmic bucket of a length or distance: values below 4 are their own
+ * code, above that two codes per power of two with the remaining bits sent
+ * verbatim.
+ */
+inline int
+BucketCode(uint32_t v, int& extraBits)
+{
+    if (v < 4)
+    {
+        extraBits = 0;
+        return static_cast<int>(v);
+    }
+    int nb = 31 - __builtin_clz(v);
+    extraBits = nb - 1;
+    return 2 * nb + ((v >> (nb - 1)) & 1);
+}
+
+inline uint32_t
+BucketBase(int code, int& extraBits)
+{
+    if (code < 4)
+    {
+        extraBits = 0;
+        return code;
+    }
+    int nb = code / 2;
+    extraBits = nb - 1;
+    return (2u | (code & 1)) << (nb - 1);
+}
+
+/// LSB-first bit output.
+class BitWriter
+{
+  public:
+    explicit BitWriter(std::string& out)
+        : m_out(out)
+    {
+    }
+
+    void Put(uint32_t bits, int n)
+    {
+        m_acc |= uint64_t(bits) << m_count;
+        m_count += n;
+        while (m_count >= 8)
+        {
+            m_out.push_back(static_cast<char>(m_acc));
+            m_acc >>= 8;
+            m_count -= 8;
+        }
+    }
+
+    void Finish()
+    {
+        if (m_count > 0)
+        {
+            m_out.push_back(static_cast<char>(m_acc));
+        }
+        m_acc = 0;
+        m_count = 0;
+    }
+
+  private:
+    std::string& m_out;
+    uint64_t m_acc{0};
+    int m_count{0};
+};
+
+/// LSB-first bit input; reads zeros past the end, which the caller detects.
+class BitReader
+{
+  public:
+    BitReader(const char* p, const char* end)
+        : m_p(reinterpret_cast<const unsigned char*>(p)),
+          m_end(reinterpret_cast<const unsigned char*>(end))
+    {
+    }
+
+    /// Make at least 56 bits available.
+    void Refill()
+    {
+        while (m_count <= 56)
+        {
+            if (m_p < m_end)
+            {
+                m_acc |= uint64_t(*m_p++) << m_count;
+            }
+            else
+            {
+                ++m_overrun;
+            }
+            m_count += 8;
+        }
+    }
+
+    uint32_t Peek(int n) const
+    {
+        return static_cast<uint32_t>(m_acc & ((uint64_t(1) << n) - 1));
+    }
+
+    void Skip(int n)
+    {
+        m_acc >>= n;
+        m_count -= n;
+    }
+
+    uint32_t Get(int n)
+    {
+        uint32_t v = Peek(n);
+        Skip(n);
+        return v;
+    }
+
+    /// True if more bits were consumed than the input holds.
+    bool Overrun() const
+    {
+        return m_overrun * 8 > m_count;
+    }
+
+  private:
+    const unsigned char* m_p;
+    const unsigned char* m_end;
+    uint64_t m_acc{0};
+    int m_count{0};
+    int m_overrun{0};
+};
+
+/**
+ * Code lengths (at most BLOCK_MAX_CODE_LENGTH) of a Huffman code for the
+ * given symbol frequencies. Frequencies are halved until the longest code
+ * fits, which costs little on real data.
+ */
+inline std::vector<uint8_t>
+HuffmanLengths(std::vector<uint32_t> freq)
+{
+    const int n = static_cast<int>(freq.size());
+    std::vector<uint8_t> lengths(n, 0);
+    while (true)
+    {
+        std::vector<std::pair<uint64_t, int>> heap; // (weight, node), min-heap
+        std::vector<int> parent;
+        for (int s = 0; s < n; ++s)
+        {
+            if (freq[s] > 0)
+            {
+                heap.emplace_back(freq[s], static_cast<int>(parent.size()));
+                parent.push_back(-1);
+            }
+        }
+        if (heap.empty())
+        {
+            return lengths;
+        }
+        if (heap.size() == 1)
+        {
+            for (int s = 0; s < n; ++s)
+            {
+                lengths[s] = freq[s] > 0 ? 1 : 0;
+            }
+            return lengths;
+        }
+        const size_t leaves = heap.size();
+        auto greater = [](const std::pair<uint64_t, int>& a, const std::pair<uint64_t, int>& b) {
+            return a.first > b.first;
+        };
+        std::make_heap(heap.begin(), heap.end(), greater);
+        while (heap.size() > 1)
+        {
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            auto a = heap.back();
+            heap.pop_back();
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            auto b = heap.back();
+            heap.pop_back();
+            int node = static_cast<int>(parent.size());
+            parent.push_back(-1);
+            parent[a.second] = node;
+            parent[b.second] = node;
+            heap.emplace_back(a.first + b.first, node);
+            std::push_heap(heap.begin(), heap.end(), greater);
+        }
+        // Depth of a node = depth of its parent + 1; parents come after children
+        std::vector<int> depth(parent.size(), 0);
+        for (int i = static_cast<int>(parent.size()) - 2; i >= 0; --i)
+        {
+            depth[i] = depth[parent[i]] + 1;
+        }
+        int maxDepth = *std::max_element(depth.begin(), depth.begin() + leaves);
+        if (maxDepth <= BLOCK_MAX_CODE_LENGTH)
+        {
+            int leaf = 0;
+            for (int s = 0; s < n; ++s)
+            {
+                lengths[s] = freq[s] > 0 ? static_cast<uint8_t>(depth[leaf++]) : 0;
+            }
+            return lengths;
+        }
+        for (auto& f : freq)
+        {
+            f = f > 0 ? (f >> 1) | 1 : 0;
+        }
+    }
+}
+
+/// Canonical codes of a set of code lengths, bit-reversed for LSB-first output.
+inline std::vector<uint16_t>
+HuffmanCodes(const std::vector<uint8_t>& lengths)
+{
+    std::vector<uint16_t> codes(lengths.size(), 0);
+    uint32_t code = 0;
+    for (int len = 1; len <= BLOCK_MAX_CODE_LENGTH; ++len)
+    {
+        for (size_t s = 0; s < lengths.size(); ++s)
+        {
+            if (lengths[s] == len)
+            {
+                uint32_t reversed = 0;
+                for (int b = 0; b < len; ++b)
+                {
+                    reversed |= ((code >> b) & 1) << (len - 1 - b);
+                }
+                codes[s] = static_cast<uint16_t>(reversed);
+                ++code;
+            }
+        }
+        code <<= 1;
+    }
+    return codes;
+}
+
+/// Table decoder of a canonical Huffman code.
+class HuffmanDecoder
+{
+  public:
+    /// False if the lengths do not describe a usable code.
+    bool Init(const std::vector<uint8_t>& lengths)
+    {
+        m_bits = 0;
+        for (uint8_t l : lengths)
+        {
+            m_bits = std::max<int>(m_bits, l);
+        }
+        if (m_bits == 0)
+        {
+            m_table.clear();
+            return true; // alphabet unused in this block
+        }
+        m_table.assign(size_t(1) << m_bits, 0);
+        std::vector<uint16_t> codes = HuffmanCodes(lengths);
+        for (size_t s = 0; s < lengths.size(); ++s)
+        {
+            int len = lengths[s];
+            if (len == 0)
+            {
+                continue;
+            }
+            for (size_t i = codes[s]; i < m_table.size(); i += size_t(1) << len)
+            {
+                m_table[i] = static_cast<uint16_t>((s << 4) | len);
+            }
+        }
+        return true;
+    }
+
+    /// Next symbol, -1 on a code that is not in the table.
+    int Decode(BitReader& in) const
+    {
+        if (m_bits == 0)
+        {
+            return -1;
+        }
+        uint16_t e = m_table[in.Peek(m_bits)];
+        if ((e & 15) == 0)
+        {
+            return -1;
+        }
+        in.Skip(e & 15);
+        return e >> 4;
+    }
+
+  private:
+    int m_bits{0};
+    std::vector<uint16_t> m_table; // (symbol << 4) | length
+};
+
+/// Append one encoded block (header included) of data to out.
+inline void
+CompressBlock(const char* data, size_t n, std::string& out)
+{
+    const unsigned char* src = reinterpret_cast<const unsigned char*>(data);
+
+    // LZ77 parse into (literal run, match) tokens
+    struct Match
+    {
+        uint32_t pos;
+        uint32_t len;
+        uint32_t dist;
+    };
+
+    std::vector<Match> matches;
+    const int HASH_BITS = 16;
+    const int MAX_CHAIN = 4;      // candidates tried per position
+    const size_t NICE_LENGTH = 32; // a match this long ends the search
+    std::vector<int32_t> head(size_t(1) << HASH_BITS, -1);
+    std::vector<int32_t> prev(n, -1);
+    auto hash = [src](size_t i) {
+        uint32_t v;
+        std::memcpy(&v, src + i, 4);
+        return (v * 2654435761u) >> (32 - HASH_BITS);
+    };
+    auto insert = [&](size_t i) {
+        if (i + BLOCK_MIN_MATCH <= n)
+        {
+            uint32_t h = hash(i);
+            prev[i] = head[h];
+            head[h] = static_cast<int32_t>(i);
+        }
+    };
+    auto longest = [&](size_t i, uint32_t& dist) {
+        size_t best = 0;
+        if (i + BLOCK_MIN_MATCH > n)
+        {
+            return best;
+        }
+        size_t limit = std::min(BLOCK_MAX_MATCH, n - i);
+        int32_t cand = head[hash(i)];
+        for (int chain = 0; cand >= 0 && chain < MAX_CHAIN; ++chain, cand = prev[cand])
+        {
+            if (src[cand + best] != src[i + best])
+            {
+                continue;
+            }
+            size_t len = 0;
+            while (len < limit && src[cand + len] == src[i + len])
+            {
+                ++len;
+            }
+            if (len > best)
+            {
+                best = len;
+                dist = static_cast<uint32_t>(i - cand);
+                if (len >= std::min(limit, NICE_LENGTH))
+                {
+                    break;
+                }
+            }
+        }
+        return best >= BLOCK_MIN_MATCH ? best : 0;
+    };
+
+    size_t i = 0;
+    while (i < n)
+    {
+        uint32_t dist = 0;
+        size_t len = longest(i, dist);
+        if (len > 0 && len < 32 && i + 1 < n)
+        {
+            // One step of lazy matching: prefer a longer match at the next byte
+            insert(i);
+            uint32_t dist2 = 0;
+            size_t len2 = longest(i + 1, dist2);
+            if (len2 > len + 1)
+            {
+                ++i;
+                len = len2;
+                dist = dist2;
+            }
+            else
+            {
+                matches.push_back({static_cast<uint32_t>(i), static_cast<uint32_t>(len), dist});
+                for (size_t k = 1; k < len; ++k)
+                {
+                    insert(i + k);
+                }
+                i += len;
+                continue;
+            }
+        }
+        if (len > 0)
+        {
+            matches.push_back({static_cast<uint32_t>(i), static_cast<uint32_t>(len), dist});
+            for (size_t k = 0; k < len; ++k)
+            {
+                insert(i + k);
+            }
+            i += len;
+        }
+        else
+        {
+            insert(i);
+            ++i;
+        }
+    }
+
+    // Symbol frequencies
+    std::vector<uint32_t> litFreq(BLOCK_LITLEN_SYMBOLS, 0);
+    std::vector<uint32_t> distFreq(BLOCK_DIST_SYMBOLS, 0);
+    size_t pos = 0;
+    int extra;
+    for (const Match& m : matches)
+    {
+        for (; pos < m.pos; ++pos)
+        {
+            ++litFreq[src[pos]];
+        }
+        ++litFreq[256 + BucketCode(m.len - BLOCK_MIN_MATCH, extra)];
+        ++distFreq[BucketCode(m.dist - 1, extra)];
+        pos += m.len;
+    }
+    for (; pos < n; ++pos)
+    {
+        ++litFreq[src[pos]];
+    }
+    std::vector<uint8_t> litLen = HuffmanLengths(litFreq);
+    std::vector<uint8_t> distLen = HuffmanLengths(distFreq);
+    std::vector<uint16_t> litCode = HuffmanCodes(litLen);
+    std::vector<uint16_t> distCode = HuffmanCodes(distLen);
+
+    size_t start = out.size();
+    out.push_back(static_cast<char>(BLOCK_LZH));
+    PutLe(out, n, 4);
+    PutLe(out, 0, 4); // size, patched below
+    BitWriter bits(out);
+    for (uint8_t l : litLen)
+    {
+        bits.Put(l, 4);
+    }
+    for (uint8_t l : distLen)
+    {
+        bits.Put(l, 4);
+    }
+    pos = 0;
+    for (const Match& m : matches)
+    {
+        for (; pos < m.pos; ++pos)
+        {
+            bits.Put(litCode[src[pos]], litLen[src[pos]]);
+        }
+        int code = BucketCode(m.len - BLOCK_MIN_MATCH, extra);
+        bits.Put(litCode[256 + code], litLen[256 + code]);
+        bits.Put((m.len - BLOCK_MIN_MATCH) & ((1u << extra) - 1), extra);
+        code = BucketCode(m.dist - 1, extra);
+        bits.Put(distCode[code], distLen[code]);
+        bits.Put((m.dist - 1) & ((1u << extra) - 1), extra);
+        pos += m.len;
+    }
+    for (; pos < n; ++pos)
+    {
+        bits.Put(litCode[src[pos]], litLen[src[pos]]);
+    }
+    bits.Finish();
+
+    size_t size = out.size() - start - BLOCK_HEADER_SIZE;
+    if (size >= n)
+    {
+        out.resize(start);
+        out.push_back(static_cast<char>(BLOCK_STORED));
+        PutLe(out, n, 4);
+        PutLe(out, n, 4);
+        out.append(data, n);
+        return;
+    }
+    for (int b = 0; b < 4; ++b)
+    {
+        out[start + 5 + b] = static_cast<char>(size >> (8 * b));
+    }
+}
+
+/**
+ * Decode the payload of a block (after its header) into dst, which holds
+ * rawSize bytes. Returns false on corrupt input.
+ */
+inline bool
+DecompressBlock(uint8_t method, const char* payload, size_t size, char* dst, size_t rawSize)
+{
+    if (method == BLOCK_STORED)
+    {
+        if (size != rawSize)
+        {
+            return false;
+        }
+        std::memcpy(dst, payload, size);
+        return true;
+    }
+    if (method != BLOCK_LZH)
+    {
+        return false;
+    }
+    BitReader in(payload, payload + size);
+    std::vector<uint8_t> litLen(BLOCK_LITLEN_SYMBOLS);
+    std::vector<uint8_t> distLen(BLOCK_DIST_SYMBOLS);
+    for (auto& l : litLen)
+    {
+        in.Refill();
+        l = static_cast<uint8_t>(in.Get(4));
+    }
+    for (auto& l : distLen)
+    {
+        in.Refill();
+        l = static_cast<uint8_t>(in.Get(4));
+    }
+    HuffmanDecoder lit;
+    HuffmanDecoder dist;
+    lit.Init(litLen);
+    dist.Init(distLen);
+
+    size_t out = 0;
+    int extra;
+    while (out < rawSize)
+    {
+        in.Refill();
+        int sym = lit.Decode(in);
+        if (sym < 0)
+        {
+            return false;
+        }
+        if (sym < 256)
+        {
+            dst[out++] = static_cast<char>(sym);
+            continue;
+        }
+        size_t len = BucketBase(sym - 256, extra);
+        len += in.Get(extra) + BLOCK_MIN_MATCH;
+        in.Refill();
+        int dsym = dist.Decode(in);
+        if (dsym < 0)
+        {
+            return false;
+        }
+        size_t d = BucketBase(dsym, extra);
+        d += in.Get(extra) + 1;
+        if (d > out || len > rawSize - out)
+        {
+            return false;
+        }
+        const char* from = dst + out - d;
+        if (d >= len)
+        {
+            std::memcpy(dst + out, from, len);
+        }
+        else
+        {
+            for (size_t k = 0; k < len; ++k)
+            {
+                dst[out + k] = from[k];
+            }
+        }
+        out += len;
+    }
+    return !in.Overrun();
+}
+
+/**
+ * Writer of a .kpz file. Write() takes text in any pieces; a block is emitted
+ * whenever blockSize bytes are pending, cut after the last complete line.
+ */
+class BlockFileWriter
+{
+  public:
+    explicit BlockFileWriter(size_t blockSize = BLOCK_FILE_DEFAULT_BLOCK)
+        : m_blockSize(std::min<size_t>(std::max<size_t>(blockSize, 4096), 1 << 24))
+    {
+    }
+
+    ~BlockFileWriter()
+    {
+        Close();
+    }
+
+    BlockFileWriter(const BlockFileWriter&) = delete;
+    BlockFileWriter& operator=(const BlockFileWriter&) = delete;
+
+    bool Open(const std::string& path)
+    {
+        m_fp = std::fopen(path.c_str(), "wb");
+        if (!m_fp)
+        {
+            return false;
+        }
+        std::string header("KPZ1");
+        PutLe(header, m_blockSize, 4);
+        std::fwrite(header.data(), 1, header.size(), m_fp);
+        m_fileBytes = header.size();
+        return true;
+    }
+
+    void Write(const char* data, size_t len)
+    {
+        m_pending.append(data, len);
+        size_t begin = 0;
+        while (m_pending.size() - begin >= m_blockSize)
+        {
+            size_t cut = m_pending.rfind('\n', begin + m_blockSize - 1);
+            cut = cut == std::string::npos || cut < begin ? begin + m_blockSize : cut + 1;
+            Emit(m_pending.data() + begin, cut - begin);
+            begin = cut;
+        }
+        m_pending.erase(0, begin);
+    }
+
+    /// Write the last block and the trailer. Idempotent.
+    bool Close()
+    {
+        if (!m_fp)
+        {
+            return true;
+        }
+        if (!m_pending.empty())
+        {
+            Emit(m_pending.data(), m_pending.size());
+            m_pending.clear();
+        }
+        std::string trailer;
+        for (const auto& b : m_blocks)
+        {
+            PutLe(trailer, b.first, 8);
+            PutLe(trailer, b.second, 8);
+        }
+        PutLe(trailer, m_rawBytes, 8);
+        PutLe(trailer, m_blocks.size(), 4);
+        trailer.append("KPZT");
+        std::fwrite(trailer.data(), 1, trailer.size(), m_fp);
+        m_fileBytes += trailer.size();
+        bool ok = !std::ferror(m_fp);
+        ok = std::fclose(m_fp) == 0 && ok;
+        m_fp = nullptr;
+        return ok;
+    }
+
+    uint64_t GetRawBytes() const
+    {
+        return m_rawBytes;
+    }
+
+    uint64_t GetFileBytes() const
+    {
+        return m_fileBytes;
+    }
+
+  private:
+    void Emit(const char* data, size_t n)
+    {
+        m_blocks.emplace_back(m_rawBytes, m_fileBytes);
+        m_out.clear();
+        CompressBlock(data, n, m_out);
+        std::fwrite(m_out.data(), 1, m_out.size(), m_fp);
+        m_rawBytes += n;
+        m_fileBytes += m_out.size();
+    }
+
+    const size_t m_blockSize;
+    FILE* m_fp{nullptr};
+    std::string m_pending;
+    std::string m_out;
+    std::vector<std::pair<uint64_t, uint64_t>> m_blocks; // (raw offset, file offset)
+    uint64_t m_rawBytes{0};
+    uint64_t m_fileBytes{0};
+};
+
+/// True if the file starts with the .kpz magic.
+inline bool
+IsBlockFile(const std::string& path)
+{
+    std::ifstream in(path, std::ifstream::binary);
+    char magic[4];
+    return in.read(magic, 4) && std::memcmp(magic, "KPZ1", 4) == 0;
+}
+
+/// Random access reader of a .kpz file.
+class BlockFileReader
+{
+  public:
+    struct Block
+    {
+        uint64_t rawOffset;
+        uint64_t fileOffset;
+    };
+
+    /// Open a file and load its block table; false if it is not a .kpz file.
+    bool Open(const std::string& path)
+    {
+        m_in.open(path, std::ifstream::binary);
+        char header[8];
+        if (!m_in.read(header, 8) || std::memcmp(header, "KPZ1", 4) != 0)
+        {
+            return false;
+        }
+        m_blocks.clear();
+        m_in.seekg(0, std::ifstream::end);
+        uint64_t fileSize = m_in.tellg();
+        char tail[16];
+        if (fileSize >= 8 + 16 && m_in.seekg(fileSize - 16) && m_in.read(tail, 16) &&
+            std::memcmp(tail + 12, "KPZT", 4) == 0)
+        {
+            m_rawSize = GetLe(tail, 8);
+            uint64_t count = GetLe(tail + 8, 4);
+            if (count * 16 + 16 + 8 <= fileSize)
+            {
+                std::string table(count * 16, '\0');
+                m_in.seekg(fileSize - 16 - table.size());
+                if (m_in.read(&table[0], table.size()))
+                {
+                    for (uint64_t b = 0; b < count; ++b)
+                    {
+                        m_blocks.push_back(
+                            {GetLe(&table[b * 16], 8), GetLe(&table[b * 16 + 8], 8)});
+                    }
+                    return true;
+                }
+            }
+        }
+        // No trailer: walk the block headers
+        m_in.clear();
+        m_blocks.clear();
+        m_rawSize = 0;
+        uint64_t offset = 8;
+        char h[BLOCK_HEADER_SIZE];
+        while (offset + BLOCK_HEADER_SIZE <= fileSize && m_in.seekg(offset) &&
+               m_in.read(h, BLOCK_HEADER_SIZE))
+        {
+            uint64_t size = GetLe(h + 5, 4);
+            if (offset + BLOCK_HEADER_SIZE + size > fileSize)
+            {
+                break;
+            }
+            m_blocks.push_back({m_rawSize, offset});
+            m_rawSize += GetLe(h + 1, 4);
+            offset += BLOCK_HEADER_SIZE + size;
+        }
+        m_in.clear();
+        return true;
+    }
+
+    /// Size of the original text.
+    uint64_t GetRawSize() const
+    {
+        return m_rawSize;
+    }
+
+    const std::vector<Block>& GetBlocks() const
+    {
+        return m_blocks;
+    }
+
+    /// Block holding a raw offset (offsets past the end map to the last block).
+    size_t BlockAt(uint64_t rawOffset) const
+    {
+        auto it = std::upper_bound(m_blocks.begin(),
+                                   m_blocks.end(),
+                                   rawOffset,
+                                   [](uint64_t o, const Block& b) { return o < b.rawOffset; });
+        return it == m_blocks.begin() ? 0 : (it - m_blocks.begin()) - 1;
+    }
+
+    /// Raw byte range [begin, end) of a block.
+    std::pair<uint64_t, uint64_t> RawRange(size_t block) const
+    {
+        uint64_t end = block + 1 < m_blocks.size() ? m_blocks[block + 1].rawOffset : m_rawSize;
+        return std::make_pair(m_blocks[block].rawOffset, end);
+    }
+
+    /// Decompress a block into dst, which holds the block's raw size.
+    bool ReadBlock(size_t block, char* dst)
+    {
+        char h[BLOCK_HEADER_SIZE];
+        m_in.clear();
+        if (!m_in.seekg(m_blocks[block].fileOffset) || !m_in.read(h, BLOCK_HEADER_SIZE))
+        {
+            return false;
+        }
+        auto range = RawRange(block);
+        uint64_t rawSize = GetLe(h + 1, 4);
+        if (rawSize != range.second - range.first)
+        {
+            return false;
+        }
+        m_payload.resize(GetLe(h + 5, 4));
+        return m_in.read(&m_payload[0], m_payload.size()) &&
+               DecompressBlock(static_cast<uint8_t>(h[0]),
+                               m_payload.data(),
+                               m_payload.size(),
+                               dst,
+                               rawSize);
+    }
+
+    bool ReadBlock(size_t block, std::string& out)
+    {
+        auto range = RawRange(block);
+        out.resize(range.second - range.first);
+        return ReadBlock(block, &out[0]);
+    }
+
+  private:
+    std::ifstream m_in;
+    std::vector<Block> m_blocks;
+    uint64_t m_rawSize{0};
+    std::string m_payload;
+};
+
+/// Line input from a plain or a .kpz file.
+class LineInput
+{
+  public:
+    bool Open(const std::string& path)
+    {
+        m_compressed = IsBlockFile(path);
+        if (m_compressed)
+        {
+            m_next = 0;
+            m_buffer.clear();
+            m_pos = 0;
+            return m_blocks.Open(path);
+        }
+        m_in.open(path, std::ifstream::binary);
+        return m_in.is_open();
+    }
+
+    /// Next line without its '\n', like std::getline.
+    bool GetLine(std::string& line)
+    {
+        if (!m_compressed)
+        {
+            return static_cast<bool>(std::getline(m_in, line));
+        }
+        line.clear();
+        bool any = false;
+        while (true)
+        {
+            if (m_pos == m_buffer.size())
+            {
+                if (m_next >= m_blocks.GetBlocks().size() || !m_blocks.ReadBlock(m_next++, m_buffer))
+                {
+                    return any;
+                }
+                m_pos = 0;
+                continue;
+            }
+            any = true;
+            size_t nl = m_buffer.find('\n', m_pos);
+            if (nl != std::string::npos)
+            {
+                line.append(m_buffer, m_pos, nl - m_pos);
+                m_pos = nl + 1;
+                return true;
+            }
+            line.append(m_buffer, m_pos, std::string::npos);
+            m_pos = m_buffer.size();
+        }
+    }
+
+    /// Size of the (uncompressed) text, -1 if unknown.
+    int64_t GetRawSize() const
+    {
+        return m_compressed ? static_cast<int64_t>(m_blocks.GetRawSize()) : -1;
+    }
+
+  private:
+    bool m_compressed{false};
+    std::ifstream m_in;
+    BlockFileReader m_blocks;
+    size_t m_next{0};
+    std::string m_buffer;
+    size_t m_pos{0};
+};
+
+/**
+ * Compress a file to CompressedTracePath(path) and remove the original. Returns
+ * false (and leaves the original) if it cannot be read or written.
+ */
+inline bool
+CompressFile(const std::string& path,
+             size_t blockSize,
+             uint64_t* rawBytes = nullptr,
+             uint64_t* fileBytes = nullptr)
+{
+    std::ifstream in(path, std::ifstream::binary);
+    BlockFileWriter writer(blockSize);
+    std::string target = CompressedTracePath(path);
+    if (!in.is_open() || !writer.Open(target))
+    {
+        return false;
+    }
+    std::vector<char> buf(1 << 20);
+    while (in.read(buf.data(), buf.size()) || in.gcount() > 0)
+    {
+        writer.Write(buf.data(), in.gcount());
+    }
+    if (!writer.Close() || in.bad())
+    {
+        std::remove(target.c_str());
+        return false;
+    }
+    if (rawBytes)
+    {
+        *rawBytes += writer.GetRawBytes();
+    }
+    if (fileBytes)
+    {
+        *fileBytes += writer.GetFileBytes();
+    }
+    return std::remove(path.c_str()) == 0;
+}
+
+/**
+ * Restore the original of a .kpz file (its name without ".kpz") and remove the
+ * .kpz. Returns false (and leaves the .kpz) on error.
+ */
+inline bool
+DecompressFile(const std::string& kpzPath)
+{
+    const std::string suffix = CompressedTracePath("");
+    if (kpzPath.size() <= suffix.size() ||
+        kpzPath.compare(kpzPath.size() - suffix.size(), suffix.size(), suffix) != 0)
+    {
+        return false;
+    }
+    std::string target = kpzPath.substr(0, kpzPath.size() - suffix.size());
+    BlockFileReader reader;
+    std::ofstream out(target, std::ofstream::binary | std::ofstream::trunc);
+    if (!reader.Open(kpzPath) || !out.is_open())
+    {
+        return false;
+    }
+    std::string block;
+    for (size_t b = 0; b < reader.GetBlocks().size(); ++b)
+    {
+        if (!reader.ReadBlock(b, block) || !out.write(block.data(), block.size()))
+        {
+            out.close();
+            std::remove(target.c_str());
+            return false;
+        }
+    }
+    out.close();
+    return out.good() && std::remove(kpzPath.c_str()) == 0;
+}
+
+} // namespace kpm
+
+#endif // KPM_BLOCK_CODEC_H
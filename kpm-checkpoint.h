@@ -0,0 +1,229 @@
+/**
+ * \file kpm-checkpoint.h
+ * \brief Checkpoint manifests and deterministic fast-forward resume of a run.
+ *
+ * ns-3 cannot save its state (event queue, objects, RNG substreams) to a file.
+ * A run is a pure function of its configuration, though (kpm-run-cache.h), so
+ * the state at time T is recreated by simulating up to T again. A resumed run
+ * replays up to the checkpoint with its traces connected from the start, as
+ * the interrupted run had them, but the per-packet NR traces of NrTraceSinks
+ * (kpm-nr-traces.h), which cost most of the run time, drop their records up
+ * to the checkpoint. It then continues as the
+ * interrupted run would have.
+ *
+ * At every checkpoint the run replaces its manifest:
+ *
+ * \code{.unparsed}
+KPMCHECKPOINT 1
+config	<RunKey hash>
+time	<simulated s>
+wallTime	<s of Simulator::Run so far>
+events	<events so far>
+fingerprint	<name>	<value>      counters any divergence of the run changes
+trace	<file name>               time-ordered traces the run has written
+ * \endcode
+ *
+ * A resumed run checks the configuration hash before it starts and the
+ * fingerprint when it reaches the checkpoint. A mismatch aborts, because the
+ * replay would not recreate the interrupted run.
+ *
+ * The traces are spliced with SpliceTrace(). Records before the checkpoint come
+ * from the interrupted run; anything it wrote later is cut, including a partly
+ * written last line. Records from the checkpoint on come from the resumed run;
+ * the ones it wrote during the replay are cut.
+ * The header has no ns-3 dependency.
+ */
+
+#ifndef KPM_CHECKPOINT_H
+#define KPM_CHECKPOINT_H
+
+#include "kpm-trace-index.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace kpm
+{
+
+/// File name suffix of the interrupted run's part of a trace, while a resumed run writes its own.
+const char* const CHECKPOINT_PREFIX_SUFFIX = ".prefix";
+
+/// State of a run at a checkpoint.
+struct CheckpointManifest
+{
+    std::string config;
+    double time{0.0};
+    double wallTime{0.0};
+    uint64_t events{0};
+    std::vector<std::pair<std::string, uint64_t>> fingerprint;
+    std::vector<std::string> traces;
+
+    /// Write to path through a temporary file, so a crash leaves the previous manifest.
+    bool Write(const std::string& path) const
+    {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ofstream::trunc);
+            out.precision(17);
+            out << "KPMCHECKPOINT 1\n";
+            out << "config\t" << config << "\n";
+            out << "time\t" << time << "\n";
+            out << "wallTime\t" << wallTime << "\n";
+            out << "events\t" << events << "\n";
+            for (const auto& f : fingerprint)
+            {
+                out << "fingerprint\t" << f.first << "\t" << f.second << "\n";
+            }
+            for (const auto& t : traces)
+            {
+                out << "trace\t" << t << "\n";
+            }
+            if (!out.flush())
+            {
+                return false;
+            }
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, path, ec);
+        return !ec;
+    }
+
+    bool Read(const std::string& path)
+    {
+        std::ifstream in(path);
+        std::string line;
+        if (!std::getline(in, line) || line != "KPMCHECKPOINT 1")
+        {
+            return false;
+        }
+        *this = CheckpointManifest();
+        while (std::getline(in, line))
+        {
+            std::istringstream fields(line);
+            std::string key;
+            std::getline(fields, key, '\t');
+            if (key == "config")
+            {
+                fields >> config;
+            }
+            else if (key == "time")
+            {
+                fields >> time;
+            }
+            else if (key == "wallTime")
+            {
+                fields >> wallTime;
+            }
+            else if (key == "events")
+            {
+                fields >> events;
+            }
+            else if (key == "fingerprint")
+            {
+                std::string name;
+                uint64_t value = 0;
+                std::getline(fields, name, '\t');
+                fields >> value;
+                fingerprint.emplace_back(name, value);
+            }
+            else if (key == "trace")
+            {
+                std::string name;
+                std::getline(fields, name);
+                traces.push_back(name);
+            }
+        }
+        return !config.empty();
+    }
+};
+
+/// File names of the time-ordered "*.txt" traces in dir last written at or after notBefore.
+inline std::vector<std::string>
+ListRunTraces(const std::string& dir, std::filesystem::file_time_type notBefore)
+{
+    std::vector<std::string> traces;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec))
+    {
+        if (!entry.is_regular_file() || entry.path().extension() != ".txt" ||
+            entry.last_write_time() < notBefore)
+        {
+            continue;
+        }
+        std::ifstream in(entry.path());
+        std::string header;
+        if (std::getline(in, header) && IsTimeOrderedTrace(entry.path().string(), header))
+        {
+            traces.push_back(entry.path().filename().string());
+        }
+    }
+    std::sort(traces.begin(), traces.end());
+    return traces;
+}
+
+/**
+ * Replace path by the records of prefixPath before time followed by those of path
+ * (as written by the resumed run) from time on, and remove prefixPath. Lines that
+ * do not start with a time, such as a closing summary, are kept from path.
+ * Returns false on I/O errors.
+ */
+inline bool
+SpliceTrace(const std::string& prefixPath, const std::string& path, double time)
+{
+    std::string tmp = path + ".splice";
+    std::ofstream out(tmp, std::ofstream::binary | std::ofstream::trunc);
+    std::string line;
+    std::vector<std::string_view> fields;
+    double t = 0.0;
+
+    std::ifstream prefix(prefixPath, std::ifstream::binary);
+    bool header = true;
+    while (std::getline(prefix, line) && !prefix.eof())
+    {
+        // A line cut by the crash has no '\n' and ends the loop through eof()
+        SplitTraceFields(line, fields, 2);
+        if (!header && ParseTraceNumber(fields[0], t) && t >= time)
+        {
+            break;
+        }
+        out << line << "\n";
+        header = false;
+    }
+
+    std::ifstream resumed(path, std::ifstream::binary);
+    header = true;
+    while (std::getline(resumed, line))
+    {
+        SplitTraceFields(line, fields, 2);
+        bool skip = header || (ParseTraceNumber(fields[0], t) && t < time);
+        if (!skip)
+        {
+            out << line << "\n";
+        }
+        header = false;
+    }
+    if (!out.flush())
+    {
+        return false;
+    }
+    out.close();
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec)
+    {
+        return false;
+    }
+    std::filesystem::remove(prefixPath, ec);
+    return true;
+}
+
+} // namespace kpm
+
+#endif // KPM_CHECKPOINT_H
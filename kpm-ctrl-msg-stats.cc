@@ -0,0 +1,375 @@
+/**
+ * \file kpm-ctrl-msg-stats.cc
+ * \brief Control-plane signalling latency, attach timing and load from the control-message traces.
+ *
+ * Joins the five control-message traces of one run by time:
+ *
+ * - UE PHY Txed -> gNB PHY Rxed (RACH_PREAMBLE, DL_CQI, DL_HARQ, SRS, BSR, SR):
+ *   paired first-in first-out per (cell, BWP, message type). The RNTI is not
+ *   usable here: the UE PHY logs 0 for CQI/HARQ feedback and the gNB PHY logs 0
+ *   for SRS, but all UEs of a cell transmit in the same slot, so the order is
+ *   enough;
+ * - gNB PHY Txed -> UE PHY Rxed (MIB, SIB1, RAR, DL_DCI, UL_DCI): paired with the
+ *   latest transmission of the same (cell, RNTI, BWP, type) at or before the
+ *   reception, falling back to RNTI 0 for broadcast messages (MIB, SIB1, RAR)
+ *   and for the DCIs, which the gNB PHY logs without RNTI. The gNB PHY names
+ *   the UL DCI "UL_UCI";
+ * - gNB PHY Rxed -> gNB MAC Rxed: PHY to MAC hand-over, paired like the above.
+ *
+ * The "nodeId" column of these traces holds the cell id. The report contains:
+ *
+ * - per message type and link: count, paired count, mean/min/max/p95 latency;
+ * - per (cell, RNTI): RACH preamble, RAR reception, first UE-specific uplink
+ *   control message and first DCI, i.e. the RACH and attach completion times.
+ *   The UE PHY logs preambles without RNTI, so a UE's first RAR is paired with
+ *   the oldest unanswered preamble of its cell (first-in first-out);
+ * - per cell: signalling messages per second over time in --bin sized bins, and
+ *   the share of each message type.
+ *
+ * \code{.unparsed}
+$ g++ -O2 -std=c++17 -o kpm-ctrl-msg-stats kpm-ctrl-msg-stats.cc
+$ ./kpm-ctrl-msg-stats sim-params/sim-1 --bin=0.01
+ * \endcode
+ */
+
+#include "kpm-trace-format.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <limits>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace kpm;
+
+namespace
+{
+
+/// The traces joined, in tie-break order for records with the same time.
+enum Stream
+{
+    UE_PHY_TX,
+    GNB_PHY_TX,
+    GNB_PHY_RX,
+    GNB_MAC_RX,
+    UE_PHY_RX,
+    NUM_STREAMS
+};
+
+const char* STREAM_FILES[NUM_STREAMS] = {"TxedUePhyCtrlMsgsTrace.txt",
+                                         "TxedGnbPhyCtrlMsgsTrace.txt",
+                                         "RxedGnbPhyCtrlMsgsTrace.txt",
+                                         "RxedGnbMacCtrlMsgsTrace.txt",
+                                         "RxedUePhyCtrlMsgsTrace.txt"};
+
+/// (cell, rnti, bwp, message type)
+typedef std::tuple<uint32_t, uint32_t, uint32_t, std::string> MsgKey;
+
+/// Latency samples of one message type on one link.
+struct Latency
+{
+    uint64_t count = 0;
+    uint64_t paired = 0;
+    double sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = 0;
+    std::vector<double> samples;
+
+    void Add(double v)
+    {
+        ++paired;
+        sum += v;
+        min = std::min(min, v);
+        max = std::max(max, v);
+        samples.push_back(v);
+    }
+};
+
+/// Attach milestones of one (cell, RNTI); NaN when not observed.
+struct Attach
+{
+    double preamble = std::numeric_limits<double>::quiet_NaN();
+    double rar = std::numeric_limits<double>::quiet_NaN();
+    double firstUlCtrl = std::numeric_limits<double>::quiet_NaN();
+    double firstDci = std::numeric_limits<double>::quiet_NaN();
+};
+
+double
+Percentile(std::vector<double>& v, double p)
+{
+    if (v.empty())
+    {
+        return 0.0;
+    }
+    size_t k = static_cast<size_t>(p * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+/// Latest time at or before t for key, falling back to the broadcast (RNTI 0) key.
+const double*
+LatestBefore(const std::map<MsgKey, double>& last, MsgKey key, double t)
+{
+    auto it = last.find(key);
+    if (it != last.end() && it->second <= t)
+    {
+        return &it->second;
+    }
+    std::get<1>(key) = 0;
+    it = last.find(key);
+    if (it != last.end() && it->second <= t)
+    {
+        return &it->second;
+    }
+    return nullptr;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    std::string dir;
+    double bin = 0.01;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 6, "--bin=") == 0)
+        {
+            bin = std::stod(arg.substr(6));
+        }
+        else if (arg.compare(0, 2, "--") != 0 && dir.empty())
+        {
+            dir = arg;
+        }
+        else
+        {
+            dir.clear();
+            break;
+        }
+    }
+    if (dir.empty() || bin <= 0)
+    {
+        std::fprintf(stderr, "Usage: %s <trace dir> [--bin=seconds]\n", argv[0]);
+        return 1;
+    }
+
+    TraceReader readers[NUM_STREAMS];
+    bool live[NUM_STREAMS];
+    int cellCol[NUM_STREAMS];
+    int rntiCol[NUM_STREAMS];
+    int bwpCol[NUM_STREAMS];
+    int typeCol[NUM_STREAMS];
+    for (int s = 0; s < NUM_STREAMS; ++s)
+    {
+        std::string path = dir + "/" + STREAM_FILES[s];
+        if (!readers[s].Open(path))
+        {
+            std::fprintf(stderr, "Can't open %s\n", path.c_str());
+            return 1;
+        }
+        cellCol[s] = readers[s].Column("nodeid");
+        rntiCol[s] = readers[s].Column("rnti");
+        bwpCol[s] = readers[s].Column("bwpid");
+        typeCol[s] = readers[s].Column("msgtype");
+        live[s] = readers[s].Next();
+    }
+
+    std::map<MsgKey, std::deque<double>> ulPending; // UE PHY Tx waiting for gNB PHY Rx
+    std::map<MsgKey, double> dlLastTx;              // last gNB PHY Tx
+    std::map<MsgKey, double> gnbLastPhyRx;          // last gNB PHY Rx
+    std::map<std::pair<std::string, std::string>, Latency> latency;
+    std::map<std::pair<uint32_t, uint32_t>, Attach> attach;
+    std::map<uint32_t, std::deque<double>> cellPreambles; // preambles not answered by a RAR yet
+    // cell -> bin -> message type -> count (messages sent by either side)
+    std::map<uint32_t, std::map<uint64_t, std::map<std::string, uint64_t>>> load;
+    double lastTime = 0.0;
+
+    while (true)
+    {
+        int s = -1;
+        double t = 0.0;
+        for (int i = 0; i < NUM_STREAMS; ++i)
+        {
+            if (live[i] && (s < 0 || readers[i].Number(0) < t))
+            {
+                s = i;
+                t = readers[i].Number(0);
+            }
+        }
+        if (s < 0)
+        {
+            break;
+        }
+        lastTime = t;
+        const TraceReader& r = readers[s];
+        uint32_t cell = r.Uint(cellCol[s]);
+        uint32_t rnti = r.Uint(rntiCol[s]);
+        std::string type(r.Text(typeCol[s]));
+        MsgKey key(cell, rnti, r.Uint(bwpCol[s]), type);
+
+        switch (s)
+        {
+        case UE_PHY_TX: {
+            ulPending[MsgKey(cell, 0, std::get<2>(key), type)].push_back(t);
+            load[cell][static_cast<uint64_t>(t / bin)][type]++;
+            if (type == "RACH_PREAMBLE")
+            {
+                cellPreambles[cell].push_back(t);
+            }
+            if (rnti != 0)
+            {
+                Attach& a = attach[std::make_pair(cell, rnti)];
+                if (std::isnan(a.firstUlCtrl))
+                {
+                    a.firstUlCtrl = t;
+                }
+            }
+            break;
+        }
+        case GNB_PHY_TX:
+            dlLastTx[key] = t;
+            load[cell][static_cast<uint64_t>(t / bin)][type]++;
+            break;
+        case GNB_PHY_RX: {
+            Latency& l = latency[std::make_pair(std::string("UE PHY -> gNB PHY"), type)];
+            ++l.count;
+            std::deque<double>& q = ulPending[MsgKey(cell, 0, std::get<2>(key), type)];
+            if (!q.empty() && q.front() <= t)
+            {
+                l.Add(t - q.front());
+                q.pop_front();
+            }
+            gnbLastPhyRx[key] = t;
+            break;
+        }
+        case GNB_MAC_RX: {
+            Latency& l = latency[std::make_pair(std::string("gNB PHY -> gNB MAC"), type)];
+            ++l.count;
+            if (const double* tx = LatestBefore(gnbLastPhyRx, key, t))
+            {
+                l.Add(t - *tx);
+            }
+            break;
+        }
+        case UE_PHY_RX: {
+            Latency& l = latency[std::make_pair(std::string("gNB PHY -> UE PHY"), type)];
+            ++l.count;
+            if (type == "UL_DCI")
+            {
+                std::get<3>(key) = "UL_UCI";
+            }
+            if (const double* tx = LatestBefore(dlLastTx, key, t))
+            {
+                l.Add(t - *tx);
+            }
+            if (rnti != 0)
+            {
+                Attach& a = attach[std::make_pair(cell, rnti)];
+                if (type == "RAR" && std::isnan(a.rar))
+                {
+                    a.rar = t;
+                    std::deque<double>& preambles = cellPreambles[cell];
+                    if (!preambles.empty() && preambles.front() <= t)
+                    {
+                        a.preamble = preambles.front();
+                        preambles.pop_front();
+                    }
+                }
+                if ((type == "DL_DCI" || type == "UL_DCI") && std::isnan(a.firstDci))
+                {
+                    a.firstDci = t;
+                }
+            }
+            break;
+        }
+        }
+        live[s] = readers[s].Next();
+    }
+
+    std::printf("Control message latency\n");
+    std::printf("  link\tmsgType\tcount\tpaired\tmean(us)\tmin(us)\tp95(us)\tmax(us)\n");
+    for (auto& e : latency)
+    {
+        Latency& l = e.second;
+        std::printf("  %s\t%s\t%llu\t%llu\t%.3f\t%.3f\t%.3f\t%.3f\n",
+                    e.first.first.c_str(),
+                    e.first.second.c_str(),
+                    static_cast<unsigned long long>(l.count),
+                    static_cast<unsigned long long>(l.paired),
+                    l.paired > 0 ? 1e6 * l.sum / l.paired : 0.0,
+                    l.paired > 0 ? 1e6 * l.min : 0.0,
+                    1e6 * Percentile(l.samples, 0.95),
+                    1e6 * l.max);
+    }
+
+    std::printf("\nRACH and attach per UE (times in ms)\n");
+    std::printf("  cellId\trnti\tpreambleTx\trarRx\tfirstUlCtrl\tfirstDci\trachDone(ms)\tattachDone(ms)\n");
+    for (const auto& e : attach)
+    {
+        const Attach& a = e.second;
+        std::printf("  %u\t%u\t%.4f\t%.4f\t%.4f\t%.4f\t%.4f\t%.4f\n",
+                    e.first.first,
+                    e.first.second,
+                    1e3 * a.preamble,
+                    1e3 * a.rar,
+                    1e3 * a.firstUlCtrl,
+                    1e3 * a.firstDci,
+                    1e3 * (a.rar - a.preamble),
+                    1e3 * (std::max(a.firstUlCtrl, a.firstDci) - a.preamble));
+    }
+
+    std::printf("\nSignalling load per cell (messages sent by UEs and gNB)\n");
+    std::printf("  cellId\tmsgType\tcount\tshare\trate(msg/s)\n");
+    double duration = std::max(lastTime, bin);
+    for (const auto& c : load)
+    {
+        std::map<std::string, uint64_t> perType;
+        uint64_t total = 0;
+        for (const auto& b : c.second)
+        {
+            for (const auto& m : b.second)
+            {
+                perType[m.first] += m.second;
+                total += m.second;
+            }
+        }
+        for (const auto& m : perType)
+        {
+            std::printf("  %u\t%s\t%llu\t%.4f\t%.1f\n",
+                        c.first,
+                        m.first.c_str(),
+                        static_cast<unsigned long long>(m.second),
+                        double(m.second) / total,
+                        m.second / duration);
+        }
+        std::printf("  %u\tall\t%llu\t1.0000\t%.1f\n",
+                    c.first,
+                    static_cast<unsigned long long>(total),
+                    total / duration);
+    }
+
+    std::printf("\nSignalling rate per cell over time (bin %g s)\n", bin);
+    std::printf("  binStart(s)\tcellId\tmessages\trate(msg/s)\n");
+    for (const auto& c : load)
+    {
+        for (const auto& b : c.second)
+        {
+            uint64_t n = 0;
+            for (const auto& m : b.second)
+            {
+                n += m.second;
+            }
+            std::printf("  %.4f\t%u\t%llu\t%.1f\n",
+                        b.first * bin,
+                        c.first,
+                        static_cast<unsigned long long>(n),
+                        n / bin);
+        }
+    }
+    return 0;
+}
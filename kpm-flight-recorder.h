@@ -0,0 +1,377 @@
+/**
+ * \file kpm-flight-recorder.h
+ * \brief In-memory ring buffers of detailed records, dumped to disk only around anomalies.
+ *
+ * Writing every transport block and scheduling decision of a long run costs disk
+ * and time, yet a voice delay spike is only explained by the PHY/MAC detail
+ * around it. The FlightRecorder keeps, per stream (record type), the records of
+ * the last pre seconds in a ring buffer and writes nothing. When a trigger fires
+ * it opens a capture: every stream's buffered window goes to
+ *
+ * \code{.unparsed}
+<prefix>-<capture>-<stream>.txt
+ * \endcode
+ *
+ * followed by the records of the next post seconds. A trigger during a capture
+ * extends it, so one spike gives one capture. The records are formatted like
+ * the NR traces (tab separated, time first, one header line), so the capture
+ * files work with kpm-trace-query and the sidecar indexes. <prefix>-events.txt
+ * lists the captures with the trigger that opened them.
+ *
+ * The triggers are evaluated by the trace sinks that feed the recorder; the
+ * spec parsed by ParseFlightRecorderSpec() carries their thresholds. The
+ * header has no ns-3 dependency.
+ */
+
+#ifndef KPM_FLIGHT_RECORDER_H
+#define KPM_FLIGHT_RECORDER_H
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace kpm
+{
+
+/// Windows and trigger thresholds of a flight recorder.
+struct FlightRecorderConfig
+{
+    double pre{0.005};          ///< seconds of records kept before a trigger
+    double post{0.005};         ///< seconds recorded after the (last) trigger
+    double delay{0.05};         ///< application packet delay in s that triggers, 0 disables
+    uint32_t corruptBurst{3};   ///< consecutive corrupt TBs of a UE that trigger, 0 disables
+    uint64_t backlog{100000};   ///< bytes sent but not yet received by a flow that trigger, 0 disables
+    uint32_t maxCaptures{20};   ///< captures written at most, later triggers are only counted
+    size_t maxRecords{1 << 16}; ///< records per stream ring at most
+};
+
+/**
+ * Parse "key=value[,key=value...]" with keys pre, post, delay (ms), corrupt
+ * (TBs), backlog (bytes), captures and records; unspecified keys keep their
+ * default, and "on" alone takes all defaults. Returns false on an unknown key
+ * or malformed value.
+ */
+inline bool
+ParseFlightRecorderSpec(const std::string& spec, FlightRecorderConfig& config)
+{
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        if (item == "on")
+        {
+            continue;
+        }
+        size_t eq = item.find('=');
+        if (eq == std::string::npos)
+        {
+            return false;
+        }
+        std::string key = item.substr(0, eq);
+        const char* value = item.c_str() + eq + 1;
+        char* end = nullptr;
+        double v = std::strtod(value, &end);
+        if (end == value || *end != '\0' || v < 0)
+        {
+            return false;
+        }
+        if (key == "pre")
+        {
+            config.pre = v / 1000;
+        }
+        else if (key == "post")
+        {
+            config.post = v / 1000;
+        }
+        else if (key == "delay")
+        {
+            config.delay = v / 1000;
+        }
+        else if (key == "corrupt")
+        {
+            config.corruptBurst = static_cast<uint32_t>(v);
+        }
+        else if (key == "backlog")
+        {
+            config.backlog = static_cast<uint64_t>(v);
+        }
+        else if (key == "captures")
+        {
+            config.maxCaptures = static_cast<uint32_t>(v);
+        }
+        else if (key == "records")
+        {
+            config.maxRecords = std::max<size_t>(static_cast<size_t>(v), 1);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Consecutive hits per key, e.g. corrupt TBs per UE.
+class BurstCounter
+{
+  public:
+    /// Account one event; true when the run of hits of key reaches n.
+    bool Add(uint64_t key, bool hit, uint32_t n)
+    {
+        uint32_t& run = m_runs[key];
+        run = hit ? run + 1 : 0;
+        return n > 0 && run == n;
+    }
+
+  private:
+    std::map<uint64_t, uint32_t> m_runs;
+};
+
+/// Ring buffers of records and the captures written around triggers.
+class FlightRecorder
+{
+  public:
+    explicit FlightRecorder(const FlightRecorderConfig& config)
+        : m_config(config)
+    {
+    }
+
+    ~FlightRecorder()
+    {
+        Close();
+    }
+
+    const FlightRecorderConfig& GetConfig() const
+    {
+        return m_config;
+    }
+
+    /// Start recording; files are named after prefix. False if the event log cannot be written.
+    bool Open(const std::string& prefix)
+    {
+        m_prefix = prefix;
+        m_events.open(prefix + "-events.txt", std::ofstream::out | std::ofstream::trunc);
+        m_events << "Time\tcapture\ttrigger\tdetail\n";
+        return m_events.is_open();
+    }
+
+    bool IsOpen() const
+    {
+        return m_events.is_open();
+    }
+
+    /// Register a stream with the header line of its files; returns its id.
+    int AddStream(const std::string& name, const std::string& header)
+    {
+        m_streams.emplace_back();
+        m_streams.back().name = name;
+        m_streams.back().header = header;
+        return static_cast<int>(m_streams.size() - 1);
+    }
+
+    /// Add a record at time (seconds); the text is printf-formatted, without newline.
+    __attribute__((format(printf, 4, 5))) void Record(int stream, double time, const char* format, ...)
+    {
+        if (!m_events.is_open())
+        {
+            return;
+        }
+        if (m_capturing && time > m_captureEnd)
+        {
+            EndCapture();
+        }
+        Stream& s = m_streams[stream];
+        Entry& e = s.Push(time, m_config);
+        va_list args;
+        va_start(args, format);
+        int n = std::vsnprintf(m_line, sizeof(m_line), format, args);
+        va_end(args);
+        e.line.assign(m_line, std::min<size_t>(std::max(n, 0), sizeof(m_line) - 1));
+        ++m_records;
+        if (m_capturing)
+        {
+            *s.out << e.line << "\n";
+            ++m_dumped;
+        }
+    }
+
+    /// Fire a trigger at time: open a capture, or extend the current one.
+    void Trigger(double time, const std::string& trigger, const std::string& detail)
+    {
+        if (!m_events.is_open())
+        {
+            return;
+        }
+        ++m_triggers[trigger];
+        if (m_capturing && time > m_captureEnd)
+        {
+            EndCapture();
+        }
+        if (m_capturing)
+        {
+            m_captureEnd = std::max(m_captureEnd, time + m_config.post);
+            return;
+        }
+        if (m_captures >= m_config.maxCaptures)
+        {
+            ++m_suppressed;
+            return;
+        }
+        m_events << time << "\t" << m_captures << "\t" << trigger << "\t" << detail << "\n";
+        m_capturing = true;
+        m_captureEnd = time + m_config.post;
+        for (auto& s : m_streams)
+        {
+            s.out.reset(new std::ofstream(m_prefix + "-" + std::to_string(m_captures) + "-" +
+                                              s.name + ".txt",
+                                          std::ofstream::out | std::ofstream::trunc));
+            *s.out << s.header << "\n";
+            // The buffered window, without what an earlier capture already wrote
+            for (size_t i = 0; i < s.size; ++i)
+            {
+                const Entry& e = s.At(i);
+                if (e.time >= time - m_config.pre && e.time > m_lastCaptureEnd)
+                {
+                    *s.out << e.line << "\n";
+                    ++m_dumped;
+                }
+            }
+        }
+    }
+
+    /// End a capture in progress and close the event log.
+    void Close()
+    {
+        if (m_capturing)
+        {
+            EndCapture();
+        }
+        if (m_events.is_open())
+        {
+            m_events.close();
+        }
+    }
+
+    /// Summary for the run report.
+    void Write(std::ostream& os) const
+    {
+        uint64_t triggers = 0;
+        uint64_t dropped = 0;
+        for (const auto& t : m_triggers)
+        {
+            triggers += t.second;
+        }
+        for (const auto& s : m_streams)
+        {
+            dropped += s.dropped;
+        }
+        os << "\n\nFlight recorder (pre " << 1000 * m_config.pre << " ms, post "
+           << 1000 * m_config.post << " ms)\n";
+        os << "  Records buffered: " << m_records << "\n";
+        os << "  Triggers: " << triggers;
+        for (const auto& t : m_triggers)
+        {
+            os << ", " << t.first << " " << t.second;
+        }
+        os << "\n";
+        os << "  Captures: " << m_captures << " (" << m_suppressed << " triggers over the limit)\n";
+        os << "  Records written: " << m_dumped << "\n";
+        os << "  Records dropped from full rings: " << dropped << "\n";
+    }
+
+  private:
+    struct Entry
+    {
+        double time{0.0};
+        std::string line;
+    };
+
+    /// Ring of the records of the last pre seconds, storage reused.
+    struct Stream
+    {
+        std::string name;
+        std::string header;
+        std::vector<Entry> ring;
+        size_t head{0}; ///< oldest entry
+        size_t size{0};
+        uint64_t dropped{0};
+        std::unique_ptr<std::ofstream> out;
+
+        Entry& At(size_t i)
+        {
+            return ring[(head + i) % ring.size()];
+        }
+
+        const Entry& At(size_t i) const
+        {
+            return ring[(head + i) % ring.size()];
+        }
+
+        /// Slot for a new record at time, after expiring the old ones.
+        Entry& Push(double time, const FlightRecorderConfig& config)
+        {
+            while (size > 0 && At(0).time < time - config.pre)
+            {
+                head = (head + 1) % ring.size();
+                --size;
+            }
+            if (size == ring.size())
+            {
+                if (ring.size() < config.maxRecords)
+                {
+                    // Grow, keeping the order: unroll the ring to the front
+                    std::rotate(ring.begin(), ring.begin() + head, ring.end());
+                    head = 0;
+                    ring.resize(std::min(config.maxRecords, std::max<size_t>(2 * ring.size(), 64)));
+                }
+                else
+                {
+                    head = (head + 1) % ring.size();
+                    --size;
+                    ++dropped;
+                }
+            }
+            Entry& e = At(size++);
+            e.time = time;
+            return e;
+        }
+    };
+
+    void EndCapture()
+    {
+        for (auto& s : m_streams)
+        {
+            s.out.reset();
+        }
+        m_capturing = false;
+        m_lastCaptureEnd = m_captureEnd;
+        ++m_captures;
+    }
+
+    FlightRecorderConfig m_config;
+    std::string m_prefix;
+    std::ofstream m_events;
+    std::vector<Stream> m_streams;
+    char m_line[1024];
+    bool m_capturing{false};
+    double m_captureEnd{0.0};
+    double m_lastCaptureEnd{-1.0};
+    uint32_t m_captures{0};
+    uint64_t m_suppressed{0};
+    uint64_t m_records{0};
+    uint64_t m_dumped{0};
+    std::map<std::string, uint64_t> m_triggers;
+};
+
+} // namespace kpm
+
+#endif // KPM_FLIGHT_RECORDER_H
@@ -0,0 +1,276 @@
+/**
+ * \file kpm-flow-classes.h
+ * \brief Per-traffic-class aggregates, voice GBR compliance and fairness of the flows of a run.
+ *
+ * The report's "Mean flow throughput" averages every FlowMonitor flow, so the
+ * voice flows, the browsing flows and the GTP-C signalling between the EPC nodes
+ * (13.0.0.x/14.0.0.x port 2123) are blended into one number. Flows are classified
+ * by their ports instead:
+ *
+ * - voice: the voice call port (1235, GBR_CONV_VOICE bearer);
+ * - browsing: the web browsing port (1234, NGBR_LOW_LAT_EMBB bearer);
+ * - voice-ul, browsing-ul: the uplink of the same bearers, to the per-UE ports
+ *   of the remote host given by UplinkPorts;
+ * - control: GTP-C (2123) and GTP-U (2152) flows inside the core network;
+ * - other: anything else.
+ *
+ * Per class the report gives flow and UE counts, packets, loss, aggregate and
+ * per-flow throughput, packet-weighted delay and jitter, and Jain's fairness index
+ * J = (sum x)^2 / (n sum x^2) over the per-UE throughput. A voice flow complies
+ * with its GBR bearer when its loss is within the packet error rate, its mean
+ * delay within the packet delay budget of 5QI 1 (1e-2, 100 ms) and, if a GBR is
+ * given, its throughput at least the GBR.
+ *
+ * A voice user is satisfied, in the sense of the 3GPP VoIP capacity (TR 36.814
+ * A.2.1.3), when at least 98% of the packets of its flow arrive within the
+ * delay budget (50 ms on the air interface by default); the voice capacity of a
+ * cell is the most users at which 95% of them are satisfied. Downlink and
+ * uplink voice users are counted apart. A voice user whose call sent nothing
+ * during the run has no flow; given the number of voice users, it counts as
+ * not satisfied. The header has no ns-3 dependency.
+ */
+
+#ifndef KPM_FLOW_CLASSES_H
+#define KPM_FLOW_CLASSES_H
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+
+namespace kpm
+{
+
+enum FlowClass
+{
+    FLOW_VOICE,
+    FLOW_BROWSING,
+    FLOW_VOICE_UL,
+    FLOW_BROWSING_UL,
+    FLOW_CONTROL,
+    FLOW_OTHER,
+    NUM_FLOW_CLASSES
+};
+
+inline const char*
+FlowClassName(FlowClass c)
+{
+    static const char* names[NUM_FLOW_CLASSES] =
+        {"voice", "browsing", "voice-ul", "browsing-ul", "control", "other"};
+    return names[c];
+}
+
+inline bool
+IsVoiceClass(FlowClass c)
+{
+    return c == FLOW_VOICE || c == FLOW_VOICE_UL;
+}
+
+/// Remote host ports of the uplink flows: the i-th UE of a class sends to port first + i.
+struct UplinkPorts
+{
+    uint16_t voice{0};
+    uint32_t voiceUes{0};
+    uint16_t browsing{0};
+    uint32_t browsingUes{0};
+};
+
+/// GTP-C and GTP-U ports of the core network.
+const uint16_t GTPC_PORT = 2123;
+const uint16_t GTPU_PORT = 2152;
+
+/// Class of a flow from its ports.
+inline FlowClass
+ClassifyFlow(uint16_t srcPort,
+             uint16_t dstPort,
+             uint16_t voicePort,
+             uint16_t browsingPort,
+             const UplinkPorts& ul = UplinkPorts())
+{
+    if (dstPort >= ul.voice && dstPort < ul.voice + ul.voiceUes)
+    {
+        return FLOW_VOICE_UL;
+    }
+    if (dstPort >= ul.browsing && dstPort < ul.browsing + ul.browsingUes)
+    {
+        return FLOW_BROWSING_UL;
+    }
+    if (dstPort == voicePort || srcPort == voicePort)
+    {
+        return FLOW_VOICE;
+    }
+    if (dstPort == browsingPort || srcPort == browsingPort)
+    {
+        return FLOW_BROWSING;
+    }
+    if (dstPort == GTPC_PORT || srcPort == GTPC_PORT || dstPort == GTPU_PORT ||
+        srcPort == GTPU_PORT)
+    {
+        return FLOW_CONTROL;
+    }
+    return FLOW_OTHER;
+}
+
+/// 5QI 1 (conversational voice) packet error rate and delay budget.
+const double VOICE_PER = 1e-2;
+const double VOICE_PDB_MS = 100.0;
+
+/// Share of a voice user's packets that must arrive within the budget, and of satisfied users.
+const double VOICE_ON_TIME_RATIO = 0.98;
+const double VOICE_SATISFIED_RATIO = 0.95;
+
+/// Aggregates of the flows of each class.
+class FlowClassReport
+{
+  public:
+    /**
+     * Account one flow. ue identifies the UE end of the flow (e.g. its address);
+     * throughput is in Mbps, delaySum and jitterSum in seconds.
+     */
+    void AddFlow(FlowClass c,
+                 const std::string& ue,
+                 uint64_t txPackets,
+                 uint64_t rxPackets,
+                 uint64_t rxBytes,
+                 double throughput,
+                 double delaySum,
+                 double jitterSum,
+                 double voiceGbrMbps)
+    {
+        Class& k = m_classes[c];
+        ++k.flows;
+        k.txPackets += txPackets;
+        k.rxPackets += rxPackets;
+        k.rxBytes += rxBytes;
+        k.throughput += throughput;
+        k.delaySum += delaySum;
+        k.jitterSum += jitterSum;
+        k.jitterSamples += rxPackets > 1 ? rxPackets - 1 : 0;
+        k.ueThroughput[ue] += throughput;
+        if (IsVoiceClass(c))
+        {
+            double loss =
+                txPackets > 0 ? double(txPackets - std::min(txPackets, rxPackets)) / txPackets
+                              : 0.0;
+            double delayMs = rxPackets > 0 ? 1000 * delaySum / rxPackets : 0.0;
+            if (rxPackets > 0 && loss <= VOICE_PER && delayMs <= VOICE_PDB_MS &&
+                throughput >= voiceGbrMbps)
+            {
+                ++k.compliant;
+            }
+        }
+    }
+
+    /// Delay budget in ms of the voice user satisfaction.
+    void SetVoiceDelayBudget(double budgetMs)
+    {
+        m_voiceBudgetMs = budgetMs;
+    }
+
+    double GetVoiceDelayBudget() const
+    {
+        return m_voiceBudgetMs;
+    }
+
+    /// Account a voice flow of class c; onTimePackets of its txPackets arrived within the budget.
+    void AddVoiceUser(FlowClass c, uint64_t txPackets, uint64_t onTimePackets)
+    {
+        Class& k = m_classes[c];
+        ++k.voiceUsers;
+        if (txPackets > 0 && onTimePackets >= VOICE_ON_TIME_RATIO * txPackets)
+        {
+            ++k.voiceSatisfied;
+        }
+    }
+
+    /// Voice users of class c in the run, including those without a flow.
+    void SetVoiceUsers(FlowClass c, uint64_t users)
+    {
+        m_classes[c].voiceExpected = users;
+    }
+
+    void Write(std::ostream& os, double voiceGbrMbps) const
+    {
+        os << "\n\nPer-class flow statistics\n";
+        for (int c = 0; c < NUM_FLOW_CLASSES; ++c)
+        {
+            const Class& k = m_classes[c];
+            if (k.flows == 0 && k.voiceExpected == 0)
+            {
+                continue;
+            }
+            double sum = 0.0;
+            double sumSq = 0.0;
+            for (const auto& u : k.ueThroughput)
+            {
+                sum += u.second;
+                sumSq += u.second * u.second;
+            }
+            double jain = sumSq > 0 ? sum * sum / (k.ueThroughput.size() * sumSq) : 1.0;
+            os << "Class " << FlowClassName(static_cast<FlowClass>(c)) << "\n";
+            os << "  Flows: " << k.flows << "\n";
+            os << "  UEs/endpoints: " << k.ueThroughput.size() << "\n";
+            os << "  Tx Packets: " << k.txPackets << "\n";
+            os << "  Rx Packets: " << k.rxPackets << "\n";
+            os << "  Rx Bytes:   " << k.rxBytes << "\n";
+            os << "  Packet loss: "
+               << (k.txPackets > 0
+                       ? 100.0 * (k.txPackets - std::min(k.txPackets, k.rxPackets)) / k.txPackets
+                       : 0.0)
+               << "%\n";
+            os << "  Aggregate throughput: " << k.throughput << " Mbps\n";
+            os << "  Mean flow throughput: " << (k.flows > 0 ? k.throughput / k.flows : 0.0)
+               << " Mbps\n";
+            os << "  Mean delay:  " << (k.rxPackets > 0 ? 1000 * k.delaySum / k.rxPackets : 0.0)
+               << " ms\n";
+            // A flow's jitter is summed from its second received packet on
+            os << "  Mean jitter:  "
+               << (k.jitterSamples > 0 ? 1000 * k.jitterSum / k.jitterSamples : 0.0) << " ms\n";
+            os << "  Jain fairness (per UE): " << jain << "\n";
+            if (IsVoiceClass(static_cast<FlowClass>(c)))
+            {
+                os << "  GBR compliant flows: " << k.compliant << " / " << k.flows
+                   << " (PER <= " << VOICE_PER << ", delay <= " << VOICE_PDB_MS << " ms";
+                if (voiceGbrMbps > 0)
+                {
+                    os << ", throughput >= " << voiceGbrMbps << " Mbps";
+                }
+                os << ")\n";
+            }
+            uint64_t silent = k.voiceExpected - std::min(k.voiceExpected, k.voiceUsers);
+            if (k.voiceUsers + silent > 0)
+            {
+                os << "  Satisfied voice users: " << k.voiceSatisfied << " / "
+                   << k.voiceUsers + silent << " (>= " << 100 * VOICE_ON_TIME_RATIO
+                   << "% of packets within " << m_voiceBudgetMs << " ms)\n";
+                os << "  Voice users without traffic: " << silent << "\n";
+            }
+        }
+    }
+
+  private:
+    struct Class
+    {
+        uint64_t flows{0};
+        uint64_t txPackets{0};
+        uint64_t rxPackets{0};
+        uint64_t rxBytes{0};
+        uint64_t compliant{0};
+        uint64_t voiceUsers{0};
+        uint64_t voiceSatisfied{0};
+        uint64_t voiceExpected{0}; ///< voice users of the run, with a flow or not
+        double throughput{0.0};
+        double delaySum{0.0};
+        double jitterSum{0.0};
+        uint64_t jitterSamples{0}; ///< rxPackets - 1 of every flow
+        std::map<std::string, double> ueThroughput;
+    };
+
+    Class m_classes[NUM_FLOW_CLASSES];
+    double m_voiceBudgetMs{50.0};
+};
+
+} // namespace kpm
+
+#endif // KPM_FLOW_CLASSES_H
@@ -0,0 +1,460 @@
+/**
+ * \file kpm-flow-probe.h
+ * \brief Per-flow statistics restricted to measurement windows.
+ *
+ * FlowMonitor accumulates a flow over the whole run, so the report divides all
+ * received bytes by simTime - udpAppStartTime and the RACH/attach transient and
+ * the initial queue build-up end up in the throughput and delay. FlowProbe hooks
+ * the "Tx" trace of every UdpClient, TrafficGenerator or VoipSource and the
+ * "Rx" trace of every UdpServer and reads the transmit time from the
+ * SeqTsHeader the client puts in front of every payload, so a packet is
+ * attributed to the window in which it was *sent*:
+ *
+ * - txPackets/txBytes: packets sent inside the window;
+ * - rxPackets/rxBytes, delay, jitter: those of them that were received, whenever
+ *   that happened;
+ * - throughput: rxBytes * 8 / window length.
+ *
+ * Windows are given as "start-end" in seconds, comma separated, with an open
+ * start or end standing for the application start and stop, e.g. "0.03-",
+ * "0.02-0.06,0.06-0.1". A flow is one (UE address, port) server; the clients
+ * sending to it are matched through their RemoteAddress/RemotePort attributes.
+ *
+ * With EnableTimeline() the probe also keeps a per-flow time series in fixed bins:
+ * bytes offered (by send time) and bytes, packets and delay delivered (by
+ * reception time). A packet costs one indexed add, the bins grow with the run,
+ * and WriteTimeline() writes the non-empty (bin, flow) pairs as a time-ordered
+ * trace that kpm-trace-query and the sidecar indexes understand. A long run
+ * calls FlushTimeline() now and then to write the finished bins and drop them.
+ *
+ * With EnableFlightRecorder() every sent and received packet also goes to the
+ * "app" stream of a FlightRecorder (kpm-flight-recorder.h), and the probe fires
+ * its delay trigger (a packet later than the threshold) and backlog trigger (a
+ * flow with more bytes sent than received than the threshold; re-armed once the
+ * backlog halves).
+ */
+
+#ifndef KPM_FLOW_PROBE_H
+#define KPM_FLOW_PROBE_H
+
+#include "ns3/applications-module.h"
+#include "ns3/core-module.h"
+#include "ns3/internet-module.h"
+
+#include "kpm-flight-recorder.h"
+#include "kpm-traffic-generator.h"
+#include "kpm-voip.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace kpm
+{
+
+/// A measurement window [start, end), in seconds of simulation time.
+struct MeasurementWindow
+{
+    double start;
+    double end;
+};
+
+/**
+ * Parse "start-end[,start-end...]"; an empty start or end is replaced by
+ * defaultStart or defaultEnd. Returns no windows for an empty spec and aborts on
+ * malformed ones.
+ */
+inline std::vector<MeasurementWindow>
+ParseMeasurementWindows(const std::string& spec, double defaultStart, double defaultEnd)
+{
+    std::vector<MeasurementWindow> windows;
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        size_t dash = item.find('-');
+        NS_ABORT_MSG_IF(dash == std::string::npos,
+                        "Measurement window \"" << item << "\" is not start-end");
+        std::string start = item.substr(0, dash);
+        std::string end = item.substr(dash + 1);
+        MeasurementWindow w;
+        w.start = start.empty() ? defaultStart : std::atof(start.c_str());
+        w.end = end.empty() ? defaultEnd : std::atof(end.c_str());
+        NS_ABORT_MSG_IF(w.end <= w.start, "Empty measurement window \"" << item << "\"");
+        windows.push_back(w);
+    }
+    return windows;
+}
+
+/// Counters of one flow in one window.
+struct WindowFlowStats
+{
+    uint64_t txPackets{0};
+    uint64_t txBytes{0};
+    uint64_t rxPackets{0};
+    uint64_t rxBytes{0};
+    double delaySum{0.0};
+    double delayMin{std::numeric_limits<double>::infinity()};
+    double delayMax{0.0};
+    double jitterSum{0.0};
+    double lastDelay{-1.0};
+};
+
+/// Counters of one flow in one timeline bin.
+struct TimelineBin
+{
+    uint64_t txBytes{0};
+    uint64_t rxBytes{0};
+    uint32_t rxPackets{0};
+    double delaySum{0.0};
+};
+
+/// Window statistics of the UDP flows of a run.
+class FlowProbe
+{
+  public:
+    explicit FlowProbe(const std::vector<MeasurementWindow>& windows)
+        : m_windows(windows)
+    {
+    }
+
+    const std::vector<MeasurementWindow>& GetWindows() const
+    {
+        return m_windows;
+    }
+
+    /// Keep a per-flow time series in bins of binWidth seconds (0 disables).
+    void EnableTimeline(double binWidth)
+    {
+        m_binWidth = binWidth;
+    }
+
+    /// Feed the packets of every flow and the delay/backlog triggers to recorder.
+    void EnableFlightRecorder(FlightRecorder* recorder)
+    {
+        m_recorder = recorder;
+        m_appStream = recorder->AddStream("app", "Time\tevent\tflow\tseq\tsize\tdelay(ms)\tbacklog");
+    }
+
+    /**
+     * Connect the UdpServer applications in servers and the UdpClient,
+     * TrafficGenerator and VoipSource applications in clients; other
+     * applications are ignored.
+     */
+    void Install(ns3::ApplicationContainer clients, ns3::ApplicationContainer servers)
+    {
+        if (m_windows.empty() && m_binWidth <= 0 && !m_recorder)
+        {
+            return;
+        }
+        for (auto it = servers.Begin(); it != servers.End(); ++it)
+        {
+            ns3::Ptr<ns3::UdpServer> server = ns3::DynamicCast<ns3::UdpServer>(*it);
+            if (!server)
+            {
+                continue;
+            }
+            ns3::UintegerValue port;
+            server->GetAttribute("Port", port);
+            ns3::Ptr<ns3::Ipv4> ipv4 = server->GetNode()->GetObject<ns3::Ipv4>();
+            uint32_t flow = FlowIndex(ipv4->GetAddress(1, 0).GetLocal(), port.Get());
+            server->TraceConnectWithoutContext(
+                "Rx",
+                ns3::MakeBoundCallback(&FlowProbe::RxTrace, this, flow));
+        }
+        for (auto it = clients.Begin(); it != clients.End(); ++it)
+        {
+            ns3::Ptr<ns3::Application> client = *it;
+            if (!ns3::DynamicCast<ns3::UdpClient>(client) &&
+                !ns3::DynamicCast<TrafficGenerator>(client) &&
+                !ns3::DynamicCast<VoipSource>(client))
+            {
+                continue;
+            }
+            ns3::AddressValue remote;
+            ns3::UintegerValue port;
+            client->GetAttribute("RemoteAddress", remote);
+            client->GetAttribute("RemotePort", port);
+            ns3::Ipv4Address address =
+                ns3::Ipv4Address::IsMatchingType(remote.Get())
+                    ? ns3::Ipv4Address::ConvertFrom(remote.Get())
+                    : ns3::InetSocketAddress::ConvertFrom(remote.Get()).GetIpv4();
+            uint32_t flow = FlowIndex(address, port.Get());
+            client->TraceConnectWithoutContext(
+                "Tx",
+                ns3::MakeBoundCallback(&FlowProbe::TxTrace, this, flow));
+        }
+    }
+
+    /// Write the per-window, per-flow report and the per-window means.
+    void Write(std::ostream& os) const
+    {
+        for (size_t w = 0; w < m_windows.size(); ++w)
+        {
+            double length = m_windows[w].end - m_windows[w].start;
+            os << "\n\nMeasurement window " << w << ": [" << m_windows[w].start << ", "
+               << m_windows[w].end << ") s, packets sent inside the window\n";
+            double throughputSum = 0.0;
+            double delaySum = 0.0;
+            for (size_t f = 0; f < m_flows.size(); ++f)
+            {
+                const WindowFlowStats& s = m_stats[f][w];
+                double throughput = s.rxBytes * 8.0 / length / 1000.0 / 1000.0;
+                double delay = s.rxPackets > 0 ? 1000 * s.delaySum / s.rxPackets : 0.0;
+                throughputSum += throughput;
+                delaySum += delay;
+                os << "Flow -> " << m_flows[f].first << ":" << m_flows[f].second << "\n";
+                os << "  Tx Packets: " << s.txPackets << "\n";
+                os << "  Tx Bytes:   " << s.txBytes << "\n";
+                os << "  TxOffered:  " << s.txBytes * 8.0 / length / 1000.0 / 1000.0 << " Mbps\n";
+                os << "  Rx Packets: " << s.rxPackets << "\n";
+                os << "  Rx Bytes:   " << s.rxBytes << "\n";
+                os << "  Lost Packets: " << s.txPackets - std::min(s.txPackets, s.rxPackets) << "\n";
+                os << "  Throughput: " << throughput << " Mbps\n";
+                os << "  Mean delay:  " << delay << " ms\n";
+                os << "  Min/max delay:  " << (s.rxPackets > 0 ? 1000 * s.delayMin : 0.0) << " / "
+                   << 1000 * s.delayMax << " ms\n";
+                os << "  Mean jitter:  "
+                   << (s.rxPackets > 1 ? 1000 * s.jitterSum / (s.rxPackets - 1) : 0.0) << " ms\n";
+            }
+            if (!m_flows.empty())
+            {
+                os << "\n  Mean flow throughput: " << throughputSum / m_flows.size() << "\n";
+                os << "  Mean flow delay: " << delaySum / m_flows.size() << "\n";
+            }
+        }
+    }
+
+    /// Write the header line of the timeline.
+    static void WriteTimelineHeader(std::ostream& os)
+    {
+        os << "Time\tflow\ttxBytes\trxBytes\trxPackets\tthroughput(Mbps)\tmeanDelay(ms)\n";
+    }
+
+    /// Write the timeline, one line per non-empty (bin, flow), in time order.
+    void WriteTimeline(std::ostream& os) const
+    {
+        WriteTimelineHeader(os);
+        WriteBins(os, std::numeric_limits<size_t>::max());
+    }
+
+    /// Write the bins that end at or before t (s) without a header and drop them.
+    void FlushTimeline(std::ostream& os, double t)
+    {
+        if (m_binWidth <= 0)
+        {
+            return;
+        }
+        size_t kept = 0;
+        for (const auto& timeline : m_timeline)
+        {
+            kept = std::max(kept, timeline.size());
+        }
+        double end = std::floor(t / m_binWidth) - m_firstBin;
+        size_t bins = end > 0 ? static_cast<size_t>(std::min(end, static_cast<double>(kept))) : 0;
+        WriteBins(os, bins);
+        for (auto& timeline : m_timeline)
+        {
+            timeline.erase(timeline.begin(),
+                           timeline.begin() + std::min(bins, timeline.size()));
+        }
+        m_firstBin += bins;
+    }
+
+  private:
+    /// Write the first bins of the kept timeline, one line per non-empty (bin, flow).
+    void WriteBins(std::ostream& os, size_t bins) const
+    {
+        size_t kept = 0;
+        for (const auto& t : m_timeline)
+        {
+            kept = std::max(kept, t.size());
+        }
+        bins = std::min(bins, kept);
+        for (size_t b = 0; b < bins; ++b)
+        {
+            for (size_t f = 0; f < m_flows.size(); ++f)
+            {
+                if (b >= m_timeline[f].size())
+                {
+                    continue;
+                }
+                const TimelineBin& bin = m_timeline[f][b];
+                if (bin.txBytes == 0 && bin.rxPackets == 0)
+                {
+                    continue;
+                }
+                os << (m_firstBin + b) * m_binWidth << "\t" << m_flows[f].first << ":"
+                   << m_flows[f].second << "\t" << bin.txBytes << "\t" << bin.rxBytes << "\t"
+                   << bin.rxPackets << "\t"
+                   << bin.rxBytes * 8.0 / m_binWidth / 1000.0 / 1000.0 << "\t"
+                   << (bin.rxPackets > 0 ? 1000 * bin.delaySum / bin.rxPackets : 0.0) << "\n";
+            }
+        }
+    }
+
+    /// Timeline bin of flow at time t, grown on demand.
+    TimelineBin& Bin(uint32_t flow, double t)
+    {
+        size_t b = std::max(static_cast<size_t>(t / m_binWidth), m_firstBin) - m_firstBin;
+        std::vector<TimelineBin>& bins = m_timeline[flow];
+        if (b >= bins.size())
+        {
+            bins.resize(std::max(b + 1, 2 * bins.size()));
+        }
+        return bins[b];
+    }
+
+    uint32_t FlowIndex(ns3::Ipv4Address address, uint16_t port)
+    {
+        auto key = std::make_pair(address, port);
+        for (uint32_t i = 0; i < m_flows.size(); ++i)
+        {
+            if (m_flows[i] == key)
+            {
+                return i;
+            }
+        }
+        m_flows.push_back(key);
+        m_stats.emplace_back(m_windows.size());
+        m_timeline.emplace_back();
+        std::ostringstream label;
+        label << address << ":" << port;
+        m_labels.push_back(label.str());
+        m_backlog.emplace_back();
+        return m_flows.size() - 1;
+    }
+
+    static void TxTrace(FlowProbe* probe, uint32_t flow, ns3::Ptr<const ns3::Packet> packet)
+    {
+        double now = ns3::Simulator::Now().GetSeconds();
+        for (size_t w = 0; w < probe->m_windows.size(); ++w)
+        {
+            if (now >= probe->m_windows[w].start && now < probe->m_windows[w].end)
+            {
+                WindowFlowStats& s = probe->m_stats[flow][w];
+                ++s.txPackets;
+                s.txBytes += packet->GetSize();
+            }
+        }
+        if (probe->m_binWidth > 0)
+        {
+            probe->Bin(flow, now).txBytes += packet->GetSize();
+        }
+        if (probe->m_recorder)
+        {
+            Backlog& b = probe->m_backlog[flow];
+            b.bytes += packet->GetSize();
+            ns3::SeqTsHeader seqTs;
+            packet->PeekHeader(seqTs);
+            probe->m_recorder->Record(probe->m_appStream,
+                                      now,
+                                      "%.9f\tTX\t%s\t%u\t%u\t0\t%lld",
+                                      now,
+                                      probe->m_labels[flow].c_str(),
+                                      seqTs.GetSeq(),
+                                      packet->GetSize(),
+                                      static_cast<long long>(b.bytes));
+            uint64_t threshold = probe->m_recorder->GetConfig().backlog;
+            if (threshold > 0 && !b.over && b.bytes > static_cast<int64_t>(threshold))
+            {
+                b.over = true;
+                probe->m_recorder->Trigger(now,
+                                           "backlog",
+                                           probe->m_labels[flow] + " " + std::to_string(b.bytes) +
+                                               " bytes");
+            }
+        }
+    }
+
+    static void RxTrace(FlowProbe* probe, uint32_t flow, ns3::Ptr<const ns3::Packet> packet)
+    {
+        ns3::SeqTsHeader seqTs;
+        if (packet->PeekHeader(seqTs) != seqTs.GetSerializedSize())
+        {
+            return;
+        }
+        double now = ns3::Simulator::Now().GetSeconds();
+        double sent = seqTs.GetTs().GetSeconds();
+        double delay = now - sent;
+        if (probe->m_recorder)
+        {
+            Backlog& b = probe->m_backlog[flow];
+            b.bytes -= packet->GetSize();
+            const FlightRecorderConfig& config = probe->m_recorder->GetConfig();
+            if (b.over && b.bytes <= static_cast<int64_t>(config.backlog / 2))
+            {
+                b.over = false;
+            }
+            probe->m_recorder->Record(probe->m_appStream,
+                                      now,
+                                      "%.9f\tRX\t%s\t%u\t%u\t%.3f\t%lld",
+                                      now,
+                                      probe->m_labels[flow].c_str(),
+                                      seqTs.GetSeq(),
+                                      packet->GetSize(),
+                                      1000 * delay,
+                                      static_cast<long long>(b.bytes));
+            if (config.delay > 0 && delay > config.delay)
+            {
+                std::ostringstream detail;
+                detail << probe->m_labels[flow] << " seq " << seqTs.GetSeq() << " " << 1000 * delay
+                       << " ms";
+                probe->m_recorder->Trigger(now, "delay", detail.str());
+            }
+        }
+        if (probe->m_binWidth > 0)
+        {
+            TimelineBin& bin = probe->Bin(flow, now);
+            bin.rxBytes += packet->GetSize();
+            ++bin.rxPackets;
+            bin.delaySum += delay;
+        }
+        for (size_t w = 0; w < probe->m_windows.size(); ++w)
+        {
+            if (sent >= probe->m_windows[w].start && sent < probe->m_windows[w].end)
+            {
+                WindowFlowStats& s = probe->m_stats[flow][w];
+                ++s.rxPackets;
+                s.rxBytes += packet->GetSize();
+                s.delaySum += delay;
+                s.delayMin = std::min(s.delayMin, delay);
+                s.delayMax = std::max(s.delayMax, delay);
+                if (s.lastDelay >= 0)
+                {
+                    s.jitterSum += std::abs(delay - s.lastDelay);
+                }
+                s.lastDelay = delay;
+            }
+        }
+    }
+
+    std::vector<MeasurementWindow> m_windows;
+    std::vector<std::pair<ns3::Ipv4Address, uint16_t>> m_flows;
+    std::vector<std::vector<WindowFlowStats>> m_stats; ///< [flow][window]
+    double m_binWidth{0.0};
+    std::vector<std::vector<TimelineBin>> m_timeline; ///< [flow][bin - m_firstBin]
+    size_t m_firstBin{0};                              ///< bins flushed so far
+
+    /// Bytes sent and not yet received of a flow.
+    struct Backlog
+    {
+        int64_t bytes{0};
+        bool over{false}; ///< trigger fired, waiting for the backlog to halve
+    };
+
+    FlightRecorder* m_recorder{nullptr};
+    int m_appStream{-1};
+    std::vector<std::string> m_labels;
+    std::vector<Backlog> m_backlog;
+};
+
+} // namespace kpm
+
+#endif // KPM_FLOW_PROBE_H
@@ -0,0 +1,71 @@
+/**
+ * \file kpm-harq-stats.cc
+ * \brief HARQ/BLER report of an RxPacketTrace.txt in one pass.
+ *
+ * Offline counterpart of the online report written by kpm-project-11
+ * (--harqStats); see kpm-harq-stats.h for the metrics.
+ *
+ * \code{.unparsed}
+$ g++ -O2 -std=c++17 -o kpm-harq-stats kpm-harq-stats.cc
+$ ./kpm-harq-stats sim-params/sim-2/RxPacketTrace.txt
+ * \endcode
+ */
+
+#include "kpm-harq-stats.h"
+#include "kpm-trace-format.h"
+
+#include <cstdio>
+#include <iostream>
+
+using namespace kpm;
+
+int
+main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        std::fprintf(stderr, "Usage: %s <RxPacketTrace.txt>\n", argv[0]);
+        return 1;
+    }
+
+    TraceReader reader;
+    if (!reader.Open(argv[1]))
+    {
+        std::fprintf(stderr, "Can't open %s\n", argv[1]);
+        return 1;
+    }
+    const int dir = reader.Column("direction");
+    const int cell = reader.Column("cellid");
+    const int rnti = reader.Column("rnti");
+    const int tbSize = reader.Column("tbsize");
+    const int mcs = reader.Column("mcs");
+    const int rv = reader.Column("rv");
+    const int sinr = reader.Column("sinr");
+    const int cqi = reader.Column("cqi");
+    const int corrupt = reader.Column("corrupt");
+    const int tbler = reader.Column("tbler");
+    if (dir < 0 || cell < 0 || rnti < 0 || mcs < 0 || rv < 0 || corrupt < 0)
+    {
+        std::fprintf(stderr, "%s is not an RxPacketTrace\n", argv[1]);
+        return 1;
+    }
+
+    HarqStats stats;
+    while (reader.Next())
+    {
+        stats.AddTb(reader.Uint(cell),
+                    reader.Uint(rnti),
+                    reader.Text(dir) == "DL",
+                    reader.Uint(mcs),
+                    reader.Uint(cqi),
+                    reader.Uint(rv),
+                    reader.Number(sinr),
+                    reader.Uint(corrupt) != 0,
+                    reader.Number(tbler),
+                    reader.Uint(tbSize));
+    }
+    std::cout.setf(std::ios_base::fixed);
+    std::cout.precision(4);
+    stats.Write(std::cout);
+    return 0;
+}
@@ -0,0 +1,269 @@
+/**
+ * \file kpm-harq-stats.h
+ * \brief HARQ, BLER, MCS and CQI statistics of the transport blocks of a run.
+ *
+ * Fed once per received transport block with the fields that RxPacketTrace.txt
+ * carries (cellId, RNTI, direction, mcs, CQI, rv, SINR, corrupt, TBler, tbSize),
+ * either online from the RxPacketTraceUe/RxPacketTraceGnb trace sources or from
+ * the trace file in one pass (kpm-harq-stats.cc). Per UE and per cell it keeps:
+ *
+ * - initial BLER: corrupt fraction of first transmissions (rv = 0);
+ * - residual BLER: fraction of new transport blocks never decoded, i.e.
+ *   (new - decoded) / new, which counts TBs still in HARQ at the end as lost;
+ * - retransmissions: number of rv > 0 attempts, per rv;
+ * - MCS and CQI distributions, as one row of TB counts per UE and per cell
+ *   next to the run total;
+ * - SINR-to-MCS mapping quality: per MCS the SINR statistics of first
+ *   transmissions and the observed BLER next to the mean TBler predicted by the
+ *   error model, so a badly calibrated link adaptation stands out.
+ *
+ * The state is a handful of fixed-size arrays per entity, so the cost per
+ * transport block is O(1). The header has no ns-3 dependency.
+ */
+
+#ifndef KPM_HARQ_STATS_H
+#define KPM_HARQ_STATS_H
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+
+namespace kpm
+{
+
+/// Counters of one entity (a UE, a cell or the whole run) in one direction.
+struct HarqCounters
+{
+    static const int NUM_MCS = 29;
+    static const int NUM_CQI = 16;
+    static const int NUM_RV = 4;
+
+    uint64_t tbs = 0;
+    uint64_t newTbs = 0;
+    uint64_t newCorrupt = 0;
+    uint64_t decoded = 0;
+    uint64_t bytesDecoded = 0;
+    std::array<uint64_t, NUM_RV> perRv{};
+    std::array<uint64_t, NUM_RV> perRvCorrupt{};
+    std::array<uint64_t, NUM_MCS> mcs{};
+    std::array<uint64_t, NUM_CQI> cqi{};
+
+    // First transmissions per MCS, for the SINR-to-MCS mapping
+    std::array<uint64_t, NUM_MCS> mcsNew{};
+    std::array<uint64_t, NUM_MCS> mcsNewCorrupt{};
+    std::array<double, NUM_MCS> mcsSinrSum{};
+    std::array<double, NUM_MCS> mcsSinrSqSum{};
+    std::array<double, NUM_MCS> mcsTblerSum{};
+
+    void Add(uint32_t m, uint32_t c, uint32_t rv, double sinr, bool corrupt, double tbler, uint32_t tbSize)
+    {
+        m = std::min<uint32_t>(m, NUM_MCS - 1);
+        c = std::min<uint32_t>(c, NUM_CQI - 1);
+        rv = std::min<uint32_t>(rv, NUM_RV - 1);
+        ++tbs;
+        ++perRv[rv];
+        ++mcs[m];
+        ++cqi[c];
+        if (corrupt)
+        {
+            ++perRvCorrupt[rv];
+        }
+        else
+        {
+            ++decoded;
+            bytesDecoded += tbSize;
+        }
+        if (rv == 0)
+        {
+            ++newTbs;
+            ++mcsNew[m];
+            mcsSinrSum[m] += sinr;
+            mcsSinrSqSum[m] += sinr * sinr;
+            mcsTblerSum[m] += tbler;
+            if (corrupt)
+            {
+                ++newCorrupt;
+                ++mcsNewCorrupt[m];
+            }
+        }
+    }
+
+    double InitialBler() const
+    {
+        return newTbs > 0 ? double(newCorrupt) / newTbs : 0.0;
+    }
+
+    double ResidualBler() const
+    {
+        return newTbs > decoded ? double(newTbs - decoded) / newTbs : 0.0;
+    }
+
+    uint64_t Retransmissions() const
+    {
+        return tbs - newTbs;
+    }
+};
+
+/// HARQ statistics per UE and per cell, for DL and UL.
+class HarqStats
+{
+  public:
+    /// Account one received transport block.
+    void AddTb(uint16_t cellId,
+               uint16_t rnti,
+               bool downlink,
+               uint32_t mcs,
+               uint32_t cqi,
+               uint32_t rv,
+               double sinrDb,
+               bool corrupt,
+               double tbler,
+               uint32_t tbSize)
+    {
+        int d = downlink ? 0 : 1;
+        m_ue[d][std::make_pair(cellId, rnti)].Add(mcs, cqi, rv, sinrDb, corrupt, tbler, tbSize);
+        m_cell[d][cellId].Add(mcs, cqi, rv, sinrDb, corrupt, tbler, tbSize);
+        m_total[d].Add(mcs, cqi, rv, sinrDb, corrupt, tbler, tbSize);
+    }
+
+    /// Counters of all UEs and cells in one direction.
+    const HarqCounters& GetTotal(bool downlink) const
+    {
+        return m_total[downlink ? 0 : 1];
+    }
+
+    /// Write the report; directions without transport blocks are skipped.
+    void Write(std::ostream& os) const
+    {
+        for (int d = 0; d < 2; ++d)
+        {
+            if (m_total[d].tbs == 0)
+            {
+                continue;
+            }
+            const char* dir = d == 0 ? "DL" : "UL";
+            os << dir << " HARQ/BLER per UE\n";
+            WriteHeader(os, "  cellId\trnti");
+            for (const auto& e : m_ue[d])
+            {
+                os << "  " << e.first.first << "\t" << e.first.second;
+                WriteRow(os, e.second);
+            }
+            os << dir << " HARQ/BLER per cell\n";
+            WriteHeader(os, "  cellId\t");
+            for (const auto& e : m_cell[d])
+            {
+                os << "  " << e.first << "\t";
+                WriteRow(os, e.second);
+            }
+            os << "  all\t";
+            WriteRow(os, m_total[d]);
+
+            WriteDistribution(os, d, "MCS", &HarqCounters::mcs);
+            WriteDistribution(os, d, "CQI", &HarqCounters::cqi);
+
+            const HarqCounters& t = m_total[d];
+            os << dir << " retransmissions per rv (attempts / corrupt)\n";
+            for (int rv = 0; rv < HarqCounters::NUM_RV; ++rv)
+            {
+                os << "  rv " << rv << ": " << t.perRv[rv] << " / " << t.perRvCorrupt[rv] << "\n";
+            }
+            os << dir << " CQI distribution\n";
+            for (int c = 0; c < HarqCounters::NUM_CQI; ++c)
+            {
+                if (t.cqi[c] > 0)
+                {
+                    os << "  CQI " << c << ": " << t.cqi[c] << "\n";
+                }
+            }
+            os << dir << " MCS distribution and SINR-to-MCS mapping (first transmissions)\n";
+            os << "  mcs\tTBs\tnewTBs\tmeanSINR(dB)\tstdSINR(dB)\tobservedBLER\tpredictedBLER\n";
+            for (int m = 0; m < HarqCounters::NUM_MCS; ++m)
+            {
+                if (t.mcs[m] == 0)
+                {
+                    continue;
+                }
+                uint64_t n = t.mcsNew[m];
+                double mean = n > 0 ? t.mcsSinrSum[m] / n : 0.0;
+                double var = n > 0 ? t.mcsSinrSqSum[m] / n - mean * mean : 0.0;
+                os << "  " << m << "\t" << t.mcs[m] << "\t" << n << "\t" << mean << "\t"
+                   << std::sqrt(std::max(0.0, var)) << "\t"
+                   << (n > 0 ? double(t.mcsNewCorrupt[m]) / n : 0.0) << "\t"
+                   << (n > 0 ? t.mcsTblerSum[m] / n : 0.0) << "\n";
+            }
+        }
+    }
+
+  private:
+    /// TBs per value of a distribution, per UE and per cell; only the values seen in the direction.
+    template <size_t N>
+    void WriteDistribution(std::ostream& os,
+                           int d,
+                           const char* name,
+                           std::array<uint64_t, N> HarqCounters::*field) const
+    {
+        const std::array<uint64_t, N>& total = m_total[d].*field;
+        os << (d == 0 ? "DL " : "UL ") << name << " distribution per UE and cell (TBs)\n";
+        os << "  cellId\trnti";
+        for (size_t v = 0; v < N; ++v)
+        {
+            if (total[v] > 0)
+            {
+                os << "\t" << name << " " << v;
+            }
+        }
+        os << "\n";
+        auto writeRow = [&os, &total](const std::array<uint64_t, N>& counts) {
+            for (size_t v = 0; v < N; ++v)
+            {
+                if (total[v] > 0)
+                {
+                    os << "\t" << counts[v];
+                }
+            }
+            os << "\n";
+        };
+        for (const auto& e : m_ue[d])
+        {
+            os << "  " << e.first.first << "\t" << e.first.second;
+            writeRow(e.second.*field);
+        }
+        for (const auto& e : m_cell[d])
+        {
+            os << "  " << e.first << "\tall";
+            writeRow(e.second.*field);
+        }
+    }
+
+    static void WriteHeader(std::ostream& os, const char* key)
+    {
+        os << key
+           << "\tTBs\tnewTBs\tinitialBLER\tresidualBLER\tretx\tretx/newTB\tdecodedBytes\tmeanMCS\n";
+    }
+
+    static void WriteRow(std::ostream& os, const HarqCounters& c)
+    {
+        double mcsSum = 0.0;
+        for (int m = 0; m < HarqCounters::NUM_MCS; ++m)
+        {
+            mcsSum += double(m) * c.mcs[m];
+        }
+        os << "\t" << c.tbs << "\t" << c.newTbs << "\t" << c.InitialBler() << "\t"
+           << c.ResidualBler() << "\t" << c.Retransmissions() << "\t"
+           << (c.newTbs > 0 ? double(c.Retransmissions()) / c.newTbs : 0.0) << "\t"
+           << c.bytesDecoded << "\t" << (c.tbs > 0 ? mcsSum / c.tbs : 0.0) << "\n";
+    }
+
+    std::map<std::pair<uint16_t, uint16_t>, HarqCounters> m_ue[2];
+    std::map<uint16_t, HarqCounters> m_cell[2];
+    HarqCounters m_total[2];
+};
+
+} // namespace kpm
+
+#endif // KPM_HARQ_STATS_H
@@ -0,0 +1,765 @@
+/**
+ * \file kpm-latency-breakdown.cc
+ * \brief Per-packet downlink or uplink delay budget per layer, joined from the NR traces.
+ *
+ * NrDlPdcpRxStats.txt only gives the end-to-end PDCP delay of each packet. This
+ * tool splits it into the contributions of the layers below by joining, per
+ * (cellId, RNTI[, LCID]), the PDCP, RLC, MAC and PHY traces of one run:
+ *
+ * \code{.unparsed}
+ pdcpTx = pdcpRx.time - pdcpRx.delay                      (NrDlPdcpRxStats)
+ rlcTx  = pdcpRx.time - rlcRx.delay                       (NrDlRxRlcStats, last PDU of the SDU)
+ alloc  = first new-data allocation at or after pdcpTx    (NrDlMacStats, ndi = 1)
+ okTb   = last non-corrupt DL transport block at or before the RLC delivery
+ first  = new-data attempt (rv 0) of the HARQ process of okTb (RxPacketTrace)
+
+ schedWait = alloc  - pdcpTx   no grant for the UE yet
+ rlcQueue  = rlcTx  - alloc    grants served data queued ahead of the packet
+ air       = first  - rlcTx    MAC -> PHY reception of the delivering data, including
+                               the transport blocks of the earlier segments of the SDU
+ harq      = okTb   - first    HARQ retransmissions until successful decoding
+ decode    = pdcpRx - okTb     TB decode latency and delivery up to PDCP
+ \endcode
+ *
+ * RxPacketTrace has no HARQ process id, so every transport block is joined with
+ * the DL DCI of its slot (same cell, RNTI, frame, subframe and slot), which has
+ * one; NrDlMacStats only lists the new-data allocations. harq is the time from
+ * the first to the successful attempt of the same process, so it is 0 for data
+ * decoded at the first attempt, however many transport blocks the SDU was
+ * segmented over. The retransmissions are the
+ * earlier attempts of that process, and the K1 delay is that of the last DL DCI
+ * of the process before the first attempt (RxedUePhyDlDciTrace). The components
+ * add up to the PDCP delay.
+ *
+ * With --direction=ul the uplink traces are joined instead (NrUl*Stats, the UL
+ * transport blocks of RxPacketTrace). A UE must ask for a grant first, so the
+ * wait for the first grant is split at the scheduling request the gNB MAC
+ * received (RxedGnbMacCtrlMsgsTrace):
+ *
+ * \code{.unparsed}
+ sr        = first SR at or after pdcpTx, if before alloc   (RxedGnbMacCtrlMsgsTrace)
+ alloc     = first new-data UL allocation at or after pdcpTx (NrUlMacStats, ndi = 1)
+
+ srWait    = sr     - pdcpTx   waiting for an SR opportunity (0 without SR)
+ grantWait = alloc  - sr       SR (or BSR) to UL grant
+ \endcode
+ *
+ * rlcQueue, air, harq and decode are as above; rlcQueue includes the K2 delay
+ * between the UL DCI and the transmission. A UL transport block takes the HARQ
+ * process of its NrUlMacStats allocation (same slot and first symbol); a
+ * retransmission without one continues the oldest failed, not yet retransmitted
+ * transport block of the same size. The report adds the share of packets that
+ * waited for an SR, the BSRs received while the packet was queued and the SINR
+ * of the transport block that delivered the packet.
+ *
+ * All traces are time ordered, so they are consumed as a streaming k-way merge by
+ * time; every trace only keeps the per-key records of the last --horizon seconds
+ * in hash tables. The PDCP delays of a key go to a fixed log-spaced histogram, so
+ * p50/p95 are within half a bin (about 1%) and memory is bounded independently of
+ * the run length.
+ *
+ * \code{.unparsed}
+$ g++ -O2 -std=c++17 -o kpm-latency-breakdown kpm-latency-breakdown.cc
+$ ./kpm-latency-breakdown sim-params/sim-2 --per-packet=sim-2-delays.txt
+$ ./kpm-latency-breakdown <ulTraffic run> --direction=ul
+ * \endcode
+ */
+
+#include "kpm-trace-format.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace kpm;
+
+namespace
+{
+
+/// Key of a (cellId, RNTI) pair; the LCID is added for PDCP/RLC streams.
+uint64_t
+MakeKey(uint64_t cell, uint64_t rnti, uint64_t lcid = 0)
+{
+    return (cell << 32) | (rnti << 8) | (lcid & 0xFF);
+}
+
+/// Timed record kept in the per-key windows.
+struct Event
+{
+    double time;
+    double value; //!< delay, k1 or rv depending on the stream
+    bool ok;      //!< not corrupt (RxPacketTrace) / new data (MAC)
+    double sinr{0.0}; //!< dB (RxPacketTrace)
+    uint64_t slot{0};  //!< MakeSlot() of the MAC allocation, DL DCI or transport block
+    int harqId{-1};    //!< HARQ process (MAC, DL DCIs, joined transport blocks); -1 unknown
+    uint64_t size{0};  //!< TB size in bytes (RxPacketTrace)
+};
+
+typedef std::unordered_map<uint64_t, std::deque<Event>> Window;
+
+/// Key of the frame, subframe, slot and first symbol of an allocation.
+uint64_t
+MakeSlot(uint64_t frame, uint64_t subframe, uint64_t slot, uint64_t symbol)
+{
+    return (frame << 24) | ((subframe & 0xFF) << 16) | ((slot & 0xFF) << 8) | (symbol & 0xFF);
+}
+
+/// HARQ process of the allocation (MAC) or DCI at slot, looked up in the records of the last 20 ms.
+int
+FindHarqProcess(const std::deque<Event>& q, uint64_t slot, double t)
+{
+    for (auto it = q.rbegin(); it != q.rend() && it->time >= t - 0.02; ++it)
+    {
+        if (it->slot == slot)
+        {
+            return it->harqId;
+        }
+    }
+    return -1;
+}
+
+/**
+ * HARQ process of a UL retransmission with no allocation to join: that of the
+ * oldest transport block of the last 20 ms with this size that failed and is the
+ * last of its process so far.
+ */
+int
+FindPendingProcess(const std::deque<Event>& tbs, uint64_t size, double t)
+{
+    std::map<int, const Event*> last;
+    for (auto it = tbs.rbegin(); it != tbs.rend() && it->time >= t - 0.02; ++it)
+    {
+        if (it->harqId >= 0)
+        {
+            last.emplace(it->harqId, &*it);
+        }
+    }
+    const Event* pending = nullptr;
+    for (const auto& p : last)
+    {
+        if (!p.second->ok && p.second->size == size &&
+            (pending == nullptr || p.second->time < pending->time))
+        {
+            pending = p.second;
+        }
+    }
+    return pending ? pending->harqId : -1;
+}
+
+/// Drop events older than the horizon.
+void
+Evict(std::deque<Event>& q, double before)
+{
+    while (!q.empty() && q.front().time < before)
+    {
+        q.pop_front();
+    }
+}
+
+/// Last event with time <= t (optionally only ok ones), or nullptr.
+const Event*
+LastAtOrBefore(const std::deque<Event>& q, double t, bool okOnly)
+{
+    auto it = std::upper_bound(q.begin(), q.end(), t, [](double v, const Event& e) {
+        return v < e.time;
+    });
+    while (it != q.begin())
+    {
+        --it;
+        if (!okOnly || it->ok)
+        {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
+
+/// First event with time >= t (optionally only ok ones), or nullptr.
+const Event*
+FirstAtOrAfter(const std::deque<Event>& q, double t, bool okOnly)
+{
+    auto it = std::lower_bound(q.begin(), q.end(), t, [](const Event& e, double v) {
+        return e.time < v;
+    });
+    for (; it != q.end(); ++it)
+    {
+        if (!okOnly || it->ok)
+        {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
+
+/// Delays on log-spaced bins from 1 us to 10 s; fixed memory for any number of packets.
+struct DelayHistogram
+{
+    static constexpr double MIN_DELAY = 1e-6;
+    static constexpr int BINS_PER_DECADE = 100;
+    static constexpr int BINS = 7 * BINS_PER_DECADE + 2; // below MIN_DELAY, 7 decades, above
+
+    uint64_t count = 0;
+    double sum = 0;
+    std::vector<uint64_t> bins = std::vector<uint64_t>(BINS, 0);
+
+    void Add(double delay)
+    {
+        int b = 0;
+        if (delay >= MIN_DELAY)
+        {
+            b = std::min(BINS - 1,
+                         1 + static_cast<int>(BINS_PER_DECADE * std::log10(delay / MIN_DELAY)));
+        }
+        ++bins[b];
+        ++count;
+        sum += delay;
+    }
+
+    double Mean() const
+    {
+        return count > 0 ? sum / count : 0.0;
+    }
+
+    /// The p-quantile, as the geometric centre of its bin.
+    double Percentile(double p) const
+    {
+        if (count == 0)
+        {
+            return 0.0;
+        }
+        uint64_t k = static_cast<uint64_t>(p * (count - 1));
+        uint64_t seen = 0;
+        int b = 0;
+        for (; b < BINS - 1; ++b)
+        {
+            seen += bins[b];
+            if (seen > k)
+            {
+                break;
+            }
+        }
+        return b == 0 ? MIN_DELAY : MIN_DELAY * std::pow(10.0, (b - 0.5) / BINS_PER_DECADE);
+    }
+};
+
+/// Aggregated budget of one (cellId, RNTI, LCID).
+struct Budget
+{
+    uint64_t txPackets = 0;
+    uint64_t rxPackets = 0;
+    uint64_t unmatched = 0;
+    uint64_t retx = 0;
+    uint64_t sr = 0;
+    uint64_t bsr = 0;
+    double srWait = 0;
+    double schedWait = 0;
+    double rlcQueue = 0;
+    double air = 0;
+    double harq = 0;
+    double decode = 0;
+    double k1 = 0;
+    double sinr = 0;
+    DelayHistogram delays;
+};
+
+/// The traces joined, in tie-break order for records with the same time.
+enum Stream
+{
+    MAC,
+    RX_PACKET,
+    CTRL, //!< DL DCIs, or the SRs and BSRs of the uplink
+    RLC_RX,
+    PDCP_TX,
+    PDCP_RX,
+    NUM_STREAMS
+};
+
+/// Trace of each stream, downlink and uplink.
+const char* STREAM_FILES[2][NUM_STREAMS] = {{"NrDlMacStats.txt",
+                                             "RxPacketTrace.txt",
+                                             "RxedUePhyDlDciTrace.txt",
+                                             "NrDlRxRlcStats.txt",
+                                             "NrDlPdcpTxStats.txt",
+                                             "NrDlPdcpRxStats.txt"},
+                                            {"NrUlMacStats.txt",
+                                             "RxPacketTrace.txt",
+                                             "RxedGnbMacCtrlMsgsTrace.txt",
+                                             "NrUlRxRlcStats.txt",
+                                             "NrUlPdcpTxStats.txt",
+                                             "NrUlPdcpRxStats.txt"}};
+
+/// Transport blocks that carried the data of a delivery.
+struct HarqChain
+{
+    const Event* first{nullptr}; //!< new-data attempt of the process
+    const Event* ok{nullptr};    //!< decoded attempt
+    uint64_t retx{0};            //!< attempts between them
+};
+
+/**
+ * The last non-corrupt transport block at or before t and the earlier attempts of
+ * its HARQ process back to the new-data one (rv 0). Transport blocks of other
+ * processes in between carried other data and are not part of it.
+ */
+HarqChain
+FindHarqChain(const std::deque<Event>& tbs, double t)
+{
+    HarqChain chain;
+    auto it = std::upper_bound(tbs.begin(), tbs.end(), t, [](double v, const Event& e) {
+        return v < e.time;
+    });
+    while (it != tbs.begin())
+    {
+        --it;
+        if (it->ok)
+        {
+            chain.ok = &*it;
+            break;
+        }
+    }
+    if (chain.ok == nullptr)
+    {
+        return chain;
+    }
+    chain.first = chain.ok;
+    while (chain.ok->harqId >= 0 && chain.first->value > 0 && it != tbs.begin())
+    {
+        --it;
+        if (it->harqId == chain.ok->harqId)
+        {
+            chain.first = &*it;
+            ++chain.retx;
+        }
+    }
+    return chain;
+}
+
+/// Last event of HARQ process harqId (any if -1) with time <= t, or nullptr.
+const Event*
+LastOfProcessAtOrBefore(const std::deque<Event>& q, double t, int harqId)
+{
+    auto it = std::upper_bound(q.begin(), q.end(), t, [](double v, const Event& e) {
+        return v < e.time;
+    });
+    while (it != q.begin())
+    {
+        --it;
+        if (harqId < 0 || it->harqId == harqId)
+        {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
+
+/// Events in q with from <= time <= to.
+size_t
+CountBetween(const std::deque<Event>& q, double from, double to)
+{
+    auto first = std::lower_bound(q.begin(), q.end(), from, [](const Event& e, double v) {
+        return e.time < v;
+    });
+    auto last = std::upper_bound(first, q.end(), to, [](double v, const Event& e) {
+        return v < e.time;
+    });
+    return static_cast<size_t>(last - first);
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    std::string dir;
+    std::string perPacketPath;
+    double horizon = 2.0;
+    std::string direction = "dl";
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 13, "--per-packet=") == 0)
+        {
+            perPacketPath = arg.substr(13);
+        }
+        else if (arg.compare(0, 12, "--direction=") == 0)
+        {
+            direction = arg.substr(12);
+        }
+        else if (arg.compare(0, 10, "--horizon=") == 0)
+        {
+            horizon = std::stod(arg.substr(10));
+        }
+        else if (arg.compare(0, 2, "--") != 0 && dir.empty())
+        {
+            dir = arg;
+        }
+        else
+        {
+            dir.clear();
+            break;
+        }
+    }
+    if (dir.empty() || (direction != "dl" && direction != "ul"))
+    {
+        std::fprintf(stderr,
+                     "Usage: %s <trace dir> [--direction=dl|ul] [--per-packet=file] "
+                     "[--horizon=seconds]\n",
+                     argv[0]);
+        return 1;
+    }
+    const bool ul = direction == "ul";
+    const char* const linkDir = ul ? "UL" : "DL";
+
+    auto start = std::chrono::steady_clock::now();
+
+    TraceReader readers[NUM_STREAMS];
+    bool live[NUM_STREAMS];
+    for (int s = 0; s < NUM_STREAMS; ++s)
+    {
+        std::string path = dir + "/" + STREAM_FILES[ul ? 1 : 0][s];
+        if (!readers[s].Open(path))
+        {
+            std::fprintf(stderr, "Can't open %s\n", path.c_str());
+            return 1;
+        }
+        live[s] = readers[s].Next();
+    }
+
+    // Column positions
+    const int macCell = readers[MAC].Column("cellid");
+    const int macRnti = readers[MAC].Column("rnti");
+    const int macNdi = readers[MAC].Column("ndi");
+    const int macFrame = readers[MAC].Column("frame");
+    const int macSubframe = readers[MAC].Column("sframe");
+    const int macSlot = readers[MAC].Column("slot");
+    const int macSymbol = readers[MAC].Column("symstart");
+    const int macHarq = readers[MAC].Column("harqid");
+    const int rxDir = readers[RX_PACKET].Column("direction");
+    const int rxCell = readers[RX_PACKET].Column("cellid");
+    const int rxRnti = readers[RX_PACKET].Column("rnti");
+    const int rxRv = readers[RX_PACKET].Column("rv");
+    const int rxCorrupt = readers[RX_PACKET].Column("corrupt");
+    const int rxSinr = readers[RX_PACKET].Column("sinr");
+    const int rxFrame = readers[RX_PACKET].Column("frame");
+    const int rxSubframe = readers[RX_PACKET].Column("subf");
+    const int rxSlot = readers[RX_PACKET].Column("slot");
+    const int rxSymbol = readers[RX_PACKET].Column("1stsym");
+    const int rxTbSize = readers[RX_PACKET].Column("tbsize");
+    const int ctrlCell = readers[CTRL].Column("nodeid");
+    const int ctrlRnti = readers[CTRL].Column("rnti");
+    const int ctrlK1 = readers[CTRL].Column("k1_delay");
+    const int ctrlHarq = readers[CTRL].Column("harq_id");
+    const int ctrlEntity = readers[CTRL].Column("entity");
+    const int ctrlFrame = readers[CTRL].Column("frame");
+    const int ctrlSubframe = readers[CTRL].Column("sf");
+    const int ctrlSlot = readers[CTRL].Column("slot");
+    const int ctrlType = readers[CTRL].Column("msgtype");
+    const int rlcCell = readers[RLC_RX].Column("cellid");
+    const int rlcRnti = readers[RLC_RX].Column("rnti");
+    const int rlcLcid = readers[RLC_RX].Column("lcid");
+    const int rlcDelay = readers[RLC_RX].Column("delay");
+    const int ptxCell = readers[PDCP_TX].Column("cellid");
+    const int ptxRnti = readers[PDCP_TX].Column("rnti");
+    const int ptxLcid = readers[PDCP_TX].Column("lcid");
+    const int prxCell = readers[PDCP_RX].Column("cellid");
+    const int prxRnti = readers[PDCP_RX].Column("rnti");
+    const int prxLcid = readers[PDCP_RX].Column("lcid");
+    const int prxSize = readers[PDCP_RX].Column("packetsize");
+    const int prxDelay = readers[PDCP_RX].Column("delay");
+
+    Window macWindow;
+    Window tbWindow;
+    Window ctrlWindow; // DL DCIs, or the SRs of the uplink
+    Window bsrWindow;
+    Window rlcWindow;
+    std::map<uint64_t, Budget> budgets;
+
+    FILE* perPacket = nullptr;
+    if (!perPacketPath.empty())
+    {
+        perPacket = std::fopen(perPacketPath.c_str(), "w");
+        if (perPacket == nullptr)
+        {
+            std::fprintf(stderr, "Can't open %s\n", perPacketPath.c_str());
+            return 1;
+        }
+        std::fprintf(perPacket,
+                     ul ? "time(s)\tcellId\trnti\tlcid\tpacketSize\tdelay(s)\tsrWait(s)\t"
+                          "grantWait(s)\trlcQueue(s)\tair(s)\tharq(s)\tdecode(s)\tretx\tBSRs\t"
+                          "SINR(dB)\n"
+                        : "time(s)\tcellId\trnti\tlcid\tpacketSize\tdelay(s)\tschedWait(s)\t"
+                          "rlcQueue(s)\tair(s)\tharq(s)\tdecode(s)\tretx\tK1\n");
+    }
+
+    uint64_t records = 0;
+    double evictedUntil = 0.0;
+    while (true)
+    {
+        // Next record in time order across all traces
+        int s = -1;
+        double t = 0.0;
+        for (int i = 0; i < NUM_STREAMS; ++i)
+        {
+            if (live[i] && (s < 0 || readers[i].Number(0) < t))
+            {
+                s = i;
+                t = readers[i].Number(0);
+            }
+        }
+        if (s < 0)
+        {
+            break;
+        }
+        ++records;
+        const TraceReader& r = readers[s];
+
+        switch (s)
+        {
+        case MAC:
+            macWindow[MakeKey(r.Uint(macCell), r.Uint(macRnti))].push_back(
+                {t,
+                 0.0,
+                 r.Uint(macNdi) == 1,
+                 0.0,
+                 MakeSlot(r.Uint(macFrame),
+                          r.Uint(macSubframe),
+                          r.Uint(macSlot),
+                          r.Uint(macSymbol)),
+                 macHarq >= 0 ? static_cast<int>(r.Uint(macHarq)) : -1});
+            break;
+        case RX_PACKET:
+            if (r.Text(rxDir) == linkDir)
+            {
+                uint64_t key = MakeKey(r.Uint(rxCell), r.Uint(rxRnti));
+                // A DL DCI gives the process of its slot, NrUlMacStats that of an allocation
+                uint64_t slot = MakeSlot(r.Uint(rxFrame),
+                                         r.Uint(rxSubframe),
+                                         r.Uint(rxSlot),
+                                         ul ? r.Uint(rxSymbol) : 0);
+                int harqId = ul ? FindHarqProcess(macWindow[key], slot, t)
+                                : FindHarqProcess(ctrlWindow[key], slot, t);
+                uint64_t size = r.Uint(rxTbSize);
+                if (ul && harqId < 0 && r.Number(rxRv) > 0)
+                {
+                    harqId = FindPendingProcess(tbWindow[key], size, t);
+                }
+                tbWindow[key].push_back({t,
+                                         r.Number(rxRv),
+                                         r.Uint(rxCorrupt) == 0,
+                                         r.Number(rxSinr),
+                                         slot,
+                                         harqId,
+                                         size});
+            }
+            break;
+        case CTRL:
+            if (!ul)
+            {
+                // The trace lists the HARQ feedback too ("HARQ FD Txed")
+                if (r.Text(ctrlEntity) == "DL DCI Rxed")
+                {
+                    ctrlWindow[MakeKey(r.Uint(ctrlCell), r.Uint(ctrlRnti))].push_back(
+                        {t,
+                         r.Number(ctrlK1),
+                         true,
+                         0.0,
+                         MakeSlot(r.Uint(ctrlFrame), r.Uint(ctrlSubframe), r.Uint(ctrlSlot), 0),
+                         ctrlHarq >= 0 ? static_cast<int>(r.Uint(ctrlHarq)) : -1});
+                }
+            }
+            else if (r.Text(ctrlType) == "SR")
+            {
+                ctrlWindow[MakeKey(r.Uint(ctrlCell), r.Uint(ctrlRnti))].push_back({t, 0.0, true});
+            }
+            else if (r.Text(ctrlType) == "BSR")
+            {
+                bsrWindow[MakeKey(r.Uint(ctrlCell), r.Uint(ctrlRnti))].push_back({t, 0.0, true});
+            }
+            break;
+        case RLC_RX:
+            rlcWindow[MakeKey(r.Uint(rlcCell), r.Uint(rlcRnti), r.Uint(rlcLcid))].push_back(
+                {t, r.Number(rlcDelay), true});
+            break;
+        case PDCP_TX:
+            budgets[MakeKey(r.Uint(ptxCell), r.Uint(ptxRnti), r.Uint(ptxLcid))].txPackets++;
+            break;
+        case PDCP_RX: {
+            uint64_t cell = r.Uint(prxCell);
+            uint64_t rnti = r.Uint(prxRnti);
+            uint64_t lcid = r.Uint(prxLcid);
+            Budget& b = budgets[MakeKey(cell, rnti, lcid)];
+            double delay = r.Number(prxDelay);
+            b.rxPackets++;
+            b.delays.Add(delay);
+
+            const Event* rlc = LastAtOrBefore(rlcWindow[MakeKey(cell, rnti, lcid)], t, false);
+            if (rlc == nullptr)
+            {
+                b.unmatched++;
+                break;
+            }
+            double pdcpTx = t - delay;
+            double rlcTx = std::max(pdcpTx, t - rlc->value);
+            const Event* alloc = FirstAtOrAfter(macWindow[MakeKey(cell, rnti)], pdcpTx, true);
+            double allocTime = alloc ? std::min(std::max(alloc->time, pdcpTx), rlcTx) : rlcTx;
+            // The data reached RLC with the transport block decoded at the RLC delivery
+            HarqChain chain = FindHarqChain(tbWindow[MakeKey(cell, rnti)], rlc->time);
+            double okTime = chain.ok ? std::min(std::max(chain.ok->time, rlcTx), t) : t;
+            double firstTime =
+                chain.first ? std::min(std::max(chain.first->time, rlcTx), okTime) : okTime;
+            const std::deque<Event>& ctrl = ctrlWindow[MakeKey(cell, rnti)];
+            const Event* dci =
+                ul ? nullptr
+                   : LastOfProcessAtOrBefore(ctrl, firstTime, chain.ok ? chain.ok->harqId : -1);
+
+            // Uplink: the wait for the grant starts with the SR, if the UE needed one
+            const Event* sr = ul ? FirstAtOrAfter(ctrl, pdcpTx, false) : nullptr;
+            bool waitedForSr = sr && sr->time <= allocTime;
+            double srTime = waitedForSr ? sr->time : pdcpTx;
+            double srWait = srTime - pdcpTx;
+            double schedWait = allocTime - srTime;
+            double rlcQueue = rlcTx - allocTime;
+            double air = firstTime - rlcTx;
+            double harq = okTime - firstTime;
+            double decode = t - okTime;
+            uint64_t retx = chain.retx;
+            double k1 = dci ? dci->value : 0.0;
+            size_t bsrs = ul ? CountBetween(bsrWindow[MakeKey(cell, rnti)], pdcpTx, rlcTx) : 0;
+            double sinr = chain.ok ? chain.ok->sinr : 0.0;
+
+            b.sr += waitedForSr;
+            b.bsr += bsrs;
+            b.srWait += srWait;
+            b.sinr += sinr;
+            b.schedWait += schedWait;
+            b.rlcQueue += rlcQueue;
+            b.air += air;
+            b.harq += harq;
+            b.decode += decode;
+            b.retx += retx;
+            b.k1 += k1;
+
+            if (perPacket && ul)
+            {
+                std::fprintf(perPacket,
+                             "%.9g\t%llu\t%llu\t%llu\t%.*s\t%.9g\t%.9g\t%.9g\t%.9g\t%.9g\t%.9g\t%.9g\t%llu\t%zu\t%g\n",
+                             t,
+                             static_cast<unsigned long long>(cell),
+                             static_cast<unsigned long long>(rnti),
+                             static_cast<unsigned long long>(lcid),
+                             static_cast<int>(r.Text(prxSize).size()),
+                             r.Text(prxSize).data(),
+                             delay,
+                             srWait,
+                             schedWait,
+                             rlcQueue,
+                             air,
+                             harq,
+                             decode,
+                             static_cast<unsigned long long>(retx),
+                             bsrs,
+                             sinr);
+            }
+            else if (perPacket)
+            {
+                std::fprintf(perPacket,
+                             "%.9g\t%llu\t%llu\t%llu\t%.*s\t%.9g\t%.9g\t%.9g\t%.9g\t%.9g\t%.9g\t%llu\t%g\n",
+                             t,
+                             static_cast<unsigned long long>(cell),
+                             static_cast<unsigned long long>(rnti),
+                             static_cast<unsigned long long>(lcid),
+                             static_cast<int>(r.Text(prxSize).size()),
+                             r.Text(prxSize).data(),
+                             delay,
+                             schedWait,
+                             rlcQueue,
+                             air,
+                             harq,
+                             decode,
+                             static_cast<unsigned long long>(retx),
+                             k1);
+            }
+            break;
+        }
+        }
+
+        live[s] = readers[s].Next();
+
+        // Bound the windows; amortised over a few ms of simulated time
+        if (t - evictedUntil > 0.01)
+        {
+            double before = t - horizon;
+            for (Window* w : {&macWindow, &tbWindow, &ctrlWindow, &bsrWindow, &rlcWindow})
+            {
+                for (auto& q : *w)
+                {
+                    Evict(q.second, before);
+                }
+            }
+            evictedUntil = t;
+        }
+    }
+
+    if (perPacket)
+    {
+        std::fclose(perPacket);
+    }
+
+    std::printf("cellId\trnti\tlcid\ttxPkts\trxPkts\tlost\tmeanDelay(ms)\tp50(ms)\tp95(ms)\t%s",
+                ul ? "srWait(ms)\tgrantWait(ms)\trlcQueue(ms)\tair(ms)\tharq(ms)\tdecode(ms)\t"
+                     "retx/pkt\tSR/pkt\tBSR/pkt\tSINR(dB)\tunmatched\n"
+                   : "schedWait(ms)\trlcQueue(ms)\tair(ms)\tharq(ms)\tdecode(ms)\tretx/pkt\tK1\t"
+                     "unmatched\n");
+    for (auto& e : budgets)
+    {
+        Budget& b = e.second;
+        uint64_t matched = b.rxPackets - b.unmatched;
+        double m = matched > 0 ? 1000.0 / matched : 0.0;
+        std::printf("%llu\t%llu\t%llu\t%llu\t%llu\t%lld\t%.4f\t%.4f\t%.4f\t",
+                    static_cast<unsigned long long>(e.first >> 32),
+                    static_cast<unsigned long long>((e.first >> 8) & 0xFFFFFF),
+                    static_cast<unsigned long long>(e.first & 0xFF),
+                    static_cast<unsigned long long>(b.txPackets),
+                    static_cast<unsigned long long>(b.rxPackets),
+                    static_cast<long long>(b.txPackets) - static_cast<long long>(b.rxPackets),
+                    1000.0 * b.delays.Mean(),
+                    1000.0 * b.delays.Percentile(0.50),
+                    1000.0 * b.delays.Percentile(0.95));
+        if (ul)
+        {
+            std::printf("%.4f\t%.4f\t%.4f\t%.4f\t%.4f\t%.4f\t%.3f\t%.3f\t%.3f\t%.2f\t%llu\n",
+                        b.srWait * m,
+                        b.schedWait * m,
+                        b.rlcQueue * m,
+                        b.air * m,
+                        b.harq * m,
+                        b.decode * m,
+                        matched > 0 ? double(b.retx) / matched : 0.0,
+                        matched > 0 ? double(b.sr) / matched : 0.0,
+                        matched > 0 ? double(b.bsr) / matched : 0.0,
+                        matched > 0 ? b.sinr / matched : 0.0,
+                        static_cast<unsigned long long>(b.unmatched));
+            continue;
+        }
+        std::printf("%.4f\t%.4f\t%.4f\t%.4f\t%.4f\t%.3f\t%.2f\t%llu\n",
+                    b.schedWait * m,
+                    b.rlcQueue * m,
+                    b.air * m,
+                    b.harq * m,
+                    b.decode * m,
+                    matched > 0 ? double(b.retx) / matched : 0.0,
+                    matched > 0 ? b.k1 / matched : 0.0,
+                    static_cast<unsigned long long>(b.unmatched));
+    }
+
+    double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::fprintf(stderr, "%llu records joined in %.3f s\n", static_cast<unsigned long long>(records), elapsed);
+    return 0;
+}
@@ -0,0 +1,554 @@
+/**
+ * \file kpm-nr-traces.h
+ * \brief The per-packet NR traces, written from script-side sinks through an AsyncTraceWriter.
+ *
+ * NrHelper::EnableTraces() writes every record with std::ofstream on the
+ * simulation thread, so each disk stall blocks the event loop. NrTraceSinks
+ * connects sinks of its own to the same trace sources for the files that grow
+ * with the traffic, and writes them through an AsyncTraceWriter:
+ *
+ * - RxPacketTrace.txt and DlDataSinr.txt: one record per transport block;
+ * - Nr{Dl,Ul}Pdcp{Tx,Rx}Stats.txt and Nr{Dl,Ul}{Tx,Rx}RlcStats.txt: one per PDU;
+ * - {Rxed,Txed}{Gnb,Ue}PhyCtrlMsgsTrace.txt, RxedUePhyDlDciTrace.txt and
+ *   {Rxed,Txed}GnbMacCtrlMsgsTrace.txt: one per control message.
+ *
+ * The records keep the NR module's layout, including its quirks (the gNB PHY
+ * names the UL DCI "UL_UCI", the gNB MAC header announces a VarTTI column it
+ * never writes), so the analysis tools read them unchanged. A file is created
+ * with its first record, as the NR writers do. EnableNrModuleTraces() switches
+ * on the remaining NR traces, which are small: control channel SINR, path loss,
+ * MAC scheduling, UE MAC control messages and the E2E RLC/PDCP epochs.
+ *
+ * The RLC and PDCP trace sources belong to the bearers, which exist only once
+ * the RRC has set them up. Like the NR module's bearer stats connector, the
+ * sinks are connected to a bearer when the UE or gNB RRC reports it created
+ * (DrbCreated), so NrTraceSinks must be connected before the UEs attach. The
+ * cell of an RLC/PDCP record is the one the bearer was set up in.
+ *
+ * Records before SetStartTime() are dropped before they are formatted, which
+ * is how a resumed run replays up to its checkpoint (kpm-checkpoint.h) with the
+ * sinks connected from the start.
+ */
+
+#ifndef KPM_NR_TRACES_H
+#define KPM_NR_TRACES_H
+
+#include "kpm-async-writer.h"
+
+#include "ns3/core-module.h"
+#include "ns3/nr-module.h"
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace kpm
+{
+
+/// Script-side writers of the NR traces that grow with the traffic.
+class NrTraceSinks
+{
+  public:
+    /// Write the traces into dir through writer.
+    NrTraceSinks(AsyncTraceWriter* writer, const std::string& dir)
+        : m_writer(writer),
+          m_dir(dir)
+    {
+        for (int& h : m_handles)
+        {
+            h = UNOPENED;
+        }
+    }
+
+    /// Drop the records of the simulated time before start.
+    void SetStartTime(ns3::Time start)
+    {
+        m_start = start;
+    }
+
+    /**
+     * Connect the sinks to the trace sources of all NR devices; returns the paths
+     * that matched no trace source.
+     */
+    std::vector<std::string> Connect()
+    {
+        const std::string ue = "/NodeList/*/DeviceList/*/$ns3::NrUeNetDevice/";
+        const std::string uePhy = ue + "ComponentCarrierMapUe/*/NrUePhy/";
+        const std::string gnb = "/NodeList/*/DeviceList/*/$ns3::NrGnbNetDevice/";
+        const std::string gnbPhy = gnb + "BandwidthPartMap/*/NrGnbPhy/";
+        const std::string gnbMac = gnb + "BandwidthPartMap/*/NrGnbMac/";
+        std::vector<std::string> missing;
+        auto check = [&missing](bool connected, const std::string& path) {
+            if (!connected)
+            {
+                missing.push_back(path);
+            }
+        };
+        std::string path;
+
+        path = uePhy + "NrSpectrumPhyList/*/RxPacketTraceUe";
+        check(ns3::Config::ConnectWithoutContextFailSafe(
+                  path,
+                  ns3::MakeBoundCallback(&NrTraceSinks::RxPacketTrace, this, "DL")),
+              path);
+        path = gnbPhy + "NrSpectrumPhyList/*/RxPacketTraceGnb";
+        check(ns3::Config::ConnectWithoutContextFailSafe(
+                  path,
+                  ns3::MakeBoundCallback(&NrTraceSinks::RxPacketTrace, this, "UL")),
+              path);
+        path = uePhy + "DlDataSinr";
+        check(ns3::Config::ConnectWithoutContextFailSafe(
+                  path,
+                  ns3::MakeBoundCallback(&NrTraceSinks::DlDataSinr, this)),
+              path);
+
+        const struct
+        {
+            std::string path;
+            File file;
+        } ctrl[] = {{gnbPhy + "GnbPhyRxedCtrlMsgsTrace", GNB_PHY_RX_CTRL},
+                    {gnbPhy + "GnbPhyTxedCtrlMsgsTrace", GNB_PHY_TX_CTRL},
+                    {uePhy + "UePhyRxedCtrlMsgsTrace", UE_PHY_RX_CTRL},
+                    {uePhy + "UePhyTxedCtrlMsgsTrace", UE_PHY_TX_CTRL},
+                    {gnbMac + "GnbMacRxedCtrlMsgsTrace", GNB_MAC_RX_CTRL},
+                    {gnbMac + "GnbMacTxedCtrlMsgsTrace", GNB_MAC_TX_CTRL}};
+        for (const auto& c : ctrl)
+        {
+            check(ns3::Config::ConnectWithoutContextFailSafe(
+                      c.path,
+                      ns3::MakeBoundCallback(&NrTraceSinks::CtrlMsg, this, c.file)),
+                  c.path);
+        }
+        path = uePhy + "UePhyRxedDlDciTrace";
+        check(ns3::Config::ConnectWithoutContextFailSafe(
+                  path,
+                  ns3::MakeBoundCallback(&NrTraceSinks::DlDci, this)),
+              path);
+
+        path = ue + "NrUeRrc/DrbCreated";
+        check(ns3::Config::ConnectFailSafe(path,
+                                           ns3::MakeBoundCallback(&NrTraceSinks::UeDrbCreated,
+                                                                  this)),
+              path);
+        path = gnb + "NrGnbRrc/DrbCreated";
+        check(ns3::Config::ConnectFailSafe(path,
+                                           ns3::MakeBoundCallback(&NrTraceSinks::GnbDrbCreated,
+                                                                  this)),
+              path);
+        return missing;
+    }
+
+    /// Records written so far.
+    uint64_t GetRecords() const
+    {
+        return m_records;
+    }
+
+    /// File names of the traces the sinks write.
+    static std::vector<std::string> GetFileNames()
+    {
+        std::vector<std::string> names;
+        for (int f = 0; f < NUM_FILES; ++f)
+        {
+            names.push_back(GetLayout(static_cast<File>(f)).name);
+        }
+        return names;
+    }
+
+    /// Bearer trace sources (RLC/PDCP TxPDU/RxPDU) that could not be connected.
+    uint64_t GetMissingBearerSources() const
+    {
+        return m_missingBearerSources;
+    }
+
+  private:
+    enum File
+    {
+        RX_PACKET,
+        DL_DATA_SINR,
+        DL_PDCP_TX,
+        DL_PDCP_RX,
+        UL_PDCP_TX,
+        UL_PDCP_RX,
+        DL_RLC_TX,
+        DL_RLC_RX,
+        UL_RLC_TX,
+        UL_RLC_RX,
+        GNB_PHY_RX_CTRL,
+        GNB_PHY_TX_CTRL,
+        UE_PHY_RX_CTRL,
+        UE_PHY_TX_CTRL,
+        UE_PHY_DL_DCI,
+        GNB_MAC_RX_CTRL,
+        GNB_MAC_TX_CTRL,
+        NUM_FILES
+    };
+
+    static constexpr int UNOPENED = -1;
+    static constexpr int FAILED = -2;
+
+    /// File name, header and entity column (control messages) of each trace.
+    struct Layout
+    {
+        const char* name;
+        const char* header;
+        const char* entity;
+    };
+
+    static const Layout& GetLayout(File f)
+    {
+        static const char* const pdcpTx = "time(s)\tcellId\trnti\tlcid\tpacketSize\n";
+        static const char* const pdcpRx = "time(s)\tcellId\trnti\tlcid\tpacketSize\tdelay(s)\n";
+        static const char* const phyCtrl =
+            "Time\tEntity\tFrame\tSF\tSlot\tnodeId\tRNTI\tbwpId\tMsgType\n";
+        static const char* const macCtrl =
+            "Time\tEntity\tFrame\tSF\tSlot\tVarTTI\tnodeId\tRNTI\tbwpId\tMsgType\n";
+        static const Layout layouts[NUM_FILES] = {
+            {"RxPacketTrace.txt",
+             "Time\tdirection\tframe\tsubF\tslot\t1stSym\tnSymbol\tcellId\tbwpId\trnti\ttbSize\tmcs"
+             "\trank\trv\tSINR(dB)\tCQI\tcorrupt\tTBler\n",
+             nullptr},
+            {"DlDataSinr.txt", "Time\tCellId\tRNTI\tBWPId\tSINR(dB)\n", nullptr},
+            {"NrDlPdcpTxStats.txt", pdcpTx, nullptr},
+            {"NrDlPdcpRxStats.txt", pdcpRx, nullptr},
+            {"NrUlPdcpTxStats.txt", pdcpTx, nullptr},
+            {"NrUlPdcpRxStats.txt", pdcpRx, nullptr},
+            {"NrDlTxRlcStats.txt", pdcpTx, nullptr},
+            {"NrDlRxRlcStats.txt", pdcpRx, nullptr},
+            {"NrUlTxRlcStats.txt", pdcpTx, nullptr},
+            {"NrUlRxRlcStats.txt", pdcpRx, nullptr},
+            {"RxedGnbPhyCtrlMsgsTrace.txt", phyCtrl, "gNB PHY Rxed"},
+            {"TxedGnbPhyCtrlMsgsTrace.txt", phyCtrl, "gNB PHY Txed"},
+            {"RxedUePhyCtrlMsgsTrace.txt", phyCtrl, "UE  PHY Rxed"},
+            {"TxedUePhyCtrlMsgsTrace.txt", phyCtrl, "UE  PHY Txed"},
+            {"RxedUePhyDlDciTrace.txt",
+             "Time\tEntity\tFrame\tSF\tSlot\tnodeId\tRNTI\tbwpId\tHarq ID\tK1 Delay\n",
+             "DL DCI Rxed"},
+            {"RxedGnbMacCtrlMsgsTrace.txt", macCtrl, "gNB MAC Rxed"},
+            {"TxedGnbMacCtrlMsgsTrace.txt", macCtrl, "gNB MAC Txed"}};
+        return layouts[f];
+    }
+
+    /// Message type as the NR writers name it.
+    static const char* MsgTypeName(File f, ns3::NrControlMessage::messageType type)
+    {
+        switch (type)
+        {
+        case ns3::NrControlMessage::UL_DCI:
+            return f == GNB_PHY_TX_CTRL ? "UL_UCI" : "UL_DCI";
+        case ns3::NrControlMessage::DL_DCI:
+            return "DL_DCI";
+        case ns3::NrControlMessage::DL_CQI:
+            return "DL_CQI";
+        case ns3::NrControlMessage::MIB:
+            return "MIB";
+        case ns3::NrControlMessage::SIB1:
+            return "SIB1";
+        case ns3::NrControlMessage::RACH_PREAMBLE:
+            return "RACH_PREAMBLE";
+        case ns3::NrControlMessage::RAR:
+            return "RAR";
+        case ns3::NrControlMessage::BSR:
+            return "BSR";
+        case ns3::NrControlMessage::DL_HARQ:
+            return "DL_HARQ";
+        case ns3::NrControlMessage::SR:
+            return "SR";
+        case ns3::NrControlMessage::SRS:
+            return "SRS";
+        default:
+            return "Other";
+        }
+    }
+
+    /// Handle of a trace, opened with its header on first use; negative if it can't be.
+    int Handle(File f)
+    {
+        if (m_handles[f] == UNOPENED)
+        {
+            m_handles[f] = m_writer->Open(m_dir + "/" + GetLayout(f).name);
+            if (m_handles[f] < 0)
+            {
+                m_handles[f] = FAILED;
+            }
+            else
+            {
+                m_writer->Append(m_handles[f], GetLayout(f).header);
+            }
+        }
+        ++m_records;
+        return m_handles[f];
+    }
+
+    bool Skip() const
+    {
+        return ns3::Simulator::Now() < m_start;
+    }
+
+    static void RxPacketTrace(NrTraceSinks* sinks,
+                              const char* direction,
+                              ns3::RxPacketTraceParams params)
+    {
+        int h;
+        if (sinks->Skip() || (h = sinks->Handle(RX_PACKET)) < 0)
+        {
+            return;
+        }
+        sinks->m_writer->Printf(h,
+                                "%g\t%s\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u"
+                                "\t%g\t%u\t%u\t%g\n",
+                                ns3::Simulator::Now().GetSeconds(),
+                                direction,
+                                static_cast<unsigned>(params.m_frameNum),
+                                static_cast<unsigned>(params.m_subframeNum),
+                                static_cast<unsigned>(params.m_slotNum),
+                                static_cast<unsigned>(params.m_symStart),
+                                static_cast<unsigned>(params.m_numSym),
+                                static_cast<unsigned>(params.m_cellId),
+                                static_cast<unsigned>(params.m_bwpId),
+                                static_cast<unsigned>(params.m_rnti),
+                                static_cast<unsigned>(params.m_tbSize),
+                                static_cast<unsigned>(params.m_mcs),
+                                static_cast<unsigned>(params.m_rank),
+                                static_cast<unsigned>(params.m_rv),
+                                10 * std::log10(params.m_sinr),
+                                static_cast<unsigned>(params.m_cqi),
+                                static_cast<unsigned>(params.m_corrupt),
+                                params.m_tbler);
+    }
+
+    static void DlDataSinr(NrTraceSinks* sinks,
+                           uint16_t cellId,
+                           uint16_t rnti,
+                           double sinr,
+                           uint16_t bwpId)
+    {
+        int h;
+        if (sinks->Skip() || (h = sinks->Handle(DL_DATA_SINR)) < 0)
+        {
+            return;
+        }
+        sinks->m_writer->Printf(h,
+                                "%g\t%u\t%u\t%u\t%g\n",
+                                ns3::Simulator::Now().GetSeconds(),
+                                static_cast<unsigned>(cellId),
+                                static_cast<unsigned>(rnti),
+                                static_cast<unsigned>(bwpId),
+                                10 * std::log10(sinr));
+    }
+
+    static void CtrlMsg(NrTraceSinks* sinks,
+                        File f,
+                        ns3::SfnSf sfn,
+                        uint16_t nodeId,
+                        uint16_t rnti,
+                        uint8_t bwpId,
+                        ns3::Ptr<const ns3::NrControlMessage> msg)
+    {
+        int h;
+        if (sinks->Skip() || (h = sinks->Handle(f)) < 0)
+        {
+            return;
+        }
+        sinks->m_writer->Printf(h,
+                                "%g\t%s\t%u\t%u\t%u\t%u\t%u\t%u\t%s\n",
+                                ns3::Simulator::Now().GetSeconds(),
+                                GetLayout(f).entity,
+                                static_cast<unsigned>(sfn.GetFrame()),
+                                static_cast<unsigned>(sfn.GetSubframe()),
+                                static_cast<unsigned>(sfn.GetSlot()),
+                                static_cast<unsigned>(nodeId),
+                                static_cast<unsigned>(rnti),
+                                static_cast<unsigned>(bwpId),
+                                MsgTypeName(f, msg->GetMessageType()));
+    }
+
+    static void DlDci(NrTraceSinks* sinks,
+                      ns3::SfnSf sfn,
+                      uint16_t nodeId,
+                      uint16_t rnti,
+                      uint8_t bwpId,
+                      uint8_t harqId,
+                      uint32_t k1Delay)
+    {
+        int h;
+        if (sinks->Skip() || (h = sinks->Handle(UE_PHY_DL_DCI)) < 0)
+        {
+            return;
+        }
+        sinks->m_writer->Printf(h,
+                                "%g\t%s\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\n",
+                                ns3::Simulator::Now().GetSeconds(),
+                                GetLayout(UE_PHY_DL_DCI).entity,
+                                static_cast<unsigned>(sfn.GetFrame()),
+                                static_cast<unsigned>(sfn.GetSubframe()),
+                                static_cast<unsigned>(sfn.GetSlot()),
+                                static_cast<unsigned>(nodeId),
+                                static_cast<unsigned>(rnti),
+                                static_cast<unsigned>(bwpId),
+                                static_cast<unsigned>(harqId),
+                                static_cast<unsigned>(k1Delay));
+    }
+
+    static void TxPdu(NrTraceSinks* sinks,
+                      File f,
+                      uint16_t cellId,
+                      uint16_t rnti,
+                      uint8_t lcid,
+                      uint32_t size)
+    {
+        int h;
+        if (sinks->Skip() || (h = sinks->Handle(f)) < 0)
+        {
+            return;
+        }
+        sinks->m_writer->Printf(h,
+                                "%g\t%u\t%u\t%u\t%u\n",
+                                ns3::Simulator::Now().GetSeconds(),
+                                static_cast<unsigned>(cellId),
+                                static_cast<unsigned>(rnti),
+                                static_cast<unsigned>(lcid),
+                                static_cast<unsigned>(size));
+    }
+
+    static void RxPdu(NrTraceSinks* sinks,
+                      File f,
+                      uint16_t cellId,
+                      uint16_t rnti,
+                      uint8_t lcid,
+                      uint32_t size,
+                      uint64_t delay)
+    {
+        int h;
+        if (sinks->Skip() || (h = sinks->Handle(f)) < 0)
+        {
+            return;
+        }
+        sinks->m_writer->Printf(h,
+                                "%g\t%u\t%u\t%u\t%u\t%g\n",
+                                ns3::Simulator::Now().GetSeconds(),
+                                static_cast<unsigned>(cellId),
+                                static_cast<unsigned>(rnti),
+                                static_cast<unsigned>(lcid),
+                                static_cast<unsigned>(size),
+                                delay * 1e-9);
+    }
+
+    /// Connect the RLC and PDCP sinks of the bearer at path (a DataRadioBearerMap entry).
+    void ConnectBearer(const std::string& path,
+                       uint16_t cellId,
+                       File rlcTx,
+                       File rlcRx,
+                       File pdcpTx,
+                       File pdcpRx)
+    {
+        const struct
+        {
+            const char* layer;
+            File tx;
+            File rx;
+        } layers[] = {{"NrRlc", rlcTx, rlcRx}, {"NrPdcp", pdcpTx, pdcpRx}};
+        for (const auto& l : layers)
+        {
+            std::string base = path + "/" + l.layer + "/";
+            if (!ns3::Config::ConnectWithoutContextFailSafe(
+                    base + "TxPDU",
+                    ns3::MakeBoundCallback(&NrTraceSinks::TxPdu, this, l.tx, cellId)))
+            {
+                ++m_missingBearerSources;
+            }
+            if (!ns3::Config::ConnectWithoutContextFailSafe(
+                    base + "RxPDU",
+                    ns3::MakeBoundCallback(&NrTraceSinks::RxPdu, this, l.rx, cellId)))
+            {
+                ++m_missingBearerSources;
+            }
+        }
+    }
+
+    /// The DataRadioBearerMap is keyed by DRB id, which is the LCID - 2.
+    static std::string DrbPath(const std::string& rrc, uint8_t lcid)
+    {
+        return rrc + "/DataRadioBearerMap/" + std::to_string(lcid - 2);
+    }
+
+    static void UeDrbCreated(NrTraceSinks* sinks,
+                             std::string context,
+                             uint64_t /* imsi */,
+                             uint16_t cellId,
+                             uint16_t /* rnti */,
+                             uint8_t lcid)
+    {
+        std::string rrc = context.substr(0, context.rfind('/'));
+        sinks->ConnectBearer(DrbPath(rrc, lcid),
+                             cellId,
+                             UL_RLC_TX,
+                             DL_RLC_RX,
+                             UL_PDCP_TX,
+                             DL_PDCP_RX);
+    }
+
+    static void GnbDrbCreated(NrTraceSinks* sinks,
+                              std::string context,
+                              uint64_t /* imsi */,
+                              uint16_t cellId,
+                              uint16_t rnti,
+                              uint8_t lcid)
+    {
+        std::string ueManager =
+            context.substr(0, context.rfind('/')) + "/UeMap/" + std::to_string(rnti);
+        sinks->ConnectBearer(DrbPath(ueManager, lcid),
+                             cellId,
+                             DL_RLC_TX,
+                             UL_RLC_RX,
+                             DL_PDCP_TX,
+                             UL_PDCP_RX);
+    }
+
+    AsyncTraceWriter* m_writer;
+    std::string m_dir;
+    ns3::Time m_start;
+    int m_handles[NUM_FILES];
+    uint64_t m_records{0};
+    uint64_t m_missingBearerSources{0};
+};
+
+/**
+ * Switch on the NR module's own traces that NrTraceSinks does not write: control
+ * channel SINR, path loss, MAC scheduling, UE MAC control messages and the E2E
+ * RLC/PDCP statistics. Together with NrTraceSinks::Connect() this replaces
+ * NrHelper::EnableTraces().
+ */
+inline void
+EnableNrModuleTraces(ns3::Ptr<ns3::NrHelper> nrHelper)
+{
+    nrHelper->EnableDlCtrlPhyTraces();
+    nrHelper->EnablePathlossTraces();
+    nrHelper->EnableDlMacSchedTraces();
+    nrHelper->EnableUlMacSchedTraces();
+    nrHelper->EnableUeMacCtrlMsgsTraces();
+    nrHelper->EnableRlcE2eTraces();
+    nrHelper->EnablePdcpE2eTraces();
+}
+
+/// File names of the traces EnableNrModuleTraces() switches on.
+inline std::vector<std::string>
+GetNrModuleTraceFileNames()
+{
+    return {"DlCtrlSinr.txt",
+            "DlPathlossTrace.txt",
+            "UlPathlossTrace.txt",
+            "NrDlMacStats.txt",
+            "NrUlMacStats.txt",
+            "RxedUeMacCtrlMsgsTrace.txt",
+            "TxedUeMacCtrlMsgsTrace.txt",
+            "NrDlRlcStatsE2E.txt",
+            "NrUlRlcStatsE2E.txt",
+            "NrDlPdcpStatsE2E.txt",
+            "NrUlPdcpStatsE2E.txt"};
+}
+
+} // namespace kpm
+
+#endif // KPM_NR_TRACES_H
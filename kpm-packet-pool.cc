@@ -0,0 +1,213 @@
+/**
+ * \file kpm-packet-pool.cc
+ * \brief Benchmark of PacketPool against Create<Packet> on a source-to-RLC packet path.
+ *
+ * Every packet goes through what the stack does to a UDP packet of the
+ * scenario. The source adds a SeqTs header. The socket, UDP and IPv4 add tags
+ * and headers. The remote host's device holds the packet until it is sent; the
+ * p2p channel's copy is then segmented by RLC, and the segments wait in an RLC
+ * queue. Allocation happens once through Create<Packet> and once through a
+ * PacketPool. The program reports packets/s, heap allocations (operator new)
+ * per packet and per second, the pool hits and the resident memory. It also
+ * reassembles every 64th packet from its segments and checks the sequence
+ * number, i.e. that recycling never overwrote data shared with a segment.
+ *
+ * It needs the ns-3 network and internet modules; build it as a scratch program
+ * next to kpm-project-11:
+ *
+ * \code{.unparsed}
+$ ./ns3 run "kpm-packet-pool --packets=2000000 --size=238"
+$ ./ns3 run "kpm-packet-pool --packets=2000000 --metadata=true"
+ * \endcode
+ */
+
+#include "ns3/applications-module.h"
+#include "ns3/core-module.h"
+#include "ns3/internet-module.h"
+#include "ns3/network-module.h"
+
+#include "kpm-packet-pool.h"
+#include "kpm-process-stats.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <new>
+
+using namespace ns3;
+
+namespace
+{
+
+std::atomic<uint64_t> g_allocations{0};
+
+} // namespace
+
+void*
+operator new(size_t size)
+{
+    ++g_allocations;
+    void* p = std::malloc(size ? size : 1);
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void
+operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void
+operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+
+struct Result
+{
+    double seconds{0.0};
+    uint64_t allocations{0};
+    kpm::PacketPoolStats pool;
+    kpm::ProcessMemory memory;
+    bool intact{true};
+};
+
+/// Send packets packets of size payload bytes down the path, pooled or not.
+Result
+Run(uint32_t packets, uint32_t size, bool pooled, uint32_t deviceQueue, uint32_t rlcQueue)
+{
+    kpm::PacketPool pool;
+    std::deque<Ptr<Packet>> device;
+    std::deque<std::pair<Ptr<Packet>, uint32_t>> rlc; // segment, seq of the packet it was cut from
+    Result r;
+    uint64_t allocations = g_allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < packets; ++i)
+    {
+        Ptr<Packet> p = pooled ? pool.Allocate(size) : Create<Packet>(size);
+        SeqTsHeader seqTs;
+        seqTs.SetSeq(i);
+        p->AddHeader(seqTs);
+
+        SocketIpTtlTag ttl;
+        ttl.SetTtl(64);
+        p->AddPacketTag(ttl);
+        UdpHeader udp;
+        udp.SetSourcePort(49153);
+        udp.SetDestinationPort(1234);
+        p->AddHeader(udp);
+        Ipv4Header ip;
+        ip.SetSource(Ipv4Address("1.0.0.2"));
+        ip.SetDestination(Ipv4Address("7.0.0.2"));
+        ip.SetPayloadSize(p->GetSize());
+        p->AddHeader(ip);
+
+        // The device holds the packet until it is on the wire, the channel delivers a copy
+        device.push_back(p);
+        if (device.size() > deviceQueue)
+        {
+            device.pop_front();
+        }
+        Ptr<Packet> copy = p->Copy();
+        copy->RemoveHeader(ip);
+        copy->RemoveHeader(udp);
+
+        // RLC cuts the SDU in two segments that wait for a grant
+        uint32_t half = copy->GetSize() / 2;
+        rlc.emplace_back(copy->CreateFragment(0, half), i);
+        rlc.emplace_back(copy->CreateFragment(half, copy->GetSize() - half), i);
+        while (rlc.size() > 2 * rlcQueue)
+        {
+            // Reassemble a sample of the segments; the SDU starts with its SeqTs header
+            if (rlc.front().second % 64 == 0)
+            {
+                SeqTsHeader check;
+                Ptr<Packet> whole = rlc[0].first->Copy();
+                whole->AddAtEnd(rlc[1].first);
+                whole->RemoveHeader(check);
+                r.intact = r.intact && check.GetSeq() == rlc.front().second;
+            }
+            rlc.pop_front();
+            rlc.pop_front();
+        }
+    }
+    r.seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    r.allocations = g_allocations - allocations;
+    r.pool = pool.GetStats();
+    r.memory = kpm::ReadProcessMemory();
+    return r;
+}
+
+void
+Print(const char* name, uint32_t packets, const Result& r)
+{
+    std::printf("%-8s %12.0f %14.2f %14.0f %9.1f%% %10llu %10llu %s\n",
+                name,
+                packets / r.seconds,
+                static_cast<double>(r.allocations) / packets,
+                r.allocations / r.seconds,
+                r.pool.allocations > 0 ? 100.0 * r.pool.hits / r.pool.allocations : 0.0,
+                static_cast<unsigned long long>(r.memory.rssKb),
+                static_cast<unsigned long long>(r.memory.peakRssKb),
+                r.intact ? "ok" : "CORRUPT");
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    uint32_t packets = 1000000;
+    uint32_t size = 25 - 12;
+    uint32_t deviceQueue = 4;
+    uint32_t rlcQueue = 1024;
+    bool metadata = false;
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("packets", "Packets sent per run", packets);
+    cmd.AddValue("size", "Payload bytes behind the SeqTs header (udpPacketSizeBrowsing - 12)", size);
+    cmd.AddValue("deviceQueue", "Packets the sending device holds", deviceQueue);
+    cmd.AddValue("rlcQueue", "Segmented packets waiting in RLC", rlcQueue);
+    cmd.AddValue("metadata", "Enable packet metadata checking and printing, as kpm-project-11 does", metadata);
+    cmd.Parse(argc, argv);
+
+    if (metadata)
+    {
+        Packet::EnableChecking();
+        Packet::EnablePrinting();
+    }
+
+    kpm::ProcessMemory before = kpm::ReadProcessMemory();
+    std::printf("%u packets of %u + 12 bytes, device queue %u, RLC queue %u, metadata %s, "
+                "RSS before %llu kB\n\n",
+                packets,
+                size,
+                deviceQueue,
+                rlcQueue,
+                metadata ? "on" : "off",
+                static_cast<unsigned long long>(before.rssKb));
+    std::printf("%-8s %12s %14s %14s %10s %10s %10s %s\n",
+                "path",
+                "packets/s",
+                "allocs/packet",
+                "allocs/s",
+                "pool hits",
+                "RSS kB",
+                "peak kB",
+                "segments");
+    Result plain = Run(packets, size, false, deviceQueue, rlcQueue);
+    Print("create", packets, plain);
+    Result pooled = Run(packets, size, true, deviceQueue, rlcQueue);
+    Print("pool", packets, pooled);
+    return plain.intact && pooled.intact ? 0 : 1;
+}
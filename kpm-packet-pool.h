@@ -0,0 +1,137 @@
+/**
+ * \file kpm-packet-pool.h
+ * \brief Per-size free lists of packets for the high-rate traffic applications.
+ *
+ * At lambda = 100000 a source creates and frees 100k Packet objects per second
+ * and flow. PacketPool keeps the packets it handed out, per payload size, in
+ * send order. Once the stack has let go of the oldest one (the pool holds the
+ * only reference), the next Allocate() of that size takes it back instead of
+ * creating a packet. It strips the headers, packet tags, byte tags and nix
+ * vector that the stack added on the way down, down to the original payload.
+ *
+ * Reuse is safe with everything that happens further down. The reference count
+ * tells that no queue or trace holds the packet any more. Whatever was derived
+ * from it (the p2p channel's copy, the PDCP/RLC segments made from that copy)
+ * is a separate Packet; at most it shares the Buffer data copy-on-write. The
+ * new header then goes into a fresh buffer, and the segments keep their bytes.
+ *
+ * The stack must only add headers, no trailers, which holds for UDP down to a
+ * point-to-point link. A reused packet keeps its uid, so the uid no longer
+ * identifies one send across the whole run. Nothing in this project keys on it.
+ */
+
+#ifndef KPM_PACKET_POOL_H
+#define KPM_PACKET_POOL_H
+
+#include "ns3/network-module.h"
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <ostream>
+#include <string>
+
+namespace kpm
+{
+
+/// Counters of a PacketPool.
+struct PacketPoolStats
+{
+    uint64_t allocations{0}; ///< Allocate() calls
+    uint64_t hits{0};        ///< served with a pooled packet
+    uint64_t pooled{0};      ///< packets kept by the pool
+    uint64_t busy{0};        ///< misses because the oldest pooled packet was still in use
+
+    PacketPoolStats& operator+=(const PacketPoolStats& other)
+    {
+        allocations += other.allocations;
+        hits += other.hits;
+        pooled += other.pooled;
+        busy += other.busy;
+        return *this;
+    }
+
+    void Write(std::ostream& os) const
+    {
+        os << "\n\nPacket pool\n";
+        os << "  Allocations: " << allocations << "\n";
+        os << "  Pool hits: " << hits << " ("
+           << (allocations > 0 ? 100.0 * hits / allocations : 0.0) << "%)\n";
+        os << "  Misses with the oldest packet in flight: " << busy << "\n";
+        os << "  Pooled packets: " << pooled << "\n";
+    }
+};
+
+/// Packets of a source recycled once the stack has released them.
+class PacketPool
+{
+  public:
+    explicit PacketPool(size_t maxPerSize = 4096)
+        : m_maxPerSize(maxPerSize)
+    {
+    }
+
+    /// A packet of size (zero) payload bytes, pooled if possible.
+    ns3::Ptr<ns3::Packet> Allocate(uint32_t size)
+    {
+        ++m_stats.allocations;
+        std::deque<ns3::Ptr<ns3::Packet>>& list = m_lists[size];
+        if (!list.empty())
+        {
+            ns3::Ptr<ns3::Packet> p = list.front();
+            list.pop_front();
+            if (p->GetReferenceCount() == 1 && Reset(p, size))
+            {
+                // Nobody but the pool holds it
+                list.push_back(p);
+                ++m_stats.hits;
+                return p;
+            }
+            if (p->GetReferenceCount() > 1)
+            {
+                // Still in a queue: look at the next one next time
+                list.push_back(p);
+                ++m_stats.busy;
+            }
+            else
+            {
+                --m_stats.pooled;
+            }
+        }
+        ns3::Ptr<ns3::Packet> p = ns3::Create<ns3::Packet>(size);
+        if (list.size() < m_maxPerSize)
+        {
+            list.push_back(p);
+            ++m_stats.pooled;
+        }
+        return p;
+    }
+
+    const PacketPoolStats& GetStats() const
+    {
+        return m_stats;
+    }
+
+  private:
+    /// Strip what the stack added to p; false if it is not size payload bytes plus headers.
+    static bool Reset(ns3::Ptr<ns3::Packet> p, uint32_t size)
+    {
+        if (p->GetSize() < size)
+        {
+            return false;
+        }
+        p->RemoveAllPacketTags();
+        p->RemoveAllByteTags();
+        p->RemoveAtStart(p->GetSize() - size);
+        p->SetNixVector(nullptr);
+        return true;
+    }
+
+    size_t m_maxPerSize;
+    std::map<uint32_t, std::deque<ns3::Ptr<ns3::Packet>>> m_lists;
+    PacketPoolStats m_stats;
+};
+
+} // namespace kpm
+
+#endif // KPM_PACKET_POOL_H
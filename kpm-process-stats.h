@@ -0,0 +1,54 @@
+/**
+ * \file kpm-process-stats.h
+ * \brief Resident memory of the running process, for run reports and benchmarks.
+ *
+ * Reads VmRSS and VmHWM from /proc/self/status; both are 0 where the file does
+ * not exist. The header has no ns-3 dependency.
+ */
+
+#ifndef KPM_PROCESS_STATS_H
+#define KPM_PROCESS_STATS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace kpm
+{
+
+/// Resident set size now and at its peak, in kB.
+struct ProcessMemory
+{
+    uint64_t rssKb{0};
+    uint64_t peakRssKb{0};
+};
+
+inline ProcessMemory
+ReadProcessMemory()
+{
+    ProcessMemory m;
+    FILE* f = std::fopen("/proc/self/status", "r");
+    if (!f)
+    {
+        return m;
+    }
+    char line[256];
+    while (std::fgets(line, sizeof(line), f))
+    {
+        unsigned long long kb = 0;
+        if (std::sscanf(line, "VmRSS: %llu kB", &kb) == 1)
+        {
+            m.rssKb = kb;
+        }
+        else if (std::sscanf(line, "VmHWM: %llu kB", &kb) == 1)
+        {
+            m.peakRssKb = kb;
+        }
+    }
+    std::fclose(f);
+    return m;
+}
+
+} // namespace kpm
+
+#endif // KPM_PROCESS_STATS_H
@@ -0,0 +1,190 @@
+/**
+ * \file kpm-profile-bench.cc
+ * \brief Events/s and memory of the debug and the lean execution profile, with a KPI check.
+ *
+ * Runs the simulation once with --profile=debug and once with --profile=lean and
+ * reads the "Run profile" line each run prints after its report: events
+ * executed, wall time of Simulator::Run and resident memory. The table gives
+ * both profiles and the lean speed-up.
+ *
+ * The lean profile must not change the results. The KPIs of the two reports are
+ * compared line by line: everything from "Per-class flow statistics" on, without
+ * the control and other classes. Those hold the GTP tunnels, which only the
+ * debug profile's probes on the core network nodes see as flows. The per-flow
+ * list above is skipped for the same reason (its flow ids differ). The program
+ * exits with 1 if the KPIs differ.
+ *
+ * The command is run through the shell with --profile=<profile> appended; do not
+ * give it a --resultsCache, a cached run has no run statistics. Build ns-3 with
+ * the optimized profile to also compile the NS_LOG calls of the ns-3 modules out.
+ *
+ * \code{.unparsed}
+$ g++ -O2 -std=c++17 -o kpm-profile-bench kpm-profile-bench.cc
+$ ./kpm-profile-bench "./ns3 run 'kpm-project-11 --lambdaBrowsing=100000' --no-build"
+ * \endcode
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+int
+Usage(const char* argv0)
+{
+    std::fprintf(stderr, "Usage: %s \"<simulation command>\"\n", argv0);
+    return 1;
+}
+
+/// Run statistics and KPI lines of one run.
+struct Run
+{
+    bool ok{false};
+    unsigned long long events{0};
+    double seconds{0.0};
+    double eventsPerSecond{0.0};
+    unsigned long long rssMb{0};
+    unsigned long long peakRssMb{0};
+    std::vector<std::string> kpis;
+};
+
+/// Run the simulation with the profile and parse its output.
+Run
+RunProfile(const std::string& command, const char* profile)
+{
+    std::string cmd = command + " --profile=" + profile;
+    Run r;
+    FILE* pipe = popen(cmd.c_str(), "r");
+    if (!pipe)
+    {
+        return r;
+    }
+    char line[4096];
+    bool inKpis = false;
+    bool skipClass = false;
+    while (std::fgets(line, sizeof(line), pipe))
+    {
+        char name[32];
+        if (std::sscanf(line,
+                        "Run profile %31[^:]: %llu events in %lf s (%lf events/s), RSS %llu MB, "
+                        "peak %llu MB",
+                        name,
+                        &r.events,
+                        &r.seconds,
+                        &r.eventsPerSecond,
+                        &r.rssMb,
+                        &r.peakRssMb) == 6)
+        {
+            r.ok = true;
+            inKpis = false;
+            continue;
+        }
+        if (std::strncmp(line, "Per-class flow statistics", 25) == 0)
+        {
+            inKpis = true;
+        }
+        if (!inKpis)
+        {
+            continue;
+        }
+        if (std::strncmp(line, "Class ", 6) == 0)
+        {
+            skipClass = std::strncmp(line, "Class control", 13) == 0 ||
+                        std::strncmp(line, "Class other", 11) == 0;
+        }
+        else if (std::strncmp(line, "  ", 2) != 0)
+        {
+            skipClass = false;
+        }
+        if (!skipClass)
+        {
+            r.kpis.emplace_back(line);
+        }
+    }
+    if (pclose(pipe) != 0 || !r.ok)
+    {
+        std::fprintf(stderr, "No run statistics from: %s\n", cmd.c_str());
+        r.ok = false;
+    }
+    return r;
+}
+
+void
+Print(const char* profile, const Run& r)
+{
+    std::printf("%-8s %12llu %10.2f %12.0f %8llu %8llu\n",
+                profile,
+                r.events,
+                r.seconds,
+                r.eventsPerSecond,
+                r.rssMb,
+                r.peakRssMb);
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    if (argc != 2 || std::strncmp(argv[1], "--", 2) == 0)
+    {
+        return Usage(argv[0]);
+    }
+    std::string command = argv[1];
+
+    Run debug = RunProfile(command, "debug");
+    Run lean = RunProfile(command, "lean");
+    if (!debug.ok || !lean.ok)
+    {
+        return 1;
+    }
+
+    std::printf("%-8s %12s %10s %12s %8s %8s\n",
+                "profile",
+                "events",
+                "run s",
+                "events/s",
+                "RSS MB",
+                "peak MB");
+    Print("debug", debug);
+    Print("lean", lean);
+    if (debug.seconds > 0 && lean.seconds > 0)
+    {
+        std::printf("\nLean: %.2fx the events/s, %.2fx the run time, %lld MB peak RSS\n",
+                    lean.eventsPerSecond / debug.eventsPerSecond,
+                    lean.seconds / debug.seconds,
+                    static_cast<long long>(lean.peakRssMb) -
+                        static_cast<long long>(debug.peakRssMb));
+    }
+
+    size_t differ = 0;
+    for (size_t i = 0; i < std::max(debug.kpis.size(), lean.kpis.size()); ++i)
+    {
+        const std::string& d = i < debug.kpis.size() ? debug.kpis[i] : std::string();
+        const std::string& l = i < lean.kpis.size() ? lean.kpis[i] : std::string();
+        if (d != l)
+        {
+            if (++differ == 1)
+            {
+                std::printf("\nKPI lines that differ:\n");
+            }
+            if (differ <= 10)
+            {
+                std::printf("  debug: %s  lean:  %s", d.c_str(), l.c_str());
+            }
+        }
+    }
+    if (debug.kpis.empty())
+    {
+        std::printf("\nKPIs: no \"Per-class flow statistics\" in the reports\n");
+        return 1;
+    }
+    std::printf("\nKPIs (%zu report lines): %s\n",
+                debug.kpis.size(),
+                differ == 0 ? "identical" : "DIFFER");
+    return differ == 0 ? 0 : 1;
+}
@@ -41,13 +41,335 @@ $ ./ns3 run "kpm-project --help"
 #include "ns3/nr-module.h"
 #include "ns3/point-to-point-module.h"
 
+#include "kpm-async-writer.h"
+#include "kpm-checkpoint.h"
+#include "kpm-flight-recorder.h"
+#include "kpm-flow-classes.h"
+#include "kpm-flow-probe.h"
+#include "kpm-harq-stats.h"
+#include "kpm-nr-traces.h"
+#include "kpm-packet-pool.h"
+#include "kpm-process-stats.h"
+#include "kpm-run-cache.h"
+#include "kpm-soak.h"
+#include "kpm-tcp-probe.h"
+#include "kpm-trace-index.h"
+#include "kpm-trace-store.h"
+#include "kpm-traffic-generator.h"
+#include "kpm-web-browsing.h"
+#include "kpm-ue-map.h"
+#include "kpm-voip.h"
+
+#include <chrono>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <set>
+
 using namespace ns3;
 
 NS_LOG_COMPONENT_DEFINE("KpmProject");
 
+/**
+ * Feed every DL transport block received by a UE into the HARQ/BLER statistics.
+ */
+static void
+RxPacketTraceUe(kpm::HarqStats* stats, RxPacketTraceParams params)
+{
+    stats->AddTb(params.m_cellId, params.m_rnti, true, params.m_mcs, params.m_cqi, params.m_rv,
+                 10 * std::log10(params.m_sinr), params.m_corrupt, params.m_tbler, params.m_tbSize);
+}
+
+/**
+ * Feed every UL transport block received by a gNB into the HARQ/BLER statistics.
+ */
+static void
+RxPacketTraceGnb(kpm::HarqStats* stats, RxPacketTraceParams params)
+{
+    stats->AddTb(params.m_cellId, params.m_rnti, false, params.m_mcs, params.m_cqi, params.m_rv,
+                 10 * std::log10(params.m_sinr), params.m_corrupt, params.m_tbler, params.m_tbSize);
+}
+
+/// Flight recorder streams and trigger state of the PHY/MAC trace sinks.
+struct FlightHooks
+{
+    kpm::FlightRecorder* recorder{nullptr};
+    int tbStream{-1};
+    int schedStream{-1};
+    kpm::BurstCounter corrupt;
+};
+
+/**
+ * Buffer a received transport block in the flight recorder, in the
+ * RxPacketTrace.txt layout, and fire the corrupt-burst trigger.
+ */
+static void
+FlightRecordTb(FlightHooks* hooks, const char* direction, const RxPacketTraceParams& params)
+{
+    double now = Simulator::Now().GetSeconds();
+    hooks->recorder->Record(hooks->tbStream,
+                            now,
+                            "%.9f\t%s\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%.4f\t%u\t%u"
+                            "\t%.6f",
+                            now,
+                            direction,
+                            static_cast<unsigned>(params.m_frameNum),
+                            static_cast<unsigned>(params.m_subframeNum),
+                            static_cast<unsigned>(params.m_slotNum),
+                            static_cast<unsigned>(params.m_symStart),
+                            static_cast<unsigned>(params.m_numSym),
+                            static_cast<unsigned>(params.m_cellId),
+                            static_cast<unsigned>(params.m_bwpId),
+                            static_cast<unsigned>(params.m_rnti),
+                            static_cast<unsigned>(params.m_tbSize),
+                            static_cast<unsigned>(params.m_mcs),
+                            static_cast<unsigned>(params.m_rank),
+                            static_cast<unsigned>(params.m_rv),
+                            10 * std::log10(params.m_sinr),
+                            static_cast<unsigned>(params.m_cqi),
+                            static_cast<unsigned>(params.m_corrupt),
+                            params.m_tbler);
+    uint64_t ue = (uint64_t(params.m_cellId) << 17) | (uint64_t(params.m_rnti) << 1) |
+                  (direction[0] == 'D' ? 1 : 0);
+    if (hooks->corrupt.Add(ue, params.m_corrupt, hooks->recorder->GetConfig().corruptBurst))
+    {
+        std::ostringstream detail;
+        detail << direction << " cell " << params.m_cellId << " rnti " << params.m_rnti << ", "
+               << hooks->recorder->GetConfig().corruptBurst << " corrupt TBs in a row";
+        hooks->recorder->Trigger(now, "corrupt", detail.str());
+    }
+}
+
+static void
+FlightRxPacketTraceUe(FlightHooks* hooks, RxPacketTraceParams params)
+{
+    FlightRecordTb(hooks, "DL", params);
+}
+
+static void
+FlightRxPacketTraceGnb(FlightHooks* hooks, RxPacketTraceParams params)
+{
+    FlightRecordTb(hooks, "UL", params);
+}
+
+/**
+ * Buffer a DL scheduling decision of a gNB MAC in the flight recorder, in the
+ * NrDlMacStats.txt layout.
+ */
+static void
+FlightDlScheduling(FlightHooks* hooks, uint16_t cellId, NrSchedulingCallbackInfo info)
+{
+    double now = Simulator::Now().GetSeconds();
+    hooks->recorder->Record(hooks->schedStream,
+                            now,
+                            "%.9f\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u",
+                            now,
+                            static_cast<unsigned>(cellId),
+                            static_cast<unsigned>(info.m_bwpId),
+                            static_cast<unsigned>(info.m_frameNum),
+                            static_cast<unsigned>(info.m_subframeNum),
+                            static_cast<unsigned>(info.m_slotNum),
+                            static_cast<unsigned>(info.m_symStart),
+                            static_cast<unsigned>(info.m_numSym),
+                            static_cast<unsigned>(info.m_rnti),
+                            static_cast<unsigned>(info.m_mcs),
+                            static_cast<unsigned>(info.m_tbSize),
+                            static_cast<unsigned>(info.m_ndi),
+                            static_cast<unsigned>(info.m_rv));
+}
+
+/**
+ * Record the cell and RNTI of a UE once its RRC connection is established.
+ */
+static void
+UeRrcConnectionEstablished(kpm::UeMap* ueMap, uint64_t imsi, uint16_t cellId, uint16_t rnti)
+{
+    ueMap->Update(Simulator::Now().GetSeconds(), "CONNECTED", imsi, cellId, rnti);
+    if (ueMap->AllConnected())
+    {
+        NS_LOG_INFO("All " << ueMap->GetUes().size() << " UEs connected at "
+                           << Simulator::Now().GetSeconds() << " s");
+    }
+}
+
+/**
+ * Record the new cell and RNTI of a UE after a handover.
+ */
+static void
+UeRrcHandoverEndOk(kpm::UeMap* ueMap, uint64_t imsi, uint16_t cellId, uint16_t rnti)
+{
+    ueMap->Update(Simulator::Now().GetSeconds(), "HANDOVER", imsi, cellId, rnti);
+}
+
+/// Soak samples and the long-run containers they flush.
+struct SoakHooks
+{
+    kpm::SoakMonitor* monitor{nullptr};
+    kpm::FlowProbe* flowProbe{nullptr};
+    std::ostream* timeline{nullptr};
+    Time interval;
+    std::chrono::steady_clock::time_point wallStart;
+    uint64_t eventsBefore{0};
+};
+
+/**
+ * Record the RSS of the process and write out the finished flow timeline bins,
+ * once every soak interval.
+ */
+static void
+SoakTick(SoakHooks* hooks)
+{
+    double now = Simulator::Now().GetSeconds();
+    hooks->monitor->Sample(
+        now,
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - hooks->wallStart).count(),
+        Simulator::GetEventCount() - hooks->eventsBefore,
+        kpm::ReadProcessMemory());
+    if (hooks->timeline)
+    {
+        hooks->flowProbe->FlushTimeline(*hooks->timeline, now);
+        hooks->timeline->flush();
+    }
+    Simulator::Schedule(hooks->interval, &SoakTick, hooks);
+}
+
+/// Checkpoint manifests of this run, and the checkpoint a resumed run continues from.
+struct CheckpointHooks
+{
+    Ptr<ns3::FlowMonitor> monitor;
+    const kpm::HarqStats* harqStats{nullptr};
+    std::string config;
+    std::string manifest; ///< empty: no manifests
+    std::string outputDir;
+    std::filesystem::file_time_type runStart;
+    const kpm::CheckpointManifest* resume{nullptr};
+    std::chrono::steady_clock::time_point wallStart;
+};
+
+/**
+ * At a checkpoint, compare the counters with those of the checkpoint a resumed run
+ * continues from, then write the manifest.
+ */
+static void
+CheckpointTick(CheckpointHooks* hooks)
+{
+    double now = Simulator::Now().GetSeconds();
+    std::vector<std::pair<std::string, uint64_t>> fingerprint = {
+        {"txPackets", 0}, {"rxPackets", 0}, {"rxBytes", 0}};
+    for (const auto& flow : hooks->monitor->GetFlowStats())
+    {
+        fingerprint[0].second += flow.second.txPackets;
+        fingerprint[1].second += flow.second.rxPackets;
+        fingerprint[2].second += flow.second.rxBytes;
+    }
+    fingerprint.emplace_back("dlTbs", hooks->harqStats->GetTotal(true).tbs);
+    fingerprint.emplace_back("ulTbs", hooks->harqStats->GetTotal(false).tbs);
+
+    if (hooks->resume && Simulator::Now() == Seconds(hooks->resume->time))
+    {
+        NS_ABORT_MSG_IF(fingerprint != hooks->resume->fingerprint,
+                        "The replay diverged from the interrupted run at " << now << " s");
+        NS_LOG_INFO("Replayed up to the checkpoint at " << now << " s");
+    }
+    if (hooks->manifest.empty())
+    {
+        return;
+    }
+    kpm::CheckpointManifest manifest;
+    manifest.config = hooks->config;
+    manifest.time = now;
+    manifest.wallTime =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - hooks->wallStart).count();
+    manifest.events = Simulator::GetEventCount();
+    manifest.fingerprint = fingerprint;
+    manifest.traces = kpm::ListRunTraces(hooks->outputDir, hooks->runStart);
+    if (!manifest.Write(hooks->manifest))
+    {
+        NS_LOG_ERROR("Can't write the checkpoint manifest " << hooks->manifest);
+    }
+}
+
+/**
+ * Fast start: count down the data radio bearers a UE still waits for, and end the
+ * attach phase once every UE has all of them.
+ */
+static void
+UeDrbCreated(std::map<uint64_t, uint32_t>* pendingDrbs,
+             uint64_t imsi,
+             uint16_t cellId,
+             uint16_t rnti,
+             uint8_t lcid)
+{
+    auto it = pendingDrbs->find(imsi);
+    if (it == pendingDrbs->end() || it->second == 0 || --it->second > 0)
+    {
+        return;
+    }
+    for (const auto& ue : *pendingDrbs)
+    {
+        if (ue.second > 0)
+        {
+            return;
+        }
+    }
+    NS_LOG_INFO("All " << pendingDrbs->size() << " UEs attached with their bearers at "
+                       << Simulator::Now().GetSeconds() << " s");
+    Simulator::Stop();
+}
+
+/**
+ * Trace store: the files of dir this run wrote, picked by name (the NR traces, the
+ * files named after simTag, their indexes and compressed forms) and last written at
+ * or after runStart. Only these are moved to the store; whatever else shares the
+ * directory is left alone.
+ */
+static std::vector<std::string>
+RunOutputFiles(const std::string& dir,
+               const std::string& simTag,
+               std::filesystem::file_time_type runStart)
+{
+    std::set<std::string> nrTraces;
+    for (const auto& names :
+         {kpm::NrTraceSinks::GetFileNames(), kpm::GetNrModuleTraceFileNames()})
+    {
+        nrTraces.insert(names.begin(), names.end());
+    }
+    auto startsWith = [](const std::string& s, const std::string& prefix) {
+        return s.compare(0, prefix.size(), prefix) == 0;
+    };
+    std::vector<std::string> files;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec))
+    {
+        if (!entry.is_regular_file() || entry.last_write_time() < runStart)
+        {
+            continue;
+        }
+        std::string name = entry.path().filename().string();
+        std::string base = name;
+        for (const std::string& suffix : {std::string(".idx"), std::string(".kpz")})
+        {
+            if (base.size() > suffix.size() &&
+                base.compare(base.size() - suffix.size(), suffix.size(), suffix) == 0)
+            {
+                base.resize(base.size() - suffix.size());
+            }
+        }
+        if (nrTraces.count(base) > 0 || base == simTag || startsWith(base, simTag + "-") ||
+            startsWith(base, simTag + ".") || startsWith(base, "nr-rem-" + simTag + "-"))
+        {
+            files.push_back(name);
+        }
+    }
+    return files;
+}
+
 int
 main(int argc, char* argv[])
 {
+    // Files written from here on are the output of this run (see --traceStore)
+    const auto runStart = std::filesystem::file_time_type::clock::now();
+
     /** ______  ______   ______   ______   __    __   ______    
     *  /\  == \/\  __ \ /\  == \ /\  __ \ /\ "-./  \ /\  ___\   
     *  \ \  _-/\ \  __ \\ \  __< \ \  __ \\ \ \-./\ \\ \___  \  
@@ -63,6 +385,39 @@ main(int argc, char* argv[])
 	uint32_t lambdaBrowsing = 10000;  // Default lambda for browsing traffic
 	uint32_t lambdaVoiceCall = 10000;  // Default lambda for voice traffic
 	double totalTxPower = 35.0;  // Default total TX power
+	uint32_t traceIndexStride = kpm::TRACE_INDEX_DEFAULT_STRIDE;  // Records per trace index block, 0 disables
+	bool harqStats = true;  // Online HARQ/BLER analysis of the received transport blocks
+	std::string traceStore = "";  // Content-addressed store the run output is added to, empty disables
+	std::string resultsCache = "";  // Results of finished runs keyed by configuration hash, empty disables
+	std::string measurementWindows = "";  // Flow statistics windows "start-end[,start-end...]" in s, empty disables
+	double flowTimelineBin = 0.0;  // Bin width in s of the per-flow throughput timeline, 0 disables
+	double voiceGbr = 0.0;  // Guaranteed bit rate in Mbps a voice flow must reach to be GBR compliant
+	bool asyncTraceWriter = true;  // Write the in-run traces (UE map, per-packet NR traces) from a background thread
+	bool compressTraces = false;  // Store the traces as seekable block-compressed .kpz files
+	std::string flightRecorder = "";  // Flight recorder windows and triggers, empty disables
+	std::string trafficModel = "udp-client";  // Arrival process of the DL sources, udp-client keeps the constant-interval UdpClient
+	bool trafficBatching = true;  // Hand the packets of a traffic generator to the socket once per slot
+	double trafficOnTime = 0.01;  // Mean ON period in s of the onoff traffic model
+	double trafficOffTime = 0.01;  // Mean OFF period in s of the onoff traffic model
+	double trafficBurstSize = 4.0;  // Mean packets per burst of the batch traffic model
+	std::string webBrowsing = "";  // Page sessions for the browsing UEs over "tcp" or "udp", empty keeps the constant stream
+	std::string browsingTransport = "udp";  // Transport of the constant browsing stream, "udp" or "tcp"
+	std::string tcpCongestionControl = "";  // TCP congestion control, e.g. "Cubic" or "ns3::TcpBbr", empty keeps ns-3's NewReno
+	double tcpSampleInterval = 0.001;  // Simulated s between the cwnd/RTT/goodput samples of the TCP flows
+	double webReadingTime = 30.0;  // Mean reading time in s between the pages of a browsing UE
+	std::string voiceCodec = "";  // Codec of the voice calls (VoipSource), empty keeps the UdpClient stream
+	uint32_t voiceUesPerGnb = 0;  // Voice UEs per gNB, each with a browsing UE, 0 keeps the assignment layout
+	double voiceDelayBudget = 50.0;  // Delay budget in ms of a satisfied voice user
+	bool packetPool = true;  // Recycle the packets of the traffic generators and VoIP sources
+	std::string ulTraffic = "";  // Uplink traffic classes, "voice", "browsing" or "all", empty keeps the downlink only
+	std::string profile = "debug";  // Execution profile, "lean" strips the debug-only per-packet work
+	bool fastStart = false;  // Start the traffic once every UE is attached, instead of at udpAppStartTime
+	double runTime = 0.0;  // Simulated run length in s, 0 keeps the 100 ms run
+	double soakTime = 0.0;  // Length in s of a soak run with bounded memory, 0 keeps the 100 ms run
+	double soakInterval = 1.0;  // Simulated s between the RSS samples and flushes of a soak run
+	uint32_t soakRlcBuffer = 1000000;  // RLC transmission buffer in bytes of a soak run
+	double checkpointInterval = 0.0;  // Simulated s between checkpoint manifests, 0 disables
+	std::string resume = "";  // Checkpoint manifest of an interrupted run to resume from, empty disables
 	
 	CommandLine cmd(__FILE__);
 	cmd.AddValue("direction", "Direction of the REM: 'UL' or 'DL'", direction);
@@ -72,9 +427,54 @@ main(int argc, char* argv[])
 	cmd.AddValue("lambdaBrowsing", "Packet generation rate (packets/sec) for browsing traffic", lambdaBrowsing);
 	cmd.AddValue("lambdaVoiceCall", "Packet generation rate (packets/sec) for voice call traffic", lambdaVoiceCall);
 	cmd.AddValue("totalTxPower", "Total transmission power in dBm", totalTxPower);
+	cmd.AddValue("traceIndexStride", "Records per block of the trace sidecar indexes (0 disables them)", traceIndexStride);
+	cmd.AddValue("harqStats", "Compute HARQ/BLER/MCS/CQI statistics online and write them to <simTag>-harq-stats.txt", harqStats);
+	cmd.AddValue("traceStore", "Directory of a deduplicated trace store to move the output of this run to, as run <simTag>-<configuration hash>; the stored files are removed from the output directory (empty disables)", traceStore);
+	cmd.AddValue("measurementWindows", "Also report flow statistics of the packets sent in these windows, \"start-end[,start-end...]\" in seconds, e.g. \"0.03-\" to skip the warm-up (empty disables)", measurementWindows);
+	cmd.AddValue("flowTimelineBin", "Bin width in seconds of the per-flow throughput/delay timeline written to <simTag>-flow-timeline.txt, e.g. 0.001 (0 disables)", flowTimelineBin);
+	cmd.AddValue("voiceGbr", "Throughput in Mbps a voice flow must reach, besides the 5QI 1 delay budget and error rate, to count as GBR compliant (0: no rate check)", voiceGbr);
+	cmd.AddValue("asyncTraceWriter", "Write the traces produced during the run (the UE map and the per-packet NR traces) through buffers flushed by a background thread", asyncTraceWriter);
+	cmd.AddValue("compressTraces", "Replace the traces by block-compressed <trace>.kpz files that kpm-trace-query and the other tools read in place (the UE map is compressed on the writer thread)", compressTraces);
+	cmd.AddValue("flightRecorder", "Keep the last PHY/MAC/application records in memory and write them, and those that follow, to <simTag>-flight-* only around anomalies: \"on\" or \"pre=5,post=5,delay=50,corrupt=3,backlog=100000,captures=20\" (ms, TBs, bytes; empty disables)", flightRecorder);
+	cmd.AddValue("trafficModel", "Arrival process of the DL traffic at rate lambdaBrowsing/lambdaVoiceCall: 'udp-client' (UdpClient, one packet every 1/lambda), or a traffic generator with 'periodic', 'poisson', 'onoff' or 'batch' arrivals", trafficModel);
+	cmd.AddValue("trafficBatching", "Send the packets a traffic generator draws within a slot with one event at the slot end, instead of one event per packet", trafficBatching);
+	cmd.AddValue("trafficOnTime", "Mean ON period in seconds of the onoff traffic model", trafficOnTime);
+	cmd.AddValue("trafficOffTime", "Mean OFF period in seconds of the onoff traffic model", trafficOffTime);
+	cmd.AddValue("trafficBurstSize", "Mean packets per burst of the batch traffic model", trafficBurstSize);
+	cmd.AddValue("webBrowsing", "Let the browsing UEs load web pages (3GPP web browsing model) from the remote host over 'tcp' or 'udp' and report the page load times, instead of the constant UDP stream (empty)", webBrowsing);
+	cmd.AddValue("browsingTransport", "Carry the constant browsing stream over 'udp' (UdpClient) or 'tcp' (an always-on OnOffApplication at the same rate, held back by the congestion control)", browsingTransport);
+	cmd.AddValue("tcpCongestionControl", "Congestion control of all TCP connections, e.g. 'NewReno', 'Cubic', 'Bbr', 'Vegas' or a full ns-3 type name (empty: ns-3's default)", tcpCongestionControl);
+	cmd.AddValue("tcpSampleInterval", "Simulated seconds between the samples of cwnd, RTT and goodput of every TCP flow in <simTag>-tcp.txt", tcpSampleInterval);
+	cmd.AddValue("webReadingTime", "Mean reading time in seconds between two pages of a browsing UE", webReadingTime);
+	cmd.AddValue("voiceCodec", "Send the voice calls as a codec with talk spurts and silences would ('amr-nb', 'amr-wb', 'evs' or 'g711') instead of lambdaVoiceCall packets/s (empty)", voiceCodec);
+	cmd.AddValue("voiceUesPerGnb", "Voice UEs per gNB, each paired with a browsing UE, e.g. for kpm-voice-capacity (0 keeps the assignment's 2 voice and 3 browsing UEs)", voiceUesPerGnb);
+	cmd.AddValue("voiceDelayBudget", "Delay budget in ms within which 98% of a voice user's packets must arrive for the user to count as satisfied", voiceDelayBudget);
+	cmd.AddValue("ulTraffic", "Also send the traffic of these classes from the UEs to the remote host over the same bearers: 'voice' (two-way calls), 'browsing' or 'all' (empty: downlink only)", ulTraffic);
+	cmd.AddValue("packetPool", "Let the traffic generators and VoIP sources recycle their packets once the stack has released them, instead of creating one per send", packetPool);
+	cmd.AddValue("profile", "'debug' (packet metadata checking and printing, INFO logging, FlowMonitor on every node, NR text traces) or 'lean' (none of these; FlowMonitor on the UEs and the remote host only, same per-class KPIs)", profile);
+	cmd.AddValue("fastStart", "Run the attach on its own first and start the traffic as soon as every UE has its bearers, instead of at udpAppStartTime whether attached or not; the run still ends at simTime", fastStart);
+	cmd.AddValue("runTime", "Simulated length in seconds of the run, e.g. tens of seconds for the talk spurts of --voiceCodec to average out; unlike soakTime nothing else changes (0 keeps the 100 ms run)", runTime);
+	cmd.AddValue("soakTime", "Run for this many simulated seconds as a soak test: RLC buffers capped at soakRlcBuffer, the flow timeline flushed every soakInterval, and the RSS sampled to <simTag>-soak.txt with its growth rate (0 keeps the 100 ms run)", soakTime);
+	cmd.AddValue("soakInterval", "Simulated seconds between the RSS samples and flushes of a soak run", soakInterval);
+	cmd.AddValue("soakRlcBuffer", "RLC transmission buffer in bytes per bearer of a soak run, instead of an unbounded one", soakRlcBuffer);
+	cmd.AddValue("checkpointInterval", "Every this many simulated seconds, write the checkpoint manifest <simTag>.checkpoint that --resume continues an interrupted run from (0 disables)", checkpointInterval);
+	cmd.AddValue("resume", "Checkpoint manifest of an interrupted run with the same configuration and output directory: replay up to its checkpoint (without writing the per-packet NR traces, with asyncTraceWriter), then continue and splice the traces (empty disables)", resume);
+	cmd.AddValue("resultsCache", "Directory of cached run results; a run whose configuration was already run returns the stored results (empty disables)", resultsCache);
 
 	// If --PrintHelp is provided, display the help message and exit
 	cmd.Parse(argc, argv);
+	NS_ABORT_MSG_IF(profile != "debug" && profile != "lean", "Unknown profile \"" << profile << "\"");
+	bool lean = profile == "lean";
+	NS_ABORT_MSG_IF(!ulTraffic.empty() && ulTraffic != "voice" && ulTraffic != "browsing" &&
+	                    ulTraffic != "all",
+	                "Unknown ulTraffic \"" << ulTraffic << "\"");
+	bool ulVoice = ulTraffic == "voice" || ulTraffic == "all";
+	bool ulBrowsing = ulTraffic == "browsing" || ulTraffic == "all";
+	NS_ABORT_MSG_IF(browsingTransport != "udp" && browsingTransport != "tcp",
+	                "Unknown browsingTransport \"" << browsingTransport << "\"");
+	NS_ABORT_MSG_IF(browsingTransport == "tcp" && !webBrowsing.empty(),
+	                "browsingTransport=tcp needs the constant stream, webBrowsing replaces it");
+	bool tcpBrowsing = browsingTransport == "tcp";
 
 	// Scenario parameters (that we will use inside this script):
 	uint16_t numGnb = 3;
@@ -82,12 +482,34 @@ main(int argc, char* argv[])
 	uint32_t numTotalUe = numGnb * numUePerGnb;
 	uint32_t totalUesCall = 2; // Total voice UEs
 	uint32_t totalUesBrowse = 3; // Total browsing UEs
+	if (voiceUesPerGnb > 0)
+	{
+		// Alternating voice and browsing UEs, voiceUesPerGnb of each per gNB
+		numUePerGnb = 2 * voiceUesPerGnb;
+		numTotalUe = numGnb * numUePerGnb;
+		totalUesCall = numGnb * voiceUesPerGnb;
+		totalUesBrowse = numGnb * voiceUesPerGnb;
+	}
 
-	int logging = 1;
+	int logging = lean ? 0 : 1;
 
 	// Simulation parameters.
 	Time simTime = MilliSeconds(100);
 	Time udpAppStartTime = MilliSeconds(10);
+	NS_ABORT_MSG_IF(runTime > 0 && soakTime > 0, "Set either runTime or soakTime");
+	if (runTime > 0)
+	{
+		simTime = Seconds(runTime);
+		NS_ABORT_MSG_IF(simTime <= udpAppStartTime,
+		                "runTime must be > " << udpAppStartTime.GetSeconds() << " s");
+	}
+	if (soakTime > 0)
+	{
+		simTime = Seconds(soakTime);
+		NS_ABORT_MSG_IF(simTime <= udpAppStartTime || soakInterval <= 0,
+		                "A soak run needs soakTime > " << udpAppStartTime.GetSeconds()
+		                                               << " s and soakInterval > 0");
+	}
 
 	// NR parameters (Reference: 3GPP TR 38.901 V17.0.0 (Release 17)
 	// Table 7.8-1 for the power and BW).
@@ -105,6 +527,11 @@ main(int argc, char* argv[])
 	// Where we will store the output files.
 	std::string simTag = "default";
 	std::string outputDir = "./";
+	std::string ueMapFile = outputDir + "/" + simTag + "-ue-map.txt";
+	if (compressTraces && asyncTraceWriter)
+	{
+		ueMapFile = kpm::CompressedTracePath(ueMapFile);
+	}
 
 	// Rem parameters
 	double xMin = -40.0;
@@ -135,7 +562,155 @@ main(int argc, char* argv[])
         LogComponentEnable("NrPdcp", LOG_LEVEL_INFO);
     }
 
-    Config::SetDefault("ns3::NrRlcUm::MaxTxBufferSize", UintegerValue(999999999));
+    // Unbounded for the short run; a soak run would otherwise queue everything the cell can't carry
+    Config::SetDefault("ns3::NrRlcUm::MaxTxBufferSize",
+                       UintegerValue(soakTime > 0 ? soakRlcBuffer : 999999999));
+
+    // "Cubic", "TcpCubic" and "ns3::TcpCubic" name the same congestion control
+    if (!tcpCongestionControl.empty())
+    {
+        std::string name = tcpCongestionControl;
+        if (name.find("::") == std::string::npos)
+        {
+            name = "ns3::" + (name.compare(0, 3, "Tcp") == 0 ? name : "Tcp" + name);
+        }
+        TypeId congestionControl;
+        NS_ABORT_MSG_IF(!TypeId::LookupByNameFailSafe(name, &congestionControl),
+                        "Unknown tcpCongestionControl \"" << tcpCongestionControl << "\"");
+        Config::SetDefault("ns3::TcpL4Protocol::SocketType", TypeIdValue(congestionControl));
+    }
+
+    /*
+     * Whole-run memoisation. The key covers every input of the run: the command line
+     * values, the scenario constants above, all attribute defaults and global values
+     * (including the RNG seed and run, and --ns3::...=... overrides), the executable,
+     * which holds the remaining hard-coded constants, and the ns-3 shared libraries. Output naming
+     * (simTag, outputDir, traceStore, traceIndexStride) and checkpointing
+     * (checkpointInterval, resume) do not change the results and are left out. See
+     * kpm-run-cache.h. The same hash identifies the configuration of a checkpoint and
+     * names the run in the trace store.
+     */
+    kpm::RunKey runKey;
+    std::string runHash;
+    if (!resultsCache.empty() || checkpointInterval > 0 || !resume.empty() ||
+        !traceStore.empty())
+    {
+        runKey.Add("direction", direction);
+        runKey.Add("mode", mode);
+        runKey.Add("udpPacketSizeBrowsing", udpPacketSizeBrowsing);
+        runKey.Add("udpPacketSizeVoiceCall", udpPacketSizeVoiceCall);
+        runKey.Add("lambdaBrowsing", lambdaBrowsing);
+        runKey.Add("lambdaVoiceCall", lambdaVoiceCall);
+        runKey.Add("totalTxPower", totalTxPower);
+        runKey.Add("harqStats", harqStats);
+        runKey.Add("measurementWindows", measurementWindows);
+        runKey.Add("flowTimelineBin", flowTimelineBin);
+        runKey.Add("voiceGbr", voiceGbr);
+        runKey.Add("compressTraces", compressTraces);
+        runKey.Add("flightRecorder", flightRecorder);
+        runKey.Add("trafficModel", trafficModel);
+        runKey.Add("trafficBatching", trafficBatching);
+        runKey.Add("trafficOnTime", trafficOnTime);
+        runKey.Add("trafficOffTime", trafficOffTime);
+        runKey.Add("trafficBurstSize", trafficBurstSize);
+        runKey.Add("webBrowsing", webBrowsing);
+        runKey.Add("webReadingTime", webReadingTime);
+        runKey.Add("voiceCodec", voiceCodec);
+        runKey.Add("voiceDelayBudget", voiceDelayBudget);
+        runKey.Add("packetPool", packetPool);
+        runKey.Add("ulTraffic", ulTraffic);
+        runKey.Add("browsingTransport", browsingTransport);
+        runKey.Add("tcpCongestionControl", tcpCongestionControl);
+        runKey.Add("tcpSampleInterval", tcpSampleInterval);
+        runKey.Add("profile", profile);
+        runKey.Add("fastStart", fastStart);
+        runKey.Add("soakTime", soakTime);
+        runKey.Add("soakInterval", soakInterval);
+        runKey.Add("soakRlcBuffer", soakRlcBuffer);
+        runKey.Add("numGnb", numGnb);
+        runKey.Add("numUePerGnb", numUePerGnb);
+        runKey.Add("totalUesCall", totalUesCall);
+        runKey.Add("totalUesBrowse", totalUesBrowse);
+        runKey.Add("simTime", simTime.GetSeconds());
+        runKey.Add("udpAppStartTime", udpAppStartTime.GetSeconds());
+        runKey.Add("numerologyBwp1", numerologyBwp1);
+        runKey.Add("centralFrequencyBand1", centralFrequencyBand1);
+        runKey.Add("bandwidthBand1", bandwidthBand1);
+        runKey.Add("numerologyBwp2", numerologyBwp2);
+        runKey.Add("centralFrequencyBand2", centralFrequencyBand2);
+        runKey.Add("bandwidthBand2", bandwidthBand2);
+        runKey.Add("rngSeed", RngSeedManager::GetSeed());
+        runKey.Add("rngRun", RngSeedManager::GetRun());
+        if (!runKey.AddFileHash("binary", "/proc/self/exe"))
+        {
+            runKey.Add("binary", __FILE__ " " __DATE__ " " __TIME__);
+        }
+        runKey.AddLoadedLibraries("library", "libns3");
+
+        std::string defaultsFile = outputDir + "/" + simTag + "-defaults.txt";
+        Config::SetDefault("ns3::ConfigStore::Filename", StringValue(defaultsFile));
+        Config::SetDefault("ns3::ConfigStore::FileFormat", StringValue("RawText"));
+        Config::SetDefault("ns3::ConfigStore::Mode", StringValue("Save"));
+        {
+            ConfigStore defaults;
+            defaults.ConfigureDefaults();
+        }
+        runKey.AddLines("attribute", defaultsFile, "ns3::ConfigStore::");
+        std::filesystem::remove(defaultsFile);
+
+        runHash = runKey.Hash();
+    }
+    if (!resultsCache.empty())
+    {
+        kpm::RunCache cache(resultsCache);
+        if (cache.Restore(runHash,
+                          {{"report", outputDir + "/" + simTag},
+                           {"harq-stats.txt", outputDir + "/" + simTag + "-harq-stats.txt"},
+                           {"flow-timeline.txt", outputDir + "/" + simTag + "-flow-timeline.txt"},
+                           {"page-loads.txt", outputDir + "/" + simTag + "-page-loads.txt"},
+                           {"tcp.txt", outputDir + "/" + simTag + "-tcp.txt"},
+                           {"soak.txt", outputDir + "/" + simTag + "-soak.txt"},
+                           {"flight-*", outputDir + "/" + simTag + "-flight-"},
+                           {"ue-map.txt", ueMapFile}}))
+        {
+            NS_LOG_INFO("Configuration " << runHash
+                                         << " already run, returning the cached results");
+            std::ifstream cached(outputDir + "/" + simTag);
+            if (cached.is_open())
+            {
+                std::cout << cached.rdbuf();
+            }
+            return EXIT_SUCCESS;
+        }
+        NS_LOG_INFO("Configuration " << runHash << " not in the results cache, running it");
+    }
+
+    /*
+     * Resume: the replay recreates the interrupted run up to the checkpoint, so the
+     * configuration must be the one it ran. Its traces are moved aside and spliced
+     * with the ones of this run at the end (kpm-checkpoint.h).
+     */
+    kpm::CheckpointManifest resumeFrom;
+    if (!resume.empty())
+    {
+        NS_ABORT_MSG_IF(!resumeFrom.Read(resume), "Can't read the checkpoint manifest " << resume);
+        NS_ABORT_MSG_IF(resumeFrom.config != runHash,
+                        "Checkpoint " << resume << " is of configuration " << resumeFrom.config
+                                      << ", not " << runHash);
+        NS_ABORT_MSG_IF(resumeFrom.time >= simTime.GetSeconds(),
+                        "Checkpoint " << resume << " is at the end of the run");
+        for (const auto& trace : resumeFrom.traces)
+        {
+            std::error_code ec;
+            std::filesystem::rename(outputDir + "/" + trace,
+                                    outputDir + "/" + trace + kpm::CHECKPOINT_PREFIX_SUFFIX,
+                                    ec);
+            NS_ABORT_MSG_IF(ec,
+                            "Can't move " << outputDir << "/" << trace
+                                          << " aside: " << ec.message());
+        }
+        NS_LOG_INFO("Resuming configuration " << runHash << " from " << resumeFrom.time << " s");
+    }
 
     /** ______   ______  ______   __  __   ______   ______  __  __   ______   ______    
     *  /\  ___\ /\__  _\/\  == \ /\ \/\ \ /\  ___\ /\__  _\/\ \/\ \ /\  == \ /\  ___\   
@@ -300,8 +875,16 @@ main(int argc, char* argv[])
      *
      */
 
-    Packet::EnableChecking();
-    Packet::EnablePrinting();
+    /*
+     * Packet metadata lets a packet be printed and checks every header removal, at the
+     * cost of a metadata record per header and tag on every packet. Nothing in the run
+     * needs it, so the lean profile leaves it off.
+     */
+    if (!lean)
+    {
+        Packet::EnableChecking();
+        Packet::EnablePrinting();
+    }
 
     /*
      *  Case (i): Attributes valid for all the nodes
@@ -480,6 +1063,13 @@ main(int argc, char* argv[])
     // nrHelper->AttachToClosestGnb(ueBrowsingWebNetDev, gnbNetDev);
     // nrHelper->AttachToClosestGnb(uePhoneCallNetDev, gnbNetDev);
 
+    // Trace output of this script during the run, written by a background thread
+    kpm::AsyncTraceWriter traceWriter;
+
+    // Mapping of node id, IMSI, cell/RNTI, BWP, IP address and class of every UE
+    kpm::UeMap ueMap;
+    ueMap.Open(ueMapFile, asyncTraceWriter ? &traceWriter : nullptr, compressTraces);
+
     // Attach manually
     uint32_t callIndex = 0;   // Current index for voice UEs
     uint32_t browseIndex = 0; // Current index for browsing UEs
@@ -491,10 +1081,16 @@ main(int argc, char* argv[])
         for (uint32_t j = 0; j < numUePerGnb; j++)
         {
             Ptr<NetDevice> ueDev;
+            Ipv4Address ueIp;
+            std::string ueClass;
+            uint32_t ueBwpId = 0;
 
             // Alternate between voice and browsing UEs, ensuring no overflow
             if (j % 2 == 0) {
                 if (callIndex < totalUesCall) {
+                    ueIp = ueVoiceIpIface.GetAddress(callIndex);
+                    ueClass = "voice";
+                    ueBwpId = bwpIdForCall;
                     ueDev = uePhoneCallNetDev.Get(callIndex++);
                 } else {
                     // Log specific UE ID that won't be added to BS
@@ -504,6 +1100,9 @@ main(int argc, char* argv[])
                 }
             } else {
                 if (browseIndex < totalUesBrowse) {
+                    ueIp = ueLowLatIpIface.GetAddress(browseIndex);
+                    ueClass = "browsing";
+                    ueBwpId = bwpIdForBrowsing;
                     ueDev = ueBrowsingWebNetDev.Get(browseIndex++);
                 } else {
                     // Log specific UE ID that won't be added to BS
@@ -516,6 +1115,18 @@ main(int argc, char* argv[])
             // Attach the UE to the base station
             nrHelper->AttachToGnb(ueDev, bs);
             NS_LOG_INFO("Adding UE with ID " << ueDev->GetNode()->GetId() << " to BS " << bs->GetNode()->GetId());
+
+            Ptr<NrUeNetDevice> nrUeDev = ueDev->GetObject<NrUeNetDevice>();
+            std::stringstream ipStream;
+            ipStream << ueIp;
+            ueMap.AddUe(nrUeDev->GetImsi(), ueDev->GetNode()->GetId(), ipStream.str(), ueClass,
+                        ueBwpId, bs->GetNode()->GetId());
+            nrUeDev->GetRrc()->TraceConnectWithoutContext(
+                "ConnectionEstablished",
+                MakeBoundCallback(&UeRrcConnectionEstablished, &ueMap));
+            nrUeDev->GetRrc()->TraceConnectWithoutContext(
+                "HandoverEndOk",
+                MakeBoundCallback(&UeRrcHandoverEndOk, &ueMap));
         }
     }
 
@@ -541,17 +1152,21 @@ main(int argc, char* argv[])
     uint16_t dlPortBrowsing = 1234;
     uint16_t dlPortVoiceCall = 1235;
 
-    ApplicationContainer serverApps;
-
-    // The sink will always listen to the specified ports
-    UdpServerHelper dlPacketSinkBrowsing(dlPortBrowsing);
-    UdpServerHelper dlPacketSinkVoiceCall(dlPortVoiceCall);
-
-    NS_LOG_INFO("Setting up Web Browsing and Voice Call Server");
-
-    // The server, that is the application which is listening, is installed in the UE
-    serverApps.Add(dlPacketSinkBrowsing.Install(ueBrowsingWebContainer));
-    serverApps.Add(dlPacketSinkVoiceCall.Install(uePhoneCallContainer));
+    // Uplink: the i-th UE of a class sends to port ulPort... + i of the remote host, so
+    // that every UE has a server, and a flow, of its own
+    uint16_t ulPortBrowsing = 30000;
+    uint16_t ulPortVoiceCall = 20000;
+    kpm::UplinkPorts ulPorts;
+    if (ulBrowsing)
+    {
+        ulPorts.browsing = ulPortBrowsing;
+        ulPorts.browsingUes = ueBrowsingWebContainer.GetN();
+    }
+    if (ulVoice)
+    {
+        ulPorts.voice = ulPortVoiceCall;
+        ulPorts.voiceUes = uePhoneCallContainer.GetN();
+    }
 
     // Web browsing traffic configuration    
     UdpClientHelper dlClientBrowsing;
@@ -561,12 +1176,27 @@ main(int argc, char* argv[])
     dlClientBrowsing.SetAttribute("Interval", TimeValue(Seconds(1.0 / lambdaBrowsing)));
     NrEpsBearer bearerBrowsing(NrEpsBearer::NGBR_LOW_LAT_EMBB);
 
+    // With browsingTransport=tcp the same rate goes over one TCP connection per UE: an
+    // always-on OnOffApplication, which the congestion control and send buffer hold back
+    OnOffHelper dlTcpBrowsing("ns3::TcpSocketFactory", Address());
+    dlTcpBrowsing.SetConstantRate(
+        DataRate(static_cast<uint64_t>(8.0 * udpPacketSizeBrowsing * lambdaBrowsing)),
+        udpPacketSizeBrowsing);
+
     // The filter for the Web Browsing traffic
     Ptr<NrEpcTft> tftBrowsing = Create<NrEpcTft>();
     NrEpcTft::PacketFilter dlpfLowLat;
     dlpfLowLat.localPortStart = dlPortBrowsing;
     dlpfLowLat.localPortEnd = dlPortBrowsing;
     tftBrowsing->Add(dlpfLowLat);
+    if (ulBrowsing)
+    {
+        NrEpcTft::PacketFilter ulpfLowLat;
+        ulpfLowLat.remotePortStart = ulPortBrowsing;
+        ulpfLowLat.remotePortEnd = ulPortBrowsing + ulPorts.browsingUes - 1;
+        ulpfLowLat.direction = NrEpcTft::UPLINK;
+        tftBrowsing->Add(ulpfLowLat);
+    }
 
     // Voice configuration and object creation for both client and server
     UdpClientHelper dlClientVoice;
@@ -584,6 +1214,176 @@ main(int argc, char* argv[])
     dlpfVoice.localPortStart = dlPortVoiceCall;
     dlpfVoice.localPortEnd = dlPortVoiceCall;
     tftVoice->Add(dlpfVoice);
+    if (ulVoice)
+    {
+        NrEpcTft::PacketFilter ulpfVoice;
+        ulpfVoice.remotePortStart = ulPortVoiceCall;
+        ulpfVoice.remotePortEnd = ulPortVoiceCall + ulPorts.voiceUes - 1;
+        ulpfVoice.direction = NrEpcTft::UPLINK;
+        tftVoice->Add(ulpfVoice);
+    }
+
+    // With a trafficModel other than udp-client the same rates are drawn by
+    // traffic generators (kpm-traffic-generator.h), batched per slot of the BWP
+    // the class is mapped to
+    bool useTrafficGenerator = trafficModel != "udp-client";
+    const uint16_t bwpNumerology[] = {numerologyBwp1, numerologyBwp2};
+    kpm::TrafficGeneratorHelper dlGeneratorBrowsing;
+    kpm::TrafficGeneratorHelper dlGeneratorVoice;
+    dlGeneratorBrowsing.SetAttribute("RemotePort", UintegerValue(dlPortBrowsing));
+    dlGeneratorBrowsing.SetAttribute("PacketSize", UintegerValue(udpPacketSizeBrowsing));
+    dlGeneratorBrowsing.SetAttribute("Rate", DoubleValue(lambdaBrowsing));
+    dlGeneratorVoice.SetAttribute("RemotePort", UintegerValue(dlPortVoiceCall));
+    dlGeneratorVoice.SetAttribute("PacketSize", UintegerValue(udpPacketSizeVoiceCall));
+    dlGeneratorVoice.SetAttribute("Rate", DoubleValue(lambdaVoiceCall));
+    for (auto* generator : {&dlGeneratorBrowsing, &dlGeneratorVoice})
+    {
+        uint32_t bwpId = generator == &dlGeneratorBrowsing ? bwpIdForBrowsing : bwpIdForCall;
+        Time slot = NanoSeconds(1000000 >> bwpNumerology[bwpId]);
+        generator->SetAttribute("Process", StringValue(trafficModel));
+        generator->SetAttribute("MeanOnTime", TimeValue(Seconds(trafficOnTime)));
+        generator->SetAttribute("MeanOffTime", TimeValue(Seconds(trafficOffTime)));
+        generator->SetAttribute("MeanBurstSize", DoubleValue(trafficBurstSize));
+        generator->SetAttribute("BatchInterval", TimeValue(trafficBatching ? slot : Seconds(0)));
+        generator->SetAttribute("PacketPool", BooleanValue(packetPool));
+    }
+
+    // The uplink clients send the same traffic from the UEs to the remote host
+    Address remoteHostAddress = internetIpIfaces.GetAddress(1);
+    UdpClientHelper ulClientBrowsing = dlClientBrowsing;
+    UdpClientHelper ulClientVoice = dlClientVoice;
+    kpm::TrafficGeneratorHelper ulGeneratorBrowsing = dlGeneratorBrowsing;
+    kpm::TrafficGeneratorHelper ulGeneratorVoice = dlGeneratorVoice;
+    ulClientBrowsing.SetAttribute("RemoteAddress", AddressValue(remoteHostAddress));
+    ulClientVoice.SetAttribute("RemoteAddress", AddressValue(remoteHostAddress));
+    ulGeneratorBrowsing.SetAttribute("RemoteAddress", AddressValue(remoteHostAddress));
+    ulGeneratorVoice.SetAttribute("RemoteAddress", AddressValue(remoteHostAddress));
+
+    // Activate a dedicated bearer for each traffic type with the specified TFT (Traffic Flow Template)
+    for (uint32_t i = 0; i < ueBrowsingWebNetDev.GetN(); ++i)
+    {
+        nrHelper->ActivateDedicatedEpsBearer(ueBrowsingWebNetDev.Get(i), bearerBrowsing, tftBrowsing);
+    }
+    for (uint32_t i = 0; i < uePhoneCallNetDev.GetN(); ++i)
+    {
+        nrHelper->ActivateDedicatedEpsBearer(uePhoneCallNetDev.Get(i), bearerVoice, tftVoice);
+    }
+
+    // enable the traces provided by the nr module before the attach, so that they record it
+    // and see the bearers created; the report is computed without them. With the async
+    // writer the per-packet ones (RxPacketTrace, RLC/PDCP, control messages) come from the
+    // sinks of kpm-nr-traces.h instead of the NR module's std::ofstream writers. A resumed
+    // run connects them here as well: the sinks drop the records of the replay, and the
+    // replayed records of the NR module's own traces are cut when the traces are spliced.
+    kpm::NrTraceSinks nrTraceSinks(&traceWriter, outputDir);
+    if (!resume.empty())
+    {
+        nrTraceSinks.SetStartTime(Seconds(resumeFrom.time));
+    }
+    if (!lean)
+    {
+        if (asyncTraceWriter)
+        {
+            for (const std::string& path : nrTraceSinks.Connect())
+            {
+                NS_LOG_WARN("NR trace source not found: " << path);
+            }
+            kpm::EnableNrModuleTraces(nrHelper);
+        }
+        else
+        {
+            nrHelper->EnableTraces();
+        }
+    }
+
+    /*
+     * Fast start. The fixed udpAppStartTime is a guess at when the UEs are attached; in
+     * the traces the first RACH preamble comes later, so the first packets of every run
+     * go to UEs without bearers. The NR module has no way to create a UE in connected
+     * state, so with fastStart the attach (cell search, RACH, RRC setup, bearer setup)
+     * runs first, up to the moment every UE has its data radio bearers. The applications
+     * are then installed and start 1 ms later (time for the bearer modification to reach
+     * the gateways); they stop at simTime, as in the normal path, so the traffic covers
+     * only the time the UEs can carry it. Everything below is set up at that point of the
+     * simulation, except the NR traces, which must see the attach.
+     */
+    std::map<uint64_t, uint32_t> pendingDrbs; // per IMSI: the default and the dedicated bearer
+    if (fastStart)
+    {
+        for (const NetDeviceContainer* devices : {&ueBrowsingWebNetDev, &uePhoneCallNetDev})
+        {
+            for (uint32_t i = 0; i < devices->GetN(); ++i)
+            {
+                Ptr<NrUeNetDevice> nrUeDev = devices->Get(i)->GetObject<NrUeNetDevice>();
+                pendingDrbs[nrUeDev->GetImsi()] = 2;
+                NS_ABORT_MSG_IF(!nrUeDev->GetRrc()->TraceConnectWithoutContext(
+                                    "DrbCreated",
+                                    MakeBoundCallback(&UeDrbCreated, &pendingDrbs)),
+                                "Fast start: the UE RRC has no DrbCreated trace source");
+            }
+        }
+        EventId deadline =
+            Simulator::Schedule(simTime, static_cast<void (*)()>(&Simulator::Stop));
+        Simulator::Run();
+        Simulator::Cancel(deadline);
+        for (const auto& ue : pendingDrbs)
+        {
+            NS_ABORT_MSG_IF(ue.second > 0,
+                            "Fast start: UE with IMSI " << ue.first << " not attached by "
+                                                        << simTime.GetSeconds() << " s");
+        }
+        udpAppStartTime = Simulator::Now() + MilliSeconds(1);
+        NS_ABORT_MSG_IF(udpAppStartTime >= simTime,
+                        "Fast start: the UEs attached at " << Simulator::Now().GetSeconds()
+                                                           << " s, no time left for traffic");
+        NS_LOG_INFO("Fast start: traffic from " << udpAppStartTime.GetSeconds() << " s to "
+                                                << simTime.GetSeconds() << " s");
+    }
+
+    ApplicationContainer serverApps;
+
+    // The sink will always listen to the specified ports
+    UdpServerHelper dlPacketSinkBrowsing(dlPortBrowsing);
+    UdpServerHelper dlPacketSinkVoiceCall(dlPortVoiceCall);
+
+    NS_LOG_INFO("Setting up Web Browsing and Voice Call Server");
+
+    // The server, that is the application which is listening, is installed in the UE
+    if (tcpBrowsing)
+    {
+        PacketSinkHelper dlTcpSinkBrowsing(
+            "ns3::TcpSocketFactory",
+            InetSocketAddress(Ipv4Address::GetAny(), dlPortBrowsing));
+        serverApps.Add(dlTcpSinkBrowsing.Install(ueBrowsingWebContainer));
+    }
+    else if (webBrowsing.empty())
+    {
+        serverApps.Add(dlPacketSinkBrowsing.Install(ueBrowsingWebContainer));
+    }
+    serverApps.Add(dlPacketSinkVoiceCall.Install(uePhoneCallContainer));
+
+    // The uplink servers are on the remote host, one per UE
+    for (uint32_t i = 0; i < ulPorts.browsingUes; ++i)
+    {
+        serverApps.Add(UdpServerHelper(ulPortBrowsing + i).Install(remoteHost));
+    }
+    for (uint32_t i = 0; i < ulPorts.voiceUes; ++i)
+    {
+        serverApps.Add(UdpServerHelper(ulPortVoiceCall + i).Install(remoteHost));
+    }
+
+    // With webBrowsing the browsing UEs instead load pages from a web server on the
+    // remote host (kpm-web-browsing.h). The clients bind the browsing port, so the
+    // browsing TFT carries the requests and the pages.
+    uint16_t webServerPort = 80;
+    if (!webBrowsing.empty())
+    {
+        Ptr<kpm::WebServer> webServer = CreateObject<kpm::WebServer>();
+        webServer->SetAttribute("Port", UintegerValue(webServerPort));
+        webServer->SetAttribute("Transport", StringValue(webBrowsing));
+        remoteHost->AddApplication(webServer);
+        serverApps.Add(webServer);
+    }
 
     /*
     * Set up and install applications for web browsing and voice call traffic on UEs.
@@ -597,9 +1397,8 @@ main(int argc, char* argv[])
 
     for (uint32_t i = 0; i < ueBrowsingWebContainer.GetN(); ++i)
     {
-        // Get the UE node and its corresponding network device
+        // Get the UE node
         Ptr<Node> ue = ueBrowsingWebContainer.Get(i);
-        Ptr<NetDevice> ueDevice = ueBrowsingWebNetDev.Get(i);
 
         // Log the UE and device being set up for web browsing
         NS_LOG_INFO("Setting up Web Browsing Client for UE ID: " << ue->GetId());
@@ -609,12 +1408,44 @@ main(int argc, char* argv[])
         
         // Configure the UDP client for web browsing traffic:
         dlClientBrowsing.SetAttribute("RemoteAddress", AddressValue(ueAddress));
+        dlGeneratorBrowsing.SetAttribute("RemoteAddress", AddressValue(ueAddress));
 
-        // Install the client application on the remote host (the server in this case)
-        clientApps.Add(dlClientBrowsing.Install(remoteHost));
+        // Install the client application on the remote host (the server in this case),
+        // or the web client on the UE
+        if (!webBrowsing.empty())
+        {
+            Ptr<kpm::WebBrowsingClient> webClient = CreateObject<kpm::WebBrowsingClient>();
+            webClient->SetAttribute("RemoteAddress", AddressValue(internetIpIfaces.GetAddress(1)));
+            webClient->SetAttribute("RemotePort", UintegerValue(webServerPort));
+            webClient->SetAttribute("LocalPort", UintegerValue(dlPortBrowsing));
+            webClient->SetAttribute("Transport", StringValue(webBrowsing));
+            webClient->SetAttribute("ReadingTime", TimeValue(Seconds(webReadingTime)));
+            // A SYN sent before the UE is attached is retried within the run
+            webClient->SetAttribute("ConnectTimeout", TimeValue(MilliSeconds(20)));
+            ue->AddApplication(webClient);
+            clientApps.Add(webClient);
+        }
+        else if (tcpBrowsing)
+        {
+            dlTcpBrowsing.SetAttribute(
+                "Remote",
+                AddressValue(InetSocketAddress(ueLowLatIpIface.GetAddress(i), dlPortBrowsing)));
+            clientApps.Add(dlTcpBrowsing.Install(remoteHost));
+        }
+        else
+        {
+            clientApps.Add(useTrafficGenerator ? dlGeneratorBrowsing.Install(remoteHost)
+                                               : dlClientBrowsing.Install(remoteHost));
+        }
 
-        // Activate a dedicated bearer for browsing traffic with the specified TFT (Traffic Flow Template)
-        nrHelper->ActivateDedicatedEpsBearer(ueDevice, bearerBrowsing, tftBrowsing);
+        // And the uplink stream from the UE
+        if (ulBrowsing)
+        {
+            ulClientBrowsing.SetAttribute("RemotePort", UintegerValue(ulPortBrowsing + i));
+            ulGeneratorBrowsing.SetAttribute("RemotePort", UintegerValue(ulPortBrowsing + i));
+            clientApps.Add(useTrafficGenerator ? ulGeneratorBrowsing.Install(ue)
+                                               : ulClientBrowsing.Install(ue));
+        }
     }
 
     /////////////////////////////////////////////
@@ -623,9 +1454,8 @@ main(int argc, char* argv[])
 
     for (uint32_t i = 0; i < uePhoneCallContainer.GetN(); ++i)
     {
-        // Get the UE node and its corresponding network device
+        // Get the UE node
         Ptr<Node> ue = uePhoneCallContainer.Get(i);
-        Ptr<NetDevice> ueDevice = uePhoneCallNetDev.Get(i);
 
         // Log the UE and device being set up for voice call traffic
         NS_LOG_INFO("Setting up Voice Call Client for UE ID: " << ue->GetId());
@@ -635,32 +1465,163 @@ main(int argc, char* argv[])
 
         // Configure the UDP client for voice call traffic:
         dlClientVoice.SetAttribute("RemoteAddress", AddressValue(ueAddress));
+        dlGeneratorVoice.SetAttribute("RemoteAddress", AddressValue(ueAddress));
 
         // Install the client application on the remote host (the server in this case)
-        clientApps.Add(dlClientVoice.Install(remoteHost));
+        if (!voiceCodec.empty())
+        {
+            Ptr<kpm::VoipSource> voip = CreateObject<kpm::VoipSource>();
+            voip->SetAttribute("RemoteAddress", AddressValue(ueAddress));
+            voip->SetAttribute("RemotePort", UintegerValue(dlPortVoiceCall));
+            voip->SetAttribute("Codec", StringValue(voiceCodec));
+            voip->SetAttribute("PacketPool", BooleanValue(packetPool));
+            remoteHost->AddApplication(voip);
+            clientApps.Add(voip);
+        }
+        else
+        {
+            clientApps.Add(useTrafficGenerator ? dlGeneratorVoice.Install(remoteHost)
+                                               : dlClientVoice.Install(remoteHost));
+        }
+
+        // The other half of a two-way call: the UE talks to the remote host
+        if (ulVoice && !voiceCodec.empty())
+        {
+            Ptr<kpm::VoipSource> voip = CreateObject<kpm::VoipSource>();
+            voip->SetAttribute("RemoteAddress", AddressValue(remoteHostAddress));
+            voip->SetAttribute("RemotePort", UintegerValue(ulPortVoiceCall + i));
+            voip->SetAttribute("Codec", StringValue(voiceCodec));
+            voip->SetAttribute("PacketPool", BooleanValue(packetPool));
+            ue->AddApplication(voip);
+            clientApps.Add(voip);
+        }
+        else if (ulVoice)
+        {
+            ulClientVoice.SetAttribute("RemotePort", UintegerValue(ulPortVoiceCall + i));
+            ulGeneratorVoice.SetAttribute("RemotePort", UintegerValue(ulPortVoiceCall + i));
+            clientApps.Add(useTrafficGenerator ? ulGeneratorVoice.Install(ue)
+                                               : ulClientVoice.Install(ue));
+        }
+    }
 
-        // Activate a dedicated bearer for voice call traffic with the specified TFT (Traffic Flow Template)
-        nrHelper->ActivateDedicatedEpsBearer(ueDevice, bearerVoice, tftVoice);
+    // Fixed random streams for the traffic generators, web clients and VoIP sources, like for the NR devices
+    for (auto it = clientApps.Begin(); it != clientApps.End(); ++it)
+    {
+        Ptr<kpm::TrafficGenerator> generator = DynamicCast<kpm::TrafficGenerator>(*it);
+        Ptr<kpm::WebBrowsingClient> webClient = DynamicCast<kpm::WebBrowsingClient>(*it);
+        Ptr<kpm::VoipSource> voip = DynamicCast<kpm::VoipSource>(*it);
+        if (generator)
+        {
+            randomStream += generator->AssignStreams(randomStream);
+        }
+        if (webClient)
+        {
+            randomStream += webClient->AssignStreams(randomStream);
+        }
+        if (voip)
+        {
+            randomStream += voip->AssignStreams(randomStream);
+        }
     }
+    kpm::WebBrowsingStats webStats;
+    webStats.Install(clientApps);
 
     ///////////////////////////////////////////////
     // Starting and Stopping Applications
     ///////////////////////////////////////////////
 
-    // Start both the server and client applications at the specified time
-    serverApps.Start(udpAppStartTime);
-    clientApps.Start(udpAppStartTime);
+    // Start both the server and client applications at the specified time (relative to
+    // now, which is later than 0 with fastStart)
+    serverApps.Start(udpAppStartTime - Simulator::Now());
+    clientApps.Start(udpAppStartTime - Simulator::Now());
 
     // Stop both the server and client applications at the end of the simulation time
-    serverApps.Stop(simTime);
-    clientApps.Stop(simTime);
+    serverApps.Stop(simTime - Simulator::Now());
+    clientApps.Stop(simTime - Simulator::Now());
 
-    // enable the traces provided by the nr module
-    nrHelper->EnableTraces();
+    // Steady-state flow statistics, counting only the packets sent inside the measurement windows
+    kpm::FlowProbe flowProbe(kpm::ParseMeasurementWindows(measurementWindows,
+                                                          udpAppStartTime.GetSeconds(),
+                                                          simTime.GetSeconds()));
+    flowProbe.EnableTimeline(flowTimelineBin);
+
+    /*
+     * Flight recorder: TBs, DL scheduling and application packets of the last few ms
+     * are kept in memory and written only around a delay spike, a burst of corrupt
+     * TBs or a growing flow backlog. See kpm-flight-recorder.h.
+     */
+    kpm::FlightRecorderConfig flightConfig;
+    NS_ABORT_MSG_IF(!kpm::ParseFlightRecorderSpec(flightRecorder, flightConfig),
+                    "Malformed --flightRecorder \"" << flightRecorder << "\"");
+    kpm::FlightRecorder recorder(flightConfig);
+    FlightHooks flightHooks;
+    if (!flightRecorder.empty())
+    {
+        recorder.Open(outputDir + "/" + simTag + "-flight");
+        flightHooks.recorder = &recorder;
+        flightHooks.tbStream = recorder.AddStream(
+            "tb",
+            "Time\tdirection\tframe\tsubF\tslot\t1stSym\tnSymbol\tcellId\tbwpId\trnti\ttbSize\tmcs\trank\trv\tSINR(dB)\tCQI\tcorrupt\tTBler");
+        flightHooks.schedStream = recorder.AddStream(
+            "sched",
+            "Time\tcellId\tbwpId\tframe\tsubF\tslot\t1stSym\tnSymbol\trnti\tmcs\ttbSize\tndi\trv");
+        Config::ConnectWithoutContextFailSafe(
+            "/NodeList/*/DeviceList/*/$ns3::NrUeNetDevice/ComponentCarrierMapUe/*/NrUePhy/"
+            "NrSpectrumPhyList/*/RxPacketTraceUe",
+            MakeBoundCallback(&FlightRxPacketTraceUe, &flightHooks));
+        Config::ConnectWithoutContextFailSafe(
+            "/NodeList/*/DeviceList/*/$ns3::NrGnbNetDevice/BandwidthPartMap/*/NrGnbPhy/"
+            "NrSpectrumPhyList/*/RxPacketTraceGnb",
+            MakeBoundCallback(&FlightRxPacketTraceGnb, &flightHooks));
+        for (uint32_t i = 0; i < gnbNetDev.GetN(); ++i)
+        {
+            Ptr<NrGnbNetDevice> gnb = DynamicCast<NrGnbNetDevice>(gnbNetDev.Get(i));
+            for (uint32_t bwp = 0; bwp < gnb->GetCcMapSize(); ++bwp)
+            {
+                gnb->GetMac(bwp)->TraceConnectWithoutContext(
+                    "DlScheduling",
+                    MakeBoundCallback(&FlightDlScheduling, &flightHooks, gnb->GetCellId()));
+            }
+        }
+        flowProbe.EnableFlightRecorder(&recorder);
+    }
+    flowProbe.Install(clientApps, serverApps);
+
+    // Online HARQ/BLER analysis from the same trace sources that feed RxPacketTrace.txt
+    kpm::HarqStats harqStatsCollector;
+    if (harqStats)
+    {
+        bool dlConnected = Config::ConnectWithoutContextFailSafe(
+            "/NodeList/*/DeviceList/*/$ns3::NrUeNetDevice/ComponentCarrierMapUe/*/NrUePhy/"
+            "NrSpectrumPhyList/*/RxPacketTraceUe",
+            MakeBoundCallback(&RxPacketTraceUe, &harqStatsCollector));
+        bool ulConnected = Config::ConnectWithoutContextFailSafe(
+            "/NodeList/*/DeviceList/*/$ns3::NrGnbNetDevice/BandwidthPartMap/*/NrGnbPhy/"
+            "NrSpectrumPhyList/*/RxPacketTraceGnb",
+            MakeBoundCallback(&RxPacketTraceGnb, &harqStatsCollector));
+        if (!dlConnected || !ulConnected)
+        {
+            NS_LOG_WARN("HARQ statistics: RxPacketTrace sources not found (DL " << dlConnected
+                        << ", UL " << ulConnected << ")");
+        }
+    }
 
+    /*
+     * The lean profile monitors only where the service flows start and end: the UEs and
+     * the remote host. Their delay, loss and throughput are the same as with a probe on
+     * every node, but the GTP tunnels of the core network are no longer flows of their
+     * own (no "control" class, and "Mean flow throughput" averages the service flows only).
+     */
     FlowMonitorHelper flowmonHelper;
-    flowmonHelper.InstallAll();  // Install Flow Monitor on all nodes and devices
     NodeContainer endpointNodes;
+    if (lean)
+    {
+        endpointNodes.Add(remoteHost);
+    }
+    else
+    {
+        flowmonHelper.InstallAll();  // Install Flow Monitor on all nodes and devices
+    }
     endpointNodes.Add(gridScenario.GetUserTerminals());
 
     Ptr<ns3::FlowMonitor> monitor = flowmonHelper.Install(endpointNodes);
@@ -799,11 +1760,123 @@ main(int argc, char* argv[])
     }
 
 
-    Simulator::Stop(simTime);
+    /*
+     * Soak run: every soakInterval the RSS is sampled and the finished timeline bins
+     * are written out, so the only state that grows with the run length is on disk.
+     * FlowMonitor keeps per-flow totals and histograms plus the packets in flight
+     * (dropped as lost after MaxPerHopDelay), and the other statistics of the report
+     * are per UE, cell or flow, so none of them grows with the run.
+     */
+    std::ofstream soakFile;
+    std::ofstream soakTimelineFile;
+    std::unique_ptr<kpm::SoakMonitor> soakMonitor;
+    SoakHooks soakHooks;
+    if (soakTime > 0)
+    {
+        soakFile.open(outputDir + "/" + simTag + "-soak.txt",
+                      std::ofstream::out | std::ofstream::trunc);
+        soakMonitor = std::make_unique<kpm::SoakMonitor>(
+            &soakFile,
+            kpm::SOAK_WARMUP_FRACTION * simTime.GetSeconds());
+        soakHooks.monitor = soakMonitor.get();
+        soakHooks.flowProbe = &flowProbe;
+        soakHooks.interval = Seconds(soakInterval);
+        if (flowTimelineBin > 0)
+        {
+            soakTimelineFile.open(outputDir + "/" + simTag + "-flow-timeline.txt",
+                                  std::ofstream::out | std::ofstream::trunc);
+            soakTimelineFile.setf(std::ios_base::fixed);
+            soakTimelineFile.precision(6);
+            kpm::FlowProbe::WriteTimelineHeader(soakTimelineFile);
+            soakHooks.timeline = &soakTimelineFile;
+        }
+        Simulator::Schedule(soakHooks.interval, &SoakTick, &soakHooks);
+    }
+
+    /*
+     * TCP: cwnd, RTT and goodput of the connections the remote host sends on (the
+     * browsing stream or the web pages), sampled to <simTag>-tcp.txt. See kpm-tcp-probe.h.
+     */
+    std::ofstream tcpFile;
+    kpm::TcpProbe tcpProbe;
+    if (tcpBrowsing || webBrowsing == "tcp")
+    {
+        tcpFile.open(outputDir + "/" + simTag + "-tcp.txt",
+                     std::ofstream::out | std::ofstream::trunc);
+        tcpFile.setf(std::ios_base::fixed);
+        tcpFile.precision(6);
+        tcpProbe.Install(remoteHost, Seconds(tcpSampleInterval), &tcpFile);
+    }
+
+    /*
+     * Checkpoints. All ticks are scheduled here, before the run, so a resumed run
+     * schedules the same events in the same order as the interrupted one. The
+     * fingerprint (flow and HARQ counters) must match at the checkpoint it resumes
+     * from.
+     */
+    CheckpointHooks checkpointHooks;
+    checkpointHooks.monitor = monitor;
+    checkpointHooks.harqStats = &harqStatsCollector;
+    checkpointHooks.config = runHash;
+    checkpointHooks.outputDir = outputDir;
+    checkpointHooks.runStart = runStart;
+    checkpointHooks.resume = resume.empty() ? nullptr : &resumeFrom;
+    std::set<Time> checkpointTimes;
+    if (checkpointInterval > 0)
+    {
+        checkpointHooks.manifest = outputDir + "/" + simTag + ".checkpoint";
+        for (uint32_t k = 1; Seconds(k * checkpointInterval) < simTime; ++k)
+        {
+            checkpointTimes.insert(Seconds(k * checkpointInterval));
+        }
+    }
+    if (!resume.empty())
+    {
+        checkpointTimes.insert(Seconds(resumeFrom.time));
+    }
+    for (const Time& t : checkpointTimes)
+    {
+        if (t > Simulator::Now())
+        {
+            Simulator::Schedule(t - Simulator::Now(), &CheckpointTick, &checkpointHooks);
+        }
+    }
+
+    Simulator::Stop(simTime - Simulator::Now());
     NS_LOG_INFO("Starting the simulation ...");
+    auto wallStart = std::chrono::steady_clock::now();
+    uint64_t eventsBefore = Simulator::GetEventCount(); // the fastStart attach phase
+    soakHooks.wallStart = wallStart;
+    soakHooks.eventsBefore = eventsBefore;
+    checkpointHooks.wallStart = wallStart;
     Simulator::Run();
+    double wallSeconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    uint64_t events = Simulator::GetEventCount() - eventsBefore;
     NS_LOG_INFO("Simulation finished ...");
 
+    traceWriter.Close();
+    recorder.Close();
+    kpm::AsyncWriterStats writerStats = traceWriter.GetStats();
+    NS_LOG_INFO("Async trace writer: " << writerStats.bytes << " bytes in " << writerStats.buffers
+                                       << " buffers, " << writerStats.stalls << " stalls ("
+                                       << writerStats.stallSeconds << " s), "
+                                       << nrTraceSinks.GetRecords() << " NR trace records");
+    if (nrTraceSinks.GetMissingBearerSources() > 0)
+    {
+        NS_LOG_WARN(nrTraceSinks.GetMissingBearerSources()
+                    << " RLC/PDCP trace sources not found, their records are missing");
+    }
+    kpm::ProcessMemory memory = kpm::ReadProcessMemory();
+    if (soakMonitor)
+    {
+        soakMonitor->Sample(Simulator::Now().GetSeconds(), wallSeconds, events, memory);
+        soakMonitor->WriteSummary(soakFile);
+        soakFile.close();
+    }
+    NS_LOG_INFO("Memory: RSS " << memory.rssKb / 1024 << " MB, peak " << memory.peakRssKb / 1024
+                               << " MB");
+
     /*
      * To check what was installed in the memory, i.e., BWPs of gNB Device, and its configuration.
      * Example is: Node 1 -> Device 0 -> BandwidthPartMap -> {0,1} BWPs -> NrGnbPhy -> Numerology,
@@ -832,6 +1905,14 @@ main(int argc, char* argv[])
     outFile.setf(std::ios_base::fixed);
 
     double flowDuration = (simTime - udpAppStartTime).GetSeconds();
+    kpm::FlowClassReport classReport;
+    classReport.SetVoiceDelayBudget(voiceDelayBudget);
+    // A voice UE that stayed silent for the whole run has no flow, but still counts
+    classReport.SetVoiceUsers(kpm::FLOW_VOICE, uePhoneCallContainer.GetN());
+    if (ulVoice)
+    {
+        classReport.SetVoiceUsers(kpm::FLOW_VOICE_UL, uePhoneCallContainer.GetN());
+    }
     for (std::map<FlowId, FlowMonitor::FlowStats>::const_iterator i = stats.begin();
          i != stats.end();
          ++i)
@@ -880,6 +1961,51 @@ main(int argc, char* argv[])
             outFile << "  Mean jitter: 0 ms\n";
         }
         outFile << "  Rx Packets: " << i->second.rxPackets << "\n";
+        if (t.protocol == 6)
+        {
+            tcpProbe.WriteFlow(outFile, t.destinationAddress, t.destinationPort, flowDuration);
+        }
+
+        // The UE end of a service flow is the one on the service port, or the sender
+        // of an uplink flow
+        kpm::FlowClass flowClass = kpm::ClassifyFlow(t.sourcePort,
+                                                     t.destinationPort,
+                                                     dlPortVoiceCall,
+                                                     dlPortBrowsing,
+                                                     ulPorts);
+        bool uplink = flowClass == kpm::FLOW_VOICE_UL || flowClass == kpm::FLOW_BROWSING_UL;
+        std::stringstream ueAddress;
+        if (uplink || t.sourcePort == dlPortVoiceCall || t.sourcePort == dlPortBrowsing)
+        {
+            ueAddress << t.sourceAddress;
+        }
+        else
+        {
+            ueAddress << t.destinationAddress;
+        }
+        classReport.AddFlow(flowClass,
+                            ueAddress.str(),
+                            i->second.txPackets,
+                            i->second.rxPackets,
+                            i->second.rxBytes,
+                            i->second.rxBytes * 8.0 / flowDuration / 1000 / 1000,
+                            i->second.delaySum.GetSeconds(),
+                            i->second.jitterSum.GetSeconds(),
+                            voiceGbr);
+        if (kpm::IsVoiceClass(flowClass))
+        {
+            // Packets within the delay budget, from the whole bins below it
+            const Histogram& delays = i->second.delayHistogram;
+            uint64_t onTime = 0;
+            for (uint32_t b = 0; b < delays.GetNBins(); ++b)
+            {
+                if (delays.GetBinEnd(b) <= voiceDelayBudget / 1000 + 1e-9)
+                {
+                    onTime += delays.GetBinCount(b);
+                }
+            }
+            classReport.AddVoiceUser(flowClass, i->second.txPackets, onTime);
+        }
     }
 
     double meanFlowThroughput = averageFlowThroughput / stats.size();
@@ -888,8 +2014,82 @@ main(int argc, char* argv[])
     outFile << "\n\n  Mean flow throughput: " << meanFlowThroughput << "\n";
     outFile << "  Mean flow delay: " << meanFlowDelay << "\n";
 
+    classReport.Write(outFile, voiceGbr);
+    flowProbe.Write(outFile);
+    tcpProbe.Write(outFile, flowDuration);
+    kpm::WriteTrafficGeneratorReport(outFile, clientApps);
+    kpm::PacketPoolStats poolStats;
+    for (auto it = clientApps.Begin(); it != clientApps.End(); ++it)
+    {
+        if (Ptr<kpm::TrafficGenerator> generator = DynamicCast<kpm::TrafficGenerator>(*it))
+        {
+            poolStats += generator->GetPacketPoolStats();
+        }
+        if (Ptr<kpm::VoipSource> voip = DynamicCast<kpm::VoipSource>(*it))
+        {
+            poolStats += voip->GetPacketPoolStats();
+        }
+    }
+    if (poolStats.allocations > 0)
+    {
+        poolStats.Write(outFile);
+    }
+    webStats.Write(outFile);
+    if (!flightRecorder.empty())
+    {
+        recorder.Write(outFile);
+    }
+
     outFile.close();
 
+    if (harqStats)
+    {
+        std::ofstream harqFile(outputDir + "/" + simTag + "-harq-stats.txt",
+                               std::ofstream::out | std::ofstream::trunc);
+        harqFile.setf(std::ios_base::fixed);
+        harqFile.precision(4);
+        harqStatsCollector.Write(harqFile);
+    }
+
+    tcpFile.close();
+
+    if (soakHooks.timeline)
+    {
+        flowProbe.FlushTimeline(soakTimelineFile, std::numeric_limits<double>::max());
+        soakTimelineFile.close();
+    }
+    else if (flowTimelineBin > 0)
+    {
+        std::ofstream timelineFile(outputDir + "/" + simTag + "-flow-timeline.txt",
+                                   std::ofstream::out | std::ofstream::trunc);
+        timelineFile.setf(std::ios_base::fixed);
+        timelineFile.precision(6);
+        flowProbe.WriteTimeline(timelineFile);
+    }
+
+    if (!webBrowsing.empty())
+    {
+        std::ofstream pageFile(outputDir + "/" + simTag + "-page-loads.txt",
+                               std::ofstream::out | std::ofstream::trunc);
+        pageFile.setf(std::ios_base::fixed);
+        pageFile.precision(6);
+        webStats.WriteTrace(pageFile);
+    }
+
+    if (!resultsCache.empty())
+    {
+        kpm::RunCache(resultsCache)
+            .Save(runKey,
+                  {{"report", filename},
+                   {"harq-stats.txt", outputDir + "/" + simTag + "-harq-stats.txt"},
+                   {"flow-timeline.txt", outputDir + "/" + simTag + "-flow-timeline.txt"},
+                   {"page-loads.txt", outputDir + "/" + simTag + "-page-loads.txt"},
+                   {"tcp.txt", outputDir + "/" + simTag + "-tcp.txt"},
+                   {"soak.txt", outputDir + "/" + simTag + "-soak.txt"},
+                   {"flight-*", outputDir + "/" + simTag + "-flight-"},
+                   {"ue-map.txt", ueMapFile}});
+    }
+
     std::ifstream f(filename.c_str());
 
     if (f.is_open())
@@ -897,8 +2097,88 @@ main(int argc, char* argv[])
         std::cout << f.rdbuf();
     }
 
+    // Cost of the run, on screen only: the report stays identical between runs and profiles
+    std::cout << "\nRun profile " << profile << ": " << events << " events in " << wallSeconds
+              << " s (" << (wallSeconds > 0 ? events / wallSeconds : 0.0) << " events/s), RSS "
+              << memory.rssKb / 1024 << " MB, peak " << memory.peakRssKb / 1024 << " MB"
+              << std::endl;
+    if (soakMonitor)
+    {
+        soakMonitor->WriteSummary(std::cout);
+    }
+
     Simulator::Destroy();
 
+    // Put the records of the interrupted run before those of this one
+    for (const auto& trace : resumeFrom.traces)
+    {
+        std::string path = outputDir + "/" + trace;
+        if (!kpm::SpliceTrace(path + kpm::CHECKPOINT_PREFIX_SUFFIX, path, resumeFrom.time))
+        {
+            NS_LOG_ERROR("Can't splice " << path << " at " << resumeFrom.time << " s");
+        }
+    }
+
+    /*
+     * Write a sparse sidecar index (time -> byte offset, cellId/RNTI postings) next to
+     * every trace. This is one sequential pass over the finished files, so it adds
+     * nothing to the event loop; see kpm-trace-index.h for the format.
+     */
+    if (traceIndexStride > 0)
+    {
+        uint32_t indexed = kpm::BuildTraceIndexes(outputDir, traceIndexStride);
+        NS_LOG_INFO("Wrote " << indexed << " trace indexes with stride " << traceIndexStride);
+    }
+
+    /*
+     * Compress the traces into independent, record-aligned blocks (kpm-block-codec.h).
+     * The indexes keep their offsets into the text, so queries decompress only the
+     * blocks they need.
+     */
+    if (compressTraces)
+    {
+        uint64_t rawBytes = 0;
+        uint64_t fileBytes = 0;
+        uint32_t compressed =
+            kpm::CompressTraces(outputDir, kpm::BLOCK_FILE_DEFAULT_BLOCK, rawBytes, fileBytes);
+        NS_LOG_INFO("Compressed " << compressed << " traces, " << rawBytes << " -> " << fileBytes
+                                  << " bytes");
+    }
+
+    /*
+     * Move the traces, indexes and reports written by this run to the content-addressed
+     * store, so runs of a sweep share identical files and chunks. simTag is the same in
+     * every run, so the run is named by its configuration hash as well; "kpm-trace-store
+     * restore <store> <simTag>-<hash> <dir>" recreates the files. Only the files this run
+     * wrote (RunOutputFiles) are stored, and removed from outputDir once the manifest is
+     * written. See kpm-trace-store.h.
+     */
+    if (!traceStore.empty())
+    {
+        kpm::TraceStore store(traceStore);
+        kpm::TraceStoreStats storeStats;
+        std::string storeRun = simTag + "-" + runHash;
+        if (store.HasRun(storeRun))
+        {
+            NS_LOG_INFO("Run " << storeRun << " is already in the trace store, keeping "
+                               << outputDir);
+        }
+        else if (store.StoreFiles(outputDir,
+                                  storeRun,
+                                  RunOutputFiles(outputDir, simTag, runStart),
+                                  storeStats,
+                                  true))
+        {
+            NS_LOG_INFO("Moved " << storeStats.files << " files (" << storeStats.bytes
+                                 << " bytes) to the trace store as run " << storeRun << ", "
+                                 << storeStats.newBytes << " new bytes");
+        }
+        else
+        {
+            NS_LOG_ERROR("Can't add " << outputDir << " to the trace store " << traceStore);
+        }
+    }
+
     if (argc == 0)
     {
         double toleranceMeanFlowThroughput = 0.0001 * 56.258560;
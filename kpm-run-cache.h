@@ -0,0 +1,333 @@
+/**
+ * \file kpm-run-cache.h
+ * \brief Whole-run memoisation: results keyed by a hash of the effective configuration.
+ *
+ * A run is a pure function of its configuration: the command line values, the
+ * constants compiled into the script, the ns-3 attribute defaults, the RNG seed
+ * and run number, and the binary itself with the ns-3 shared libraries it loaded. RunKey collects these as "name=value"
+ * lines, sorts them into a canonical text and hashes it with SHA-256; the order in
+ * which the values are added, and spelling differences of the command line such
+ * as "--x=1" vs. "--x 1", do not change the key.
+ *
+ * RunCache keeps the output files of every finished run under its key:
+ *
+ * \code{.unparsed}
+<cache>/<sha256>/key.txt       canonical configuration, for inspection
+<cache>/<sha256>/<name>...     the output files of the run, by role (e.g. "report")
+ * \endcode
+ *
+ * An entry is written to a temporary directory and renamed, so a crashed run
+ * leaves no entry and a rerun of the sweep executes exactly the missing points.
+ * Outputs with run-dependent names are given as a group: the name "flight-*"
+ * with the destination "<dir>/default-flight-" stands for every file
+ * "<dir>/default-flight-<x>", stored as "flight-<x>".
+ * The header has no ns-3 dependency.
+ */
+
+#ifndef KPM_RUN_CACHE_H
+#define KPM_RUN_CACHE_H
+
+#include "kpm-trace-store.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace kpm
+{
+
+/// Canonical description of a run configuration.
+class RunKey
+{
+  public:
+    void Add(const std::string& name, const std::string& value)
+    {
+        m_lines.push_back(name + "=" + value);
+    }
+
+    void Add(const std::string& name, const char* value)
+    {
+        Add(name, std::string(value));
+    }
+
+    void Add(const std::string& name, double value)
+    {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.17g", value);
+        Add(name, std::string(buf));
+    }
+
+    void Add(const std::string& name, uint64_t value)
+    {
+        Add(name, std::to_string(value));
+    }
+
+    void Add(const std::string& name, int64_t value)
+    {
+        Add(name, std::to_string(value));
+    }
+
+    void Add(const std::string& name, uint32_t value)
+    {
+        Add(name, uint64_t(value));
+    }
+
+    void Add(const std::string& name, int value)
+    {
+        Add(name, int64_t(value));
+    }
+
+    void Add(const std::string& name, bool value)
+    {
+        Add(name, std::string(value ? "true" : "false"));
+    }
+
+    /**
+     * Add the SHA-256 of a file's contents, e.g. the executable. Returns false,
+     * and adds nothing, if the file cannot be read.
+     */
+    bool AddFileHash(const std::string& name, const std::string& path)
+    {
+        std::ifstream in(path, std::ifstream::binary);
+        if (!in.is_open())
+        {
+            return false;
+        }
+        Sha256 sha;
+        char buf[1 << 16];
+        while (in.read(buf, sizeof(buf)) || in.gcount() > 0)
+        {
+            sha.Update(buf, in.gcount());
+        }
+        Add(name, sha.HexDigest());
+        return true;
+    }
+
+    /**
+     * Add the SHA-256 of every shared object mapped into this process whose file
+     * name contains pattern (e.g. "libns3"), as "<name>:<file name>". ns-3 builds
+     * its modules as shared libraries by default, so the executable alone misses a
+     * rebuilt module. Returns the number of libraries added; 0 without /proc.
+     */
+    size_t AddLoadedLibraries(const std::string& name, const std::string& pattern)
+    {
+        std::ifstream maps("/proc/self/maps");
+        std::set<std::string> paths;
+        std::string line;
+        while (std::getline(maps, line))
+        {
+            size_t slash = line.find('/');
+            if (slash == std::string::npos)
+            {
+                continue;
+            }
+            std::string path = line.substr(slash);
+            const std::string deleted = " (deleted)";
+            if (path.size() > deleted.size() &&
+                path.compare(path.size() - deleted.size(), deleted.size(), deleted) == 0)
+            {
+                path.resize(path.size() - deleted.size());
+            }
+            if (std::filesystem::path(path).filename().string().find(pattern) != std::string::npos)
+            {
+                paths.insert(path);
+            }
+        }
+        size_t added = 0;
+        for (const auto& path : paths)
+        {
+            if (AddFileHash(name + ":" + std::filesystem::path(path).filename().string(), path))
+            {
+                ++added;
+            }
+        }
+        return added;
+    }
+
+    /**
+     * Add every line of a "name value" text dump (e.g. the ns-3 attribute
+     * defaults saved by ConfigStore) except those containing skip.
+     */
+    bool AddLines(const std::string& prefix, const std::string& path, const std::string& skip)
+    {
+        std::ifstream in(path);
+        if (!in.is_open())
+        {
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line))
+        {
+            if (!line.empty() && (skip.empty() || line.find(skip) == std::string::npos))
+            {
+                Add(prefix, line);
+            }
+        }
+        return true;
+    }
+
+    /// Sorted "name=value" lines, one per line.
+    std::string Canonical() const
+    {
+        std::vector<std::string> lines = m_lines;
+        std::sort(lines.begin(), lines.end());
+        std::string out;
+        for (const auto& l : lines)
+        {
+            out += l;
+            out += '\n';
+        }
+        return out;
+    }
+
+    /// SHA-256 of the canonical text.
+    std::string Hash() const
+    {
+        std::string text = Canonical();
+        Sha256 sha;
+        sha.Update(text.data(), text.size());
+        return sha.HexDigest();
+    }
+
+  private:
+    std::vector<std::string> m_lines;
+};
+
+/// Output files of finished runs, keyed by RunKey::Hash().
+class RunCache
+{
+  public:
+    explicit RunCache(const std::string& dir)
+        : m_dir(dir)
+    {
+    }
+
+    std::string EntryPath(const std::string& hash) const
+    {
+        return m_dir + "/" + hash;
+    }
+
+    bool Contains(const std::string& hash) const
+    {
+        std::error_code ec;
+        return std::filesystem::exists(EntryPath(hash) + "/key.txt", ec);
+    }
+
+    /**
+     * Copy the stored files of an entry to their destinations, given as
+     * (name in the entry, destination path) or as a group. Returns false if there
+     * is no entry or a copy fails.
+     */
+    bool Restore(const std::string& hash,
+                 const std::vector<std::pair<std::string, std::string>>& files) const
+    {
+        if (!Contains(hash))
+        {
+            return false;
+        }
+        std::error_code ec;
+        for (const auto& file : ExpandGroups(files, EntryPath(hash), true))
+        {
+            std::string stored = EntryPath(hash) + "/" + file.first;
+            if (std::filesystem::exists(stored, ec))
+            {
+                std::filesystem::copy_file(stored,
+                                           file.second,
+                                           std::filesystem::copy_options::overwrite_existing,
+                                           ec);
+                if (ec)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Store files, given as (name in the entry, source path) or as a group, as the
+     * entry of key. Missing sources are skipped.
+     */
+    bool Save(const RunKey& key,
+              const std::vector<std::pair<std::string, std::string>>& files) const
+    {
+        std::string hash = key.Hash();
+        std::string final = EntryPath(hash);
+        std::string tmp = final + ".tmp" + std::to_string(std::random_device{}());
+        std::error_code ec;
+        std::filesystem::create_directories(tmp, ec);
+        for (const auto& file : ExpandGroups(files, std::string(), false))
+        {
+            if (std::filesystem::exists(file.second, ec))
+            {
+                std::filesystem::copy_file(file.second,
+                                           tmp + "/" + file.first,
+                                           std::filesystem::copy_options::overwrite_existing,
+                                           ec);
+            }
+        }
+        {
+            std::ofstream out(tmp + "/key.txt", std::ofstream::trunc);
+            out << key.Canonical();
+        }
+        std::filesystem::remove_all(final, ec);
+        std::filesystem::rename(tmp, final, ec);
+        if (ec)
+        {
+            std::filesystem::remove_all(tmp, ec);
+            return false;
+        }
+        return true;
+    }
+
+  private:
+    /**
+     * Replace the groups ("<x>-*", "<dir>/<prefix>") of files by one (name, path)
+     * per file, found in the entry (restore) or in the destination directory (save).
+     */
+    static std::vector<std::pair<std::string, std::string>> ExpandGroups(
+        const std::vector<std::pair<std::string, std::string>>& files,
+        const std::string& entry,
+        bool restore)
+    {
+        std::vector<std::pair<std::string, std::string>> expanded;
+        for (const auto& file : files)
+        {
+            if (file.first.empty() || file.first.back() != '*')
+            {
+                expanded.push_back(file);
+                continue;
+            }
+            std::string namePrefix = file.first.substr(0, file.first.size() - 1);
+            std::filesystem::path dest(file.second);
+            std::string pathPrefix = dest.filename().string();
+            std::string dir = restore ? entry : dest.parent_path().string();
+            const std::string& prefix = restore ? namePrefix : pathPrefix;
+            std::error_code ec;
+            for (const auto& e : std::filesystem::directory_iterator(dir.empty() ? "." : dir, ec))
+            {
+                std::string f = e.path().filename().string();
+                if (!e.is_regular_file() || f.compare(0, prefix.size(), prefix) != 0)
+                {
+                    continue;
+                }
+                std::string rest = f.substr(prefix.size());
+                expanded.emplace_back(namePrefix + rest, file.second + rest);
+            }
+        }
+        return expanded;
+    }
+
+    std::string m_dir;
+};
+
+} // namespace kpm
+
+#endif // KPM_RUN_CACHE_H
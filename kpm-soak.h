@@ -0,0 +1,126 @@
+/**
+ * \file kpm-soak.h
+ * \brief Resident memory over simulated time for long soak runs, with its growth rate.
+ *
+ * A soak run samples the process every few simulated seconds and writes one line
+ * per sample (simulated time, wall time, events, RSS, peak RSS) as it goes. Only
+ * the sums of a least-squares fit are kept, so the monitor itself stays O(1) for
+ * any run length. Samples from the warm-up (the first SOAK_WARMUP_FRACTION of the
+ * run, while the queues, maps and pools fill) are written but not fitted.
+ *
+ * The summary gives the slope of RSS over simulated time in kB/s and the growth
+ * per simulated minute relative to the mean RSS. Memory counts as flat when that
+ * growth stays below SOAK_FLAT_GROWTH. The header has no ns-3 dependency.
+ */
+
+#ifndef KPM_SOAK_H
+#define KPM_SOAK_H
+
+#include "kpm-process-stats.h"
+
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+
+namespace kpm
+{
+
+/// Fraction of the run left out of the RSS fit.
+const double SOAK_WARMUP_FRACTION = 0.1;
+
+/// Largest RSS growth per simulated minute, relative to the mean RSS, of a flat run.
+const double SOAK_FLAT_GROWTH = 0.01;
+
+/// RSS samples of a soak run and their linear fit.
+class SoakMonitor
+{
+  public:
+    /// Samples go to os (may be nullptr); those before warmUp (simulated s) are not fitted.
+    SoakMonitor(std::ostream* os, double warmUp)
+        : m_os(os),
+          m_warmUp(warmUp)
+    {
+        if (m_os)
+        {
+            *m_os << "Time\twallTime\tevents\trssKb\tpeakRssKb\n";
+        }
+    }
+
+    void Sample(double simTime, double wallTime, uint64_t events, const ProcessMemory& memory)
+    {
+        if (m_os)
+        {
+            *m_os << simTime << "\t" << wallTime << "\t" << events << "\t" << memory.rssKb
+                  << "\t" << memory.peakRssKb << "\n";
+        }
+        m_peakRssKb = memory.peakRssKb;
+        if (simTime < m_warmUp)
+        {
+            return;
+        }
+        double y = static_cast<double>(memory.rssKb);
+        if (m_n == 0)
+        {
+            m_firstTime = simTime;
+            m_firstRssKb = memory.rssKb;
+        }
+        m_lastTime = simTime;
+        m_lastRssKb = memory.rssKb;
+        ++m_n;
+        m_sx += simTime;
+        m_sy += y;
+        m_sxx += simTime * simTime;
+        m_sxy += simTime * y;
+    }
+
+    /// Fitted samples.
+    uint64_t GetSamples() const
+    {
+        return m_n;
+    }
+
+    /// Least-squares slope of RSS in kB per simulated second (0 below two samples).
+    double GetSlope() const
+    {
+        double d = m_n * m_sxx - m_sx * m_sx;
+        return m_n >= 2 && d > 0 ? (m_n * m_sxy - m_sx * m_sy) / d : 0.0;
+    }
+
+    /// RSS growth per simulated minute relative to the mean RSS of the fitted samples.
+    double GetGrowthPerMinute() const
+    {
+        return m_n > 0 && m_sy > 0 ? 60.0 * GetSlope() / (m_sy / m_n) : 0.0;
+    }
+
+    bool IsFlat() const
+    {
+        return std::fabs(GetGrowthPerMinute()) < SOAK_FLAT_GROWTH;
+    }
+
+    void WriteSummary(std::ostream& os) const
+    {
+        os << "Soak: " << m_n << " samples from " << m_firstTime << " s to " << m_lastTime
+           << " s, RSS " << m_firstRssKb / 1024 << " -> " << m_lastRssKb / 1024 << " MB (peak "
+           << m_peakRssKb / 1024 << " MB), slope " << GetSlope() << " kB/s, "
+           << 100 * GetGrowthPerMinute() << "% per simulated minute: "
+           << (m_n < 2 ? "too few samples" : IsFlat() ? "flat" : "GROWING") << "\n";
+    }
+
+  private:
+    std::ostream* m_os;
+    double m_warmUp;
+    uint64_t m_n{0};
+    double m_sx{0.0};
+    double m_sy{0.0};
+    double m_sxx{0.0};
+    double m_sxy{0.0};
+    double m_firstTime{0.0};
+    double m_lastTime{0.0};
+    uint64_t m_firstRssKb{0};
+    uint64_t m_lastRssKb{0};
+    uint64_t m_peakRssKb{0};
+};
+
+} // namespace kpm
+
+#endif // KPM_SOAK_H
@@ -0,0 +1,309 @@
+/**
+ * \file kpm-tcp-probe.h
+ * \brief Congestion window, RTT and goodput of the TCP connections a node sends on.
+ *
+ * FlowMonitor sees a TCP connection as two flows of IP packets: data one way,
+ * ACKs the other. Their delay is that of single packets and their throughput
+ * counts retransmissions. It says nothing about what the sender's congestion
+ * control did, or about the goodput and RTT a user sees, which with the deep
+ * RLC buffers of the NR stack can grow far beyond the air interface delay
+ * (bufferbloat). TcpProbe hooks the TcpSocketBase trace sources of every
+ * connection of the sending node (the remote host):
+ *
+ * - CongestionWindow, BytesInFlight: the last value;
+ * - RTT: every RTT estimate, for the mean, minimum and maximum;
+ * - HighestRxAck: the bytes acknowledged, i.e. delivered in order (goodput);
+ * - CongState: the entries into fast recovery or loss (loss events).
+ *
+ * The node's sockets are looked up in the SocketList of its TcpL4Protocol every
+ * sample interval, so connections accepted by a listening server are found too.
+ * ns-3 starts every connection at sequence number 0, so the acknowledged bytes
+ * are counted in full even for a connection found an interval late.
+ *
+ * A flow is the (address, port) peer, i.e. the UE end, as in FlowProbe; the
+ * connections of one peer are added up. Every sample interval one line per flow
+ * is written: time, flow, cwnd and bytes in flight (bytes), last RTT (ms) and
+ * the goodput over the interval (Mbps), a time-ordered trace that kpm-trace-query
+ * and the sidecar indexes understand.
+ */
+
+#ifndef KPM_TCP_PROBE_H
+#define KPM_TCP_PROBE_H
+
+#include "ns3/core-module.h"
+#include "ns3/internet-module.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace kpm
+{
+
+/// Congestion control statistics of one TCP flow.
+struct TcpFlowStats
+{
+    uint32_t connections{0};
+    uint64_t ackedBytes{0};
+    uint64_t rttSamples{0};
+    double rttSum{0.0};
+    double rttMin{std::numeric_limits<double>::infinity()};
+    double rttMax{0.0};
+    double lastRtt{0.0};
+    uint32_t cwnd{0};
+    uint32_t cwndMax{0};
+    uint64_t cwndSamples{0};
+    double cwndSum{0.0};
+    uint32_t bytesInFlight{0};
+    uint32_t lossEvents{0};
+    uint64_t ackedAtSample{0};
+};
+
+/// Per-flow congestion window, RTT and goodput of the TCP senders of a node.
+class TcpProbe
+{
+  public:
+    /**
+     * Watch the TCP sockets of node every interval from now on and write the samples
+     * to os (may be nullptr).
+     */
+    void Install(ns3::Ptr<ns3::Node> node, ns3::Time interval, std::ostream* os)
+    {
+        m_tcp = node->GetObject<ns3::TcpL4Protocol>();
+        m_interval = interval;
+        m_os = os;
+        if (m_os)
+        {
+            *m_os << "time\tflow\tcwnd\tbytesInFlight\trtt(ms)\tgoodput(Mbps)\n";
+        }
+        ns3::Simulator::Schedule(m_interval, &TcpProbe::Tick, this);
+    }
+
+    /// Congestion control of the node's sockets, e.g. "ns3::TcpNewReno".
+    std::string GetCongestionControl() const
+    {
+        ns3::TypeIdValue type;
+        m_tcp->GetAttribute("SocketType", type);
+        return type.Get().GetName();
+    }
+
+    /// Statistics of the flow to (address, port), or nullptr.
+    const TcpFlowStats* GetFlow(ns3::Ipv4Address address, uint16_t port) const
+    {
+        for (size_t f = 0; f < m_flows.size(); ++f)
+        {
+            if (m_flows[f] == std::make_pair(address, port))
+            {
+                return &m_stats[f];
+            }
+        }
+        return nullptr;
+    }
+
+    /// Lines of the flow to (address, port) for the per-flow report; nothing if not TCP.
+    void WriteFlow(std::ostream& os, ns3::Ipv4Address address, uint16_t port, double duration) const
+    {
+        const TcpFlowStats* s = GetFlow(address, port);
+        if (!s)
+        {
+            return;
+        }
+        os << "  TCP goodput: " << (duration > 0 ? s->ackedBytes * 8.0 / duration / 1e6 : 0.0)
+           << " Mbps (" << s->ackedBytes << " bytes acknowledged, " << s->connections
+           << " connections)\n";
+        os << "  TCP RTT: mean " << (s->rttSamples > 0 ? 1000 * s->rttSum / s->rttSamples : 0.0)
+           << " ms, min " << (s->rttSamples > 0 ? 1000 * s->rttMin : 0.0) << " ms, max "
+           << 1000 * s->rttMax << " ms\n";
+        os << "  TCP cwnd: mean " << (s->cwndSamples > 0 ? s->cwndSum / s->cwndSamples : 0.0)
+           << " bytes, max " << s->cwndMax << " bytes, loss events " << s->lossEvents << "\n";
+    }
+
+    /// Summary over the flows; nothing without TCP connections.
+    void Write(std::ostream& os, double duration) const
+    {
+        if (m_flows.empty())
+        {
+            return;
+        }
+        uint64_t acked = 0;
+        uint64_t rttSamples = 0;
+        double rttSum = 0.0;
+        double rttMax = 0.0;
+        uint32_t lossEvents = 0;
+        for (const auto& s : m_stats)
+        {
+            acked += s.ackedBytes;
+            rttSamples += s.rttSamples;
+            rttSum += s.rttSum;
+            rttMax = std::max(rttMax, s.rttMax);
+            lossEvents += s.lossEvents;
+        }
+        os << "\n\nTCP flows (" << GetCongestionControl() << ")\n";
+        os << "  Flows: " << m_flows.size() << "\n";
+        os << "  Aggregate goodput: " << (duration > 0 ? acked * 8.0 / duration / 1e6 : 0.0)
+           << " Mbps\n";
+        os << "  Mean flow goodput: "
+           << (duration > 0 ? acked * 8.0 / duration / 1e6 / m_flows.size() : 0.0) << " Mbps\n";
+        os << "  Mean RTT: " << (rttSamples > 0 ? 1000 * rttSum / rttSamples : 0.0)
+           << " ms (max " << 1000 * rttMax << " ms)\n";
+        os << "  Loss events: " << lossEvents << "\n";
+    }
+
+  private:
+    /// A hooked connection.
+    struct Connection
+    {
+        ns3::Ptr<ns3::TcpSocketBase> socket;
+        uint32_t flow;
+        uint32_t highestAck{1}; ///< after the SYN
+    };
+
+    uint32_t FlowIndex(ns3::Ipv4Address address, uint16_t port)
+    {
+        auto key = std::make_pair(address, port);
+        for (uint32_t i = 0; i < m_flows.size(); ++i)
+        {
+            if (m_flows[i] == key)
+            {
+                return i;
+            }
+        }
+        m_flows.push_back(key);
+        m_stats.emplace_back();
+        std::ostringstream label;
+        label << address << ":" << port;
+        m_labels.push_back(label.str());
+        return m_flows.size() - 1;
+    }
+
+    /// Hook the connections opened since the last tick.
+    void Discover()
+    {
+        ns3::ObjectVectorValue sockets;
+        m_tcp->GetAttribute("SocketList", sockets);
+        for (auto it = sockets.Begin(); it != sockets.End(); ++it)
+        {
+            ns3::Ptr<ns3::TcpSocketBase> socket = ns3::DynamicCast<ns3::TcpSocketBase>(it->second);
+            ns3::Address peer;
+            if (!socket || socket->GetPeerName(peer) != 0 ||
+                !ns3::InetSocketAddress::IsMatchingType(peer) ||
+                std::any_of(m_connections.begin(), m_connections.end(), [&](const Connection& c) {
+                    return c.socket == socket;
+                }))
+            {
+                continue; // not TCP over IPv4, listening, or already hooked
+            }
+            ns3::InetSocketAddress inet = ns3::InetSocketAddress::ConvertFrom(peer);
+            uint32_t flow = FlowIndex(inet.GetIpv4(), inet.GetPort());
+            ++m_stats[flow].connections;
+            size_t c = m_connections.size();
+            m_connections.push_back({socket, flow});
+            socket->TraceConnectWithoutContext(
+                "CongestionWindow",
+                ns3::MakeBoundCallback(&TcpProbe::CwndTrace, this, flow));
+            socket->TraceConnectWithoutContext(
+                "BytesInFlight",
+                ns3::MakeBoundCallback(&TcpProbe::InFlightTrace, this, flow));
+            socket->TraceConnectWithoutContext(
+                "RTT",
+                ns3::MakeBoundCallback(&TcpProbe::RttTrace, this, flow));
+            socket->TraceConnectWithoutContext(
+                "HighestRxAck",
+                ns3::MakeBoundCallback(&TcpProbe::AckTrace, this, c));
+            socket->TraceConnectWithoutContext(
+                "CongState",
+                ns3::MakeBoundCallback(&TcpProbe::CongStateTrace, this, flow));
+        }
+    }
+
+    void Tick()
+    {
+        Discover();
+        double now = ns3::Simulator::Now().GetSeconds();
+        for (size_t f = 0; f < m_flows.size(); ++f)
+        {
+            TcpFlowStats& s = m_stats[f];
+            s.cwndSum += s.cwnd;
+            ++s.cwndSamples;
+            if (m_os)
+            {
+                *m_os << now << "\t" << m_labels[f] << "\t" << s.cwnd << "\t" << s.bytesInFlight
+                      << "\t" << 1000 * s.lastRtt << "\t"
+                      << (s.ackedBytes - s.ackedAtSample) * 8.0 / m_interval.GetSeconds() / 1e6
+                      << "\n";
+            }
+            s.ackedAtSample = s.ackedBytes;
+        }
+        ns3::Simulator::Schedule(m_interval, &TcpProbe::Tick, this);
+    }
+
+    static void CwndTrace(TcpProbe* probe, uint32_t flow, uint32_t /* old */, uint32_t cwnd)
+    {
+        TcpFlowStats& s = probe->m_stats[flow];
+        s.cwnd = cwnd;
+        s.cwndMax = std::max(s.cwndMax, cwnd);
+    }
+
+    static void InFlightTrace(TcpProbe* probe, uint32_t flow, uint32_t /* old */, uint32_t bytes)
+    {
+        probe->m_stats[flow].bytesInFlight = bytes;
+    }
+
+    static void RttTrace(TcpProbe* probe, uint32_t flow, ns3::Time /* old */, ns3::Time rtt)
+    {
+        TcpFlowStats& s = probe->m_stats[flow];
+        double r = rtt.GetSeconds();
+        s.lastRtt = r;
+        ++s.rttSamples;
+        s.rttSum += r;
+        s.rttMin = std::min(s.rttMin, r);
+        s.rttMax = std::max(s.rttMax, r);
+    }
+
+    static void AckTrace(TcpProbe* probe,
+                         size_t connection,
+                         ns3::SequenceNumber32 /* old */,
+                         ns3::SequenceNumber32 ack)
+    {
+        Connection& c = probe->m_connections[connection];
+        // Modulo 2^32, as the sequence numbers wrap
+        uint32_t acked = ack.GetValue() - c.highestAck;
+        if (acked < (1u << 31))
+        {
+            probe->m_stats[c.flow].ackedBytes += acked;
+            c.highestAck = ack.GetValue();
+        }
+    }
+
+    static void CongStateTrace(TcpProbe* probe,
+                               uint32_t flow,
+                               ns3::TcpSocketState::TcpCongState_t old,
+                               ns3::TcpSocketState::TcpCongState_t state)
+    {
+        bool lossState = state == ns3::TcpSocketState::CA_RECOVERY ||
+                         state == ns3::TcpSocketState::CA_LOSS;
+        bool wasLossState = old == ns3::TcpSocketState::CA_RECOVERY ||
+                            old == ns3::TcpSocketState::CA_LOSS;
+        if (lossState && !wasLossState)
+        {
+            ++probe->m_stats[flow].lossEvents;
+        }
+    }
+
+    ns3::Ptr<ns3::TcpL4Protocol> m_tcp;
+    ns3::Time m_interval;
+    std::ostream* m_os{nullptr};
+    std::vector<Connection> m_connections;
+    std::vector<std::pair<ns3::Ipv4Address, uint16_t>> m_flows;
+    std::vector<TcpFlowStats> m_stats;
+    std::vector<std::string> m_labels;
+};
+
+} // namespace kpm
+
+#endif // KPM_TCP_PROBE_H
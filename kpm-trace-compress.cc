@@ -0,0 +1,178 @@
+/**
+ * \file kpm-trace-compress.cc
+ * \brief Compress trace directories into seekable block files (see kpm-block-codec.h).
+ *
+ * kpm-project-11 compresses its traces at the end of a run with
+ * --compressTraces; this tool covers existing directories such as the
+ * sim-params archive, restores the plain text and prints a compressed trace.
+ * Directories are compressed trace by trace (time-ordered "*.txt" files, the
+ * reports are left alone); an index next to a trace moves along with it.
+ * kpm-trace-query and the other analysis tools read the .kpz files directly.
+ *
+ * \code{.unparsed}
+$ g++ -O2 -std=c++17 -o kpm-trace-compress kpm-trace-compress.cc
+$ ./kpm-trace-compress sim-params/sim-1
+$ ./kpm-trace-compress --cat sim-params/sim-1/RxPacketTrace.txt.kpz | head
+$ ./kpm-trace-compress --decompress sim-params/sim-1/RxPacketTrace.txt.kpz
+ * \endcode
+ */
+
+#include "kpm-trace-index.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+int
+Usage(const char* argv0)
+{
+    std::fprintf(stderr,
+                 "Usage: %s [--block=KiB] <dir|trace>...\n"
+                 "       %s --decompress <dir|trace.kpz>...\n"
+                 "       %s --cat <trace.kpz>\n",
+                 argv0,
+                 argv0,
+                 argv0);
+    return 1;
+}
+
+bool
+IsKpz(const std::filesystem::path& p)
+{
+    return p.extension() == ".kpz";
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    size_t blockSize = kpm::BLOCK_FILE_DEFAULT_BLOCK;
+    bool decompress = false;
+    bool cat = false;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 8, "--block=") == 0)
+        {
+            blockSize = std::stoul(arg.substr(8)) * 1024;
+        }
+        else if (arg == "--decompress")
+        {
+            decompress = true;
+        }
+        else if (arg == "--cat")
+        {
+            cat = true;
+        }
+        else if (arg.compare(0, 2, "--") == 0)
+        {
+            return Usage(argv[0]);
+        }
+        else
+        {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.empty() || (cat && (decompress || paths.size() != 1)))
+    {
+        return Usage(argv[0]);
+    }
+
+    if (cat)
+    {
+        kpm::BlockFileReader reader;
+        if (!reader.Open(paths[0]))
+        {
+            std::fprintf(stderr, "Can't open %s\n", paths[0].c_str());
+            return 1;
+        }
+        std::string block;
+        for (size_t b = 0; b < reader.GetBlocks().size(); ++b)
+        {
+            if (!reader.ReadBlock(b, block))
+            {
+                std::fprintf(stderr, "Corrupt block %zu in %s\n", b, paths[0].c_str());
+                return 1;
+            }
+            std::fwrite(block.data(), 1, block.size(), stdout);
+        }
+        return 0;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t rawBytes = 0;
+    uint64_t fileBytes = 0;
+    uint32_t done = 0;
+    bool failed = false;
+    for (const auto& path : paths)
+    {
+        if (decompress)
+        {
+            std::vector<std::string> files;
+            if (std::filesystem::is_directory(path))
+            {
+                for (const auto& entry : std::filesystem::directory_iterator(path))
+                {
+                    if (entry.is_regular_file() && IsKpz(entry.path()))
+                    {
+                        files.push_back(entry.path().string());
+                    }
+                }
+            }
+            else
+            {
+                files.push_back(path);
+            }
+            for (const auto& file : files)
+            {
+                std::string plain = file.substr(0, file.size() - 4);
+                std::error_code ec;
+                fileBytes += std::filesystem::file_size(file, ec);
+                if (!kpm::DecompressFile(file))
+                {
+                    std::fprintf(stderr, "Can't decompress %s\n", file.c_str());
+                    failed = true;
+                    continue;
+                }
+                rawBytes += std::filesystem::file_size(plain, ec);
+                std::filesystem::rename(kpm::TraceIndexPath(file), kpm::TraceIndexPath(plain), ec);
+                ++done;
+            }
+        }
+        else if (std::filesystem::is_directory(path))
+        {
+            done += kpm::CompressTraces(path, blockSize, rawBytes, fileBytes);
+        }
+        else if (kpm::CompressFile(path, blockSize, &rawBytes, &fileBytes))
+        {
+            std::error_code ec;
+            std::filesystem::rename(kpm::TraceIndexPath(path),
+                                    kpm::TraceIndexPath(kpm::CompressedTracePath(path)),
+                                    ec);
+            ++done;
+        }
+        else
+        {
+            std::fprintf(stderr, "Can't compress %s\n", path.c_str());
+            failed = true;
+        }
+    }
+    double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%s %u files: %llu bytes of text, %llu compressed (%.2fx), %.3f s (%.1f MB/s)\n",
+                decompress ? "Decompressed" : "Compressed",
+                done,
+                static_cast<unsigned long long>(rawBytes),
+                static_cast<unsigned long long>(fileBytes),
+                fileBytes > 0 ? double(rawBytes) / fileBytes : 0.0,
+                elapsed,
+                elapsed > 0 ? rawBytes / elapsed / 1e6 : 0.0);
+    return failed ? 1 : 0;
+}
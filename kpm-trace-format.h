@@ -0,0 +1,236 @@
+/**
+ * \file kpm-trace-format.h
+ * \brief Column layout of the NR trace files and fast record splitting.
+ *
+ * All NR traces written by nrHelper->EnableTraces() are tab separated with a
+ * single header line. Column names are normalised so that the analysis tools can
+ * refer to them independently of the spelling used by each writer:
+ * lower case, the "% " prefix and unit suffixes such as "(s)" or "(dB)" removed,
+ * spaces replaced by '_'. For example "% time(s)" -> "time", "SINR(dB)" -> "sinr",
+ * "K1 Delay" -> "k1_delay".
+ *
+ * Known deviations between header and data are corrected here:
+ * - RxedGnbMacCtrlMsgsTrace.txt announces a "VarTTI" column that the writer never
+ *   emits.
+ *
+ * TraceReader reads block-compressed traces (kpm-block-codec.h) as well.
+ *
+ * The header has no ns-3 dependency.
+ */
+
+#ifndef KPM_TRACE_FORMAT_H
+#define KPM_TRACE_FORMAT_H
+
+#include "kpm-block-codec.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace kpm
+{
+
+/// Normalised form of a header column name.
+inline std::string
+NormalizeTraceColumn(std::string_view raw)
+{
+    std::string out;
+    for (char c : raw)
+    {
+        if (c == '(')
+        {
+            break;
+        }
+        if (c == '%' || c == '\r')
+        {
+            continue;
+        }
+        out.push_back(c == ' ' ? '_' : static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+    }
+    size_t first = out.find_first_not_of('_');
+    size_t last = out.find_last_not_of('_');
+    return first == std::string::npos ? std::string() : out.substr(first, last - first + 1);
+}
+
+/**
+ * Split a record into fields (no copies). Trailing empty fields are kept. At most
+ * maxFields fields are produced; the rest of the line is left unsplit.
+ */
+inline void
+SplitTraceFields(std::string_view line,
+                 std::vector<std::string_view>& fields,
+                 size_t maxFields = std::string_view::npos)
+{
+    fields.clear();
+    size_t start = 0;
+    while (fields.size() + 1 < maxFields)
+    {
+        size_t tab = line.find('\t', start);
+        if (tab == std::string_view::npos)
+        {
+            std::string_view last = line.substr(start);
+            if (!last.empty() && last.back() == '\r')
+            {
+                last.remove_suffix(1);
+            }
+            fields.push_back(last);
+            return;
+        }
+        fields.push_back(line.substr(start, tab - start));
+        start = tab + 1;
+    }
+    fields.push_back(line.substr(start, line.find('\t', start) - start));
+}
+
+/**
+ * Normalised column names of a trace, given its file name (with or without
+ * directory) and header line.
+ */
+inline std::vector<std::string>
+TraceColumns(std::string_view fileName, std::string_view header)
+{
+    std::vector<std::string_view> raw;
+    SplitTraceFields(header, raw);
+    std::vector<std::string> columns;
+    for (auto r : raw)
+    {
+        std::string name = NormalizeTraceColumn(r);
+        if (!name.empty())
+        {
+            columns.push_back(name);
+        }
+    }
+    size_t slash = fileName.find_last_of('/');
+    std::string_view base = slash == std::string_view::npos ? fileName : fileName.substr(slash + 1);
+    if (base.compare(0, 23, "RxedGnbMacCtrlMsgsTrace") == 0)
+    {
+        columns.erase(std::remove(columns.begin(), columns.end(), "vartti"), columns.end());
+    }
+    return columns;
+}
+
+/// Index of a normalised column name, or -1.
+inline int
+FindColumn(const std::vector<std::string>& columns, std::string_view name)
+{
+    std::string wanted = NormalizeTraceColumn(name);
+    for (size_t i = 0; i < columns.size(); ++i)
+    {
+        if (columns[i] == wanted)
+        {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+/// Parse a numeric field; returns false if the field is not a number.
+inline bool
+ParseTraceNumber(std::string_view field, double& value)
+{
+    const char* begin = field.data();
+    const char* end = field.data() + field.size();
+    while (begin < end && *begin == ' ')
+    {
+        ++begin;
+    }
+    if (begin < end && *begin == '+')
+    {
+        ++begin;
+    }
+    auto res = std::from_chars(begin, end, value);
+    return res.ec == std::errc() && begin != end;
+}
+
+/// Parse an unsigned integer field, 0 if not a number.
+inline uint64_t
+ParseTraceUint(std::string_view field)
+{
+    uint64_t value = 0;
+    std::from_chars(field.data(), field.data() + field.size(), value);
+    return value;
+}
+
+/**
+ * Sequential reader of one trace file. Next() advances to the next non-empty
+ * record; the accessors read fields of the current record by column index
+ * (as returned by Column()). A trace that was compressed after the run is
+ * opened under its original name.
+ */
+class TraceReader
+{
+  public:
+    /// Open a trace (or its .kpz) and parse its header; false if it cannot be read.
+    bool Open(const std::string& path)
+    {
+        std::string header;
+        if (!m_in.Open(path) && !m_in.Open(CompressedTracePath(path)))
+        {
+            return false;
+        }
+        if (!m_in.GetLine(header))
+        {
+            return false;
+        }
+        m_columns = TraceColumns(path, header);
+        return true;
+    }
+
+    /// Advance to the next record, false at end of file.
+    bool Next()
+    {
+        while (m_in.GetLine(m_line))
+        {
+            if (!m_line.empty() && m_line != "\r")
+            {
+                SplitTraceFields(m_line, m_fields);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// Column index of a (normalised) name, -1 if the trace does not have it.
+    int Column(std::string_view name) const
+    {
+        return FindColumn(m_columns, name);
+    }
+
+    const std::vector<std::string>& Columns() const
+    {
+        return m_columns;
+    }
+
+    std::string_view Text(int col) const
+    {
+        return col >= 0 && col < static_cast<int>(m_fields.size()) ? m_fields[col]
+                                                                   : std::string_view();
+    }
+
+    double Number(int col) const
+    {
+        double v = 0.0;
+        ParseTraceNumber(Text(col), v);
+        return v;
+    }
+
+    uint64_t Uint(int col) const
+    {
+        return ParseTraceUint(Text(col));
+    }
+
+  private:
+    LineInput m_in;
+    std::string m_line;
+    std::vector<std::string> m_columns;
+    std::vector<std::string_view> m_fields;
+};
+
+} // namespace kpm
+
+#endif // KPM_TRACE_FORMAT_H
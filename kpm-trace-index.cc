@@ -0,0 +1,71 @@
+/**
+ * \file kpm-trace-index.cc
+ * \brief Build the sidecar indexes (see kpm-trace-index.h) for existing trace directories.
+ *
+ * kpm-project-11 writes the indexes itself at the end of every run; this tool
+ * covers traces produced before that, e.g. the sim-params archive.
+ *
+ * \code{.unparsed}
+$ g++ -O2 -std=c++17 -o kpm-trace-index kpm-trace-index.cc
+$ ./kpm-trace-index --stride=1024 sim-params/sim-1 sim-params/sim-2/RxPacketTrace.txt
+ * \endcode
+ */
+
+#include "kpm-trace-index.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+int
+main(int argc, char* argv[])
+{
+    uint32_t stride = kpm::TRACE_INDEX_DEFAULT_STRIDE;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--stride=") == 0)
+        {
+            stride = std::stoul(arg.substr(9));
+        }
+        else if (arg.compare(0, 2, "--") == 0)
+        {
+            std::fprintf(stderr, "Usage: %s [--stride=N] <dir|trace>...\n", argv[0]);
+            return 1;
+        }
+        else
+        {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.empty())
+    {
+        std::fprintf(stderr, "Usage: %s [--stride=N] <dir|trace>...\n", argv[0]);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint32_t written = 0;
+    for (const auto& path : paths)
+    {
+        if (std::filesystem::is_directory(path))
+        {
+            written += kpm::BuildTraceIndexes(path, stride);
+        }
+        else if (kpm::BuildTraceIndex(path, stride))
+        {
+            ++written;
+        }
+        else
+        {
+            std::fprintf(stderr, "Can't index %s\n", path.c_str());
+        }
+    }
+    double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("Wrote %u indexes in %.3f s\n", written, elapsed);
+    return 0;
+}
@@ -0,0 +1,430 @@
+/**
+ * \file kpm-trace-index.h
+ * \brief Sparse sidecar indexes for the NR trace files.
+ *
+ * The NR traces (RxPacketTrace.txt, NrDlPdcpTxStats.txt, DlPathlossTrace.txt, ...)
+ * are tab separated text files with one header line and one record per line, in
+ * simulation time order. To inspect one UE in a short time window a reader would
+ * otherwise scan the whole file. For every trace we therefore write a sidecar
+ * "<trace>.idx" holding:
+ *
+ * - a block table: every \c stride records, the byte offset of the block and the
+ *   minimum/maximum time stored in it (time -> byte offset);
+ * - postings: for every (cell, ue) entity, the list of blocks that contain at
+ *   least one of its records.
+ *
+ * The cell column is the first of "cellId"/"nodeId" present in the header and the
+ * UE column the first of "RNTI"/"IMSI" (names as normalised by kpm-trace-format.h),
+ * so the same code serves every trace format.
+ *
+ * The index is a small text file:
+ *
+ * \code{.unparsed}
+KPMIDX 1
+source RxPacketTrace.txt
+size 2411725
+records 41387
+stride 1024
+cell_column 7 cellid
+ue_column 9 rnti
+blocks 41
+B <offset> <firstRecord> <minTime> <maxTime>
+...
+entities 9
+E <cell> <ue> <records> <nBlocks> <block> <block> ...
+ * \endcode
+ *
+ * Building is a single sequential pass, so it can run either inline from a writer
+ * (TraceIndexBuilder::AddRecord) or after the run over finished files
+ * (BuildTraceIndexes).
+ *
+ * Offsets always refer to the uncompressed text. A trace compressed into a
+ * ".kpz" file (kpm-block-codec.h) keeps its index as "<trace>.kpz.idx", and a
+ * reader decompresses only the blocks that hold the selected byte ranges.
+ * The header has no ns-3 dependency.
+ */
+
+#ifndef KPM_TRACE_INDEX_H
+#define KPM_TRACE_INDEX_H
+
+#include "kpm-trace-format.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace kpm
+{
+
+/// Default number of records per index block.
+const uint32_t TRACE_INDEX_DEFAULT_STRIDE = 1024;
+
+/// Sidecar file name of a trace.
+inline std::string
+TraceIndexPath(const std::string& tracePath)
+{
+    return tracePath + ".idx";
+}
+
+/// One block of the index.
+struct TraceIndexBlock
+{
+    uint64_t offset;      //!< byte offset of the first record of the block
+    uint64_t firstRecord; //!< record number of the first record of the block
+    double minTime;       //!< smallest time stored in the block
+    double maxTime;       //!< largest time stored in the block
+};
+
+/// Postings of one (cell, ue) entity.
+struct TraceIndexPosting
+{
+    uint64_t records = 0;         //!< number of records of the entity
+    std::vector<uint32_t> blocks; //!< blocks containing the entity, ascending
+};
+
+/**
+ * Incremental index builder. Feed every record (without the header) in file
+ * order together with its byte offset, then call Write().
+ */
+class TraceIndexBuilder
+{
+  public:
+    TraceIndexBuilder(const std::string& fileName, const std::string& header, uint32_t stride)
+        : m_stride(stride == 0 ? TRACE_INDEX_DEFAULT_STRIDE : stride)
+    {
+        std::vector<std::string> columns = TraceColumns(fileName, header);
+        m_cellColumn = FindColumn(columns, "cellid");
+        if (m_cellColumn < 0)
+        {
+            m_cellColumn = FindColumn(columns, "nodeid");
+        }
+        m_ueColumn = FindColumn(columns, "rnti");
+        if (m_ueColumn < 0)
+        {
+            m_ueColumn = FindColumn(columns, "imsi");
+        }
+        if (m_cellColumn >= 0)
+        {
+            m_cellName = columns[m_cellColumn];
+        }
+        if (m_ueColumn >= 0)
+        {
+            m_ueName = columns[m_ueColumn];
+        }
+    }
+
+    /// Account one record starting at byte offset.
+    void AddRecord(uint64_t offset, const char* line, size_t len)
+    {
+        if (m_records % m_stride == 0)
+        {
+            m_blocks.push_back({offset, m_records, 0.0, 0.0});
+        }
+        TraceIndexBlock& block = m_blocks.back();
+        double t = std::strtod(line, nullptr);
+        if (m_records % m_stride == 0)
+        {
+            block.minTime = t;
+            block.maxTime = t;
+        }
+        else
+        {
+            block.minTime = std::min(block.minTime, t);
+            block.maxTime = std::max(block.maxTime, t);
+        }
+
+        if (m_cellColumn >= 0 || m_ueColumn >= 0)
+        {
+            uint32_t cell = 0;
+            uint32_t ue = 0;
+            int col = 0;
+            const char* p = line;
+            const char* end = line + len;
+            while (p < end && col <= std::max(m_cellColumn, m_ueColumn))
+            {
+                if (col == m_cellColumn)
+                {
+                    cell = std::strtoul(p, nullptr, 10);
+                }
+                if (col == m_ueColumn)
+                {
+                    ue = std::strtoul(p, nullptr, 10);
+                }
+                while (p < end && *p != '\t')
+                {
+                    ++p;
+                }
+                ++p;
+                ++col;
+            }
+            TraceIndexPosting& posting = m_postings[std::make_pair(cell, ue)];
+            uint32_t blockId = static_cast<uint32_t>(m_blocks.size() - 1);
+            if (posting.blocks.empty() || posting.blocks.back() != blockId)
+            {
+                posting.blocks.push_back(blockId);
+            }
+            ++posting.records;
+        }
+        ++m_records;
+    }
+
+    /// Write the sidecar; size is the size of the indexed trace in bytes.
+    bool Write(const std::string& indexPath, const std::string& source, uint64_t size) const
+    {
+        std::ofstream out(indexPath, std::ofstream::out | std::ofstream::trunc);
+        if (!out.is_open())
+        {
+            return false;
+        }
+        out.precision(9);
+        out << "KPMIDX 1\n";
+        out << "source " << source << "\n";
+        out << "size " << size << "\n";
+        out << "records " << m_records << "\n";
+        out << "stride " << m_stride << "\n";
+        out << "cell_column " << m_cellColumn << " " << (m_cellName.empty() ? "-" : m_cellName)
+            << "\n";
+        out << "ue_column " << m_ueColumn << " " << (m_ueName.empty() ? "-" : m_ueName) << "\n";
+        out << "blocks " << m_blocks.size() << "\n";
+        for (const auto& b : m_blocks)
+        {
+            out << "B " << b.offset << " " << b.firstRecord << " " << b.minTime << " " << b.maxTime
+                << "\n";
+        }
+        out << "entities " << m_postings.size() << "\n";
+        for (const auto& e : m_postings)
+        {
+            out << "E " << e.first.first << " " << e.first.second << " " << e.second.records << " "
+                << e.second.blocks.size();
+            for (uint32_t b : e.second.blocks)
+            {
+                out << " " << b;
+            }
+            out << "\n";
+        }
+        return out.good();
+    }
+
+    uint64_t GetRecords() const
+    {
+        return m_records;
+    }
+
+  private:
+    uint32_t m_stride;
+    int m_cellColumn{-1};
+    int m_ueColumn{-1};
+    std::string m_cellName;
+    std::string m_ueName;
+    uint64_t m_records{0};
+    std::vector<TraceIndexBlock> m_blocks;
+    std::map<std::pair<uint32_t, uint32_t>, TraceIndexPosting> m_postings;
+};
+
+/**
+ * Reader side of the sidecar. Block ranges are half-open byte ranges
+ * [begin, end) into the trace; the last block extends to the indexed size.
+ */
+class TraceIndex
+{
+  public:
+    /// Load an index, return false if missing or malformed.
+    bool Load(const std::string& indexPath)
+    {
+        std::ifstream in(indexPath);
+        std::string tag;
+        int version = 0;
+        if (!(in >> tag >> version) || tag != "KPMIDX" || version != 1)
+        {
+            return false;
+        }
+        size_t nBlocks = 0;
+        size_t nEntities = 0;
+        in >> tag >> source >> tag >> size >> tag >> records >> tag >> stride;
+        in >> tag >> cellColumn >> cellName >> tag >> ueColumn >> ueName;
+        in >> tag >> nBlocks;
+        blocks.resize(nBlocks);
+        for (auto& b : blocks)
+        {
+            in >> tag >> b.offset >> b.firstRecord >> b.minTime >> b.maxTime;
+        }
+        in >> tag >> nEntities;
+        for (size_t i = 0; i < nEntities && in; ++i)
+        {
+            uint32_t cell;
+            uint32_t ue;
+            size_t n;
+            TraceIndexPosting posting;
+            in >> tag >> cell >> ue >> posting.records >> n;
+            posting.blocks.resize(n);
+            for (auto& b : posting.blocks)
+            {
+                in >> b;
+            }
+            postings[std::make_pair(cell, ue)] = std::move(posting);
+        }
+        return !in.fail();
+    }
+
+    /// Byte range [begin, end) of a block.
+    std::pair<uint64_t, uint64_t> BlockRange(uint32_t block) const
+    {
+        uint64_t end = block + 1 < blocks.size() ? blocks[block + 1].offset : size;
+        return std::make_pair(blocks[block].offset, end);
+    }
+
+    /// Blocks that may hold records with time in [t0, t1].
+    std::vector<uint32_t> BlocksForTime(double t0, double t1) const
+    {
+        std::vector<uint32_t> out;
+        for (uint32_t i = 0; i < blocks.size(); ++i)
+        {
+            if (blocks[i].maxTime >= t0 && blocks[i].minTime <= t1)
+            {
+                out.push_back(i);
+            }
+        }
+        return out;
+    }
+
+    /**
+     * Blocks that may hold records of an entity; a negative cell or ue acts as a
+     * wildcard. Returns all blocks when the trace has no entity columns.
+     */
+    std::vector<uint32_t> BlocksForEntity(int64_t cell, int64_t ue) const
+    {
+        std::vector<uint32_t> out;
+        if (cellColumn < 0 && ueColumn < 0)
+        {
+            for (uint32_t i = 0; i < blocks.size(); ++i)
+            {
+                out.push_back(i);
+            }
+            return out;
+        }
+        for (const auto& e : postings)
+        {
+            if ((cell < 0 || e.first.first == cell) && (ue < 0 || e.first.second == ue))
+            {
+                out.insert(out.end(), e.second.blocks.begin(), e.second.blocks.end());
+            }
+        }
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+        return out;
+    }
+
+    std::string source;
+    uint64_t size{0};
+    uint64_t records{0};
+    uint32_t stride{0};
+    int cellColumn{-1};
+    int ueColumn{-1};
+    std::string cellName;
+    std::string ueName;
+    std::vector<TraceIndexBlock> blocks;
+    std::map<std::pair<uint32_t, uint32_t>, TraceIndexPosting> postings;
+};
+
+/// True for a time-ordered trace, as opposed to the reports that share its directory.
+inline bool
+IsTimeOrderedTrace(const std::string& tracePath, const std::string& header)
+{
+    std::vector<std::string> columns = TraceColumns(tracePath, header);
+    return !columns.empty() && (columns[0] == "time" || columns[0] == "start");
+}
+
+/// Index one finished trace file (plain or .kpz), return false if it cannot be read or written.
+inline bool
+BuildTraceIndex(const std::string& tracePath, uint32_t stride)
+{
+    LineInput in;
+    std::string line;
+    if (!in.Open(tracePath) || !in.GetLine(line) || !IsTimeOrderedTrace(tracePath, line))
+    {
+        return false;
+    }
+    TraceIndexBuilder builder(tracePath, line, stride);
+    uint64_t offset = line.size() + 1;
+    while (in.GetLine(line))
+    {
+        if (!line.empty())
+        {
+            builder.AddRecord(offset, line.data(), line.size());
+        }
+        offset += line.size() + 1;
+    }
+    uint64_t size = in.GetRawSize() >= 0 ? in.GetRawSize() : std::filesystem::file_size(tracePath);
+    std::string source = std::filesystem::path(tracePath).filename().string();
+    return builder.Write(TraceIndexPath(tracePath), source, size);
+}
+
+/**
+ * Index every "*.txt" and "*.kpz" trace in a directory. Returns the number of
+ * indexes written.
+ */
+inline uint32_t
+BuildTraceIndexes(const std::string& dir, uint32_t stride)
+{
+    uint32_t written = 0;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec))
+    {
+        if (entry.is_regular_file() &&
+            (entry.path().extension() == ".txt" || entry.path().extension() == ".kpz") &&
+            BuildTraceIndex(entry.path().string(), stride))
+        {
+            ++written;
+        }
+    }
+    return written;
+}
+
+/**
+ * Replace every time-ordered "*.txt" trace in a directory by its ".kpz" form,
+ * moving an existing index along (its offsets do not change). Returns the
+ * number of traces compressed and adds the sizes before and after to rawBytes
+ * and fileBytes.
+ */
+inline uint32_t
+CompressTraces(const std::string& dir, size_t blockSize, uint64_t& rawBytes, uint64_t& fileBytes)
+{
+    std::vector<std::string> traces;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec))
+    {
+        if (!entry.is_regular_file() || entry.path().extension() != ".txt")
+        {
+            continue;
+        }
+        std::string path = entry.path().string();
+        std::ifstream in(path);
+        std::string header;
+        if (std::getline(in, header) && IsTimeOrderedTrace(path, header))
+        {
+            traces.push_back(path);
+        }
+    }
+    uint32_t compressed = 0;
+    for (const auto& path : traces)
+    {
+        if (CompressFile(path, blockSize, &rawBytes, &fileBytes))
+        {
+            ++compressed;
+            std::filesystem::rename(TraceIndexPath(path),
+                                    TraceIndexPath(CompressedTracePath(path)),
+                                    ec);
+        }
+    }
+    return compressed;
+}
+
+} // namespace kpm
+
+#endif // KPM_TRACE_INDEX_H
@@ -0,0 +1,849 @@
+/**
+ * \file kpm-trace-query.cc
+ * \brief Filter, project and aggregate NR trace files.
+ *
+ * Understands the header of every NR trace written by kpm-project-11
+ * (RxPacketTrace, NrDlMacStats, DlDataSinr, PDCP/RLC stats, control-message
+ * traces, ...) through kpm-trace-format.h, so columns are referred to by their
+ * normalised names (time, cellid, rnti, mcs, sinr, delay, msgtype, ...).
+ *
+ * The trace is memory mapped and split in newline-aligned chunks that are
+ * processed by a pool of threads. When a sidecar index (kpm-trace-index.h) is
+ * present, time and cellId/RNTI equality filters only visit the blocks that can
+ * match. A block-compressed trace (<trace>.kpz, kpm-block-codec.h) is queried
+ * in place: only the compressed blocks under the candidate ranges are
+ * decompressed.
+ *
+ * Examples:
+ *
+ * \code{.unparsed}
+$ g++ -O2 -std=c++17 -pthread -o kpm-trace-query kpm-trace-query.cc
+# MCS distribution for RNTI 2 in cell 4 after 0.15 s
+$ ./kpm-trace-query sim-params/sim-3/RxPacketTrace.txt --where="rnti=2,cellid=4,time>0.15" --group-by=mcs
+# Mean PDCP delay per UE
+$ ./kpm-trace-query NrDlPdcpRxStats.txt --group-by=cellid,rnti --agg=count,avg:delay,max:delay
+# Raw records
+$ ./kpm-trace-query DlDataSinr.txt --where="sinr<0" --select=time,cellid,rnti,sinr --limit=20
+ * \endcode
+ *
+ * Filter operators: = (or ==), !=, <, <=, >, >=. Values are compared numerically
+ * when both sides are numbers and as strings otherwise (e.g. msgtype=DL_CQI).
+ * Aggregates: count, sum:col, avg:col, min:col, max:col.
+ */
+
+#include "kpm-trace-format.h"
+#include "kpm-trace-index.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace kpm;
+
+namespace
+{
+
+const size_t CHUNK_SIZE = 1 << 20;
+
+/// One condition of --where.
+struct Filter
+{
+    enum Op
+    {
+        EQ,
+        NE,
+        LT,
+        LE,
+        GT,
+        GE
+    };
+
+    int column;
+    Op op;
+    bool numeric;
+    double number;
+    std::string text;
+
+    bool Match(std::string_view field) const
+    {
+        int cmp;
+        double value;
+        if (numeric && ParseTraceNumber(field, value))
+        {
+            cmp = value < number ? -1 : (value > number ? 1 : 0);
+        }
+        else
+        {
+            cmp = field.compare(text);
+        }
+        switch (op)
+        {
+        case EQ:
+            return cmp == 0;
+        case NE:
+            return cmp != 0;
+        case LT:
+            return cmp < 0;
+        case LE:
+            return cmp <= 0;
+        case GT:
+            return cmp > 0;
+        default:
+            return cmp >= 0;
+        }
+    }
+};
+
+/// One aggregate of --agg.
+struct Aggregate
+{
+    enum Kind
+    {
+        COUNT,
+        SUM,
+        AVG,
+        MIN,
+        MAX
+    };
+
+    Kind kind;
+    int column;
+    std::string label;
+};
+
+/// Running state of one aggregate.
+struct AggState
+{
+    double count = 0;
+    double sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    void Merge(const AggState& o)
+    {
+        count += o.count;
+        sum += o.sum;
+        min = std::min(min, o.min);
+        max = std::max(max, o.max);
+    }
+};
+
+typedef std::unordered_map<std::string, std::vector<AggState>> GroupMap;
+
+/// Parsed command line.
+struct Query
+{
+    std::string path;
+    std::vector<Filter> filters;
+    std::vector<int> select;
+    std::vector<int> groupBy;
+    std::vector<Aggregate> aggs;
+    uint64_t limit = 0;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    bool useIndex = true;
+    bool stats = false;
+};
+
+std::vector<std::string>
+SplitList(const std::string& s)
+{
+    std::vector<std::string> out;
+    size_t start = 0;
+    while (start <= s.size())
+    {
+        size_t comma = s.find(',', start);
+        if (comma == std::string::npos)
+        {
+            comma = s.size();
+        }
+        if (comma > start)
+        {
+            out.push_back(s.substr(start, comma - start));
+        }
+        start = comma + 1;
+    }
+    return out;
+}
+
+int
+RequireColumn(const std::vector<std::string>& columns, const std::string& name)
+{
+    int col = FindColumn(columns, name);
+    if (col < 0)
+    {
+        std::string known;
+        for (const auto& c : columns)
+        {
+            known += " " + c;
+        }
+        throw std::runtime_error("unknown column '" + name + "', available:" + known);
+    }
+    return col;
+}
+
+Filter
+ParseFilter(const std::vector<std::string>& columns, const std::string& expr)
+{
+    static const std::pair<const char*, Filter::Op> ops[] = {{"!=", Filter::NE},
+                                                             {"<=", Filter::LE},
+                                                             {">=", Filter::GE},
+                                                             {"==", Filter::EQ},
+                                                             {"=", Filter::EQ},
+                                                             {"<", Filter::LT},
+                                                             {">", Filter::GT}};
+    for (const auto& op : ops)
+    {
+        size_t pos = expr.find(op.first);
+        if (pos != std::string::npos)
+        {
+            Filter f;
+            f.column = RequireColumn(columns, expr.substr(0, pos));
+            f.op = op.second;
+            f.text = expr.substr(pos + std::strlen(op.first));
+            f.numeric = ParseTraceNumber(f.text, f.number);
+            return f;
+        }
+    }
+    throw std::runtime_error("malformed filter '" + expr + "'");
+}
+
+Aggregate
+ParseAggregate(const std::vector<std::string>& columns, const std::string& spec)
+{
+    Aggregate a;
+    a.label = spec;
+    a.column = -1;
+    size_t colon = spec.find(':');
+    std::string kind = spec.substr(0, colon);
+    if (kind == "count")
+    {
+        a.kind = Aggregate::COUNT;
+        return a;
+    }
+    if (colon == std::string::npos)
+    {
+        throw std::runtime_error("aggregate '" + spec + "' needs a column, e.g. avg:sinr");
+    }
+    a.column = RequireColumn(columns, spec.substr(colon + 1));
+    if (kind == "sum")
+    {
+        a.kind = Aggregate::SUM;
+    }
+    else if (kind == "avg")
+    {
+        a.kind = Aggregate::AVG;
+    }
+    else if (kind == "min")
+    {
+        a.kind = Aggregate::MIN;
+    }
+    else if (kind == "max")
+    {
+        a.kind = Aggregate::MAX;
+    }
+    else
+    {
+        throw std::runtime_error("unknown aggregate '" + kind + "'");
+    }
+    return a;
+}
+
+/**
+ * Byte ranges of the body that can hold matching records, using the sidecar
+ * index when it is present and still describes the file.
+ */
+std::vector<std::pair<uint64_t, uint64_t>>
+CandidateRanges(const Query& q,
+                const std::vector<std::string>& columns,
+                uint64_t bodyStart,
+                uint64_t size,
+                bool& indexed)
+{
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    TraceIndex index;
+    indexed = q.useIndex && index.Load(TraceIndexPath(q.path)) && index.size <= size &&
+              !index.blocks.empty();
+    if (!indexed)
+    {
+        ranges.emplace_back(bodyStart, size);
+        return ranges;
+    }
+
+    double t0 = -std::numeric_limits<double>::infinity();
+    double t1 = std::numeric_limits<double>::infinity();
+    int64_t cell = -1;
+    int64_t ue = -1;
+    for (const auto& f : q.filters)
+    {
+        if (!f.numeric)
+        {
+            continue;
+        }
+        if (f.column == 0)
+        {
+            if (f.op == Filter::GT || f.op == Filter::GE || f.op == Filter::EQ)
+            {
+                t0 = std::max(t0, f.number);
+            }
+            if (f.op == Filter::LT || f.op == Filter::LE || f.op == Filter::EQ)
+            {
+                t1 = std::min(t1, f.number);
+            }
+        }
+        else if (f.op == Filter::EQ && columns[f.column] == index.cellName)
+        {
+            cell = static_cast<int64_t>(f.number);
+        }
+        else if (f.op == Filter::EQ && columns[f.column] == index.ueName)
+        {
+            ue = static_cast<int64_t>(f.number);
+        }
+    }
+
+    std::vector<uint32_t> byTime = index.BlocksForTime(t0, t1);
+    std::vector<uint32_t> blocks;
+    if (cell >= 0 || ue >= 0)
+    {
+        std::vector<uint32_t> byEntity = index.BlocksForEntity(cell, ue);
+        std::set_intersection(byTime.begin(),
+                              byTime.end(),
+                              byEntity.begin(),
+                              byEntity.end(),
+                              std::back_inserter(blocks));
+    }
+    else
+    {
+        blocks = byTime;
+    }
+
+    for (uint32_t b : blocks)
+    {
+        auto r = index.BlockRange(b);
+        if (!ranges.empty() && ranges.back().second == r.first)
+        {
+            ranges.back().second = r.second;
+        }
+        else
+        {
+            ranges.push_back(r);
+        }
+    }
+    // Records appended after the index was written
+    if (index.size < size)
+    {
+        ranges.emplace_back(index.size, size);
+    }
+    return ranges;
+}
+
+/// Cut ranges into newline-aligned chunks of about CHUNK_SIZE bytes.
+std::vector<std::pair<uint64_t, uint64_t>>
+MakeChunks(const char* data, const std::vector<std::pair<uint64_t, uint64_t>>& ranges)
+{
+    std::vector<std::pair<uint64_t, uint64_t>> chunks;
+    for (const auto& r : ranges)
+    {
+        uint64_t begin = r.first;
+        while (begin < r.second)
+        {
+            uint64_t end = std::min(begin + CHUNK_SIZE, r.second);
+            if (end < r.second)
+            {
+                const void* nl = std::memchr(data + end, '\n', r.second - end);
+                end = nl ? static_cast<const char*>(nl) - data + 1 : r.second;
+            }
+            chunks.emplace_back(begin, end);
+            begin = end;
+        }
+    }
+    return chunks;
+}
+
+bool
+LessKey(const std::string& a, const std::string& b)
+{
+    std::vector<std::string_view> fa;
+    std::vector<std::string_view> fb;
+    SplitTraceFields(a, fa);
+    SplitTraceFields(b, fb);
+    for (size_t i = 0; i < fa.size() && i < fb.size(); ++i)
+    {
+        double va;
+        double vb;
+        if (ParseTraceNumber(fa[i], va) && ParseTraceNumber(fb[i], vb))
+        {
+            if (va != vb)
+            {
+                return va < vb;
+            }
+        }
+        else if (fa[i] != fb[i])
+        {
+            return fa[i] < fb[i];
+        }
+    }
+    return fa.size() < fb.size();
+}
+
+void
+Usage(const char* prog)
+{
+    std::fprintf(stderr,
+                 "Usage: %s <trace> [--where=col<op>val,...] [--select=col,...]\n"
+                 "       [--group-by=col,...] [--agg=count,avg:col,...] [--limit=N]\n"
+                 "       [--threads=N] [--no-index] [--columns] [--stats]\n",
+                 prog);
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    Query q;
+    std::string where;
+    std::string select;
+    std::string groupBy;
+    std::string agg;
+    bool listColumns = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto value = [&arg](const char* name, std::string& out) {
+            size_t n = std::strlen(name);
+            if (arg.compare(0, n, name) == 0)
+            {
+                out = arg.substr(n);
+                return true;
+            }
+            return false;
+        };
+        std::string num;
+        if (value("--where=", where) || value("--select=", select) ||
+            value("--group-by=", groupBy) || value("--agg=", agg))
+        {
+            continue;
+        }
+        if (value("--limit=", num))
+        {
+            q.limit = std::stoull(num);
+        }
+        else if (value("--threads=", num))
+        {
+            q.threads = std::max(1ul, std::stoul(num));
+        }
+        else if (arg == "--no-index")
+        {
+            q.useIndex = false;
+        }
+        else if (arg == "--columns")
+        {
+            listColumns = true;
+        }
+        else if (arg == "--stats")
+        {
+            q.stats = true;
+        }
+        else if (arg.compare(0, 2, "--") != 0 && q.path.empty())
+        {
+            q.path = arg;
+        }
+        else
+        {
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+    if (q.path.empty())
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    if (access(q.path.c_str(), F_OK) != 0 && access(CompressedTracePath(q.path).c_str(), F_OK) == 0)
+    {
+        q.path = CompressedTracePath(q.path);
+    }
+    int fd = open(q.path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        std::fprintf(stderr, "Can't open %s\n", q.path.c_str());
+        return 1;
+    }
+
+    /*
+     * A compressed trace is decompressed into an anonymous mapping of its raw size,
+     * block by block as the ranges are known; untouched pages cost nothing.
+     */
+    BlockFileReader blockFile;
+    bool compressed = IsBlockFile(q.path) && blockFile.Open(q.path);
+    std::vector<bool> loaded;
+    size_t blocksLoaded = 0;
+    uint64_t size = compressed ? blockFile.GetRawSize() : st.st_size;
+    if (size == 0)
+    {
+        return 0;
+    }
+    const char* data = static_cast<const char*>(
+        compressed ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+                   : mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+    if (data == MAP_FAILED)
+    {
+        std::fprintf(stderr, "Can't map %s\n", q.path.c_str());
+        return 1;
+    }
+    auto load = [&](uint64_t begin, uint64_t end) {
+        for (size_t b = blockFile.BlockAt(begin); b < loaded.size(); ++b)
+        {
+            auto range = blockFile.RawRange(b);
+            if (range.first >= end)
+            {
+                break;
+            }
+            if (!loaded[b])
+            {
+                if (!blockFile.ReadBlock(b, const_cast<char*>(data) + range.first))
+                {
+                    return false;
+                }
+                loaded[b] = true;
+                ++blocksLoaded;
+            }
+        }
+        return true;
+    };
+    if (compressed)
+    {
+        loaded.assign(blockFile.GetBlocks().size(), false);
+        if (!load(0, 1))
+        {
+            std::fprintf(stderr, "Corrupt block in %s\n", q.path.c_str());
+            return 1;
+        }
+    }
+    else
+    {
+        madvise(const_cast<char*>(data), size, MADV_WILLNEED);
+    }
+
+    const char* headerEnd = static_cast<const char*>(std::memchr(data, '\n', size));
+    uint64_t bodyStart = headerEnd ? headerEnd - data + 1 : size;
+    std::vector<std::string> columns =
+        TraceColumns(q.path, std::string_view(data, headerEnd ? headerEnd - data : size));
+
+    if (listColumns)
+    {
+        for (const auto& c : columns)
+        {
+            std::printf("%s\n", c.c_str());
+        }
+        return 0;
+    }
+
+    try
+    {
+        for (const auto& f : SplitList(where))
+        {
+            q.filters.push_back(ParseFilter(columns, f));
+        }
+        for (const auto& c : SplitList(select))
+        {
+            q.select.push_back(RequireColumn(columns, c));
+        }
+        for (const auto& c : SplitList(groupBy))
+        {
+            q.groupBy.push_back(RequireColumn(columns, c));
+        }
+        for (const auto& a : SplitList(agg))
+        {
+            q.aggs.push_back(ParseAggregate(columns, a));
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    bool grouping = !q.groupBy.empty() || !q.aggs.empty();
+    if (grouping && q.aggs.empty())
+    {
+        q.aggs.push_back(Aggregate{Aggregate::COUNT, -1, "count"});
+    }
+    if (!grouping && q.select.empty())
+    {
+        for (size_t c = 0; c < columns.size(); ++c)
+        {
+            q.select.push_back(c);
+        }
+    }
+
+    // Fields past the last referenced column are never split
+    size_t maxFields = 0;
+    for (const auto& f : q.filters)
+    {
+        maxFields = std::max<size_t>(maxFields, f.column + 1);
+    }
+    for (int c : q.select)
+    {
+        maxFields = std::max<size_t>(maxFields, c + 1);
+    }
+    for (int c : q.groupBy)
+    {
+        maxFields = std::max<size_t>(maxFields, c + 1);
+    }
+    for (const auto& a : q.aggs)
+    {
+        maxFields = std::max<size_t>(maxFields, a.column + 1);
+    }
+
+    bool indexed = false;
+    auto ranges = CandidateRanges(q, columns, bodyStart, size, indexed);
+    if (compressed)
+    {
+        for (const auto& r : ranges)
+        {
+            if (!load(r.first, r.second))
+            {
+                std::fprintf(stderr, "Corrupt block in %s\n", q.path.c_str());
+                return 1;
+            }
+        }
+    }
+    auto chunks = MakeChunks(data, ranges);
+
+    std::vector<std::string> chunkOutput(grouping ? 0 : chunks.size());
+    std::vector<GroupMap> threadGroups(q.threads);
+    std::atomic<size_t> nextChunk{0};
+    std::atomic<uint64_t> scanned{0};
+
+    auto worker = [&](unsigned id) {
+        std::vector<std::string_view> fields;
+        std::string key;
+        GroupMap& groups = threadGroups[id];
+        uint64_t lines = 0;
+        for (size_t c = nextChunk++; c < chunks.size(); c = nextChunk++)
+        {
+            const char* p = data + chunks[c].first;
+            const char* end = data + chunks[c].second;
+            uint64_t emitted = 0;
+            while (p < end)
+            {
+                const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+                const char* lineEnd = nl ? nl : end;
+                std::string_view line(p, lineEnd - p);
+                p = lineEnd + 1;
+                if (line.empty())
+                {
+                    continue;
+                }
+                ++lines;
+                SplitTraceFields(line, fields, maxFields);
+                bool match = true;
+                for (const auto& f : q.filters)
+                {
+                    if (f.column >= static_cast<int>(fields.size()) || !f.Match(fields[f.column]))
+                    {
+                        match = false;
+                        break;
+                    }
+                }
+                if (!match)
+                {
+                    continue;
+                }
+                if (!grouping)
+                {
+                    if (q.limit > 0 && emitted >= q.limit)
+                    {
+                        break;
+                    }
+                    std::string& out = chunkOutput[c];
+                    for (size_t s = 0; s < q.select.size(); ++s)
+                    {
+                        if (s > 0)
+                        {
+                            out.push_back('\t');
+                        }
+                        if (q.select[s] < static_cast<int>(fields.size()))
+                        {
+                            out.append(fields[q.select[s]]);
+                        }
+                    }
+                    out.push_back('\n');
+                    ++emitted;
+                    continue;
+                }
+                key.clear();
+                for (size_t g = 0; g < q.groupBy.size(); ++g)
+                {
+                    if (g > 0)
+                    {
+                        key.push_back('\t');
+                    }
+                    if (q.groupBy[g] < static_cast<int>(fields.size()))
+                    {
+                        key.append(fields[q.groupBy[g]]);
+                    }
+                }
+                auto it = groups.find(key);
+                if (it == groups.end())
+                {
+                    it = groups.emplace(key, std::vector<AggState>(q.aggs.size())).first;
+                }
+                for (size_t a = 0; a < q.aggs.size(); ++a)
+                {
+                    AggState& s = it->second[a];
+                    double v = 0;
+                    if (q.aggs[a].column >= 0)
+                    {
+                        if (q.aggs[a].column >= static_cast<int>(fields.size()) ||
+                            !ParseTraceNumber(fields[q.aggs[a].column], v))
+                        {
+                            continue;
+                        }
+                    }
+                    s.count += 1;
+                    s.sum += v;
+                    s.min = std::min(s.min, v);
+                    s.max = std::max(s.max, v);
+                }
+            }
+        }
+        scanned += lines;
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < q.threads; ++t)
+    {
+        pool.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto& t : pool)
+    {
+        t.join();
+    }
+
+    if (!grouping)
+    {
+        for (size_t s = 0; s < q.select.size(); ++s)
+        {
+            std::printf("%s%s", s > 0 ? "\t" : "", columns[q.select[s]].c_str());
+        }
+        std::printf("\n");
+        uint64_t printed = 0;
+        for (const auto& out : chunkOutput)
+        {
+            size_t pos = 0;
+            while (pos < out.size() && (q.limit == 0 || printed < q.limit))
+            {
+                size_t nl = out.find('\n', pos);
+                std::fwrite(out.data() + pos, 1, nl + 1 - pos, stdout);
+                pos = nl + 1;
+                ++printed;
+            }
+        }
+    }
+    else
+    {
+        std::map<std::string, std::vector<AggState>, bool (*)(const std::string&, const std::string&)>
+            merged(&LessKey);
+        for (const auto& groups : threadGroups)
+        {
+            for (const auto& g : groups)
+            {
+                auto it = merged.find(g.first);
+                if (it == merged.end())
+                {
+                    merged.emplace(g.first, g.second);
+                    continue;
+                }
+                for (size_t a = 0; a < q.aggs.size(); ++a)
+                {
+                    it->second[a].Merge(g.second[a]);
+                }
+            }
+        }
+        for (size_t g = 0; g < q.groupBy.size(); ++g)
+        {
+            std::printf("%s\t", columns[q.groupBy[g]].c_str());
+        }
+        for (size_t a = 0; a < q.aggs.size(); ++a)
+        {
+            std::printf("%s%s", a > 0 ? "\t" : "", q.aggs[a].label.c_str());
+        }
+        std::printf("\n");
+        for (const auto& g : merged)
+        {
+            if (!q.groupBy.empty())
+            {
+                std::printf("%s\t", g.first.c_str());
+            }
+            for (size_t a = 0; a < q.aggs.size(); ++a)
+            {
+                const AggState& s = g.second[a];
+                double v = 0;
+                switch (q.aggs[a].kind)
+                {
+                case Aggregate::COUNT:
+                    v = s.count;
+                    break;
+                case Aggregate::SUM:
+                    v = s.sum;
+                    break;
+                case Aggregate::AVG:
+                    v = s.count > 0 ? s.sum / s.count : 0;
+                    break;
+                case Aggregate::MIN:
+                    v = s.min;
+                    break;
+                case Aggregate::MAX:
+                    v = s.max;
+                    break;
+                }
+                std::printf("%s%.10g", a > 0 ? "\t" : "", v);
+            }
+            std::printf("\n");
+        }
+    }
+
+    if (q.stats)
+    {
+        double elapsed =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::fprintf(stderr,
+                     "%llu records scanned in %zu chunks (%s), %u threads, %.3f s\n",
+                     static_cast<unsigned long long>(scanned.load()),
+                     chunks.size(),
+                     indexed ? "indexed" : "full scan",
+                     q.threads,
+                     elapsed);
+        if (compressed)
+        {
+            std::fprintf(stderr,
+                         "%zu of %zu compressed blocks decompressed\n",
+                         blocksLoaded,
+                         loaded.size());
+        }
+    }
+
+    munmap(const_cast<char*>(data), size);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,151 @@
+/**
+ * \file kpm-trace-store.cc
+ * \brief Store and restore run directories in a content-addressed trace store.
+ *
+ * See kpm-trace-store.h for the layout. kpm-project-11 stores its own output at
+ * the end of a run (--traceStore); this tool covers existing directories such as
+ * the sim-params archive, restores runs and reports the space saved.
+ *
+ * \code{.unparsed}
+$ g++ -O2 -std=c++17 -o kpm-trace-store kpm-trace-store.cc
+$ ./kpm-trace-store store archive sim-params/sim-2 sim-2
+$ ./kpm-trace-store store archive sim-params/sim-3 sim-3
+$ ./kpm-trace-store restore archive sim-3 /tmp/sim-3
+$ ./kpm-trace-store du archive
+ * \endcode
+ */
+
+#include "kpm-trace-store.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+
+namespace
+{
+
+int
+Usage(const char* argv0)
+{
+    std::fprintf(stderr,
+                 "Usage: %s store <store> <dir> <run>\n"
+                 "       %s restore <store> <run> <outdir>\n"
+                 "       %s ls <store>\n"
+                 "       %s du <store>\n",
+                 argv0,
+                 argv0,
+                 argv0,
+                 argv0);
+    return 1;
+}
+
+/// Logical size of a stored run, from its manifest.
+uint64_t
+RunSize(const kpm::TraceStore& store, const std::string& run, uint64_t& files)
+{
+    std::ifstream manifest(store.ManifestPath(run));
+    std::string line;
+    uint64_t size = 0;
+    while (std::getline(manifest, line))
+    {
+        uint64_t fileSize = 0;
+        uint64_t n = 0;
+        if (std::sscanf(line.c_str(), "F %" SCNu64 " %" SCNu64, &fileSize, &n) == 2)
+        {
+            size += fileSize;
+            ++files;
+        }
+    }
+    return size;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        return Usage(argv[0]);
+    }
+    std::string command = argv[1];
+    kpm::TraceStore store(argv[2]);
+    auto start = std::chrono::steady_clock::now();
+
+    if (command == "store" && argc == 5)
+    {
+        kpm::TraceStoreStats stats;
+        if (store.HasRun(argv[4]))
+        {
+            std::fprintf(stderr, "Run %s is already in the store\n", argv[4]);
+            return 1;
+        }
+        if (!store.Store(argv[3], argv[4], stats))
+        {
+            std::fprintf(stderr, "Can't store %s\n", argv[3]);
+            return 1;
+        }
+        double elapsed =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("Stored %" PRIu64 " files, %" PRIu64 " bytes in %" PRIu64 " chunks; "
+                    "%" PRIu64 " new chunks, %" PRIu64 " new bytes (%.1f %%) in %.3f s\n",
+                    stats.files,
+                    stats.bytes,
+                    stats.chunks,
+                    stats.newChunks,
+                    stats.newBytes,
+                    stats.bytes > 0 ? 100.0 * stats.newBytes / stats.bytes : 0.0,
+                    elapsed);
+        return 0;
+    }
+    if (command == "restore" && argc == 5)
+    {
+        if (!store.Restore(argv[3], argv[4]))
+        {
+            std::fprintf(stderr, "Can't restore %s\n", argv[3]);
+            return 1;
+        }
+        return 0;
+    }
+    if (command == "ls" && argc == 3)
+    {
+        for (const auto& run : store.Runs())
+        {
+            uint64_t files = 0;
+            uint64_t size = RunSize(store, run, files);
+            std::printf("%s\t%" PRIu64 " files\t%" PRIu64 " bytes\n", run.c_str(), files, size);
+        }
+        return 0;
+    }
+    if (command == "du" && argc == 3)
+    {
+        uint64_t logical = 0;
+        uint64_t files = 0;
+        for (const auto& run : store.Runs())
+        {
+            logical += RunSize(store, run, files);
+        }
+        uint64_t physical = 0;
+        uint64_t chunks = 0;
+        std::error_code ec;
+        for (const auto& entry :
+             std::filesystem::recursive_directory_iterator(std::string(argv[2]) + "/chunks", ec))
+        {
+            if (entry.is_regular_file())
+            {
+                physical += entry.file_size();
+                ++chunks;
+            }
+        }
+        std::printf("%" PRIu64 " files, %" PRIu64 " logical bytes; %" PRIu64
+                    " chunks, %" PRIu64 " stored bytes (%.1f %%)\n",
+                    files,
+                    logical,
+                    chunks,
+                    physical,
+                    logical > 0 ? 100.0 * physical / logical : 0.0);
+        return 0;
+    }
+    return Usage(argv[0]);
+}
@@ -0,0 +1,498 @@
+/**
+ * \file kpm-trace-store.h
+ * \brief Content-addressed, deduplicated storage of simulation output directories.
+ *
+ * Runs of a parameter sweep share most of their traces: sim-2 and sim-3 differ
+ * only in packet sizes, and eight of their traces (control messages, pathloss,
+ * ...) are byte-identical. The store keeps every file as a list of chunks, each
+ * stored once under its SHA-256:
+ *
+ * \code{.unparsed}
+<store>/chunks/ab/ab3f...e1        chunk data, named by its SHA-256
+<store>/manifests/<run>.manifest   file layout of one run
+ * \endcode
+ *
+ * Chunk boundaries are content defined (a gear rolling hash, as in FastCDC), so a
+ * file that shares a long run of records with another one, but not its byte
+ * offsets, still shares the chunks of that run. Chunks are between 8 KiB and
+ * 256 KiB, 32 KiB on average. A manifest is a small text file:
+ *
+ * \code{.unparsed}
+KPMSTORE 1
+F <size> <chunks> <relative path>
+C <sha256> <length>
+...
+ * \endcode
+ *
+ * Restore() recreates the usual directory layout of a run from its manifest.
+ * Chunks and manifests are written to a temporary name and then renamed or
+ * linked into place, so concurrent runs can share one store. A run name is
+ * stored once: Store() refuses a run whose manifest exists, rather than replace
+ * another run's layout. StoreFiles() stores an explicit list of files and, with
+ * removeStored, deletes exactly those once the manifest is in place, so the
+ * store replaces the run's output instead of adding to it without touching the
+ * other files of a shared directory. The header has no ns-3 dependency.
+ */
+
+#ifndef KPM_TRACE_STORE_H
+#define KPM_TRACE_STORE_H
+
+#include <algorithm>
+#include <array>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace kpm
+{
+
+/// Incremental SHA-256 (FIPS 180-4).
+class Sha256
+{
+  public:
+    Sha256()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        static const uint32_t init[8] = {0x6a09e667,
+                                         0xbb67ae85,
+                                         0x3c6ef372,
+                                         0xa54ff53a,
+                                         0x510e527f,
+                                         0x9b05688c,
+                                         0x1f83d9ab,
+                                         0x5be0cd19};
+        std::memcpy(m_h, init, sizeof(m_h));
+        m_length = 0;
+        m_used = 0;
+    }
+
+    void Update(const void* data, size_t len)
+    {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        m_length += len;
+        if (m_used > 0)
+        {
+            size_t n = std::min(len, sizeof(m_block) - m_used);
+            std::memcpy(m_block + m_used, p, n);
+            m_used += n;
+            p += n;
+            len -= n;
+            if (m_used < sizeof(m_block))
+            {
+                return;
+            }
+            Compress(m_block);
+            m_used = 0;
+        }
+        for (; len >= sizeof(m_block); p += sizeof(m_block), len -= sizeof(m_block))
+        {
+            Compress(p);
+        }
+        std::memcpy(m_block, p, len);
+        m_used = len;
+    }
+
+    /// Finish and return the digest as 64 lowercase hex digits.
+    std::string HexDigest()
+    {
+        uint64_t bits = m_length * 8;
+        uint8_t pad = 0x80;
+        Update(&pad, 1);
+        pad = 0;
+        while (m_used != 56)
+        {
+            Update(&pad, 1);
+        }
+        uint8_t lenBytes[8];
+        for (int i = 0; i < 8; ++i)
+        {
+            lenBytes[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+        }
+        Update(lenBytes, 8);
+        static const char* hex = "0123456789abcdef";
+        std::string out(64, '0');
+        for (int i = 0; i < 8; ++i)
+        {
+            for (int j = 0; j < 8; ++j)
+            {
+                out[8 * i + j] = hex[(m_h[i] >> (28 - 4 * j)) & 0xf];
+            }
+        }
+        return out;
+    }
+
+  private:
+    static uint32_t Rotr(uint32_t x, int n)
+    {
+        return (x >> n) | (x << (32 - n));
+    }
+
+    void Compress(const uint8_t* block)
+    {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4,
+            0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe,
+            0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f,
+            0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+            0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+            0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+            0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116,
+            0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7,
+            0xc67178f2};
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i)
+        {
+            w[i] = (uint32_t(block[4 * i]) << 24) | (uint32_t(block[4 * i + 1]) << 16) |
+                   (uint32_t(block[4 * i + 2]) << 8) | uint32_t(block[4 * i + 3]);
+        }
+        for (int i = 16; i < 64; ++i)
+        {
+            uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = m_h[0], b = m_h[1], c = m_h[2], d = m_h[3];
+        uint32_t e = m_h[4], f = m_h[5], g = m_h[6], h = m_h[7];
+        for (int i = 0; i < 64; ++i)
+        {
+            uint32_t t1 = h + (Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25)) + ((e & f) ^ (~e & g)) +
+                          k[i] + w[i];
+            uint32_t t2 = (Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        m_h[0] += a;
+        m_h[1] += b;
+        m_h[2] += c;
+        m_h[3] += d;
+        m_h[4] += e;
+        m_h[5] += f;
+        m_h[6] += g;
+        m_h[7] += h;
+    }
+
+    uint32_t m_h[8];
+    uint8_t m_block[64];
+    uint64_t m_length;
+    size_t m_used;
+};
+
+/// Content-defined chunk sizes.
+const size_t STORE_MIN_CHUNK = 8 * 1024;
+const size_t STORE_MAX_CHUNK = 256 * 1024;
+const uint64_t STORE_CHUNK_MASK = (uint64_t(1) << 15) - 1; // 32 KiB average
+
+/**
+ * Length of the chunk starting at data: the first position past STORE_MIN_CHUNK
+ * where 15 high bits of the gear hash are clear, at most STORE_MAX_CHUNK.
+ */
+inline size_t
+NextChunkLength(const uint8_t* data, size_t len)
+{
+    static const std::array<uint64_t, 256> gear = [] {
+        std::array<uint64_t, 256> table{};
+        uint64_t x = 0x9e3779b97f4a7c15ULL; // splitmix64, fixed so chunking is stable
+        for (auto& v : table)
+        {
+            x += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = x;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            v = z ^ (z >> 31);
+        }
+        return table;
+    }();
+    if (len <= STORE_MIN_CHUNK)
+    {
+        return len;
+    }
+    size_t end = std::min(len, STORE_MAX_CHUNK);
+    uint64_t hash = 0;
+    for (size_t i = STORE_MIN_CHUNK; i < end; ++i)
+    {
+        hash = (hash << 1) + gear[data[i]];
+        if ((hash & (STORE_CHUNK_MASK << 48)) == 0)
+        {
+            return i + 1;
+        }
+    }
+    return end;
+}
+
+/// Counters of a Store() call.
+struct TraceStoreStats
+{
+    uint64_t files{0};
+    uint64_t bytes{0};        ///< logical bytes of the files
+    uint64_t chunks{0};
+    uint64_t newChunks{0};
+    uint64_t newBytes{0};     ///< bytes actually written to the store
+};
+
+/// A content-addressed store rooted at a directory.
+class TraceStore
+{
+  public:
+    explicit TraceStore(const std::string& root)
+        : m_root(root)
+    {
+    }
+
+    std::string ChunkPath(const std::string& hash) const
+    {
+        return m_root + "/chunks/" + hash.substr(0, 2) + "/" + hash;
+    }
+
+    std::string ManifestPath(const std::string& run) const
+    {
+        return m_root + "/manifests/" + run + ".manifest";
+    }
+
+    /// Store one chunk unless present; return its hash, empty on error.
+    std::string PutChunk(const uint8_t* data, size_t len, TraceStoreStats& stats)
+    {
+        Sha256 sha;
+        sha.Update(data, len);
+        std::string hash = sha.HexDigest();
+        std::string path = ChunkPath(hash);
+        ++stats.chunks;
+        std::error_code ec;
+        if (std::filesystem::exists(path, ec))
+        {
+            return hash;
+        }
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+        std::string tmp = path + ".tmp" + std::to_string(std::random_device{}());
+        {
+            std::ofstream out(tmp, std::ofstream::binary | std::ofstream::trunc);
+            out.write(reinterpret_cast<const char*>(data), len);
+            if (!out)
+            {
+                return std::string();
+            }
+        }
+        std::filesystem::rename(tmp, path, ec);
+        if (ec)
+        {
+            std::filesystem::remove(tmp, ec);
+            return std::string();
+        }
+        ++stats.newChunks;
+        stats.newBytes += len;
+        return hash;
+    }
+
+    bool HasRun(const std::string& run) const
+    {
+        std::error_code ec;
+        return std::filesystem::exists(ManifestPath(run), ec);
+    }
+
+    /**
+     * Store the regular files directly under dir as run "run"; files last written
+     * before notBefore are skipped. Returns false on I/O errors and if the run exists.
+     */
+    bool Store(const std::string& dir,
+               const std::string& run,
+               TraceStoreStats& stats,
+               std::filesystem::file_time_type notBefore = std::filesystem::file_time_type::min())
+    {
+        std::vector<std::string> names;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(dir, ec))
+        {
+            if (entry.is_regular_file() && entry.last_write_time() >= notBefore)
+            {
+                names.push_back(entry.path().filename().string());
+            }
+        }
+        return StoreFiles(dir, run, names, stats);
+    }
+
+    /**
+     * Store the files names (relative to dir) as run "run". With removeStored they
+     * are deleted from dir once the manifest is written; nothing else in dir is
+     * touched. Returns false on I/O errors, on a missing file and if the run exists.
+     */
+    bool StoreFiles(const std::string& dir,
+                    const std::string& run,
+                    const std::vector<std::string>& names,
+                    TraceStoreStats& stats,
+                    bool removeStored = false)
+    {
+        if (HasRun(run))
+        {
+            return false;
+        }
+        std::ostringstream manifest;
+        manifest << "KPMSTORE 1\n";
+        std::vector<std::filesystem::path> files;
+        std::error_code ec;
+        for (const auto& name : names)
+        {
+            files.push_back(std::filesystem::path(dir) / name);
+        }
+        std::sort(files.begin(), files.end());
+        std::vector<uint8_t> data;
+        for (const auto& file : files)
+        {
+            std::ifstream in(file, std::ifstream::binary);
+            if (!in)
+            {
+                return false;
+            }
+            data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            if (in.bad())
+            {
+                return false;
+            }
+            std::ostringstream chunks;
+            uint64_t n = 0;
+            for (size_t off = 0; off < data.size();)
+            {
+                size_t len = NextChunkLength(data.data() + off, data.size() - off);
+                std::string hash = PutChunk(data.data() + off, len, stats);
+                if (hash.empty())
+                {
+                    return false;
+                }
+                chunks << "C " << hash << " " << len << "\n";
+                off += len;
+                ++n;
+            }
+            manifest << "F " << data.size() << " " << n << " " << file.filename().string()
+                     << "\n"
+                     << chunks.str();
+            ++stats.files;
+            stats.bytes += data.size();
+        }
+        std::filesystem::create_directories(m_root + "/manifests", ec);
+        std::string path = ManifestPath(run);
+        std::string tmp = path + ".tmp" + std::to_string(std::random_device{}());
+        {
+            std::ofstream out(tmp, std::ofstream::trunc);
+            out << manifest.str();
+            if (!out.flush())
+            {
+                std::filesystem::remove(tmp, ec);
+                return false;
+            }
+        }
+        // A hard link fails if the manifest exists, so a concurrent Store() of the run can't be lost
+        std::filesystem::create_hard_link(tmp, path, ec);
+        std::error_code removeEc;
+        std::filesystem::remove(tmp, removeEc);
+        if (ec)
+        {
+            return false;
+        }
+        if (removeStored)
+        {
+            for (const auto& file : files)
+            {
+                std::filesystem::remove(file, ec);
+            }
+        }
+        return true;
+    }
+
+    /// Recreate the files of run "run" under outDir; false on missing or corrupt data.
+    bool Restore(const std::string& run, const std::string& outDir, bool verify = true) const
+    {
+        std::ifstream manifest(ManifestPath(run));
+        std::string line;
+        if (!std::getline(manifest, line) || line != "KPMSTORE 1")
+        {
+            return false;
+        }
+        std::error_code ec;
+        std::filesystem::create_directories(outDir, ec);
+        std::vector<char> buf;
+        while (std::getline(manifest, line))
+        {
+            uint64_t size = 0;
+            uint64_t n = 0;
+            int pos = 0;
+            if (std::sscanf(line.c_str(), "F %" SCNu64 " %" SCNu64 " %n", &size, &n, &pos) != 2 || pos == 0)
+            {
+                return false;
+            }
+            std::ofstream out(outDir + "/" + line.substr(pos),
+                              std::ofstream::binary | std::ofstream::trunc);
+            uint64_t written = 0;
+            for (uint64_t i = 0; i < n && std::getline(manifest, line); ++i)
+            {
+                char hash[65];
+                size_t len = 0;
+                if (std::sscanf(line.c_str(), "C %64s %zu", hash, &len) != 2)
+                {
+                    return false;
+                }
+                std::ifstream in(ChunkPath(hash), std::ifstream::binary);
+                buf.resize(len);
+                if (!in.read(buf.data(), len))
+                {
+                    return false;
+                }
+                if (verify)
+                {
+                    Sha256 sha;
+                    sha.Update(buf.data(), len);
+                    if (sha.HexDigest() != hash)
+                    {
+                        return false;
+                    }
+                }
+                out.write(buf.data(), len);
+                written += len;
+            }
+            if (!out || written != size)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Names of the stored runs.
+    std::vector<std::string> Runs() const
+    {
+        std::vector<std::string> runs;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(m_root + "/manifests", ec))
+        {
+            if (entry.path().extension() == ".manifest")
+            {
+                runs.push_back(entry.path().stem().string());
+            }
+        }
+        std::sort(runs.begin(), runs.end());
+        return runs;
+    }
+
+  private:
+    std::string m_root;
+};
+
+} // namespace kpm
+
+#endif // KPM_TRACE_STORE_H
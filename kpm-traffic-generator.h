@@ -0,0 +1,391 @@
+/**
+ * \file kpm-traffic-generator.h
+ * \brief UDP source with Poisson, on-off and batch-Poisson arrivals, sent in per-slot batches.
+ *
+ * UdpClient sends one packet every Interval, so lambdaBrowsing and
+ * lambdaVoiceCall give perfectly periodic streams, and every packet costs one
+ * scheduler event. TrafficGenerator draws the arrival instants of a stochastic
+ * process instead:
+ *
+ * - periodic: one packet every 1/Rate;
+ * - poisson: exponential gaps of mean 1/Rate;
+ * - onoff: Poisson at the peak rate Rate * (on + off) / on during exponential
+ *   ON periods of mean MeanOnTime, silent during exponential OFF periods of mean
+ *   MeanOffTime, so the mean rate is still Rate;
+ * - batch: bursts at Poisson instants of rate Rate / MeanBurstSize, each of a
+ *   geometric number of packets with mean MeanBurstSize.
+ *
+ * With a BatchInterval (the slot duration of the BWP the flow is mapped to) the
+ * arrivals are not scheduled one by one: one event per slot boundary that
+ * follows at least one arrival hands all packets that arrived in the slot to
+ * the socket. The gNB only schedules at slot boundaries, so the load a slot sees
+ * is the same, but the event count scales with the slots that carry traffic
+ * rather than the packets. The packets carry a SeqTsHeader like UdpClient's,
+ * stamped when they are handed to the socket, and fire the same "Tx" trace, so
+ * UdpServer, FlowMonitor and FlowProbe see no difference.
+ */
+
+#ifndef KPM_TRAFFIC_GENERATOR_H
+#define KPM_TRAFFIC_GENERATOR_H
+
+#include "ns3/applications-module.h"
+#include "ns3/core-module.h"
+#include "ns3/internet-module.h"
+
+#include "kpm-packet-pool.h"
+
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace kpm
+{
+
+/// UDP packet source with a stochastic arrival process and per-slot batching.
+class TrafficGenerator : public ns3::Application
+{
+  public:
+    /// Arrival process of a TrafficGenerator.
+    enum Process
+    {
+        PERIODIC,
+        POISSON,
+        ON_OFF,
+        BATCH
+    };
+
+    static ns3::TypeId GetTypeId()
+    {
+        static ns3::TypeId tid =
+            ns3::TypeId("kpm::TrafficGenerator")
+                .SetParent<ns3::Application>()
+                .AddConstructor<TrafficGenerator>()
+                .AddAttribute("RemoteAddress",
+                              "Destination address of the packets",
+                              ns3::AddressValue(),
+                              ns3::MakeAddressAccessor(&TrafficGenerator::m_peer),
+                              ns3::MakeAddressChecker())
+                .AddAttribute("RemotePort",
+                              "Destination port of the packets",
+                              ns3::UintegerValue(100),
+                              ns3::MakeUintegerAccessor(&TrafficGenerator::m_port),
+                              ns3::MakeUintegerChecker<uint16_t>())
+                .AddAttribute("PacketSize",
+                              "Size of the packets, SeqTs header included (12 bytes at least)",
+                              ns3::UintegerValue(1024),
+                              ns3::MakeUintegerAccessor(&TrafficGenerator::m_size),
+                              ns3::MakeUintegerChecker<uint32_t>(12))
+                .AddAttribute("Process",
+                              "Arrival process: periodic, poisson, onoff or batch",
+                              ns3::StringValue("poisson"),
+                              ns3::MakeStringAccessor(&TrafficGenerator::SetProcess,
+                                                      &TrafficGenerator::GetProcess),
+                              ns3::MakeStringChecker())
+                .AddAttribute("Rate",
+                              "Mean packet rate in packets/s",
+                              ns3::DoubleValue(1000.0),
+                              ns3::MakeDoubleAccessor(&TrafficGenerator::m_rate),
+                              ns3::MakeDoubleChecker<double>(0.0))
+                .AddAttribute("MeanOnTime",
+                              "Mean ON period of the onoff process",
+                              ns3::TimeValue(ns3::MilliSeconds(10)),
+                              ns3::MakeTimeAccessor(&TrafficGenerator::m_meanOn),
+                              ns3::MakeTimeChecker())
+                .AddAttribute("MeanOffTime",
+                              "Mean OFF period of the onoff process",
+                              ns3::TimeValue(ns3::MilliSeconds(10)),
+                              ns3::MakeTimeAccessor(&TrafficGenerator::m_meanOff),
+                              ns3::MakeTimeChecker())
+                .AddAttribute("MeanBurstSize",
+                              "Mean packets per burst of the batch process",
+                              ns3::DoubleValue(4.0),
+                              ns3::MakeDoubleAccessor(&TrafficGenerator::m_meanBurst),
+                              ns3::MakeDoubleChecker<double>(1.0))
+                .AddAttribute("BatchInterval",
+                              "Send the packets of each interval (slot) with one event at its "
+                              "end; 0 sends every arrival with an event of its own",
+                              ns3::TimeValue(ns3::Seconds(0)),
+                              ns3::MakeTimeAccessor(&TrafficGenerator::m_batch),
+                              ns3::MakeTimeChecker())
+                .AddAttribute("PacketPool",
+                              "Recycle the packets once the stack has released them (kpm-packet-pool.h)",
+                              ns3::BooleanValue(true),
+                              ns3::MakeBooleanAccessor(&TrafficGenerator::m_usePool),
+                              ns3::MakeBooleanChecker())
+                .AddTraceSource("Tx",
+                                "A packet has been sent",
+                                ns3::MakeTraceSourceAccessor(&TrafficGenerator::m_txTrace),
+                                "ns3::Packet::TracedCallback");
+        return tid;
+    }
+
+    TrafficGenerator()
+    {
+        m_exponential = ns3::CreateObject<ns3::ExponentialRandomVariable>();
+        m_uniform = ns3::CreateObject<ns3::UniformRandomVariable>();
+    }
+
+    void SetProcess(std::string process)
+    {
+        if (process == "periodic")
+        {
+            m_process = PERIODIC;
+        }
+        else if (process == "poisson")
+        {
+            m_process = POISSON;
+        }
+        else if (process == "onoff")
+        {
+            m_process = ON_OFF;
+        }
+        else if (process == "batch")
+        {
+            m_process = BATCH;
+        }
+        else
+        {
+            NS_ABORT_MSG("Unknown arrival process \"" << process << "\"");
+        }
+    }
+
+    std::string GetProcess() const
+    {
+        static const char* names[] = {"periodic", "poisson", "onoff", "batch"};
+        return names[m_process];
+    }
+
+    /// Use the random streams from stream on; returns the number used.
+    int64_t AssignStreams(int64_t stream)
+    {
+        m_exponential->SetStream(stream);
+        m_uniform->SetStream(stream + 1);
+        return 2;
+    }
+
+    /// Packets sent so far.
+    uint64_t GetSent() const
+    {
+        return m_sent;
+    }
+
+    /// Send events run so far.
+    uint64_t GetEvents() const
+    {
+        return m_events;
+    }
+
+    /// Counters of the packet pool.
+    const PacketPoolStats& GetPacketPoolStats() const
+    {
+        return m_pool.GetStats();
+    }
+
+  protected:
+    void DoDispose() override
+    {
+        m_socket = nullptr;
+        ns3::Application::DoDispose();
+    }
+
+  private:
+    void StartApplication() override
+    {
+        if (!m_socket)
+        {
+            m_socket = ns3::Socket::CreateSocket(GetNode(), ns3::UdpSocketFactory::GetTypeId());
+            m_socket->Bind();
+            ns3::Ipv4Address address = ns3::Ipv4Address::IsMatchingType(m_peer)
+                                           ? ns3::Ipv4Address::ConvertFrom(m_peer)
+                                           : ns3::InetSocketAddress::ConvertFrom(m_peer).GetIpv4();
+            m_socket->Connect(ns3::InetSocketAddress(address, m_port));
+            m_socket->SetRecvCallback(ns3::MakeNullCallback<void, ns3::Ptr<ns3::Socket>>());
+        }
+        if (m_rate <= 0)
+        {
+            return;
+        }
+        // The periodic source sends at the start, like UdpClient; the others
+        // draw their first arrival (an onoff source starts in an ON period)
+        m_next = ns3::Simulator::Now().GetSeconds();
+        m_burst = 1;
+        if (m_process == ON_OFF)
+        {
+            m_onEnd = m_next + m_exponential->GetValue(m_meanOn.GetSeconds(), 0);
+        }
+        if (m_process != PERIODIC)
+        {
+            DrawNext();
+        }
+        ScheduleNext();
+    }
+
+    void StopApplication() override
+    {
+        ns3::Simulator::Cancel(m_sendEvent);
+    }
+
+    /// Draw the instant and packet count of the next arrival after m_next.
+    void DrawNext()
+    {
+        switch (m_process)
+        {
+        case PERIODIC:
+            m_next += 1.0 / m_rate;
+            break;
+        case POISSON:
+            m_next += m_exponential->GetValue(1.0 / m_rate, 0);
+            break;
+        case ON_OFF: {
+            double on = m_meanOn.GetSeconds();
+            double off = m_meanOff.GetSeconds();
+            double t = m_next + m_exponential->GetValue(on / (m_rate * (on + off)), 0);
+            // Exponential gaps are memoryless: the part of the gap past the end
+            // of an ON period carries over into the next one
+            while (t > m_onEnd)
+            {
+                double carry = t - m_onEnd;
+                double start = m_onEnd + (off > 0 ? m_exponential->GetValue(off, 0) : 0.0);
+                m_onEnd = start + m_exponential->GetValue(on, 0);
+                t = start + carry;
+            }
+            m_next = t;
+            break;
+        }
+        case BATCH:
+            m_next += m_exponential->GetValue(m_meanBurst / m_rate, 0);
+            m_burst = 1;
+            if (m_meanBurst > 1)
+            {
+                // Geometric on {1, 2, ...} with mean m_meanBurst
+                double u = m_uniform->GetValue(0.0, 1.0);
+                m_burst += static_cast<uint32_t>(
+                    std::floor(std::log1p(-u) / std::log1p(-1.0 / m_meanBurst)));
+            }
+            break;
+        }
+    }
+
+    /// Schedule the event that sends the arrival at m_next: at the end of its slot when batching.
+    void ScheduleNext()
+    {
+        int64_t at = ns3::Seconds(m_next).GetTimeStep();
+        int64_t slot = m_batch.GetTimeStep();
+        if (slot > 0)
+        {
+            at = (at + slot - 1) / slot * slot;
+        }
+        ns3::Time delay = ns3::TimeStep(at) - ns3::Simulator::Now();
+        m_sendEvent = ns3::Simulator::Schedule(delay.IsNegative() ? ns3::Time(0) : delay,
+                                               &TrafficGenerator::SendBatch,
+                                               this);
+    }
+
+    /// Send every packet that has arrived by now, then wait for the next arrival.
+    void SendBatch()
+    {
+        ++m_events;
+        int64_t now = ns3::Simulator::Now().GetTimeStep();
+        while (ns3::Seconds(m_next).GetTimeStep() <= now)
+        {
+            for (uint32_t i = 0; i < m_burst; ++i)
+            {
+                Send();
+            }
+            DrawNext();
+        }
+        ScheduleNext();
+    }
+
+    void Send()
+    {
+        ns3::SeqTsHeader seqTs;
+        seqTs.SetSeq(m_sent++);
+        uint32_t payload = m_size - seqTs.GetSerializedSize();
+        ns3::Ptr<ns3::Packet> p =
+            m_usePool ? m_pool.Allocate(payload) : ns3::Create<ns3::Packet>(payload);
+        p->AddHeader(seqTs);
+        m_socket->Send(p);
+        m_txTrace(p);
+    }
+
+    ns3::Address m_peer;
+    uint16_t m_port{100};
+    uint32_t m_size{1024};
+    Process m_process{POISSON};
+    double m_rate{1000.0};
+    ns3::Time m_meanOn;
+    ns3::Time m_meanOff;
+    double m_meanBurst{4.0};
+    ns3::Time m_batch;
+    ns3::Ptr<ns3::ExponentialRandomVariable> m_exponential;
+    ns3::Ptr<ns3::UniformRandomVariable> m_uniform;
+    ns3::Ptr<ns3::Socket> m_socket;
+    ns3::EventId m_sendEvent;
+    double m_next{0.0};  ///< instant of the next arrival, s
+    double m_onEnd{0.0}; ///< end of the current ON period, s
+    uint32_t m_burst{1}; ///< packets of the next arrival
+    uint64_t m_sent{0};
+    uint64_t m_events{0};
+    bool m_usePool{true};
+    PacketPool m_pool;
+    ns3::TracedCallback<ns3::Ptr<const ns3::Packet>> m_txTrace;
+};
+
+/// Creates TrafficGenerator applications with a common set of attributes.
+class TrafficGeneratorHelper
+{
+  public:
+    TrafficGeneratorHelper()
+    {
+        m_factory.SetTypeId(TrafficGenerator::GetTypeId());
+    }
+
+    void SetAttribute(const std::string& name, const ns3::AttributeValue& value)
+    {
+        m_factory.Set(name, value);
+    }
+
+    ns3::ApplicationContainer Install(ns3::Ptr<ns3::Node> node) const
+    {
+        ns3::Ptr<ns3::Application> app = m_factory.Create<ns3::Application>();
+        node->AddApplication(app);
+        return ns3::ApplicationContainer(app);
+    }
+
+  private:
+    ns3::ObjectFactory m_factory;
+};
+
+/// Packets and send events of the TrafficGenerator applications in apps.
+inline void
+WriteTrafficGeneratorReport(std::ostream& os, ns3::ApplicationContainer apps)
+{
+    uint64_t sent = 0;
+    uint64_t events = 0;
+    uint32_t generators = 0;
+    for (auto it = apps.Begin(); it != apps.End(); ++it)
+    {
+        ns3::Ptr<TrafficGenerator> generator = ns3::DynamicCast<TrafficGenerator>(*it);
+        if (generator)
+        {
+            sent += generator->GetSent();
+            events += generator->GetEvents();
+            ++generators;
+        }
+    }
+    if (generators == 0)
+    {
+        return;
+    }
+    os << "\n\nTraffic generators: " << generators << "\n";
+    os << "  Packets sent: " << sent << "\n";
+    os << "  Send events: " << events << "\n";
+    os << "  Packets per event: " << (events > 0 ? static_cast<double>(sent) / events : 0.0)
+       << "\n";
+}
+
+} // namespace kpm
+
+#endif // KPM_TRAFFIC_GENERATOR_H
@@ -0,0 +1,152 @@
+/**
+ * \file kpm-ue-map.h
+ * \brief UE identity mapping table: node id, IMSI, cell, RNTI, BWP, IP address, class, gNB.
+ *
+ * FlowMonitor names flows by IP address (7.0.0.x) while the NR traces use
+ * cellId/RNTI or IMSI. UeMap holds what the script knows about every UE when it
+ * installs it (node id, IMSI, IP address, traffic class, data BWP, gNB it was
+ * attached to) and writes one line per UE whenever the UE RRC reports a new
+ * (cell, RNTI): on connection establishment and after a handover. The result is a
+ * time-ordered trace,
+ *
+ * \code{.unparsed}
+Time	event	nodeId	IMSI	cellId	RNTI	bwpId	ip	class	gnbNodeId
+0.021840	CONNECTED	4	1	1	2	1	7.0.0.2	voice	0
+ * \endcode
+ *
+ * so the sidecar indexes and kpm-trace-query join it on cellId/RNTI like any
+ * other trace, and the last line of an IMSI is its current mapping. The table is
+ * written from RRC callbacks on the simulation thread, so it can go through an
+ * AsyncTraceWriter (kpm-async-writer.h). The header has no ns-3 dependency.
+ */
+
+#ifndef KPM_UE_MAP_H
+#define KPM_UE_MAP_H
+
+#include "kpm-async-writer.h"
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+
+namespace kpm
+{
+
+/// Mapping table of the UEs of a run.
+class UeMap
+{
+  public:
+    /// Static identity of a UE, known when it is installed.
+    struct Ue
+    {
+        uint32_t nodeId{0};
+        uint64_t imsi{0};
+        std::string ip;
+        std::string trafficClass;
+        uint32_t bwpId{0};
+        uint32_t gnbNodeId{0};
+        uint16_t cellId{0};
+        uint16_t rnti{0};
+        bool connected{false};
+    };
+
+    /**
+     * Write the table to path, through writer if given. With a writer the table
+     * can be block-compressed (compress); path is then the .kpz name.
+     */
+    bool Open(const std::string& path, AsyncTraceWriter* writer = nullptr, bool compress = false)
+    {
+        if (writer)
+        {
+            m_out = writer->OpenStream(path, compress);
+        }
+        else
+        {
+            m_out.reset(new std::ofstream(path, std::ofstream::out | std::ofstream::trunc));
+        }
+        if (!m_out || !*m_out)
+        {
+            m_out.reset();
+            return false;
+        }
+        *m_out << "Time\tevent\tnodeId\tIMSI\tcellId\tRNTI\tbwpId\tip\tclass\tgnbNodeId\n";
+        return true;
+    }
+
+    void AddUe(uint64_t imsi,
+               uint32_t nodeId,
+               const std::string& ip,
+               const std::string& trafficClass,
+               uint32_t bwpId,
+               uint32_t gnbNodeId)
+    {
+        Ue& ue = m_ues[imsi];
+        ue.imsi = imsi;
+        ue.nodeId = nodeId;
+        ue.ip = ip;
+        ue.trafficClass = trafficClass;
+        ue.bwpId = bwpId;
+        ue.gnbNodeId = gnbNodeId;
+    }
+
+    /**
+     * Record a new (cell, RNTI) of a UE and write its line. The gNB of a cell
+     * first seen after a handover is learnt from the UEs attached to it.
+     */
+    void Update(double time, const char* event, uint64_t imsi, uint16_t cellId, uint16_t rnti)
+    {
+        auto it = m_ues.find(imsi);
+        if (it == m_ues.end())
+        {
+            return;
+        }
+        Ue& ue = it->second;
+        if (!ue.connected)
+        {
+            ue.connected = true;
+            ++m_connected;
+            m_cellGnb.emplace(cellId, ue.gnbNodeId);
+        }
+        else
+        {
+            auto gnb = m_cellGnb.find(cellId);
+            if (gnb != m_cellGnb.end())
+            {
+                ue.gnbNodeId = gnb->second;
+            }
+        }
+        ue.cellId = cellId;
+        ue.rnti = rnti;
+        if (m_out)
+        {
+            *m_out << time << "\t" << event << "\t" << ue.nodeId << "\t" << ue.imsi << "\t"
+                   << cellId << "\t" << rnti << "\t" << ue.bwpId << "\t" << ue.ip << "\t"
+                   << ue.trafficClass << "\t" << ue.gnbNodeId << "\n";
+            m_out->flush();
+        }
+    }
+
+    /// True once every registered UE has connected.
+    bool AllConnected() const
+    {
+        return m_connected == m_ues.size();
+    }
+
+    const std::map<uint64_t, Ue>& GetUes() const
+    {
+        return m_ues;
+    }
+
+  private:
+    std::unique_ptr<std::ostream> m_out;
+    std::map<uint64_t, Ue> m_ues;
+    std::map<uint16_t, uint32_t> m_cellGnb;
+    size_t m_connected{0};
+};
+
+} // namespace kpm
+
+#endif // KPM_UE_MAP_H
@@ -0,0 +1,224 @@
+/**
+ * \file kpm-voice-capacity.cc
+ * \brief Find the voice users per cell at which the voice delay/loss budget breaks.
+ *
+ * Runs the simulation with a growing number of voice UEs per gNB
+ * (--voiceUesPerGnb) and reads the "Satisfied voice users" line of each report:
+ * a user is satisfied when 98% of its packets arrive within the voice delay
+ * budget, and a load passes when at least 95% of the users are satisfied (3GPP
+ * VoIP capacity, TR 36.814 A.2.1.3). The load is doubled until it fails, then
+ * the last passing and the first failing load are bisected; the capacity is the
+ * largest passing load. With uplink voice (--ulTraffic) the report has a
+ * "Satisfied voice users" line per direction, and the worse one counts: the
+ * capacity is that of the weaker link.
+ *
+ * The command is run through the shell; {n} in it is replaced by the number of
+ * voice UEs per gNB, otherwise --voiceUesPerGnb=<n> is appended. Use a codec
+ * (--voiceCodec) so that the voice load is that of real calls, and a
+ * --resultsCache to reuse the runs of an earlier search.
+ *
+ * With talk spurts and silences of 2 s on average, the 100 ms default run sees
+ * a fraction of one spurt per user, so each run is made --runTime seconds long
+ * (60 s, some 15 spurt/silence cycles, by default): {t} in the command is
+ * replaced by it, otherwise --runTime=<t> is appended unless the command sets
+ * it. Users whose call sent nothing in the run count as not satisfied; their
+ * number is the "silent" column.
+ *
+ * \code{.unparsed}
+$ g++ -O2 -std=c++17 -o kpm-voice-capacity kpm-voice-capacity.cc
+$ ./kpm-voice-capacity --max=64 --runTime=60 \
+    "./ns3 run 'kpm-project-11 --voiceCodec=amr-wb --voiceUesPerGnb={n}' --no-build"
+ * \endcode
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace
+{
+
+int
+Usage(const char* argv0)
+{
+    std::fprintf(stderr,
+                 "Usage: %s [--min=N] [--max=N] [--satisfied=ratio] [--runTime=seconds] "
+                 "\"<simulation command>\"\n",
+                 argv0);
+    return 1;
+}
+
+/// Satisfied, total and silent voice users of one run, of the worse direction.
+struct Point
+{
+    bool ok{false};
+    unsigned satisfied{0};
+    unsigned users{0};
+    unsigned silent{0};
+};
+
+/// Replace {key} in cmd by value, or append --option=value if cmd does not set it.
+void
+Substitute(std::string& cmd,
+           const std::string& key,
+           const std::string& option,
+           const std::string& value)
+{
+    size_t at = cmd.find("{" + key + "}");
+    if (at != std::string::npos)
+    {
+        cmd.replace(at, key.size() + 2, value);
+    }
+    else if (cmd.find("--" + option + "=") == std::string::npos)
+    {
+        cmd += " --" + option + "=" + value;
+    }
+}
+
+/// Run the simulation with n voice UEs per gNB for runTime s and parse its report.
+Point
+Run(const std::string& command, unsigned n, const std::string& runTime)
+{
+    std::string cmd = command;
+    Substitute(cmd, "n", "voiceUesPerGnb", std::to_string(n));
+    Substitute(cmd, "t", "runTime", runTime);
+    Point p;
+    bool worse = false;
+    FILE* pipe = popen(cmd.c_str(), "r");
+    if (!pipe)
+    {
+        return p;
+    }
+    char line[4096];
+    while (std::fgets(line, sizeof(line), pipe))
+    {
+        unsigned satisfied = 0;
+        unsigned users = 0;
+        unsigned silent = 0;
+        if (std::sscanf(line, "  Satisfied voice users: %u / %u", &satisfied, &users) == 2)
+        {
+            worse = !p.ok || double(satisfied) * p.users < double(p.satisfied) * users;
+            if (worse)
+            {
+                p.ok = true;
+                p.satisfied = satisfied;
+                p.users = users;
+                p.silent = 0;
+            }
+        }
+        // Follows the "Satisfied voice users" line of its direction
+        else if (worse && std::sscanf(line, "  Voice users without traffic: %u", &silent) == 1)
+        {
+            p.silent = silent;
+        }
+    }
+    if (pclose(pipe) != 0 && !p.ok)
+    {
+        std::fprintf(stderr, "Command failed: %s\n", cmd.c_str());
+    }
+    return p;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    unsigned min = 1;
+    unsigned max = 64;
+    double required = 0.95;
+    std::string runTime = "60";
+    std::string command;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 6, "--min=") == 0)
+        {
+            min = std::max(1, std::atoi(arg.c_str() + 6));
+        }
+        else if (arg.compare(0, 6, "--max=") == 0)
+        {
+            max = std::atoi(arg.c_str() + 6);
+        }
+        else if (arg.compare(0, 12, "--satisfied=") == 0)
+        {
+            required = std::atof(arg.c_str() + 12);
+        }
+        else if (arg.compare(0, 10, "--runTime=") == 0)
+        {
+            runTime = arg.substr(10);
+        }
+        else if (arg.compare(0, 2, "--") == 0 || !command.empty())
+        {
+            return Usage(argv[0]);
+        }
+        else
+        {
+            command = arg;
+        }
+    }
+    if (command.empty() || max < min || std::atof(runTime.c_str()) <= 0)
+    {
+        return Usage(argv[0]);
+    }
+
+    std::printf("Voice UEs/gNB\tsatisfied\tusers\tsilent\tratio\tresult\n");
+    auto test = [&](unsigned n) {
+        Point p = Run(command, n, runTime);
+        if (!p.ok || p.users == 0)
+        {
+            std::fprintf(stderr, "No \"Satisfied voice users\" line in the report of n = %u\n", n);
+            std::exit(1);
+        }
+        double ratio = static_cast<double>(p.satisfied) / p.users;
+        bool pass = ratio >= required;
+        std::printf("%u\t%u\t%u\t%u\t%.3f\t%s\n",
+                    n,
+                    p.satisfied,
+                    p.users,
+                    p.silent,
+                    ratio,
+                    pass ? "pass" : "fail");
+        std::fflush(stdout);
+        return pass;
+    };
+
+    // Double until a load fails, then bisect between the last pass and the first fail
+    unsigned good = 0;
+    unsigned bad = 0;
+    for (unsigned n = min; bad == 0; n = std::min(2 * n, max))
+    {
+        if (test(n))
+        {
+            good = n;
+            if (n == max)
+            {
+                break;
+            }
+        }
+        else
+        {
+            bad = n;
+        }
+    }
+    while (bad > 0 && bad - good > 1 && good > 0)
+    {
+        unsigned mid = good + (bad - good) / 2;
+        (test(mid) ? good : bad) = mid;
+    }
+
+    if (good == 0)
+    {
+        std::printf("\nVoice capacity: below %u voice users per cell\n", min);
+    }
+    else if (bad == 0)
+    {
+        std::printf("\nVoice capacity: at least %u voice users per cell (--max)\n", max);
+    }
+    else
+    {
+        std::printf("\nVoice capacity: %u voice users per cell (%u fails)\n", good, bad);
+    }
+    return 0;
+}
@@ -0,0 +1,268 @@
+/**
+ * \file kpm-voip.h
+ * \brief VoIP source with codec frame timing, talk-spurt/silence activity and RTP-sized packets.
+ *
+ * The voice UEs otherwise receive one 50-byte packet every 1/lambdaVoiceCall,
+ * about 200 times the packet rate of a real call. VoipSource sends what a
+ * codec with discontinuous transmission (DTX) sends:
+ *
+ * - one speech frame every frame interval (20 ms) during a talk spurt;
+ * - one SID (silence descriptor) frame every 8 frames (160 ms) during silence;
+ * - talk spurts and silences of exponential length (two-state voice activity
+ *   model, 3GPP TR 36.814 A.2.1.3: activity factor 50%).
+ *
+ * A packet is the codec payload behind a 12-byte SeqTsHeader, which stands in
+ * for the 12-byte RTP header, so UdpServer, FlowMonitor and FlowProbe handle it
+ * like UdpClient's. The IP and UDP headers are added by the stack; header
+ * compression (ROHC) is not modelled.
+ *
+ * Codec payloads (octet-aligned RTP payload format, TOC/CMR included):
+ *
+ * \code{.unparsed}
+codec    rate       speech  SID   DTX
+amr-nb   12.2 kb/s  32 B    7 B   yes
+amr-wb   12.65 kb/s 34 B    7 B   yes
+evs      13.2 kb/s  33 B    6 B   yes
+g711     64 kb/s    160 B   -     no
+ * \endcode
+ */
+
+#ifndef KPM_VOIP_H
+#define KPM_VOIP_H
+
+#include "ns3/applications-module.h"
+#include "ns3/core-module.h"
+#include "ns3/internet-module.h"
+
+#include "kpm-packet-pool.h"
+
+#include <cstdint>
+#include <string>
+
+namespace kpm
+{
+
+/// Frame timing and payload sizes of a voice codec.
+struct VoiceCodec
+{
+    const char* name;
+    double frameInterval; ///< s
+    uint32_t speechBytes; ///< payload of a speech frame
+    uint32_t sidBytes;    ///< payload of a SID frame, 0 without DTX
+    uint32_t sidFrames;   ///< frame intervals between SID frames
+};
+
+/// The codec named name, or nullptr.
+inline const VoiceCodec*
+FindVoiceCodec(const std::string& name)
+{
+    static const VoiceCodec codecs[] = {
+        {"amr-nb", 0.020, 32, 7, 8},
+        {"amr-wb", 0.020, 34, 7, 8},
+        {"evs", 0.020, 33, 6, 8},
+        {"g711", 0.020, 160, 0, 0},
+    };
+    for (const auto& c : codecs)
+    {
+        if (name == c.name)
+        {
+            return &c;
+        }
+    }
+    return nullptr;
+}
+
+/// Voice over UDP with codec timing and voice activity.
+class VoipSource : public ns3::Application
+{
+  public:
+    static ns3::TypeId GetTypeId()
+    {
+        static ns3::TypeId tid =
+            ns3::TypeId("kpm::VoipSource")
+                .SetParent<ns3::Application>()
+                .AddConstructor<VoipSource>()
+                .AddAttribute("RemoteAddress",
+                              "Destination address of the packets",
+                              ns3::AddressValue(),
+                              ns3::MakeAddressAccessor(&VoipSource::m_peer),
+                              ns3::MakeAddressChecker())
+                .AddAttribute("RemotePort",
+                              "Destination port of the packets",
+                              ns3::UintegerValue(100),
+                              ns3::MakeUintegerAccessor(&VoipSource::m_port),
+                              ns3::MakeUintegerChecker<uint16_t>())
+                .AddAttribute("Codec",
+                              "amr-nb, amr-wb, evs or g711",
+                              ns3::StringValue("amr-wb"),
+                              ns3::MakeStringAccessor(&VoipSource::m_codecName),
+                              ns3::MakeStringChecker())
+                .AddAttribute("MeanTalkSpurt",
+                              "Mean length of a talk spurt",
+                              ns3::TimeValue(ns3::Seconds(2)),
+                              ns3::MakeTimeAccessor(&VoipSource::m_meanTalk),
+                              ns3::MakeTimeChecker())
+                .AddAttribute("MeanSilence",
+                              "Mean length of a silence",
+                              ns3::TimeValue(ns3::Seconds(2)),
+                              ns3::MakeTimeAccessor(&VoipSource::m_meanSilence),
+                              ns3::MakeTimeChecker())
+                .AddAttribute("PacketPool",
+                              "Recycle the packets once the stack has released them (kpm-packet-pool.h)",
+                              ns3::BooleanValue(true),
+                              ns3::MakeBooleanAccessor(&VoipSource::m_usePool),
+                              ns3::MakeBooleanChecker())
+                .AddTraceSource("Tx",
+                                "A packet has been sent",
+                                ns3::MakeTraceSourceAccessor(&VoipSource::m_txTrace),
+                                "ns3::Packet::TracedCallback");
+        return tid;
+    }
+
+    VoipSource()
+    {
+        m_uniform = ns3::CreateObject<ns3::UniformRandomVariable>();
+        m_exponential = ns3::CreateObject<ns3::ExponentialRandomVariable>();
+    }
+
+    /// Use the random streams from stream on; returns the number used.
+    int64_t AssignStreams(int64_t stream)
+    {
+        m_uniform->SetStream(stream);
+        m_exponential->SetStream(stream + 1);
+        return 2;
+    }
+
+    /// Speech frames sent so far.
+    uint64_t GetSpeechFrames() const
+    {
+        return m_speech;
+    }
+
+    /// SID frames sent so far.
+    uint64_t GetSidFrames() const
+    {
+        return m_sid;
+    }
+
+    /// Counters of the packet pool.
+    const PacketPoolStats& GetPacketPoolStats() const
+    {
+        return m_pool.GetStats();
+    }
+
+  protected:
+    void DoDispose() override
+    {
+        m_socket = nullptr;
+        ns3::Application::DoDispose();
+    }
+
+  private:
+    void StartApplication() override
+    {
+        m_codec = FindVoiceCodec(m_codecName);
+        NS_ABORT_MSG_IF(!m_codec, "Unknown voice codec \"" << m_codecName << "\"");
+        if (!m_socket)
+        {
+            m_socket = ns3::Socket::CreateSocket(GetNode(), ns3::UdpSocketFactory::GetTypeId());
+            m_socket->Bind();
+            ns3::Ipv4Address address = ns3::Ipv4Address::IsMatchingType(m_peer)
+                                           ? ns3::Ipv4Address::ConvertFrom(m_peer)
+                                           : ns3::InetSocketAddress::ConvertFrom(m_peer).GetIpv4();
+            m_socket->Connect(ns3::InetSocketAddress(address, m_port));
+            m_socket->SetRecvCallback(ns3::MakeNullCallback<void, ns3::Ptr<ns3::Socket>>());
+        }
+        // Join the call in a random state and at a random frame phase
+        double talk = m_meanTalk.GetSeconds();
+        double silence = m_meanSilence.GetSeconds();
+        m_talking = m_codec->sidBytes == 0 ||
+                    m_uniform->GetValue(0.0, talk + silence) < talk;
+        ScheduleStateChange();
+        m_sinceSid = 0;
+        m_sendEvent = ns3::Simulator::Schedule(
+            ns3::Seconds(m_uniform->GetValue(0.0, m_codec->frameInterval)),
+            &VoipSource::Frame,
+            this);
+    }
+
+    void StopApplication() override
+    {
+        ns3::Simulator::Cancel(m_sendEvent);
+        ns3::Simulator::Cancel(m_stateEvent);
+    }
+
+    void ScheduleStateChange()
+    {
+        if (m_codec->sidBytes == 0)
+        {
+            return; // no DTX: always talking
+        }
+        double mean = (m_talking ? m_meanTalk : m_meanSilence).GetSeconds();
+        m_stateEvent = ns3::Simulator::Schedule(ns3::Seconds(m_exponential->GetValue(mean, 0)),
+                                                &VoipSource::ChangeState,
+                                                this);
+    }
+
+    void ChangeState()
+    {
+        m_talking = !m_talking;
+        // The first SID follows the spurt at once, as with the DTX hangover
+        m_sinceSid = m_codec->sidFrames;
+        ScheduleStateChange();
+    }
+
+    /// One frame interval: a speech frame, a SID frame or nothing.
+    void Frame()
+    {
+        if (m_talking)
+        {
+            Send(m_codec->speechBytes);
+            ++m_speech;
+        }
+        else if (++m_sinceSid >= m_codec->sidFrames)
+        {
+            Send(m_codec->sidBytes);
+            ++m_sid;
+            m_sinceSid = 0;
+        }
+        m_sendEvent = ns3::Simulator::Schedule(ns3::Seconds(m_codec->frameInterval),
+                                               &VoipSource::Frame,
+                                               this);
+    }
+
+    void Send(uint32_t payload)
+    {
+        ns3::SeqTsHeader seqTs;
+        seqTs.SetSeq(m_sent++);
+        ns3::Ptr<ns3::Packet> p =
+            m_usePool ? m_pool.Allocate(payload) : ns3::Create<ns3::Packet>(payload);
+        p->AddHeader(seqTs);
+        m_socket->Send(p);
+        m_txTrace(p);
+    }
+
+    ns3::Address m_peer;
+    uint16_t m_port{100};
+    std::string m_codecName{"amr-wb"};
+    const VoiceCodec* m_codec{nullptr};
+    ns3::Time m_meanTalk;
+    ns3::Time m_meanSilence;
+    ns3::Ptr<ns3::UniformRandomVariable> m_uniform;
+    ns3::Ptr<ns3::ExponentialRandomVariable> m_exponential;
+    ns3::Ptr<ns3::Socket> m_socket;
+    ns3::EventId m_sendEvent;
+    ns3::EventId m_stateEvent;
+    bool m_talking{true};
+    uint32_t m_sinceSid{0};
+    uint32_t m_sent{0};
+    uint64_t m_speech{0};
+    uint64_t m_sid{0};
+    bool m_usePool{true};
+    PacketPool m_pool;
+    ns3::TracedCallback<ns3::Ptr<const ns3::Packet>> m_txTrace;
+};
+
+} // namespace kpm
+
+#endif // KPM_VOIP_H
@@ -0,0 +1,833 @@
+/**
+ * \file kpm-web-browsing.h
+ * \brief Session-level web browsing over TCP or UDP, with page load time statistics.
+ *
+ * The browsing UEs otherwise receive a constant UDP stream, which neither looks
+ * like browsing nor loads the scheduler like it. WebBrowsingClient runs on the
+ * UE and loads pages from a WebServer on the remote host, following the 3GPP
+ * web browsing model (TR 36.814 / NGMN):
+ *
+ * - a main object, truncated lognormal size (mean 10710 B, sd 25032 B, 100 B to 2 MB);
+ * - after a parsing time (exponential, mean 0.13 s), the embedded objects, whose
+ *   count is a truncated Pareto (shape 1.1, from 2, capped at 55, minus 2: mean
+ *   5.64) and whose sizes are truncated lognormal (mean 7758 B, sd 126168 B, 50 B
+ *   to 2 MB);
+ * - a reading time (exponential, mean 30 s) before the next page.
+ *
+ * The client asks for every object with an 8-byte request (object id, size), so
+ * the server is stateless and the model lives in the client. Over TCP the
+ * objects come back in order on one persistent connection; over UDP the server
+ * sends each object as datagrams of SegmentSize bytes, each with an 8-byte
+ * (object id, offset) header, and a lost datagram leaves the page to its
+ * timeout, which drops the page's objects, as UDP has no recovery. Either way a send is one event per object,
+ * or per freed TCP send buffer, not per packet.
+ *
+ * The page load time runs from the request of the main object to the arrival of
+ * the last byte of the last embedded object. WebBrowsingStats collects the
+ * loaded pages of a set of clients and reports the load time percentiles and
+ * the clients that could not connect, and
+ * WriteTrace() lists the pages as a time-ordered trace that kpm-trace-query and
+ * the sidecar indexes understand.
+ *
+ * The client binds its local port, so with the browsing port the DL TFT of the
+ * browsing bearer and the flow classification apply to the page data unchanged.
+ */
+
+#ifndef KPM_WEB_BROWSING_H
+#define KPM_WEB_BROWSING_H
+
+#include "ns3/applications-module.h"
+#include "ns3/core-module.h"
+#include "ns3/internet-module.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace kpm
+{
+
+/// Size of the requests and of the UDP object headers.
+const uint32_t WEB_HEADER_SIZE = 8;
+
+/// Two big-endian 32-bit words, the requests and UDP headers of the web model.
+inline ns3::Ptr<ns3::Packet>
+MakeWebHeader(uint32_t first, uint32_t second)
+{
+    uint8_t buf[WEB_HEADER_SIZE];
+    for (int i = 0; i < 4; ++i)
+    {
+        buf[i] = static_cast<uint8_t>(first >> (24 - 8 * i));
+        buf[4 + i] = static_cast<uint8_t>(second >> (24 - 8 * i));
+    }
+    return ns3::Create<ns3::Packet>(buf, WEB_HEADER_SIZE);
+}
+
+/// Decode the two words of a web header at buf.
+inline void
+ReadWebHeader(const uint8_t* buf, uint32_t& first, uint32_t& second)
+{
+    first = 0;
+    second = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        first = (first << 8) | buf[i];
+        second = (second << 8) | buf[4 + i];
+    }
+}
+
+/// Serves the objects web clients ask for, over TCP or UDP.
+class WebServer : public ns3::Application
+{
+  public:
+    static ns3::TypeId GetTypeId()
+    {
+        static ns3::TypeId tid =
+            ns3::TypeId("kpm::WebServer")
+                .SetParent<ns3::Application>()
+                .AddConstructor<WebServer>()
+                .AddAttribute("Port",
+                              "Port the server listens on",
+                              ns3::UintegerValue(80),
+                              ns3::MakeUintegerAccessor(&WebServer::m_port),
+                              ns3::MakeUintegerChecker<uint16_t>())
+                .AddAttribute("Transport",
+                              "tcp or udp",
+                              ns3::StringValue("tcp"),
+                              ns3::MakeStringAccessor(&WebServer::m_transport),
+                              ns3::MakeStringChecker())
+                .AddAttribute("SegmentSize",
+                              "TCP segment size, UDP datagram payload",
+                              ns3::UintegerValue(1400),
+                              ns3::MakeUintegerAccessor(&WebServer::m_segmentSize),
+                              ns3::MakeUintegerChecker<uint32_t>(WEB_HEADER_SIZE + 1));
+        return tid;
+    }
+
+    /// Objects served so far.
+    uint64_t GetObjects() const
+    {
+        return m_objects;
+    }
+
+    /// Object bytes served so far.
+    uint64_t GetBytes() const
+    {
+        return m_bytes;
+    }
+
+  protected:
+    void DoDispose() override
+    {
+        m_socket = nullptr;
+        m_connections.clear();
+        ns3::Application::DoDispose();
+    }
+
+  private:
+    /// Request bytes not parsed yet and object bytes not sent yet of a TCP connection.
+    struct Connection
+    {
+        std::vector<uint8_t> rx;
+        uint64_t pending{0};
+    };
+
+    bool IsTcp() const
+    {
+        return m_transport == "tcp";
+    }
+
+    void StartApplication() override
+    {
+        NS_ABORT_MSG_IF(m_transport != "tcp" && m_transport != "udp",
+                        "Unknown web transport \"" << m_transport << "\"");
+        if (m_socket)
+        {
+            return;
+        }
+        m_socket = ns3::Socket::CreateSocket(GetNode(),
+                                             IsTcp() ? ns3::TcpSocketFactory::GetTypeId()
+                                                     : ns3::UdpSocketFactory::GetTypeId());
+        if (IsTcp())
+        {
+            // Inherited by the accepted connections
+            m_socket->SetAttribute("SegmentSize", ns3::UintegerValue(m_segmentSize));
+        }
+        m_socket->Bind(ns3::InetSocketAddress(ns3::Ipv4Address::GetAny(), m_port));
+        m_socket->SetRecvCallback(ns3::MakeCallback(&WebServer::HandleRead, this));
+        if (IsTcp())
+        {
+            m_socket->Listen();
+            m_socket->SetAcceptCallback(
+                ns3::MakeNullCallback<bool, ns3::Ptr<ns3::Socket>, const ns3::Address&>(),
+                ns3::MakeCallback(&WebServer::HandleAccept, this));
+        }
+    }
+
+    void StopApplication() override
+    {
+        for (auto& c : m_connections)
+        {
+            c.first->Close();
+        }
+        m_connections.clear();
+        if (m_socket)
+        {
+            m_socket->Close();
+        }
+    }
+
+    void HandleAccept(ns3::Ptr<ns3::Socket> socket, const ns3::Address& /* from */)
+    {
+        socket->SetRecvCallback(ns3::MakeCallback(&WebServer::HandleRead, this));
+        socket->SetSendCallback(ns3::MakeCallback(&WebServer::HandleSend, this));
+        m_connections[socket];
+    }
+
+    void HandleRead(ns3::Ptr<ns3::Socket> socket)
+    {
+        ns3::Address from;
+        ns3::Ptr<ns3::Packet> packet;
+        while ((packet = socket->RecvFrom(from)) && packet->GetSize() > 0)
+        {
+            if (!IsTcp())
+            {
+                // One request per datagram
+                if (packet->GetSize() < WEB_HEADER_SIZE)
+                {
+                    continue;
+                }
+                uint8_t buf[WEB_HEADER_SIZE];
+                packet->CopyData(buf, WEB_HEADER_SIZE);
+                uint32_t id;
+                uint32_t size;
+                ReadWebHeader(buf, id, size);
+                SendDatagrams(socket, from, id, size);
+                continue;
+            }
+            // A TCP stream may split or merge requests
+            Connection& c = m_connections[socket];
+            size_t have = c.rx.size();
+            c.rx.resize(have + packet->GetSize());
+            packet->CopyData(c.rx.data() + have, packet->GetSize());
+            size_t used = 0;
+            for (; used + WEB_HEADER_SIZE <= c.rx.size(); used += WEB_HEADER_SIZE)
+            {
+                uint32_t id;
+                uint32_t size;
+                ReadWebHeader(c.rx.data() + used, id, size);
+                c.pending += size;
+                ++m_objects;
+                m_bytes += size;
+            }
+            c.rx.erase(c.rx.begin(), c.rx.begin() + used);
+            Fill(socket, c);
+        }
+    }
+
+    void HandleSend(ns3::Ptr<ns3::Socket> socket, uint32_t /* available */)
+    {
+        auto it = m_connections.find(socket);
+        if (it != m_connections.end())
+        {
+            Fill(socket, it->second);
+        }
+    }
+
+    /// Hand as much of the pending object data to TCP as its send buffer takes.
+    void Fill(ns3::Ptr<ns3::Socket> socket, Connection& c)
+    {
+        while (c.pending > 0 && socket->GetTxAvailable() > 0)
+        {
+            uint32_t n = static_cast<uint32_t>(
+                std::min<uint64_t>(c.pending, socket->GetTxAvailable()));
+            int sent = socket->Send(ns3::Create<ns3::Packet>(n));
+            if (sent <= 0)
+            {
+                break;
+            }
+            c.pending -= sent;
+        }
+    }
+
+    /// Send an object as datagrams with an (object id, offset) header each.
+    void SendDatagrams(ns3::Ptr<ns3::Socket> socket,
+                       const ns3::Address& to,
+                       uint32_t id,
+                       uint32_t size)
+    {
+        ++m_objects;
+        m_bytes += size;
+        uint32_t payload = m_segmentSize - WEB_HEADER_SIZE;
+        for (uint32_t offset = 0; offset < size; offset += payload)
+        {
+            ns3::Ptr<ns3::Packet> p = MakeWebHeader(id, offset);
+            p->AddAtEnd(ns3::Create<ns3::Packet>(std::min(payload, size - offset)));
+            socket->SendTo(p, 0, to);
+        }
+    }
+
+    uint16_t m_port{80};
+    std::string m_transport{"tcp"};
+    uint32_t m_segmentSize{1400};
+    ns3::Ptr<ns3::Socket> m_socket;
+    std::map<ns3::Ptr<ns3::Socket>, Connection> m_connections;
+    uint64_t m_objects{0};
+    uint64_t m_bytes{0};
+};
+
+/// Loads pages of the 3GPP web browsing model from a WebServer.
+class WebBrowsingClient : public ns3::Application
+{
+  public:
+    /**
+     * A page was loaded.
+     * \param page page number of the client, from 1
+     * \param objects main and embedded objects of the page
+     * \param bytes object bytes of the page
+     * \param loadTime from the main object request to the last byte
+     */
+    typedef void (*PageLoadedCallback)(uint32_t page,
+                                       uint32_t objects,
+                                       uint32_t bytes,
+                                       ns3::Time loadTime);
+
+    static ns3::TypeId GetTypeId()
+    {
+        static ns3::TypeId tid =
+            ns3::TypeId("kpm::WebBrowsingClient")
+                .SetParent<ns3::Application>()
+                .AddConstructor<WebBrowsingClient>()
+                .AddAttribute("RemoteAddress",
+                              "Address of the web server",
+                              ns3::AddressValue(),
+                              ns3::MakeAddressAccessor(&WebBrowsingClient::m_peer),
+                              ns3::MakeAddressChecker())
+                .AddAttribute("RemotePort",
+                              "Port of the web server",
+                              ns3::UintegerValue(80),
+                              ns3::MakeUintegerAccessor(&WebBrowsingClient::m_peerPort),
+                              ns3::MakeUintegerChecker<uint16_t>())
+                .AddAttribute("LocalPort",
+                              "Port the client binds, 0 for an ephemeral one",
+                              ns3::UintegerValue(0),
+                              ns3::MakeUintegerAccessor(&WebBrowsingClient::m_localPort),
+                              ns3::MakeUintegerChecker<uint16_t>())
+                .AddAttribute("Transport",
+                              "tcp or udp, as the server",
+                              ns3::StringValue("tcp"),
+                              ns3::MakeStringAccessor(&WebBrowsingClient::m_transport),
+                              ns3::MakeStringChecker())
+                .AddAttribute("SegmentSize",
+                              "TCP segment size",
+                              ns3::UintegerValue(1400),
+                              ns3::MakeUintegerAccessor(&WebBrowsingClient::m_segmentSize),
+                              ns3::MakeUintegerChecker<uint32_t>(1))
+                .AddAttribute("ConnectTimeout",
+                              "TCP connection (SYN) retransmission timeout",
+                              ns3::TimeValue(ns3::Seconds(3)),
+                              ns3::MakeTimeAccessor(&WebBrowsingClient::m_connectTimeout),
+                              ns3::MakeTimeChecker())
+                .AddAttribute("MainObjectMean",
+                              "Mean main object size in bytes",
+                              ns3::DoubleValue(10710),
+                              ns3::MakeDoubleAccessor(&WebBrowsingClient::m_mainMean),
+                              ns3::MakeDoubleChecker<double>(1))
+                .AddAttribute("MainObjectSd",
+                              "Standard deviation of the main object size in bytes",
+                              ns3::DoubleValue(25032),
+                              ns3::MakeDoubleAccessor(&WebBrowsingClient::m_mainSd),
+                              ns3::MakeDoubleChecker<double>(0))
+                .AddAttribute("EmbeddedObjectMean",
+                              "Mean embedded object size in bytes",
+                              ns3::DoubleValue(7758),
+                              ns3::MakeDoubleAccessor(&WebBrowsingClient::m_embeddedMean),
+                              ns3::MakeDoubleChecker<double>(1))
+                .AddAttribute("EmbeddedObjectSd",
+                              "Standard deviation of the embedded object size in bytes",
+                              ns3::DoubleValue(126168),
+                              ns3::MakeDoubleAccessor(&WebBrowsingClient::m_embeddedSd),
+                              ns3::MakeDoubleChecker<double>(0))
+                .AddAttribute("EmbeddedObjectsMax",
+                              "Cap of the Pareto embedded object count (plus 2)",
+                              ns3::UintegerValue(55),
+                              ns3::MakeUintegerAccessor(&WebBrowsingClient::m_embeddedMax),
+                              ns3::MakeUintegerChecker<uint32_t>(3))
+                .AddAttribute("ParsingTime",
+                              "Mean time between the main object and the embedded object requests",
+                              ns3::TimeValue(ns3::MilliSeconds(130)),
+                              ns3::MakeTimeAccessor(&WebBrowsingClient::m_parsingTime),
+                              ns3::MakeTimeChecker())
+                .AddAttribute("ReadingTime",
+                              "Mean time between a page and the next",
+                              ns3::TimeValue(ns3::Seconds(30)),
+                              ns3::MakeTimeAccessor(&WebBrowsingClient::m_readingTime),
+                              ns3::MakeTimeChecker())
+                .AddAttribute("PageTimeout",
+                              "A page not loaded after this time is given up",
+                              ns3::TimeValue(ns3::Seconds(10)),
+                              ns3::MakeTimeAccessor(&WebBrowsingClient::m_pageTimeout),
+                              ns3::MakeTimeChecker())
+                .AddTraceSource("PageLoaded",
+                                "A page has been loaded",
+                                ns3::MakeTraceSourceAccessor(&WebBrowsingClient::m_pageLoaded),
+                                "kpm::WebBrowsingClient::PageLoadedCallback");
+        return tid;
+    }
+
+    WebBrowsingClient()
+    {
+        m_uniform = ns3::CreateObject<ns3::UniformRandomVariable>();
+        m_exponential = ns3::CreateObject<ns3::ExponentialRandomVariable>();
+        m_lognormal = ns3::CreateObject<ns3::LogNormalRandomVariable>();
+    }
+
+    /// Use the random streams from stream on; returns the number used.
+    int64_t AssignStreams(int64_t stream)
+    {
+        m_uniform->SetStream(stream);
+        m_exponential->SetStream(stream + 1);
+        m_lognormal->SetStream(stream + 2);
+        return 3;
+    }
+
+    /// Pages loaded so far.
+    uint32_t GetPagesLoaded() const
+    {
+        return m_pagesLoaded;
+    }
+
+    /// Pages given up after the PageTimeout.
+    uint32_t GetPagesFailed() const
+    {
+        return m_pagesFailed;
+    }
+
+    /// True if the TCP connection to the server could not be set up.
+    bool HasConnectionFailed() const
+    {
+        return m_connectionFailed;
+    }
+
+    /// True while a page is loading, e.g. at the end of the run.
+    bool IsLoading() const
+    {
+        return m_loading;
+    }
+
+    /// Objects requested so far.
+    uint64_t GetObjectsRequested() const
+    {
+        return m_nextObject;
+    }
+
+  protected:
+    void DoDispose() override
+    {
+        m_socket = nullptr;
+        ns3::Application::DoDispose();
+    }
+
+  private:
+    /// An object asked for and not complete yet.
+    struct Object
+    {
+        uint32_t page;
+        uint32_t size;
+        uint32_t received;
+        bool main;
+    };
+
+    bool IsTcp() const
+    {
+        return m_transport == "tcp";
+    }
+
+    void StartApplication() override
+    {
+        NS_ABORT_MSG_IF(m_transport != "tcp" && m_transport != "udp",
+                        "Unknown web transport \"" << m_transport << "\"");
+        if (m_socket)
+        {
+            return;
+        }
+        m_socket = ns3::Socket::CreateSocket(GetNode(),
+                                             IsTcp() ? ns3::TcpSocketFactory::GetTypeId()
+                                                     : ns3::UdpSocketFactory::GetTypeId());
+        if (IsTcp())
+        {
+            m_socket->SetAttribute("SegmentSize", ns3::UintegerValue(m_segmentSize));
+            m_socket->SetAttribute("ConnTimeout", ns3::TimeValue(m_connectTimeout));
+        }
+        m_socket->Bind(ns3::InetSocketAddress(ns3::Ipv4Address::GetAny(), m_localPort));
+        m_socket->SetRecvCallback(ns3::MakeCallback(&WebBrowsingClient::HandleRead, this));
+        ns3::Ipv4Address address = ns3::Ipv4Address::IsMatchingType(m_peer)
+                                       ? ns3::Ipv4Address::ConvertFrom(m_peer)
+                                       : ns3::InetSocketAddress::ConvertFrom(m_peer).GetIpv4();
+        if (IsTcp())
+        {
+            m_socket->SetConnectCallback(
+                ns3::MakeCallback(&WebBrowsingClient::ConnectionSucceeded, this),
+                ns3::MakeCallback(&WebBrowsingClient::ConnectionFailed, this));
+        }
+        m_socket->Connect(ns3::InetSocketAddress(address, m_peerPort));
+        if (!IsTcp())
+        {
+            StartPage();
+        }
+    }
+
+    void StopApplication() override
+    {
+        ns3::Simulator::Cancel(m_pageEvent);
+        ns3::Simulator::Cancel(m_timeoutEvent);
+        if (m_socket)
+        {
+            m_socket->Close();
+        }
+    }
+
+    void ConnectionSucceeded(ns3::Ptr<ns3::Socket> /* socket */)
+    {
+        StartPage();
+    }
+
+    void ConnectionFailed(ns3::Ptr<ns3::Socket> /* socket */)
+    {
+        m_connectionFailed = true;
+    }
+
+    /// Truncated lognormal of the given mean and deviation, redrawn until in [min, max].
+    uint32_t DrawSize(double mean, double sd, double min, double max)
+    {
+        double sigma2 = std::log(1 + sd * sd / (mean * mean));
+        double mu = std::log(mean) - sigma2 / 2;
+        double x;
+        do
+        {
+            x = m_lognormal->GetValue(mu, std::sqrt(sigma2));
+        } while (x < min || x > max);
+        return static_cast<uint32_t>(x);
+    }
+
+    /**
+     * Truncated Pareto (shape 1.1, scale 2) embedded object count, minus the scale.
+     * As in the model, draws above the cap count as the cap (min(x, m) - k) instead
+     * of being redrawn, and the count is rounded, which keeps the mean at 5.64.
+     */
+    uint32_t DrawEmbeddedObjects()
+    {
+        double x = 2.0 / std::pow(1.0 - m_uniform->GetValue(0.0, 1.0), 1.0 / 1.1);
+        return static_cast<uint32_t>(std::lround(std::min(x, double(m_embeddedMax)))) - 2;
+    }
+
+    void StartPage()
+    {
+        ++m_page;
+        m_loading = true;
+        m_pageStart = ns3::Simulator::Now();
+        m_pageObjects = 0;
+        m_pageBytes = 0;
+        m_pendingEmbedded = 0;
+        m_timeoutEvent =
+            ns3::Simulator::Schedule(m_pageTimeout, &WebBrowsingClient::PageTimedOut, this);
+        Request(DrawSize(m_mainMean, m_mainSd, 100, 2e6), true);
+    }
+
+    void Request(uint32_t size, bool main)
+    {
+        uint32_t id = m_nextObject++;
+        m_objects[id] = Object{m_page, size, 0, main};
+        if (IsTcp())
+        {
+            m_order.push_back(id);
+        }
+        m_socket->Send(MakeWebHeader(id, size));
+    }
+
+    void RequestEmbedded(uint32_t page, uint32_t count)
+    {
+        if (!m_loading || page != m_page)
+        {
+            return;
+        }
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            Request(DrawSize(m_embeddedMean, m_embeddedSd, 50, 2e6), false);
+        }
+    }
+
+    void HandleRead(ns3::Ptr<ns3::Socket> socket)
+    {
+        ns3::Ptr<ns3::Packet> packet;
+        while ((packet = socket->Recv()) && packet->GetSize() > 0)
+        {
+            if (IsTcp())
+            {
+                // The objects come back in the order they were asked for
+                uint32_t bytes = packet->GetSize();
+                while (bytes > 0 && !m_order.empty())
+                {
+                    uint32_t id = m_order.front();
+                    Object& o = m_objects[id];
+                    uint32_t take = std::min(bytes, o.size - o.received);
+                    o.received += take;
+                    bytes -= take;
+                    if (o.received == o.size)
+                    {
+                        m_order.pop_front();
+                        ObjectDone(id);
+                    }
+                }
+                continue;
+            }
+            if (packet->GetSize() < WEB_HEADER_SIZE)
+            {
+                continue;
+            }
+            uint8_t buf[WEB_HEADER_SIZE];
+            packet->CopyData(buf, WEB_HEADER_SIZE);
+            uint32_t id;
+            uint32_t offset;
+            ReadWebHeader(buf, id, offset);
+            auto it = m_objects.find(id);
+            if (it == m_objects.end())
+            {
+                continue;
+            }
+            it->second.received += packet->GetSize() - WEB_HEADER_SIZE;
+            if (it->second.received >= it->second.size)
+            {
+                ObjectDone(id);
+            }
+        }
+    }
+
+    void ObjectDone(uint32_t id)
+    {
+        Object o = m_objects[id];
+        m_objects.erase(id);
+        if (!m_loading || o.page != m_page)
+        {
+            return; // of a page given up
+        }
+        ++m_pageObjects;
+        m_pageBytes += o.size;
+        if (o.main)
+        {
+            uint32_t count = DrawEmbeddedObjects();
+            if (count == 0)
+            {
+                PageDone();
+                return;
+            }
+            m_pendingEmbedded = count;
+            m_pageEvent = ns3::Simulator::Schedule(
+                ns3::Seconds(m_exponential->GetValue(m_parsingTime.GetSeconds(), 0)),
+                &WebBrowsingClient::RequestEmbedded,
+                this,
+                m_page,
+                count);
+        }
+        else if (--m_pendingEmbedded == 0)
+        {
+            PageDone();
+        }
+    }
+
+    void PageDone()
+    {
+        m_loading = false;
+        ns3::Simulator::Cancel(m_timeoutEvent);
+        ++m_pagesLoaded;
+        m_pageLoaded(m_page, m_pageObjects, m_pageBytes, ns3::Simulator::Now() - m_pageStart);
+        ScheduleNextPage();
+    }
+
+    void PageTimedOut()
+    {
+        m_loading = false;
+        ++m_pagesFailed;
+        // Over UDP an object with a lost datagram would never complete; over TCP the
+        // objects stay, their bytes are still to come in the stream
+        if (!IsTcp())
+        {
+            for (auto it = m_objects.begin(); it != m_objects.end();)
+            {
+                it = it->second.page == m_page ? m_objects.erase(it) : std::next(it);
+            }
+        }
+        ScheduleNextPage();
+    }
+
+    void ScheduleNextPage()
+    {
+        m_pageEvent = ns3::Simulator::Schedule(
+            ns3::Seconds(m_exponential->GetValue(m_readingTime.GetSeconds(), 0)),
+            &WebBrowsingClient::StartPage,
+            this);
+    }
+
+    ns3::Address m_peer;
+    uint16_t m_peerPort{80};
+    uint16_t m_localPort{0};
+    std::string m_transport{"tcp"};
+    uint32_t m_segmentSize{1400};
+    ns3::Time m_connectTimeout;
+    double m_mainMean{10710};
+    double m_mainSd{25032};
+    double m_embeddedMean{7758};
+    double m_embeddedSd{126168};
+    uint32_t m_embeddedMax{55};
+    ns3::Time m_parsingTime;
+    ns3::Time m_readingTime;
+    ns3::Time m_pageTimeout;
+    ns3::Ptr<ns3::UniformRandomVariable> m_uniform;
+    ns3::Ptr<ns3::ExponentialRandomVariable> m_exponential;
+    ns3::Ptr<ns3::LogNormalRandomVariable> m_lognormal;
+    ns3::Ptr<ns3::Socket> m_socket;
+    ns3::EventId m_pageEvent;
+    ns3::EventId m_timeoutEvent;
+    std::map<uint32_t, Object> m_objects;
+    std::deque<uint32_t> m_order; ///< TCP: objects in the order of the byte stream
+    uint32_t m_nextObject{0};
+    uint32_t m_page{0};
+    bool m_loading{false};
+    ns3::Time m_pageStart;
+    uint32_t m_pageObjects{0};
+    uint32_t m_pageBytes{0};
+    uint32_t m_pendingEmbedded{0};
+    uint32_t m_pagesLoaded{0};
+    uint32_t m_pagesFailed{0};
+    bool m_connectionFailed{false};
+    ns3::TracedCallback<uint32_t, uint32_t, uint32_t, ns3::Time> m_pageLoaded;
+};
+
+/// Page loads of a set of web clients and their load time percentiles.
+class WebBrowsingStats
+{
+  public:
+    /// Collect the pages of the WebBrowsingClient applications in clients.
+    void Install(ns3::ApplicationContainer clients)
+    {
+        for (auto it = clients.Begin(); it != clients.End(); ++it)
+        {
+            ns3::Ptr<WebBrowsingClient> client = ns3::DynamicCast<WebBrowsingClient>(*it);
+            if (!client)
+            {
+                continue;
+            }
+            m_clients.push_back(client);
+            client->TraceConnectWithoutContext(
+                "PageLoaded",
+                ns3::MakeBoundCallback(&WebBrowsingStats::PageLoadedTrace,
+                                       this,
+                                       client->GetNode()->GetId()));
+        }
+    }
+
+    /// Write the page counts and the load time percentiles.
+    void Write(std::ostream& os) const
+    {
+        if (m_clients.empty())
+        {
+            return;
+        }
+        uint32_t failed = 0;
+        uint32_t loading = 0;
+        uint32_t unconnected = 0;
+        uint64_t objects = 0;
+        for (const auto& client : m_clients)
+        {
+            failed += client->GetPagesFailed();
+            unconnected += client->HasConnectionFailed() ? 1 : 0;
+            loading += client->IsLoading() ? 1 : 0;
+            objects += client->GetObjectsRequested();
+        }
+        std::vector<double> times;
+        double objectsSum = 0.0;
+        double bytesSum = 0.0;
+        for (const auto& p : m_pages)
+        {
+            times.push_back(p.loadTime);
+            objectsSum += p.objects;
+            bytesSum += p.bytes;
+        }
+        std::sort(times.begin(), times.end());
+        size_t n = times.size();
+        os << "\n\nWeb browsing (" << m_clients.size() << " clients)\n";
+        os << "  Pages loaded: " << n << "\n";
+        os << "  Pages given up: " << failed << "\n";
+        os << "  Pages loading at the end: " << loading << "\n";
+        os << "  Clients that could not connect: " << unconnected << "\n";
+        os << "  Objects requested: " << objects << "\n";
+        if (n == 0)
+        {
+            return;
+        }
+        os << "  Mean objects per page: " << objectsSum / n << "\n";
+        os << "  Mean page size: " << bytesSum / n / 1000 << " kB\n";
+        double sum = 0.0;
+        for (double t : times)
+        {
+            sum += t;
+        }
+        os << "  Page load time mean: " << 1000 * sum / n << " ms\n";
+        for (double p : {0.5, 0.9, 0.95, 0.99})
+        {
+            os << "  Page load time p" << static_cast<int>(100 * p) << ": "
+               << 1000 * times[static_cast<size_t>(p * (n - 1))] << " ms\n";
+        }
+        os << "  Page load time max: " << 1000 * times.back() << " ms\n";
+    }
+
+    /// Write the loaded pages as a time-ordered trace.
+    void WriteTrace(std::ostream& os) const
+    {
+        os << "Time\tnodeId\tpage\tobjects\tbytes\tloadTime(ms)\n";
+        for (const auto& p : m_pages)
+        {
+            os << p.time << "\t" << p.nodeId << "\t" << p.page << "\t" << p.objects << "\t"
+               << p.bytes << "\t" << 1000 * p.loadTime << "\n";
+        }
+    }
+
+  private:
+    struct Page
+    {
+        double time;
+        uint32_t nodeId;
+        uint32_t page;
+        uint32_t objects;
+        uint32_t bytes;
+        double loadTime;
+    };
+
+    static void PageLoadedTrace(WebBrowsingStats* stats,
+                                uint32_t nodeId,
+                                uint32_t page,
+                                uint32_t objects,
+                                uint32_t bytes,
+                                ns3::Time loadTime)
+    {
+        stats->m_pages.push_back(Page{ns3::Simulator::Now().GetSeconds(),
+                                      nodeId,
+                                      page,
+                                      objects,
+                                      bytes,
+                                      loadTime.GetSeconds()});
+    }
+
+    std::vector<ns3::Ptr<WebBrowsingClient>> m_clients;
+    std::vector<Page> m_pages;
+};
+
+} // namespace kpm
+
+#endif // KPM_WEB_BROWSING_H